@@ -25,14 +25,18 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <alloca.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
+#include <net/if.h>
 #include <linux/if_link.h>
 #include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 #ifdef HAS_XDP_XSK_H
 #include <xdp/xsk.h>
 #else
@@ -44,8 +48,16 @@
 
 #define NUM_FRAMES	4096
 #define FRAME_SIZE	XSK_UMEM__DEFAULT_FRAME_SIZE
-#define BATCH_SIZE	64
 #define NUM_DESCS	XSK_RING_PROD__DEFAULT_NUM_DESCS
+#define FILL_BATCH	(NUM_DESCS / 4)	/* refill when this many slots are free */
+#define NUM_TX_DESCS	NUM_FRAMES	/* all TX frames can be in flight */
+
+/* stack of free umem frames. LIFO keeps recently used frames cache hot */
+struct ax_frames {
+	uint64_t		*addr;
+	uint32_t		nfree;
+	uint32_t		nframes;
+};
 
 struct ax_socket {
 	struct xsk_ring_cons	rring; /* Rx ring */
@@ -56,14 +68,64 @@ struct ax_socket {
 	struct xsk_umem		*umem;
 	void			*umem_area;
 	uint32_t		inflight_tx_pkts;
-	/* current frame index in the umem_area */
-	uint32_t		tx_frame_idx;
+	struct ax_frames	tx_frames;
+	/* descriptors reserved by ax_prepare_tx(), and given a frame */
+	uint32_t		tx_idx;
+	uint32_t		tx_reserved;
+	uint32_t		tx_assigned;
+	/*
+	 * RX frames not in the fill ring nor in the RX ring. twice as many
+	 * as the fill ring, so spare frames can be kept for a while.
+	 */
+	struct ax_frames	rx_frames;
+	uint32_t		rx_idx;		/* by ax_wait_for_packets() */
+	unsigned int		rx_batch;
 	bool			do_wakeup;
 };
 
+struct ax_prog {
+	struct bpf_object	*obj;
+	int			ifindex;
+	int			map_fd;		/* xsks_map */
+	int			conf_fd;	/* conf_map */
+	int			stat_fd;	/* stat_map */
+	int			flags;
+	struct ax_count		*count;		/* mmap'ed count_map */
+	unsigned int		ncount;		/* entries of count_map */
+};
+
+static int
+ax_frames_init(struct ax_frames *frames, uint64_t base, uint32_t n)
+{
+	uint32_t i;
+
+	frames->addr = malloc(sizeof(*frames->addr) * n);
+	if (frames->addr == NULL)
+		return -1;
+	/* lowest address on top */
+	for (i = 0; i < n; i++)
+		frames->addr[i] = base + (uint64_t)(n - 1 - i) * FRAME_SIZE;
+	frames->nfree = frames->nframes = n;
+	return 0;
+}
+
+static inline uint64_t
+ax_frames_get(struct ax_frames *frames)
+{
+	return frames->addr[--frames->nfree];
+}
+
+static inline void
+ax_frames_put(struct ax_frames *frames, uint64_t addr)
+{
+	/* completion may return an address with offset in unaligned mode */
+	frames->addr[frames->nfree++] = addr & ~((uint64_t)FRAME_SIZE - 1);
+}
+
 static struct ax_socket *
-ax_setup_socket(const char *ifname, void *umem_area, size_t size)
+ax_setup_socket(const char *ifname, int queue, struct ax_prog *prog, void *umem_area, size_t size)
 {
+	struct xsk_umem_config ucfg;
 	struct xsk_socket_config cfg;
 	struct ax_socket *axs;
 	int rc;
@@ -72,17 +134,34 @@ ax_setup_socket(const char *ifname, void *umem_area, size_t size)
 	if (axs == NULL)
 		return NULL;
 
-	rc = xsk_umem__create(&axs->umem, umem_area, size, &axs->fring, &axs->cring, NULL);
+	/* first half of the umem is for tx, second half for rx */
+	if ((ax_frames_init(&axs->tx_frames, 0, NUM_FRAMES) != 0) ||
+	    (ax_frames_init(&axs->rx_frames, NUM_FRAMES * FRAME_SIZE, NUM_FRAMES) != 0)) {
+		fprintf(stderr, "malloc failed: %s\n", strerror(errno));
+		free(axs->tx_frames.addr);
+		free(axs);
+		return NULL;
+	}
+
+	ucfg.fill_size = NUM_DESCS;
+	ucfg.comp_size = NUM_TX_DESCS;
+	ucfg.frame_size = FRAME_SIZE;
+	ucfg.frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM;
+	ucfg.flags = 0;
+	rc = xsk_umem__create(&axs->umem, umem_area, size, &axs->fring, &axs->cring, &ucfg);
 	if (rc != 0) {
 		fprintf(stderr, "xsk_umem__create failed: %d\n", -rc);
+		free(axs->tx_frames.addr);
+		free(axs->rx_frames.addr);
 		free(axs);
 		return NULL;
 	}
 	axs->umem_area = umem_area;
 
 	cfg.rx_size = NUM_DESCS;
-	cfg.tx_size = NUM_DESCS;
-	cfg.libbpf_flags = 0;
+	cfg.tx_size = NUM_TX_DESCS;
+	/* without own program, default one of libxdp/libbpf is loaded */
+	cfg.libbpf_flags = (prog != NULL) ? XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD : 0;
 	cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
 #ifdef USE_ZEROCOPY
 	cfg.bind_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
@@ -92,15 +171,30 @@ ax_setup_socket(const char *ifname, void *umem_area, size_t size)
 	axs->do_wakeup = false;
 #endif
 
-	rc = xsk_socket__create(&axs->xsk, ifname, 0 /* XXX */, axs->umem,
+	rc = xsk_socket__create(&axs->xsk, ifname, queue, axs->umem,
 				 &axs->rring, &axs->tring, &cfg);
 	if (rc != 0) {
 		fprintf(stderr, "xsk_socket__create failed: %d\n", -rc);
 		xsk_umem__delete(axs->umem);
+		free(axs->tx_frames.addr);
+		free(axs->rx_frames.addr);
 		free(axs);
 		return NULL;
 	}
 
+	if (prog != NULL) {
+		rc = xsk_socket__update_xskmap(axs->xsk, prog->map_fd);
+		if (rc != 0) {
+			fprintf(stderr, "xsk_socket__update_xskmap failed: %d\n", -rc);
+			xsk_socket__delete(axs->xsk);
+			xsk_umem__delete(axs->umem);
+			free(axs->tx_frames.addr);
+			free(axs->rx_frames.addr);
+			free(axs);
+			return NULL;
+		}
+	}
+
 #ifdef USE_ZEROCOPY
 	if (cfg.bind_flags == 0)
 		fprintf(stderr, "warning: zerocopy mode is NOT enabled on %s\n", ifname);
@@ -109,10 +203,14 @@ ax_setup_socket(const char *ifname, void *umem_area, size_t size)
 	return axs;
 }
 
+/*
+ * kick the kernel to send, and return completed frames to the free stack.
+ * completions may come back in any order, so their addresses are used as is.
+ */
 static inline void
-ax_complete_tx0(struct ax_socket *axs, int batch_size)
+ax_reclaim_tx(struct ax_socket *axs)
 {
-	unsigned int done;
+	unsigned int done, i;
 	uint32_t idx;
 
 	if (axs->inflight_tx_pkts == 0)
@@ -126,30 +224,34 @@ ax_complete_tx0(struct ax_socket *axs, int batch_size)
 		sendto(xsk_socket__fd(axs->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
 	}
 
-	done = xsk_ring_cons__peek(&axs->cring, batch_size, &idx);
+	done = xsk_ring_cons__peek(&axs->cring, axs->inflight_tx_pkts, &idx);
 	if (done > 0) {
+		for (i = 0; i < done; i++)
+			ax_frames_put(&axs->tx_frames,
+			    *xsk_ring_cons__comp_addr(&axs->cring, idx + i));
 		xsk_ring_cons__release(&axs->cring, done);
 		axs->inflight_tx_pkts -= done;
 	}
 }
 
+/*
+ * move free rx frames to the fill ring. called after received frames are
+ * processed, so a frame is never given to the kernel while still in use.
+ */
 static int
-ax_populate_fill_ring(struct ax_socket *axs)
+ax_refill_rx(struct ax_socket *axs, uint32_t min)
 {
-	int rc, i;
-	uint32_t idx;
+	uint32_t idx, i, n;
 
-	rc = xsk_ring_prod__reserve(&axs->fring, NUM_DESCS, &idx);
-	if (rc != NUM_DESCS) {
-		fprintf(stderr, "xsk_ring_prod__reserve failed: %d\n", rc);
+	n = MIN(axs->rx_frames.nfree, xsk_prod_nb_free(&axs->fring, NUM_DESCS));
+	if ((n == 0) || (n < min))
+		return 0;
+	if (xsk_ring_prod__reserve(&axs->fring, n, &idx) != n)
 		return -1;
-	}
-	for (i = 0; i < NUM_DESCS; i++) {
-		/* Use second half for rx */
-		*xsk_ring_prod__fill_addr(&axs->fring, idx++) =
-			NUM_FRAMES * FRAME_SIZE + i * FRAME_SIZE;
-	}
-	xsk_ring_prod__submit(&axs->fring, NUM_DESCS);
+	for (i = 0; i < n; i++)
+		*xsk_ring_prod__fill_addr(&axs->fring, idx + i) =
+		    ax_frames_get(&axs->rx_frames);
+	xsk_ring_prod__submit(&axs->fring, n);
 	return 0;
 }
 
@@ -158,39 +260,36 @@ ax_wait_for_packets(struct ax_desc *ax_desc, struct ax_rx_handle *handle)
 {
 	struct ax_socket *axs = ax_desc->axs;
 	unsigned int npkts;
-	unsigned int ret;
 
-	npkts = xsk_ring_cons__peek(&axs->rring, BATCH_SIZE, &handle->rring_idx);
+	npkts = xsk_ring_cons__peek(&axs->rring, axs->rx_batch, &handle->rring_idx);
 	if (npkts == 0) {
 		if (axs->do_wakeup && xsk_ring_prod__needs_wakeup(&axs->fring)) {
 			recvfrom(ax_desc->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
 		}
 		return 0;
 	}
-	/*
-	 * Used receive buffers will be immediately set to the fill ring,
-	 * so here we need to preserver the same number of entries as
-	 * received packets.
-	 */
-	ret = xsk_ring_prod__reserve(&axs->fring, npkts, &handle->fring_idx);
-	while (ret != npkts) {
-		if (axs->do_wakeup && xsk_ring_prod__needs_wakeup(&axs->fring)) {
-			recvfrom(ax_desc->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
-		}
-		ret = xsk_ring_prod__reserve(&axs->fring, npkts, &handle->fring_idx);
-	}
 
+	axs->rx_idx = handle->rring_idx;
 	handle->npkts = npkts;
 	return npkts;
 }
 
+/*
+ * release n received frames to the rx frame pool, and refill the fill ring
+ * in a batch of FILL_BATCH or more.
+ */
 void
 ax_complete_rx(struct ax_desc *ax_desc, unsigned int n)
 {
 	struct ax_socket *axs = ax_desc->axs;
+	uint32_t i;
 
-	xsk_ring_prod__submit(&axs->fring, n);
+	for (i = 0; i < n; i++)
+		ax_frames_put(&axs->rx_frames,
+		    xsk_ring_cons__rx_desc(&axs->rring, axs->rx_idx + i)->addr);
 	xsk_ring_cons__release(&axs->rring, n);
+
+	ax_refill_rx(axs, FILL_BATCH);
 }
 
 char *
@@ -199,41 +298,72 @@ ax_get_rx_buf(struct ax_desc *ax_desc, uint32_t *lenp, struct ax_rx_handle *hand
 	struct ax_socket *axs = ax_desc->axs;
 	const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&axs->rring, handle->rring_idx);
 
-	/*
-	 * XXX registering the buffer before accessing received data is racy
-	 * but it's unlikely to be a problem if the number of descriptors is enough large.
-	 */
-	*xsk_ring_prod__fill_addr(&axs->fring, handle->fring_idx) = desc->addr;
-
 	*lenp = desc->len;
 	return (char *)xsk_umem__get_data(axs->umem_area, desc->addr);
 }
 
+/*
+ * reserve up to *npkts tx descriptors. never waits for the ring or frames
+ * to become available; *npkts is reduced instead, and may be 0.
+ */
 uint32_t
 ax_prepare_tx(struct ax_desc *ax_desc, unsigned int *npkts)
 {
 	struct ax_socket *axs = ax_desc->axs;
-	uint32_t idx;
+	uint32_t idx, n;
 
-	*npkts = MIN(*npkts, BATCH_SIZE);
+	ax_reclaim_tx(axs);
 
-	while (xsk_ring_prod__reserve(&axs->tring, *npkts, &idx) < *npkts) {
-		ax_complete_tx0(axs, *npkts);
+	n = MIN(*npkts, axs->tx_frames.nfree);
+	n = MIN(n, xsk_prod_nb_free(&axs->tring, n));
+	if ((n == 0) || (xsk_ring_prod__reserve(&axs->tring, n, &idx) != n)) {
+		*npkts = 0;
+		return 0;
 	}
 
+	axs->tx_idx = idx;
+	axs->tx_reserved = n;
+	axs->tx_assigned = 0;
+	*npkts = n;
 	return idx;
 }
 
+/*
+ * give back the last n tx descriptors reserved by xsk_ring_prod__reserve().
+ * xsk.h has a cancel for consumer rings only, so the cached producer index
+ * is rewound by hand. it is private to this process until
+ * xsk_ring_prod__submit() publishes it, so nothing has seen these
+ * descriptors yet.
+ */
+static void
+ax_tx_cancel(struct ax_socket *axs, uint32_t n)
+{
+
+	axs->tring.cached_prod -= n;
+}
+
+/*
+ * submit first npkts descriptors of ax_prepare_tx(). the rest of them
+ * are cancelled, and their frames go back to the free stack.
+ */
 void
 ax_complete_tx(struct ax_desc *ax_desc, unsigned int npkts)
 {
 	struct ax_socket *axs = ax_desc->axs;
-
-	xsk_ring_prod__submit(&axs->tring, npkts);
-	axs->inflight_tx_pkts += npkts;
-	axs->tx_frame_idx += npkts;
-	axs->tx_frame_idx %= NUM_FRAMES;
-	ax_complete_tx0(axs, npkts);
+	uint32_t i;
+
+	for (i = npkts; i < axs->tx_assigned; i++)
+		ax_frames_put(&axs->tx_frames,
+		    xsk_ring_prod__tx_desc(&axs->tring, axs->tx_idx + i)->addr);
+	if (npkts < axs->tx_reserved)
+		ax_tx_cancel(axs, axs->tx_reserved - npkts);
+	axs->tx_reserved = axs->tx_assigned = 0;
+
+	if (npkts > 0) {
+		xsk_ring_prod__submit(&axs->tring, npkts);
+		axs->inflight_tx_pkts += npkts;
+	}
+	ax_reclaim_tx(axs);
 }
 
 char *
@@ -243,15 +373,213 @@ ax_get_tx_buf(struct ax_desc *ax_desc, uint32_t **lenp, uint32_t idx, int i)
 	char *buf;
 	struct xdp_desc *tx_desc = xsk_ring_prod__tx_desc(&axs->tring, idx + i);
 
-	tx_desc->addr = (axs->tx_frame_idx + i) * FRAME_SIZE;
+	tx_desc->addr = ax_frames_get(&axs->tx_frames);
+	axs->tx_assigned = i + 1;
 	buf = xsk_umem__get_data(axs->umem_area, tx_desc->addr);
 
 	*lenp = &tx_desc->len;
 	return buf;
 }
 
+/*
+ * load XDP program <name> of the object file, and attach it to the interface.
+ * metadata kfuncs are available only to a program bound to the device.
+ */
+static struct bpf_object *
+ax_prog_load(const char *path, const char *name, int ifindex, int devbound, unsigned int ncount)
+{
+	struct bpf_object *obj;
+	struct bpf_map *map;
+	struct bpf_program *prog, *p;
+	int rc;
+
+	obj = bpf_object__open_file(path, NULL);
+	if ((obj == NULL) || (libbpf_get_error(obj) != 0))
+		return NULL;
+
+	prog = NULL;
+	bpf_object__for_each_program(p, obj) {
+		if (strcmp(bpf_program__name(p), name) == 0)
+			prog = p;
+		else
+			bpf_program__set_autoload(p, false);
+	}
+	if (prog == NULL)
+		goto fail;
+
+	map = bpf_object__find_map_by_name(obj, "count_map");
+	if ((map == NULL) || (bpf_map__set_max_entries(map, ncount) != 0))
+		goto fail;
+
+	if (devbound) {
+#ifdef BPF_F_XDP_DEV_BOUND_ONLY
+		bpf_program__set_ifindex(prog, ifindex);
+		bpf_program__set_flags(prog, BPF_F_XDP_DEV_BOUND_ONLY);
+#else
+		goto fail;
+#endif
+	}
+
+	rc = bpf_object__load(obj);
+	if (rc != 0)
+		goto fail;
+
+	rc = bpf_xdp_attach(ifindex, bpf_program__fd(prog),
+	    XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "cannot attach XDP program %s: %s\n", name, strerror(-rc));
+		goto fail;
+	}
+	return obj;
+
+ fail:
+	bpf_object__close(obj);
+	return NULL;
+}
+
+/*
+ * open ipgen's XDP program for the interface. the one which gives RX
+ * timestamp is tried first. NULL if not available, and then the default
+ * program is loaded by ax_open().
+ * with AX_PROG_COUNT, count_map has an entry for each CPU.
+ */
+struct ax_prog *
+ax_prog_open(const char *ifname, const char *path, int flags)
+{
+	struct ax_prog *prog;
+	int ncpu;
+
+	prog = calloc(1, sizeof(*prog));
+	if (prog == NULL)
+		return NULL;
+
+	prog->ifindex = if_nametoindex(ifname);
+	if (prog->ifindex == 0) {
+		fprintf(stderr, "%s: %s\n", ifname, strerror(errno));
+		free(prog);
+		return NULL;
+	}
+
+	prog->ncount = 1;
+	if (flags & AX_PROG_COUNT) {
+		ncpu = libbpf_num_possible_cpus();
+		if (ncpu <= 0) {
+			fprintf(stderr, "cannot get number of CPUs\n");
+			free(prog);
+			return NULL;
+		}
+		prog->ncount = ncpu;
+		prog->flags |= AX_PROG_COUNT;
+	}
+
+	prog->obj = ax_prog_load(path, "ipgen_xdp_rxts", prog->ifindex, 1, prog->ncount);
+	if (prog->obj != NULL)
+		prog->flags |= AX_PROG_RXTS;
+	else
+		prog->obj = ax_prog_load(path, "ipgen_xdp", prog->ifindex, 0, prog->ncount);
+	if (prog->obj == NULL) {
+		fprintf(stderr, "cannot load XDP program %s on %s\n", path, ifname);
+		free(prog);
+		return NULL;
+	}
+
+	prog->map_fd = bpf_object__find_map_fd_by_name(prog->obj, "xsks_map");
+	prog->conf_fd = bpf_object__find_map_fd_by_name(prog->obj, "conf_map");
+	prog->stat_fd = bpf_object__find_map_fd_by_name(prog->obj, "stat_map");
+	if ((prog->map_fd < 0) || (prog->conf_fd < 0) || (prog->stat_fd < 0)) {
+		fprintf(stderr, "%s: maps are not found\n", path);
+		ax_prog_close(prog);
+		return NULL;
+	}
+	return prog;
+}
+
+void
+ax_prog_close(struct ax_prog *prog)
+{
+	if (prog->count != NULL)
+		munmap(prog->count, sizeof(struct ax_count) * prog->ncount);
+	bpf_xdp_detach(prog->ifindex, XDP_FLAGS_DRV_MODE, NULL);
+	bpf_object__close(prog->obj);
+	free(prog);
+}
+
+int
+ax_prog_flags(struct ax_prog *prog)
+{
+	return prog->flags;
+}
+
+int
+ax_prog_setconf(struct ax_prog *prog, const struct ax_conf *conf)
+{
+	uint32_t key = 0;
+
+	if (bpf_map_update_elem(prog->conf_fd, &key, conf, BPF_ANY) != 0) {
+		fprintf(stderr, "cannot configure XDP program: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * count_map of AX_PROG_COUNT, an entry per CPU
+ */
+struct ax_count *
+ax_prog_count(struct ax_prog *prog, unsigned int *ncount)
+{
+	void *p;
+	int fd;
+
+	if (!(prog->flags & AX_PROG_COUNT))
+		return NULL;
+	if (prog->count == NULL) {
+		fd = bpf_object__find_map_fd_by_name(prog->obj, "count_map");
+		if (fd < 0)
+			return NULL;
+		p = mmap(NULL, sizeof(struct ax_count) * prog->ncount,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "cannot mmap count_map: %s\n", strerror(errno));
+			return NULL;
+		}
+		prog->count = p;
+	}
+	*ncount = prog->ncount;
+	return prog->count;
+}
+
+/*
+ * sum of per-CPU counter <idx> of the XDP program
+ */
+uint64_t
+ax_prog_getstat(struct ax_prog *prog, unsigned int idx)
+{
+	static int ncpu;
+	uint64_t *val, sum;
+	uint32_t key = idx;
+	int i;
+
+	if (ncpu == 0)
+		ncpu = libbpf_num_possible_cpus();
+	if (ncpu <= 0)
+		return 0;
+
+	val = alloca(sizeof(uint64_t) * ncpu);
+	if (bpf_map_lookup_elem(prog->stat_fd, &key, val) != 0)
+		return 0;
+	for (sum = 0, i = 0; i < ncpu; i++)
+		sum += val[i];
+	return sum;
+}
+
+/*
+ * open AF_XDP socket bound to RX queue <queue> of the interface.
+ * each socket has own umem. frames are redirected by <prog>, or by
+ * the default program if NULL. up to <rx_batch> frames are received at once.
+ */
 struct ax_desc *
-ax_open(const char *ifname)
+ax_open(const char *ifname, int queue, struct ax_prog *prog, unsigned int rx_batch)
 {
 	void *umem_area;
 	size_t mem_size;
@@ -274,15 +602,16 @@ ax_open(const char *ifname)
 		return NULL;
 	}
 
-	axs = ax_setup_socket(ifname, umem_area, mem_size);
+	axs = ax_setup_socket(ifname, queue, prog, umem_area, mem_size);
 	if (axs == NULL) {
 		fprintf(stderr, "ax_setup_socket failed\n");
 		return NULL;
 	}
 
-	rc = ax_populate_fill_ring(axs);
+	axs->rx_batch = rx_batch;
+	rc = ax_refill_rx(axs, 0);
 	if (rc != 0) {
-		fprintf(stderr, "ax_populate_fill_ring failed\n");
+		fprintf(stderr, "ax_refill_rx failed\n");
 		return NULL;
 	}
 
@@ -297,6 +626,8 @@ ax_close(struct ax_desc *desc)
 {
 	struct ax_socket *axs = desc->axs;
 
-	xsk_umem__delete(axs->umem);
 	xsk_socket__delete(axs->xsk);
+	xsk_umem__delete(axs->umem);
+	free(axs->tx_frames.addr);
+	free(axs->rx_frames.addr);
 }
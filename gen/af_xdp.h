@@ -26,7 +26,10 @@
 #ifndef _AF_XDP_H_
 #define _AF_XDP_H_
 
+#include "af_xdp_kern.h"
+
 struct ax_socket;
+struct ax_prog;
 struct ax_desc
 {
 	int			fd;
@@ -36,7 +39,6 @@ struct ax_desc
 struct ax_rx_handle
 {
 	uint32_t	rring_idx;	/* Index in the Rx ring */
-	uint32_t	fring_idx;	/* Index in the Fill ring */
 	unsigned int	npkts;
 };
 
@@ -44,7 +46,21 @@ static inline void
 ax_rx_handle_advance(struct ax_rx_handle *handle)
 {
 	handle->rring_idx++;
-	handle->fring_idx++;
+}
+
+/*
+ * timestamp in ns the XDP program put in front of an RX frame,
+ * or 0 if none. the mark is cleared as the frame will be reused.
+ */
+static inline uint64_t
+ax_rx_timestamp(char *buf)
+{
+	struct ax_meta *meta = (struct ax_meta *)(buf - sizeof(struct ax_meta));
+
+	if (meta->magic != AX_META_MAGIC)
+		return 0;
+	meta->magic = 0;
+	return meta->rx_timestamp;
 }
 
 static inline int
@@ -53,8 +69,23 @@ ax_get_fd(struct ax_desc *ax_desc)
 	return ax_desc->fd;
 }
 
+#define AX_PROG_RXTS	0x01	/* XDP program gives RX timestamp */
+#define AX_PROG_COUNT	0x02	/* count_map for AX_CONF_COUNT */
+struct ax_prog *
+	ax_prog_open(const char *, const char *, int);
+void	ax_prog_close(struct ax_prog *);
+int	ax_prog_flags(struct ax_prog *);
+int	ax_prog_setconf(struct ax_prog *, const struct ax_conf *);
+uint64_t
+	ax_prog_getstat(struct ax_prog *, unsigned int);
+struct ax_count *
+	ax_prog_count(struct ax_prog *, unsigned int *);
+
+#define AX_RX_BATCH	64	/* default of ax_open() rx_batch */
+#define AX_RX_BATCH_MAX	1024
+
 struct ax_desc *
-	ax_open(const char *);
+	ax_open(const char *, int, struct ax_prog *, unsigned int);
 void	ax_close(struct ax_desc *);
 
 unsigned int
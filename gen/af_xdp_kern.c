@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * XDP program for AF_XDP sockets of ipgen. frames are redirected to
+ * the socket bound to the RX queue, with struct ax_meta in front.
+ * control frames are handled here, and test frames may be counted
+ * here, if configured (see struct ax_conf).
+ * built by clang -target bpf, and loaded by ax_prog_open().
+ */
+#include <stddef.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_arp.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/in.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "af_xdp_kern.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__uint(max_entries, AX_KERN_MAXQUEUE);
+	__type(key, __u32);
+	__type(value, __u32);
+} xsks_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct ax_conf);
+} conf_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, AX_STAT_MAX);
+	__type(key, __u32);
+	__type(value, __u64);
+} stat_map SEC(".maps");
+
+/* entry per CPU, resized by the loader. AX_CONF_COUNT */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct ax_count);
+} count_map SEC(".maps");
+
+/* metadata kfunc. needs a device bound program, linux 6.3 or later */
+extern int bpf_xdp_metadata_rx_timestamp(const struct xdp_md *, __u64 *) __ksym __weak;
+
+#define AX_ACT_XSK		(-1)	/* not handled. to AF_XDP */
+
+#define ND_NEIGHBOR_SOLICIT	135
+#define ND_NEIGHBOR_ADVERT	136
+
+struct vlanhdr {
+	__be16 tci;
+	__be16 proto;
+};
+
+/* ARP for ethernet and IPv4. addresses are not aligned */
+struct arp_ether {
+	struct arphdr ar;
+	__u8 sha[ETH_ALEN];
+	__u8 spa[4];
+	__u8 tha[ETH_ALEN];
+	__u8 tpa[4];
+} __attribute__((__packed__));
+
+/* neighbor solicitation/advertisement with a link-layer address option */
+struct nd_lla {
+	struct icmp6hdr icmp6;
+	__u8 target[16];
+	__u8 opt_type;
+	__u8 opt_len;
+	__u8 lladdr[ETH_ALEN];
+};
+
+static __always_inline void
+ax_count(__u32 idx)
+{
+	__u64 *cnt;
+
+	cnt = bpf_map_lookup_elem(&stat_map, &idx);
+	if (cnt != NULL)
+		(*cnt)++;
+}
+
+static __always_inline __u16
+csum_fold(__u32 sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* answer to the sender, from own MAC address */
+static __always_inline void
+ether_reply(struct ethhdr *eh, const struct ax_conf *conf)
+{
+	__builtin_memcpy(eh->h_dest, eh->h_source, ETH_ALEN);
+	__builtin_memcpy(eh->h_source, conf->eaddr, ETH_ALEN);
+}
+
+static __always_inline int
+ax_arp(struct ethhdr *eh, void *l3, void *data_end, const struct ax_conf *conf)
+{
+	struct arp_ether *arp = l3;
+	__u32 spa, tpa;
+
+	if ((void *)(arp + 1) > data_end)
+		return XDP_PASS;
+	if ((arp->ar.ar_hrd != bpf_htons(ARPHRD_ETHER)) ||
+	    (arp->ar.ar_pro != bpf_htons(ETH_P_IP)) ||
+	    (arp->ar.ar_hln != ETH_ALEN) || (arp->ar.ar_pln != 4) ||
+	    (arp->ar.ar_op != bpf_htons(ARPOP_REQUEST)))
+		return XDP_PASS;
+
+	/* addresses in own subnet, except for the gateway */
+	__builtin_memcpy(&tpa, arp->tpa, 4);
+	if ((conf->ipaddr == 0) ||
+	    ((tpa & conf->ipaddr_mask) != (conf->ipaddr & conf->ipaddr_mask)) ||
+	    (tpa == conf->gwaddr))
+		return XDP_PASS;
+
+	__builtin_memcpy(&spa, arp->spa, 4);
+	arp->ar.ar_op = bpf_htons(ARPOP_REPLY);
+	__builtin_memcpy(arp->tha, arp->sha, ETH_ALEN);
+	__builtin_memcpy(arp->tpa, &spa, 4);
+	__builtin_memcpy(arp->sha, conf->eaddr, ETH_ALEN);
+	__builtin_memcpy(arp->spa, &tpa, 4);
+	ether_reply(eh, conf);
+	return XDP_TX;
+}
+
+static __always_inline int
+ax_ip4(struct ethhdr *eh, void *l3, void *data_end, const struct ax_conf *conf)
+{
+	struct iphdr *ip = l3;
+	struct icmphdr *icmp;
+	__u32 addr, sum;
+
+	if ((void *)(ip + 1) > data_end)
+		return XDP_PASS;
+	if ((ip->protocol != IPPROTO_ICMP) ||
+	    ((ip->frag_off & bpf_htons(0x3fff)) != 0))
+		return AX_ACT_XSK;
+	icmp = l3 + ip->ihl * 4;
+	if ((void *)(icmp + 1) > data_end)
+		return XDP_PASS;
+	if ((icmp->type != ICMP_ECHO) || (conf->ipaddr == 0) ||
+	    ((ip->daddr & conf->ipaddr_mask) != (conf->ipaddr & conf->ipaddr_mask)))
+		return AX_ACT_XSK;
+
+	/* swapping addresses doesn't change IP checksum */
+	addr = ip->saddr;
+	ip->saddr = ip->daddr;
+	ip->daddr = addr;
+
+	/* RFC 1624 */
+	icmp->type = ICMP_ECHOREPLY;
+	sum = (__u16)~icmp->checksum + (__u16)~bpf_htons(ICMP_ECHO << 8) +
+	    bpf_htons(ICMP_ECHOREPLY << 8);
+	icmp->checksum = csum_fold(sum);
+
+	ether_reply(eh, conf);
+	return XDP_TX;
+}
+
+static __always_inline int
+ax_ip6_addr_mine(const __u8 *addr, const struct ax_conf *conf)
+{
+	__u32 a[4];
+	int i, gw;
+
+	__builtin_memcpy(a, addr, 16);
+	if ((conf->ip6addr[0] | conf->ip6addr[1] | conf->ip6addr[2] | conf->ip6addr[3]) == 0)
+		return 0;
+	gw = 1;
+	for (i = 0; i < 4; i++) {
+		if ((a[i] & conf->ip6addr_mask[i]) != (conf->ip6addr[i] & conf->ip6addr_mask[i]))
+			return 0;
+		if (a[i] != conf->gw6addr[i])
+			gw = 0;
+	}
+	return !gw;
+}
+
+static __always_inline int
+ax_ip6(struct ethhdr *eh, void *l3, void *data_end, const struct ax_conf *conf)
+{
+	struct ipv6hdr *ip6 = l3;
+	struct nd_lla *nd;
+	__u32 pseudo[2], sum;
+
+	if ((void *)(ip6 + 1) > data_end)
+		return XDP_PASS;
+	if (ip6->nexthdr != IPPROTO_ICMPV6)
+		return AX_ACT_XSK;
+	nd = (struct nd_lla *)(ip6 + 1);
+	if ((void *)(nd + 1) > data_end)
+		return AX_ACT_XSK;
+	if (nd->icmp6.icmp6_type != ND_NEIGHBOR_SOLICIT)
+		return AX_ACT_XSK;
+
+	/* DAD, or without source link-layer address. leave to the kernel */
+	if ((ip6->payload_len != bpf_htons(sizeof(struct nd_lla))) ||
+	    (nd->opt_type != 1) || (nd->opt_len != 1) ||
+	    !ax_ip6_addr_mine(nd->target, conf))
+		return XDP_PASS;
+
+	/* solicitation to advertisement, in place */
+	__builtin_memcpy(&ip6->daddr, &ip6->saddr, 16);
+	__builtin_memcpy(&ip6->saddr, nd->target, 16);
+	ip6->hop_limit = 255;
+	nd->icmp6.icmp6_type = ND_NEIGHBOR_ADVERT;
+	nd->icmp6.icmp6_code = 0;
+	nd->icmp6.icmp6_dataun.un_data32[0] = bpf_htonl(0x60000000);	/* solicited, override */
+	nd->icmp6.icmp6_cksum = 0;
+	nd->opt_type = 2;
+	__builtin_memcpy(nd->lladdr, conf->eaddr, ETH_ALEN);
+
+	pseudo[0] = bpf_htonl(sizeof(struct nd_lla));
+	pseudo[1] = bpf_htonl(IPPROTO_ICMPV6);
+	sum = bpf_csum_diff(NULL, 0, (__be32 *)&ip6->saddr, 32, 0);
+	sum = bpf_csum_diff(NULL, 0, pseudo, sizeof(pseudo), sum);
+	sum = bpf_csum_diff(NULL, 0, (__be32 *)nd, sizeof(struct nd_lla), sum);
+	nd->icmp6.icmp6_cksum = csum_fold(sum);
+
+	ether_reply(eh, conf);
+	return XDP_TX;
+}
+
+/*
+ * account a test frame, instead of ipgen. the bitmap word may be cleared
+ * by userland at the same time, so it is updated atomically.
+ */
+static __always_inline int
+ax_account(struct xdp_md *ctx, const struct ax_conf *conf)
+{
+	void *data = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	struct ax_count *c;
+	void *trailer;
+	__u64 mask, old;
+	__u32 cpu, len, seq;
+	__u16 magic;
+
+	/* struct seqdata at the end */
+	len = (__u32)(data_end - data);
+	if (len < ETH_HLEN + 6)
+		return AX_ACT_XSK;
+	trailer = data + ((len - 6) & 0x3fff);
+	if (trailer + 6 > data_end)
+		return AX_ACT_XSK;
+	__builtin_memcpy(&magic, trailer + 4, sizeof(magic));
+	if (magic != conf->seq_magic)
+		return AX_ACT_XSK;
+	__builtin_memcpy(&seq, trailer, sizeof(seq));
+
+	cpu = bpf_get_smp_processor_id();
+	c = bpf_map_lookup_elem(&count_map, &cpu);
+	if (c == NULL)
+		return AX_ACT_XSK;
+
+	c->rx++;
+	c->rx_byte += len;
+	if (!c->valid) {
+		c->lo = c->hi = seq;
+		c->valid = 1;
+	} else if ((__s32)(seq - c->hi) > 0) {
+		c->hi = seq;
+	} else if (seq != c->hi) {
+		c->reorder++;
+	}
+
+	if (c->tailvalid && ((__s32)(seq - c->tail) < 0)) {
+		c->outofrange++;
+		return XDP_DROP;
+	}
+
+	mask = 1ULL << (seq & 63);
+	old = __sync_fetch_and_or(&c->bits[(seq / 64) & (AX_SEQWIN_WORDS - 1)], mask);
+	if (old & mask)
+		c->dup++;
+	return XDP_DROP;
+}
+
+/* XDP action for the frame, or AX_ACT_XSK */
+static __always_inline int
+ax_steer(struct xdp_md *ctx, const struct ax_conf *conf)
+{
+	void *data = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	struct ethhdr *eh = data;
+	struct vlanhdr *vh;
+	void *l3, *trailer;
+	__u16 proto, magic;
+	__u32 off;
+	int i, action;
+
+	if ((void *)(eh + 1) > data_end)
+		return XDP_PASS;
+
+	/* test frame. struct seqdata is at the end */
+	off = ((__u32)(data_end - data) - sizeof(magic)) & 0x3fff;
+	trailer = data + off;
+	if (trailer + sizeof(magic) <= data_end) {
+		__builtin_memcpy(&magic, trailer, sizeof(magic));
+		if (magic == conf->seq_magic)
+			return AX_ACT_XSK;
+	}
+
+	/* VLAN and QinQ */
+	proto = eh->h_proto;
+	l3 = eh + 1;
+#pragma unroll
+	for (i = 0; i < 2; i++) {
+		if ((proto != bpf_htons(ETH_P_8021Q)) && (proto != bpf_htons(ETH_P_8021AD)))
+			break;
+		vh = l3;
+		if ((void *)(vh + 1) > data_end)
+			return XDP_PASS;
+		proto = vh->proto;
+		l3 = vh + 1;
+	}
+
+	switch (proto) {
+	case bpf_htons(ETH_P_ARP):
+		action = ax_arp(eh, l3, data_end, conf);
+		break;
+	case bpf_htons(ETH_P_IP):
+		action = ax_ip4(eh, l3, data_end, conf);
+		break;
+	case bpf_htons(ETH_P_IPV6):
+		action = ax_ip6(eh, l3, data_end, conf);
+		break;
+	default:
+		action = AX_ACT_XSK;
+		break;
+	}
+
+	/* others to own address are left to ipgen */
+	if ((action == AX_ACT_XSK) &&
+	    (__builtin_memcmp(eh->h_dest, conf->eaddr, ETH_ALEN) != 0))
+		action = XDP_PASS;
+	return action;
+}
+
+static __always_inline int
+ipgen_redirect(struct xdp_md *ctx, int rxts)
+{
+	struct ax_meta *meta;
+	void *data;
+
+	if (bpf_xdp_adjust_meta(ctx, -(int)sizeof(struct ax_meta)) == 0) {
+		meta = (void *)(long)ctx->data_meta;
+		data = (void *)(long)ctx->data;
+		if ((void *)(meta + 1) <= data) {
+			meta->rx_timestamp = 0;
+			if (rxts && bpf_ksym_exists(bpf_xdp_metadata_rx_timestamp) &&
+			    (bpf_xdp_metadata_rx_timestamp(ctx, &meta->rx_timestamp) != 0))
+				meta->rx_timestamp = 0;
+			meta->reserved = 0;
+			meta->magic = AX_META_MAGIC;
+		}
+	}
+
+	return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+static __always_inline int
+ipgen_xdp_main(struct xdp_md *ctx, int rxts)
+{
+	const struct ax_conf *conf;
+	__u32 key = 0;
+	int action;
+
+	conf = bpf_map_lookup_elem(&conf_map, &key);
+	if ((conf != NULL) && (conf->flags & AX_CONF_COUNT) &&
+	    (ax_account(ctx, conf) == XDP_DROP))
+		return XDP_DROP;
+	if ((conf != NULL) && (conf->flags & AX_CONF_STEER)) {
+		action = ax_steer(ctx, conf);
+		if (action == XDP_TX)
+			ax_count(AX_STAT_REPLY);
+		else if (action == XDP_PASS)
+			ax_count(AX_STAT_PASS);
+		if (action != AX_ACT_XSK)
+			return action;
+	}
+
+	return ipgen_redirect(ctx, rxts);
+}
+
+SEC("xdp")
+int
+ipgen_xdp_rxts(struct xdp_md *ctx)
+{
+	return ipgen_xdp_main(ctx, 1);
+}
+
+/* fallback if the driver or the kernel has no metadata kfunc */
+SEC("xdp")
+int
+ipgen_xdp(struct xdp_md *ctx)
+{
+	return ipgen_xdp_main(ctx, 0);
+}
+
+char _license[] SEC("license") = "Dual BSD/GPL";
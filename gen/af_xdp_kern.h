@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _AF_XDP_KERN_H_
+#define _AF_XDP_KERN_H_
+
+/*
+ * shared between the XDP program (af_xdp_kern.c) and userland.
+ */
+#include <linux/types.h>
+
+#define AX_KERN_MAXQUEUE	64	/* entries of xsks_map */
+
+/*
+ * metadata put in front of the frame by the XDP program.
+ * rx_timestamp is 0 if the driver gave no timestamp.
+ */
+#define AX_META_MAGIC		0x49504d44	/* "IPMD" */
+struct ax_meta {
+	__u64 rx_timestamp;	/* ns. bpf_xdp_metadata_rx_timestamp() */
+	__u32 reserved;
+	__u32 magic;		/* must be the last, just before the frame */
+};
+
+/*
+ * configuration of the XDP program, the only entry of conf_map.
+ * with AX_CONF_STEER, only test frames are redirected to AF_XDP.
+ * ARP, neighbor solicitation and ICMP echo for own addresses are
+ * answered by XDP_TX, and other frames are passed to the kernel,
+ * except for ones to own MAC address (ICMP errors, etc).
+ * addresses are in network byte order.
+ */
+#define AX_CONF_STEER		0x01
+#define AX_CONF_COUNT		0x02	/* count and drop test frames */
+struct ax_conf {
+	__u32 flags;
+	__u16 seq_magic;	/* struct seqdata at the end of test frame */
+	__u8 eaddr[6];
+	__u32 ipaddr, ipaddr_mask, gwaddr;
+	__u32 ip6addr[4], ip6addr_mask[4], gw6addr[4];
+};
+
+/* per-CPU counters in stat_map */
+#define AX_STAT_REPLY		0	/* ARP, ND and ICMP echo answered */
+#define AX_STAT_PASS		1	/* passed to the kernel */
+#define AX_STAT_MAX		2
+
+/*
+ * AX_CONF_COUNT. test frames are accounted in count_map[cpu] and dropped.
+ * the sequence of a frame is marked in the bitmap window of the CPU.
+ * userland settles sequences older than the max by AX_SEQWIN_HOLD: merges
+ * bitmaps of all CPUs, counts missing ones as drop and clears them.
+ * count_map is mmap'ed by userland.
+ */
+#define AX_SEQWIN_BITS		(1 << 20)	/* must be 2^n */
+#define AX_SEQWIN_WORDS		(AX_SEQWIN_BITS / 64)
+#define AX_SEQWIN_HOLD		(AX_SEQWIN_BITS / 2)
+struct ax_count {
+	__u64 rx;
+	__u64 rx_byte;		/* without FCS */
+	__u64 dup;		/* received twice on the CPU */
+	__u64 reorder;		/* lower than hi */
+	__u64 outofrange;	/* lower than tail. already counted as drop */
+	__u32 lo, hi;		/* first and max sequence on the CPU */
+	__u32 valid;		/* lo and hi are set */
+	__u32 tail;		/* by userland. settled before this */
+	__u32 tailvalid;
+	__u32 reserved;
+	__u64 bits[AX_SEQWIN_WORDS];
+};
+
+#endif /* _AF_XDP_KERN_H_ */
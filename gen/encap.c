@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "encap.h"
+
+#define ETHERTYPE_IPV4_ENCAP	0x0800
+#define ETHERTYPE_IPV6_ENCAP	0x86dd
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/* sum of big-endian 16bit words. len must be even */
+static uint32_t
+sum16(const uint8_t *p, unsigned int len)
+{
+	uint32_t sum = 0;
+
+	for (; len >= 2; p += 2, len -= 2)
+		sum += (p[0] << 8) | p[1];
+	return sum;
+}
+
+static inline uint16_t
+fold16(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+/*
+ * parse "<layer>[/<layer>...]"
+ *   vlan:<id>			(stacked tags are QinQ)
+ *   mpls:<label>[.<label>...]
+ *   vxlan:<vni>,<remote>
+ *   gre:<remote>[,<key>]
+ *   gtpu:<teid>,<remote>
+ * VLAN tags come first, then MPLS labels, and one tunnel at last.
+ */
+struct encap *
+encap_parse(const char *spec)
+{
+	struct encap *e;
+	char *buf, *layer, *arg, *save, *p, *q;
+	unsigned long v;
+	int stage = 0;		/* 0: vlan, 1: mpls, 2: tunnel */
+
+	e = calloc(1, sizeof(struct encap));
+	buf = strdup(spec);
+	if ((e == NULL) || (buf == NULL))
+		goto illegal;
+	snprintf(e->spec, sizeof(e->spec), "%s", spec);
+
+	for (layer = strtok_r(buf, "/", &save); layer != NULL; layer = strtok_r(NULL, "/", &save)) {
+		if ((arg = strchr(layer, ':')) == NULL)
+			goto illegal;
+		*arg++ = '\0';
+		if (stage > 1)
+			goto illegal;	/* nothing after tunnel */
+
+		if (strcmp(layer, "vlan") == 0) {
+			v = strtoul(arg, &p, 10);
+			if ((stage > 0) || (p == arg) || (*p != '\0') || (v >= 4096) ||
+			    (e->ntag >= ENCAP_MAXTAG))
+				goto illegal;
+			e->tag[e->ntag++] = v;
+		} else if (strcmp(layer, "mpls") == 0) {
+			if (stage > 0)
+				goto illegal;
+			stage = 1;
+			for (q = arg; ; q = p + 1) {
+				v = strtoul(q, &p, 0);
+				if ((p == q) || (v >= (1 << 20)) || (e->nlabel >= ENCAP_MAXLABEL))
+					goto illegal;
+				e->label[e->nlabel++] = v;
+				if (*p == '\0')
+					break;
+				if (*p != '.')
+					goto illegal;
+			}
+		} else {
+			stage = 2;
+			if ((p = strchr(arg, ',')) != NULL)
+				*p++ = '\0';
+			if (strcmp(layer, "vxlan") == 0) {
+				e->tunnel = ENCAP_TUNNEL_VXLAN;
+			} else if (strcmp(layer, "gtpu") == 0) {
+				e->tunnel = ENCAP_TUNNEL_GTPU;
+			} else if (strcmp(layer, "gre") == 0) {
+				/* gre:<remote>[,<key>] */
+				e->tunnel = ENCAP_TUNNEL_GRE;
+				if (inet_pton(AF_INET, arg, &e->remote) != 1)
+					goto illegal;
+				if (p != NULL) {
+					e->vni = strtoul(p, &q, 0);
+					if ((q == p) || (*q != '\0'))
+						goto illegal;
+					e->gre_key = 1;
+				}
+				continue;
+			} else {
+				goto illegal;
+			}
+
+			/* vxlan:<vni>,<remote> or gtpu:<teid>,<remote> */
+			if (p == NULL)
+				goto illegal;
+			v = strtoul(arg, &q, 0);
+			if ((q == arg) || (*q != '\0') || (v > UINT32_MAX) ||
+			    ((e->tunnel == ENCAP_TUNNEL_VXLAN) && (v >= (1 << 24))))
+				goto illegal;
+			e->vni = v;
+			if (inet_pton(AF_INET, p, &e->remote) != 1)
+				goto illegal;
+		}
+	}
+	if ((e->ntag == 0) && (e->nlabel == 0) && (e->tunnel == ENCAP_TUNNEL_NONE))
+		goto illegal;
+
+	free(buf);
+	return e;
+
+ illegal:
+	fprintf(stderr, "illegal encapsulation: %s\n", spec);
+	free(buf);
+	free(e);
+	return NULL;
+}
+
+void
+encap_delete(struct encap *e)
+{
+	free(e);
+}
+
+/*
+ * build headers from ether header to the inner IP header.
+ * eaddr is destination and source MAC address (12 bytes) of ether header.
+ * vlan is the tag of -V, placed outermost. src is the outer IPv4 source.
+ */
+int
+encap_build(struct encap *e, const uint8_t *eaddr, int vlan, struct in_addr src)
+{
+	uint8_t *h;
+	unsigned int i, off, ntag, af;
+	uint16_t tags[ENCAP_MAXTAG + 1];
+
+	ntag = 0;
+	if (vlan != 0)
+		tags[ntag++] = vlan;
+	for (i = 0; i < e->ntag; i++)
+		tags[ntag++] = e->tag[i];
+
+	for (af = 0; af < 2; af++) {
+		h = e->hdr[af];
+		memset(h, 0, ENCAP_MAXLEN);
+		memcpy(h, eaddr, ETHER_ADDR_LEN * 2);
+		off = ETHER_ADDR_LEN * 2;
+
+		/* outer tag of QinQ is S-tag */
+		for (i = 0; i < ntag; i++) {
+			put16(h + off, ((ntag > 1) && (i == 0)) ? ENCAP_ETHERTYPE_QINQ : ETHERTYPE_VLAN);
+			put16(h + off + 2, tags[i]);
+			off += 4;
+		}
+
+		if (e->nlabel > 0) {
+			put16(h + off, ENCAP_ETHERTYPE_MPLS);
+			off += 2;
+			for (i = 0; i < e->nlabel; i++) {
+				/* label, TC=0, S on the bottom, TTL=64 */
+				put32(h + off, (e->label[i] << 12) |
+				    ((i == e->nlabel - 1) ? 0x100 : 0) | 64);
+				off += 4;
+			}
+		} else if (e->tunnel != ENCAP_TUNNEL_NONE) {
+			put16(h + off, ETHERTYPE_IPV4_ENCAP);
+			off += 2;
+		} else {
+			put16(h + off, af ? ETHERTYPE_IPV6_ENCAP : ETHERTYPE_IPV4_ENCAP);
+			off += 2;
+		}
+
+		if (e->tunnel == ENCAP_TUNNEL_NONE) {
+			e->len = off;
+			continue;
+		}
+
+		/* outer IPv4. length and checksum are set per packet */
+		e->ip_off = off;
+		h[off] = 0x45;
+		h[off + 8] = 64;
+		h[off + 9] = (e->tunnel == ENCAP_TUNNEL_GRE) ? IPPROTO_GRE : IPPROTO_UDP;
+		memcpy(h + off + 12, &src, 4);
+		memcpy(h + off + 16, &e->remote, 4);
+		e->ip_sum0 = sum16(h + off, 20);
+		off += 20;
+
+		switch (e->tunnel) {
+		case ENCAP_TUNNEL_GRE:
+			put16(h + off, e->gre_key ? 0x2000 : 0);
+			put16(h + off + 2, af ? ETHERTYPE_IPV6_ENCAP : ETHERTYPE_IPV4_ENCAP);
+			off += 4;
+			if (e->gre_key) {
+				put32(h + off, e->vni);
+				off += 4;
+			}
+			break;
+		case ENCAP_TUNNEL_VXLAN:
+			e->udp_off = off;
+			put16(h + off, ENCAP_PORT_VXLAN);
+			put16(h + off + 2, ENCAP_PORT_VXLAN);
+			off += 8;
+			h[off] = 0x08;		/* VNI is valid */
+			put32(h + off + 4, e->vni << 8);
+			off += 8;
+			/* inner ether header */
+			memcpy(h + off, eaddr, ETHER_ADDR_LEN * 2);
+			put16(h + off + 12, af ? ETHERTYPE_IPV6_ENCAP : ETHERTYPE_IPV4_ENCAP);
+			off += ETHER_HDR_LEN;
+			break;
+		case ENCAP_TUNNEL_GTPU:
+			e->udp_off = off;
+			put16(h + off, ENCAP_PORT_GTPU);
+			put16(h + off + 2, ENCAP_PORT_GTPU);
+			off += 8;
+			e->gtp_off = off;
+			h[off] = 0x30;		/* version 1, PT=1 */
+			h[off + 1] = 0xff;	/* G-PDU */
+			put32(h + off + 4, e->vni);
+			off += 8;
+			break;
+		}
+		e->len = off;
+
+		if (e->udp_off != 0) {
+			/* pseudo header, ports, and UDP payload before the inner packet */
+			e->udp_sum0[af] = sum16(h + e->ip_off + 12, 8) + IPPROTO_UDP +
+			    sum16(h + e->udp_off, 4) +
+			    sum16(h + e->udp_off + 8, off - e->udp_off - 8);
+		}
+	}
+
+	if (e->len > ENCAP_MAXLEN)
+		return -1;
+	return 0;
+}
+
+/*
+ * set lengths and checksums of the outer headers for the inner IP
+ * packet of l3len bytes. if fast, the inner packet has valid L4 checksum
+ * without extension header, and the sum of it is derived from the pseudo
+ * header instead of summing all the bytes.
+ */
+void
+encap_finish(const struct encap *e, char *buf, unsigned int l3len, int ipv6, int fast)
+{
+	uint8_t *h = (uint8_t *)buf;
+	const uint8_t *inner = h + e->len;
+	uint32_t sum, l4len;
+	uint16_t len;
+
+	if (e->ip_off == 0)
+		return;
+
+	len = e->len - e->ip_off + l3len;
+	put16(h + e->ip_off + 2, len);
+	put16(h + e->ip_off + 10, ~fold16(e->ip_sum0 + len));
+
+	if (e->udp_off == 0)
+		return;
+
+	len = e->len - e->udp_off + l3len;
+	put16(h + e->udp_off + 4, len);
+	sum = e->udp_sum0[ipv6 ? 1 : 0] + len + len;
+	if (e->gtp_off != 0) {
+		put16(h + e->gtp_off + 2, l3len);
+		sum += l3len;
+	}
+
+	if (!fast) {
+		sum += sum16(inner, l3len & ~1U);
+		if (l3len & 1)
+			sum += inner[l3len - 1] << 8;
+	} else if (ipv6) {
+		/* addresses in header and pseudo header are cancelled out */
+		l4len = l3len - 40;
+		sum += sum16(inner, 8);
+		sum += (uint16_t)~fold16((l4len >> 16) + (l4len & 0xffff) + inner[6]);
+	} else {
+		/* IPv4 header sums to 0 */
+		l4len = l3len - (inner[0] & 0x0f) * 4;
+		sum += (uint16_t)~fold16(sum16(inner + 12, 8) + l4len + inner[9]);
+	}
+
+	sum = (uint16_t)~fold16(sum);
+	put16(h + e->udp_off + 6, (sum == 0) ? 0xffff : sum);
+}
+
+/*
+ * skip VXLAN, GRE or GTP-U tunnel on IPv4 at l3off.
+ * returns offset of the inner IP header, or l3off if not a tunnel.
+ */
+unsigned int
+encap_decap(const char *buf, unsigned int len, unsigned int l3off, int *ipv6)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	unsigned int off, flags;
+	uint16_t type;
+
+	if ((l3off + 20 > len) || ((p[l3off] >> 4) != 4))
+		return l3off;
+	off = l3off + (p[l3off] & 0x0f) * 4;
+
+	switch (p[l3off + 9]) {
+	case IPPROTO_GRE:
+		if (off + 4 > len)
+			return l3off;
+		flags = get16(p + off);
+		type = get16(p + off + 2);
+		off += 4;
+		if (flags & 0x8000)	/* checksum */
+			off += 4;
+		if (flags & 0x2000)	/* key */
+			off += 4;
+		if (flags & 0x1000)	/* sequence */
+			off += 4;
+		if (type == ETHERTYPE_IPV4_ENCAP)
+			*ipv6 = 0;
+		else if (type == ETHERTYPE_IPV6_ENCAP)
+			*ipv6 = 1;
+		else
+			return l3off;
+		break;
+	case IPPROTO_UDP:
+		if (off + 8 > len)
+			return l3off;
+		switch (get16(p + off + 2)) {
+		case ENCAP_PORT_VXLAN:
+			off += 8 + 8;
+			if (off + ETHER_HDR_LEN > len)
+				return l3off;
+			type = get16(p + off + 12);
+			off += ETHER_HDR_LEN;
+			if (type == ETHERTYPE_IPV4_ENCAP)
+				*ipv6 = 0;
+			else if (type == ETHERTYPE_IPV6_ENCAP)
+				*ipv6 = 1;
+			else
+				return l3off;
+			break;
+		case ENCAP_PORT_GTPU:
+			off += 8;
+			if ((off + 8 > len) || (p[off + 1] != 0xff))
+				return l3off;
+			flags = p[off];
+			off += 8;
+			if (flags & 0x07) {
+				/* sequence, N-PDU and next extension type */
+				off += 4;
+				if (flags & 0x04) {
+					/* extension headers. length in 4 bytes */
+					while ((off <= len) && (p[off - 1] != 0)) {
+						if ((off >= len) || (p[off] == 0))
+							return l3off;
+						off += p[off] * 4;
+					}
+				}
+			}
+			if (off >= len)
+				return l3off;
+			if ((p[off] >> 4) == 4)
+				*ipv6 = 0;
+			else if ((p[off] >> 4) == 6)
+				*ipv6 = 1;
+			else
+				return l3off;
+			break;
+		default:
+			return l3off;
+		}
+		break;
+	default:
+		return l3off;
+	}
+
+	if (off >= len)
+		return l3off;
+	return off;
+}
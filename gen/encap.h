@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _ENCAP_H_
+#define _ENCAP_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+/*
+ * encapsulation stack prebuilt in front of the inner IP packet.
+ * VLAN tags (QinQ if stacked), MPLS labels, and one of VXLAN, GRE or
+ * GTP-U tunnel over IPv4. only lengths and checksums of the outer
+ * headers are updated per packet.
+ */
+#define ENCAP_MAXLEN		128
+#define ENCAP_MAXTAG		4
+#define ENCAP_MAXLABEL		8
+
+#define ENCAP_ETHERTYPE_QINQ	0x88a8
+#define ENCAP_ETHERTYPE_MPLS	0x8847
+
+#define ENCAP_TUNNEL_NONE	0
+#define ENCAP_TUNNEL_VXLAN	1
+#define ENCAP_TUNNEL_GRE	2
+#define ENCAP_TUNNEL_GTPU	3
+
+#define ENCAP_PORT_VXLAN	4789
+#define ENCAP_PORT_GTPU		2152
+
+struct encap {
+	char spec[128];
+	unsigned int ntag;
+	uint16_t tag[ENCAP_MAXTAG];
+	unsigned int nlabel;
+	uint32_t label[ENCAP_MAXLABEL];
+	int tunnel;
+	struct in_addr remote;
+	uint32_t vni;			/* or TEID, GRE key */
+	int gre_key;
+
+	/* built by encap_build(). [0] for inner IPv4, [1] for inner IPv6 */
+	unsigned int len;		/* from ether header to inner IP header */
+	uint8_t hdr[2][ENCAP_MAXLEN];
+	unsigned int ip_off;		/* outer IPv4. 0 if no tunnel */
+	unsigned int udp_off;		/* outer UDP. 0 if not VXLAN nor GTP-U */
+	unsigned int gtp_off;		/* GTP-U. 0 if not GTP-U */
+	uint32_t ip_sum0;		/* sum of outer IPv4 header except length */
+	uint32_t udp_sum0[2];		/* sum of pseudo header and UDP payload except lengths */
+};
+
+struct encap *encap_parse(const char *);
+void encap_delete(struct encap *);
+int encap_build(struct encap *, const uint8_t *, int, struct in_addr);
+void encap_finish(const struct encap *, char *, unsigned int, int, int);
+unsigned int encap_decap(const char *, unsigned int, unsigned int, int *);
+
+#endif /* _ENCAP_H_ */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "flowdist.h"
+
+static uint32_t
+prob_scale(double p)
+{
+	p *= 4294967296.0;
+	if (p >= 4294967295.0)
+		return UINT32_MAX;
+	return (uint32_t)p;
+}
+
+/*
+ * build alias table (Vose's method) for nflow flows.
+ * weight[] is used for FLOWDIST_WEIGHT, and may be NULL (all 1).
+ */
+struct flowdist *
+flowdist_new(int type, unsigned int nflow, double s, const uint32_t *weight)
+{
+	struct flowdist *fd;
+	double *p, sum;
+	uint32_t *small, *large;
+	unsigned int i, l, g, nsmall, nlarge;
+
+	if (nflow == 0)
+		return NULL;
+
+	fd = calloc(1, sizeof(struct flowdist));
+	p = malloc(sizeof(double) * nflow);
+	small = malloc(sizeof(uint32_t) * nflow);
+	large = malloc(sizeof(uint32_t) * nflow);
+	if ((fd == NULL) || (p == NULL) || (small == NULL) || (large == NULL))
+		goto nomem;
+	fd->nflow = nflow;
+	fd->prob = malloc(sizeof(uint32_t) * nflow);
+	fd->alias = malloc(sizeof(uint32_t) * nflow);
+	if ((fd->prob == NULL) || (fd->alias == NULL))
+		goto nomem;
+
+	for (sum = 0.0, i = 0; i < nflow; i++) {
+		switch (type) {
+		case FLOWDIST_ZIPF:
+			p[i] = 1.0 / pow(i + 1, s);
+			break;
+		case FLOWDIST_WEIGHT:
+			p[i] = (weight != NULL) ? weight[i] : 1.0;
+			break;
+		case FLOWDIST_UNIFORM:
+		default:
+			p[i] = 1.0;
+			break;
+		}
+		sum += p[i];
+	}
+
+	for (nsmall = nlarge = 0, i = 0; i < nflow; i++) {
+		p[i] = p[i] * nflow / sum;
+		if (p[i] < 1.0)
+			small[nsmall++] = i;
+		else
+			large[nlarge++] = i;
+	}
+
+	while ((nsmall > 0) && (nlarge > 0)) {
+		l = small[--nsmall];
+		g = large[--nlarge];
+		fd->prob[l] = prob_scale(p[l]);
+		fd->alias[l] = g;
+
+		p[g] = (p[g] + p[l]) - 1.0;
+		if (p[g] < 1.0)
+			small[nsmall++] = g;
+		else
+			large[nlarge++] = g;
+	}
+	/* remaining columns are full, except for rounding errors */
+	while (nlarge > 0) {
+		g = large[--nlarge];
+		fd->prob[g] = UINT32_MAX;
+		fd->alias[g] = g;
+	}
+	while (nsmall > 0) {
+		l = small[--nsmall];
+		fd->prob[l] = UINT32_MAX;
+		fd->alias[l] = l;
+	}
+
+	free(p);
+	free(small);
+	free(large);
+	return fd;
+
+ nomem:
+	fprintf(stderr, "Cannot allocate memory. number of flow is %u\n", nflow);
+	free(p);
+	free(small);
+	free(large);
+	if (fd != NULL)
+		flowdist_delete(fd);
+	return NULL;
+}
+
+void
+flowdist_delete(struct flowdist *fd)
+{
+	free(fd->prob);
+	free(fd->alias);
+	free(fd);
+}
+
+/*
+ * parse "rr", "uniform", "zipf", "zipf:<s>" or "weight"
+ */
+int
+flowdist_parse(const char *str, int *type, double *s)
+{
+	char *p;
+
+	if (strcmp(str, "rr") == 0) {
+		*type = FLOWDIST_RR;
+	} else if (strcmp(str, "uniform") == 0) {
+		*type = FLOWDIST_UNIFORM;
+	} else if (strcmp(str, "weight") == 0) {
+		*type = FLOWDIST_WEIGHT;
+	} else if (strncmp(str, "zipf", 4) == 0) {
+		*type = FLOWDIST_ZIPF;
+		*s = 1.0;
+		if (str[4] == ':') {
+			*s = strtod(str + 5, &p);
+			if ((*p != '\0') || (p == str + 5) || !(*s > 0.0))
+				return -1;
+		} else if (str[4] != '\0') {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+	return 0;
+}
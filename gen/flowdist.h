@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _FLOWDIST_H_
+#define _FLOWDIST_H_
+
+#include <stdint.h>
+
+/*
+ * flow selection distribution.
+ * flows are picked by Walker's alias method, O(1) per packet.
+ */
+#define FLOWDIST_RR		0	/* round-robin (default) */
+#define FLOWDIST_UNIFORM	1	/* uniform random */
+#define FLOWDIST_ZIPF		2	/* zipf(s). flow 0 is the most popular */
+#define FLOWDIST_WEIGHT		3	/* weight=<n> of each flowlist line */
+
+struct flowdist {
+	unsigned int nflow;
+	uint32_t *prob;		/* pick i if random < prob[i], scaled by 2^32 */
+	uint32_t *alias;	/* otherwise pick alias[i] */
+};
+
+struct flowdist *flowdist_new(int, unsigned int, double, const uint32_t *);
+void flowdist_delete(struct flowdist *);
+int flowdist_parse(const char *, int *, double *);
+
+static inline unsigned int
+flowdist_select(const struct flowdist *fd, uint64_t r)
+{
+	uint32_t i, u;
+
+	/* upper 32bit selects the column, lower 32bit selects the side */
+	i = ((r >> 32) * fd->nflow) >> 32;
+	u = (uint32_t)r;
+	return (u < fd->prob[i]) ? i : fd->alias[i];
+}
+
+#endif /* _FLOWDIST_H_ */
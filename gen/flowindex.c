@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "flowindex.h"
+
+/*
+ * allocate index for nflow flows. groups are filled up to 7/8 at most.
+ */
+struct flowindex *
+flowindex_new(unsigned int nflow)
+{
+	struct flowindex *fi;
+	uint64_t nslot;
+	unsigned int ngroup;
+
+	nslot = (uint64_t)nflow * 8 / 7 + 1;
+	for (ngroup = 1; (uint64_t)ngroup * FLOWINDEX_GROUPSIZE < nslot; ngroup <<= 1)
+		;
+
+	fi = calloc(1, sizeof(struct flowindex));
+	if (fi == NULL)
+		goto nomem;
+	fi->ngroup = ngroup;
+	fi->ctrl = malloc(sizeof(uint64_t) * ngroup);
+	fi->entry = malloc(sizeof(struct flowindex_entry) * ngroup * FLOWINDEX_GROUPSIZE);
+	if ((fi->ctrl == NULL) || (fi->entry == NULL))
+		goto nomem;
+	memset(fi->ctrl, FLOWINDEX_CTRL_EMPTY, sizeof(uint64_t) * ngroup);
+	return fi;
+
+ nomem:
+	fprintf(stderr, "Cannot allocate memory. number of flow is %u\n", nflow);
+	if (fi != NULL)
+		flowindex_delete(fi);
+	return NULL;
+}
+
+void
+flowindex_delete(struct flowindex *fi)
+{
+	free(fi->ctrl);
+	free(fi->entry);
+	free(fi);
+}
+
+/*
+ * return 0 if inserted, 1 if the key already exists, -1 if full.
+ */
+int
+flowindex_insert(struct flowindex *fi, const struct flowkey *key, uint32_t flowid)
+{
+	struct flowindex_entry *e;
+	uint64_t h, empty;
+	unsigned int g, n, slot;
+	uint8_t tag;
+
+	if (flowindex_lookup(fi, key, &(uint32_t){ 0 }) == 0)
+		return 1;
+
+	h = flowkey_hash(key);
+	tag = h & 0x7f;
+	g = (h >> 7) & (fi->ngroup - 1);
+	for (n = 0; n < fi->ngroup; n++) {
+		empty = fi->ctrl[g] & 0x8080808080808080ULL;
+		if (empty != 0) {
+			slot = __builtin_ctzll(empty) / 8;
+			fi->ctrl[g] &= ~(0xffULL << (slot * 8));
+			fi->ctrl[g] |= (uint64_t)tag << (slot * 8);
+			e = &fi->entry[g * FLOWINDEX_GROUPSIZE + slot];
+			e->key = *key;
+			e->flowid = flowid;
+			fi->nentry++;
+			return 0;
+		}
+		g = (g + 1) & (fi->ngroup - 1);
+	}
+	return -1;
+}
+
+/*
+ * right-aligned 128bit address. IPv4 address is in the last 4 bytes.
+ * upper plen bits of the result are replaced with the prefix.
+ */
+static void
+flowxlat_apply(const struct flowxlat *xlat, int *af, struct in6_addr *addr)
+{
+	unsigned int off, i, bit;
+	uint8_t mask;
+
+	if (xlat->af == 0)
+		return;
+
+	*af = xlat->af;
+	off = (xlat->af == AF_INET) ? 12 : 0;
+	for (i = off; i < 16; i++) {
+		bit = (i - off) * 8;
+		if (bit >= xlat->plen)
+			break;
+		if (bit + 8 <= xlat->plen)
+			mask = 0xff;
+		else
+			mask = 0xff << (8 - (xlat->plen - bit));
+		addr->s6_addr[i] = (xlat->prefix.s6_addr[i] & mask) |
+		    (addr->s6_addr[i] & ~mask);
+	}
+	/* IPv4 result has no upper bits */
+	if (off != 0)
+		memset(addr->s6_addr, 0, off);
+}
+
+/*
+ * key of the flow as received. addresses of the flow are translated by
+ * xsrc and xdst. return -1 if the translation changes address family
+ * of one side only.
+ */
+int
+flowindex_key(const struct flowtable *ft, unsigned int flowid, int proto,
+    const struct flowxlat *xsrc, const struct flowxlat *xdst, struct flowkey *key)
+{
+	struct in6_addr saddr, daddr;
+	int saf, daf;
+
+	memset(&saddr, 0, sizeof(saddr));
+	memset(&daddr, 0, sizeof(daddr));
+	saf = daf = flowtable_af(ft, flowid);
+	if (saf == AF_INET) {
+		memcpy(&saddr.s6_addr[12], &ft->saddr4[flowid], 4);
+		memcpy(&daddr.s6_addr[12], &ft->daddr4[flowid], 4);
+	} else {
+		saddr = ft->saddr6[flowid];
+		daddr = ft->daddr6[flowid];
+	}
+	flowxlat_apply(xsrc, &saf, &saddr);
+	flowxlat_apply(xdst, &daf, &daddr);
+	if (saf != daf)
+		return -1;
+
+	flowkey_init(key, saf, proto,
+	    &saddr.s6_addr[(saf == AF_INET) ? 12 : 0],
+	    &daddr.s6_addr[(saf == AF_INET) ? 12 : 0],
+	    ft->sport[flowid], ft->dport[flowid]);
+	if (ft->nl2tag != 0)
+		flowkey_vlan(key, (const uint8_t *)&ft->l2tag[flowid * ft->nl2tag], ft->nl2tag);
+	return 0;
+}
+
+/*
+ * build index of the flows expected to be received. ft is the flowtable
+ * of the transmitting side, and addresses of it are translated by
+ * xsrc and xdst. the index gives per flow state id of ft, which is
+ * the flowid unless ft->stateid is set.
+ */
+struct flowindex *
+flowindex_build(const struct flowtable *ft, int proto, const struct flowxlat *xsrc, const struct flowxlat *xdst)
+{
+	struct flowindex *fi;
+	struct flowkey key;
+	unsigned int flowid, ndup;
+	int rc;
+
+	if ((fi = flowindex_new(ft->nflow)) == NULL)
+		return NULL;
+	fi->vlan = (ft->nl2tag != 0);
+
+	for (ndup = 0, flowid = 0; flowid < ft->nflow; flowid++) {
+		if (flowindex_key(ft, flowid, proto, xsrc, xdst, &key) != 0) {
+			fprintf(stderr, "flowcheck: address family of source and destination differ after translation\n");
+			flowindex_delete(fi);
+			return NULL;
+		}
+		rc = flowindex_insert(fi, &key, flowtable_stateid(ft, flowid));
+		if (rc < 0) {
+			flowindex_delete(fi);
+			return NULL;
+		}
+		if (rc > 0)
+			ndup++;
+	}
+	if (ndup != 0)
+		fprintf(stderr, "flowcheck: %u flows are indistinguishable after translation\n", ndup);
+
+	return fi;
+}
+
+/*
+ * parse "<prefix>/<plen>". the result address family is that of the prefix.
+ */
+int
+flowxlat_parse(const char *str, struct flowxlat *xlat)
+{
+	char buf[INET6_ADDRSTRLEN], *p;
+	unsigned long plen;
+	const char *s;
+
+	if ((s = strchr(str, '/')) == NULL || (size_t)(s - str) >= sizeof(buf))
+		return -1;
+	memcpy(buf, str, s - str);
+	buf[s - str] = '\0';
+
+	plen = strtoul(s + 1, &p, 10);
+	if ((*p != '\0') || (p == s + 1))
+		return -1;
+
+	memset(xlat, 0, sizeof(*xlat));
+	if (inet_pton(AF_INET, buf, &xlat->prefix.s6_addr[12]) == 1) {
+		if (plen > 32)
+			return -1;
+		xlat->af = AF_INET;
+	} else if (inet_pton(AF_INET6, buf, &xlat->prefix) == 1) {
+		if (plen > 128)
+			return -1;
+		xlat->af = AF_INET6;
+	} else {
+		return -1;
+	}
+	xlat->plen = plen;
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _FLOWINDEX_H_
+#define _FLOWINDEX_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "libaddrlist/libaddrlist.h"
+
+/*
+ * hash index from received 5-tuple to flowid, to classify packets
+ * translated by the DUT (NAT44, NAT64, NPTv6).
+ *
+ * open addressing in groups of 8 slots, like Swiss table. each slot has
+ * 7bit tag of the hash in the control word of the group, and a lookup
+ * compares 8 tags at once, so that it touches the key only on a hit.
+ * flows are never removed. the index is rebuilt when flows are changed.
+ */
+#define FLOWINDEX_GROUPSIZE	8
+#define FLOWINDEX_CTRL_EMPTY	0x80
+
+struct flowkey {
+	struct in6_addr saddr, daddr;	/* IPv4 address is in the last 4 bytes */
+	uint16_t sport, dport;		/* host byte order */
+	uint8_t af;
+	uint8_t proto;
+	uint16_t svlan, cvlan;		/* VLAN ID. only if flowindex.vlan */
+	uint16_t pad[3];
+};
+
+struct flowindex_entry {
+	struct flowkey key;
+	uint32_t flowid;
+};
+
+struct flowindex {
+	unsigned int ngroup;		/* power of 2 */
+	unsigned int nentry;
+	int vlan;			/* flows have per flow VLAN in the key */
+	uint64_t *ctrl;			/* tags of a group. byte n is for slot n */
+	struct flowindex_entry *entry;
+};
+
+/*
+ * address translation of the DUT. upper plen bits of an address are
+ * replaced with the prefix, and the rest are taken from the lower bits of
+ * the original address. e.g. 64:ff9b::/96 embeds IPv4 address (NAT64),
+ * and 0.0.0.0/0 extracts it.
+ */
+struct flowxlat {
+	int af;				/* 0 if not translated */
+	struct in6_addr prefix;		/* IPv4 prefix is in the last 4 bytes */
+	unsigned int plen;
+};
+
+struct flowindex *flowindex_new(unsigned int);
+void flowindex_delete(struct flowindex *);
+int flowindex_insert(struct flowindex *, const struct flowkey *, uint32_t);
+int flowindex_key(const struct flowtable *, unsigned int, int, const struct flowxlat *, const struct flowxlat *, struct flowkey *);
+struct flowindex *flowindex_build(const struct flowtable *, int, const struct flowxlat *, const struct flowxlat *);
+int flowxlat_parse(const char *, struct flowxlat *);
+
+static inline void
+flowkey_init(struct flowkey *key, int af, int proto, const void *saddr, const void *daddr, uint16_t sport, uint16_t dport)
+{
+	unsigned int off = (af == AF_INET) ? 12 : 0;
+
+	memset(key, 0, sizeof(*key));
+	memcpy(&key->saddr.s6_addr[off], saddr, 16 - off);
+	memcpy(&key->daddr.s6_addr[off], daddr, 16 - off);
+	key->sport = sport;
+	key->dport = dport;
+	key->af = af;
+	key->proto = proto;
+}
+
+/*
+ * VLAN ID of the flow from the tags as on the wire. S-VLAN has TPID 0x88a8,
+ * and C-VLAN (or single VLAN) has 0x8100.
+ */
+static inline void
+flowkey_vlan(struct flowkey *key, const uint8_t *tag, unsigned int ntag)
+{
+	unsigned int i;
+	uint16_t tpid, vid;
+
+	for (i = 0; i < ntag; i++, tag += 4) {
+		tpid = (tag[0] << 8) | tag[1];
+		vid = ((tag[2] << 8) | tag[3]) & 0x0fff;
+		if (tpid == 0x88a8)
+			key->svlan = vid;
+		else if (tpid == 0x8100)
+			key->cvlan = vid;
+	}
+}
+
+static inline uint64_t
+flowkey_hash(const struct flowkey *key)
+{
+	uint64_t w[sizeof(struct flowkey) / sizeof(uint64_t)], h;
+	unsigned int i;
+
+	memcpy(w, key, sizeof(w));
+	for (h = 0, i = 0; i < sizeof(w) / sizeof(w[0]); i++) {
+		h = (h ^ w[i]) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+/* bit 7 of each byte is set where the tag matches. may have false positives */
+static inline uint64_t
+flowindex_match(uint64_t ctrl, uint8_t tag)
+{
+	uint64_t x;
+
+	x = ctrl ^ (0x0101010101010101ULL * tag);
+	return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+}
+
+/* return 0 and set *flowid if found, otherwise -1 */
+static inline int
+flowindex_lookup(const struct flowindex *fi, const struct flowkey *key, uint32_t *flowid)
+{
+	const struct flowindex_entry *e;
+	uint64_t h, m;
+	unsigned int g, n;
+	uint8_t tag;
+
+	h = flowkey_hash(key);
+	tag = h & 0x7f;
+	g = (h >> 7) & (fi->ngroup - 1);
+	for (n = 0; n < fi->ngroup; n++) {
+		for (m = flowindex_match(fi->ctrl[g], tag); m != 0; m &= m - 1) {
+			e = &fi->entry[g * FLOWINDEX_GROUPSIZE + __builtin_ctzll(m) / 8];
+			if (memcmp(&e->key, key, sizeof(*key)) == 0) {
+				*flowid = e->flowid;
+				return 0;
+			}
+		}
+		/* no more entries after a group which has an empty slot */
+		if (fi->ctrl[g] & 0x8080808080808080ULL)
+			break;
+		g = (g + 1) & (fi->ngroup - 1);
+	}
+	return -1;
+}
+
+#endif /* _FLOWINDEX_H_ */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -63,6 +64,37 @@ parse_portrange(char *portrange, uint16_t *port_begin, uint16_t *port_end)
 	return 0;
 }
 
+/*
+ * parse "100-199"
+ *       "100"
+ * as VLAN ID range. 0 is not a VLAN.
+ */
+int
+parse_vlanrange(const char *vlanrange, uint16_t *vlan_begin, uint16_t *vlan_end)
+{
+	unsigned long begin, end;
+	char *p;
+
+	begin = strtoul(vlanrange, &p, 10);
+	if (p == vlanrange)
+		return -1;
+	end = begin;
+	if (*p == '-') {
+		vlanrange = p + 1;
+		end = strtoul(vlanrange, &p, 10);
+		if (p == vlanrange)
+			return -1;
+	}
+	if ((*p != '\0') && (*p != ' ') && (*p != '\t'))
+		return -1;
+	if ((begin == 0) || (begin > end) || (end > 4095))
+		return -1;
+
+	*vlan_begin = begin;
+	*vlan_end = end;
+	return 0;
+}
+
 /*
  * parse "1.2.3.4-2.3.4.5"
  *       "1.2.3.4"
@@ -186,18 +218,29 @@ parse_addr6_port(char *str, struct in6_addr *addr6start, struct in6_addr *addr6e
 
 /*
  * parse flow strings:
- *  <address>[-<address>]:<port>[-<port>],<address>[-<address>]:<port>[-<port>]
+ *  <address>[-<address>]:<port>[-<port>],<address>[-<address>]:<port>[-<port>] [<option> ...]
+ *
+ * options:
+ *   weight=<n>			relative frequency with --flowdist weight
+ *   vlan=<id>[-<id>]		802.1Q VLAN ID (C-VLAN if svlan= is given)
+ *   svlan=<id>[-<id>]		802.1ad S-VLAN ID of QinQ
  *
  * e.g.)
  *   10.0.0.1:9,10.0.0.2:100				(1 session)
  *   10.0.0.1:1024-65535,10.0.0.2:9			(64512 sessions)
  *   10.0.0.0-10.0.0.255:1024-65535,192.168.0.1:9	(5483519 sessions)
+ *   10.0.0.1:9,10.0.0.2:100 weight=10			(1 session, used 10 times as others with --flowdist weight)
+ *   10.0.0.1-10.0.3.232:9,10.0.0.2:9 vlan=1-1000		(1000 sessions, one for each VLAN)
+ *   10.0.0.1:9,10.0.0.2:9 svlan=10 vlan=100-199		(100 sessions over QinQ)
  */
 int
 parse_flowstr(struct addresslist *adrlist, int proto, const char *flowstr, int reverse)
 {
-	char *srcp, *dstp;
+	char *srcp, *dstp, *optp;
 	char *str;
+	unsigned long weight;
+	uint16_t svlan_start, svlan_end;
+	uint16_t cvlan_start, cvlan_end;
 	struct in_addr sadr_start, sadr_end;
 	struct in_addr dadr_start, dadr_end;
 	struct in6_addr sadr6_start, sadr6_end;
@@ -225,6 +268,46 @@ parse_flowstr(struct addresslist *adrlist, int proto, const char *flowstr, int r
 		dstp++;
 	srcp = str;
 
+	weight = 1;
+	svlan_start = svlan_end = cvlan_start = cvlan_end = 0;
+	optp = strpbrk(dstp, " \t");
+	if (optp != NULL) {
+		*optp++ = '\0';
+		for (;;) {
+			while ((*optp == ' ') || (*optp == '\t'))
+				optp++;
+			if ((*optp == '\0') || (*optp == '#'))	/* comment */
+				break;
+			if (strncmp(optp, "weight=", 7) == 0) {
+				weight = strtoul(optp + 7, &optp, 10);
+				if ((weight == 0) || (weight > UINT32_MAX) ||
+				    ((*optp != '\0') && (*optp != ' ') && (*optp != '\t'))) {
+					rc = -1;
+					goto done;
+				}
+			} else if (strncmp(optp, "vlan=", 5) == 0) {
+				if (parse_vlanrange(optp + 5, &cvlan_start, &cvlan_end) != 0) {
+					rc = -1;
+					goto done;
+				}
+			} else if (strncmp(optp, "svlan=", 6) == 0) {
+				if (parse_vlanrange(optp + 6, &svlan_start, &svlan_end) != 0) {
+					rc = -1;
+					goto done;
+				}
+			} else {
+				rc = -1;
+				goto done;
+			}
+			optp += strcspn(optp, " \t");
+		}
+	}
+	addresslist_setweight(adrlist, weight);
+	if (addresslist_setvlan(adrlist, svlan_start, svlan_end, cvlan_start, cvlan_end) != 0) {
+		rc = -1;
+		goto done;
+	}
+
 
 	if (srcp[0] == '[') {
 		if (parse_addr6_port(srcp, &sadr6_start, &sadr6_end, &sport_start, &sport_end) != 0) {
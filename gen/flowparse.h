@@ -29,6 +29,7 @@
 #include <libaddrlist/libaddrlist.h>
 
 int parse_portrange(char *, uint16_t *, uint16_t *);
+int parse_vlanrange(const char *, uint16_t *, uint16_t *);
 int parse_addrrange(char *, struct in_addr *, struct in_addr *_end);
 int parse_addr6range(char *, struct in6_addr *, struct in6_addr *_end);
 int parse_addr_port(char *, struct in_addr *, struct in_addr *, uint16_t *, uint16_t *);
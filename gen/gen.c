@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <getopt.h>
 #include <poll.h>
 #include <err.h>
@@ -84,10 +85,21 @@
 #include "gen.h"
 #include "pbuf.h"
 #include "sequencecheck.h"
+#include "seqring.h"
 #include "seqtable.h"
 #include "item.h"
 #include "genscript.h"
 #include "flowparse.h"
+#include "flowdist.h"
+#include "prng.h"
+#include "randfield.h"
+#include "rss.h"
+#include "flowindex.h"
+#include "imix.h"
+#include "tsc.h"
+#include "stream.h"
+#include "pkttemplate.h"
+#include "encap.h"
 
 #include "pktgen_item.h"
 
@@ -106,6 +118,8 @@
 
 #define	PORT_DEFAULT		9	/* discard port */
 #define MAXFLOWNUM		(1024 * 1024)
+#define PERFLOW_CHUNK		1024	/* per flow work is allocated by chunk */
+#define PERFLOW_NCHUNK		(MAXFLOWNUM / PERFLOW_CHUNK)
 
 /* For old FreeBSD */
 #if !defined(pthread_setname_np) && defined(pthread_set_name_np)
@@ -155,6 +169,7 @@ int opt_fulldup = 0;
 int opt_txonly = 0;
 int opt_rxonly = 0;
 int opt_gentest = 0;
+int opt_txpath_test = 0;
 int opt_addrrange = 0;
 int opt_saddr = 0;
 int opt_daddr = 0;
@@ -167,6 +182,7 @@ int opt_ipg = 0;
 int opt_time = 0;
 int opt_fail_if_dropped = 0;
 int opt_rfc2544 = 0;
+static int rfc2544_web = 0;	/* not --rfc2544, but started from web */
 double opt_rfc2544_tolerable_error_rate = 0.0;	/* default 0.00 % */
 int opt_rfc2544_trial_duration = RFC2544_TRIAL_SECS_DEFAULT;
 char *opt_rfc2544_pktsize;
@@ -186,6 +202,8 @@ uint16_t opt_srcport_begin = PORT_DEFAULT;
 uint16_t opt_srcport_end = PORT_DEFAULT;
 uint16_t opt_dstport_begin = PORT_DEFAULT;
 uint16_t opt_dstport_end = PORT_DEFAULT;
+uint16_t opt_svlan_begin, opt_svlan_end;	/* per flow VLAN. 0 if none */
+uint16_t opt_cvlan_begin, opt_cvlan_end;
 
 int opt_srcaddr_af;
 int opt_dstaddr_af;
@@ -200,7 +218,28 @@ struct in6_addr opt_dstaddr6_end;
 
 int opt_flowsort = 0;
 int opt_flowdump = 0;
+int opt_flowlazy = 0;
+int opt_flowmac_md5 = 0;
+int opt_flowdist = FLOWDIST_RR;
+double opt_flowdist_zipf = 1.0;
+struct randfield opt_random;
+uint64_t opt_seed;
+int opt_seed_set = 0;
 char *opt_flowlist = NULL;
+char *opt_flowlist_compile = NULL;
+char *opt_rss_generate = NULL;
+struct rss opt_rss;
+char *opt_rss_weight = NULL;
+int opt_flowcheck = 0;
+struct flowxlat opt_xlat_src;
+struct flowxlat opt_xlat_dst;
+struct imix *opt_imix = NULL;
+unsigned int opt_train_npkt = 0;
+unsigned int opt_train_usec = 0;
+struct stream *streams;			/* --streams. transmitted by interface[1] */
+struct pkttemplate *opt_template = NULL;	/* --template. transmitted by interface[1] */
+int opt_decap = 0;			/* any --encap has a tunnel */
+unsigned int nstream = 0;
 
 u_int min_pktsize = 46;	/* not include ether-header. udp4:46, tcp4:46, udp6:54, tcp6:66 */
 
@@ -264,6 +303,10 @@ struct seqdata {
 	uint16_t magic;
 } __packed;
 static uint16_t seq_magic;
+static unsigned int tx_ipid;		/* IPv4 ID of TX packets */
+
+/* specialized TX path. returns length of the frame excluding ether header */
+typedef int (*txpath_t)(char *, int, unsigned int, struct flowtable *);
 
 struct interface {
 	int opened;
@@ -271,6 +314,19 @@ struct interface {
 	struct nm_desc *nm_desc;
 #elif defined(USE_AF_XDP)
 	struct ax_desc *ax_desc;
+	struct ax_prog *ax_prog;	/* NULL if default XDP program */
+	uint64_t xdpstat_last[AX_STAT_MAX];
+
+	/* --xdp-count. count_map is settled by RX thread of shard 0 */
+	struct ax_count *xdpcount;	/* NULL if not counting */
+	unsigned int xdpcount_ncpu;
+	unsigned int *xdpcount_cpu;	/* CPUs which have received */
+	uint32_t xdpcount_tail;
+	int xdpcount_tailvalid;
+	struct {
+		uint64_t rx, rx_byte, dup, reorder, outofrange;
+	} xdpcount_last;
+	uint64_t xdp_seqdrop, xdp_dup, xdp_reorder, xdp_outofrange;	/* since reset */
 #endif
 	char ifname[IFNAMSIZ];
 	char drvname[IFNAMSIZ];
@@ -304,6 +360,8 @@ struct interface {
 		uint64_t rx_icmpredirect;
 		uint64_t rx_other;
 		uint64_t rx_expire;
+		uint64_t rx_xdpreply;	/* arp, nd, icmp-echo answered by XDP */
+		uint64_t rx_xdppass;	/* passed to the kernel by XDP */
 		uint64_t tx_underrun;
 		uint64_t rx_seqrewind;
 
@@ -319,6 +377,7 @@ struct interface {
 		uint64_t rx_outofrange;
 		uint64_t rx_outofrange_last;
 		uint64_t rx_outofrange_delta;
+		uint64_t rx_flowcheck;		/* not expected tuple of the flow */
 
 
 		uint64_t rx_seqdrop_flow;
@@ -345,23 +404,51 @@ struct interface {
 		uint64_t latency_npkt;		/* for avg */
 	} stats;
 
+	/*
+	 * flows are replaced while TX/RX threads are running. they are
+	 * freed after all threads passed quiescent state. see flow_retire()
+	 */
 	struct addresslist *adrlist;
+	struct flowtable *flowtable;		/* compact copy of adrlist for TX */
+	unsigned int flowtable_gen;		/* incremented when flowtable is replaced */
+	unsigned int flowcur;			/* next flowid in flowtable. owned by TX thread */
+	unsigned int flowcur_reset;		/* flow_apply() requests to rewind flowcur */
+	unsigned int flowcur_reset_done;	/* by TX thread */
+	struct flowdist *flowdist;		/* alias table for --flowdist. NULL if rr */
+	struct flowindex *flowindex;		/* received tuple to flowid for --flowcheck */
+	struct prng prng;			/* random numbers for TX. seeded by --seed */
+	txpath_t txpath;			/* TX path specialized for txpath_ft. NULL if generic */
+	struct flowtable *txpath_ft;
+	unsigned int txpath_gen;		/* flowtable_gen txpath was selected for */
 
 	struct sequencechecker *seqchecker;	/* receive sequence drop checker */
 	struct sequencechecker *seqchecker_flowtotal;
-	struct sequencechecker **seqchecker_perflow;
+	struct sequencechecker **seqchecker_perflow[PERFLOW_NCHUNK];
 	struct sequence_table *seqtable;	/* sequence info recorder */
 
 	uint64_t sequence_tx;			/* transmit sequence number */
-	uint64_t *sequence_tx_perflow;		/* transmit sequence number per flow*/
+	uint64_t *sequence_tx_perflow[PERFLOW_NCHUNK];	/* transmit sequence number per flow*/
+	unsigned int nperflow;			/* allocated number of per flow work */
 
-	unsigned int pktsize;	/* not include ether-header nor FCS */
+	unsigned int pktsize;	/* not include ether-header nor FCS. average if imix */
+	struct imix *imix;	/* packet size mix. NULL if all packets are pktsize */
+	struct pkttemplate *pkttemplate;	/* user defined packet. pktsize is fixed */
+	unsigned int imixcur;	/* next in imix schedule. owned by TX thread */
 	uint32_t transmit_pps;
 	uint32_t transmit_pps_max;
 	uint32_t transmit_txhz;
+	uint64_t train_next;	/* tsc of next --burst-train. owned by TX thread */
+
+	/* --streams. owned by TX thread */
+	struct streamsched streamsched;
+	struct stream *streamdue[STREAM_DUEMAX];	/* packets to be built */
+	unsigned int streamdue_head;
+	unsigned int streamdue_n;
+	uint64_t stream_epoch;		/* tsc when transmit started. 0 if stopped */
 	double transmit_Mbps;
 	int transmit_enable;
 	int need_reset_statistics;
+	int need_reset_perflow;		/* flowid of lazy addresslist shifted */
 
 	struct pbufq pbufq;
 
@@ -372,6 +459,7 @@ struct interface {
 	struct pppoe_softc pppoe_sc;
 #endif
 	int vlan_id;			/* vlan id. 0-4095. used only for TX */
+	struct encap *encap;		/* --encap. prebuilt in pktbuffer_encap */
 	int af_addr;			/* AF_INET or AF_INET6 */
 	struct in_addr ipaddr;		/* my IP address */
 	struct in_addr ipaddr_mask;	/* my IP address mask */
@@ -384,8 +472,96 @@ struct interface {
 
 } interface[2];
 
+/*
+ * --rx-threads. RX rings (netmap) or queues (AF_XDP) of an interface are
+ * distributed over RX threads. the interface sequence is checked by shard 0,
+ * and the sequence of a flow by shard (flowid % opt_rxthreads). sequences
+ * are passed to the owner through seqring.
+ * interface sequences of each shard are in order. shard 0 merges them in
+ * order, taking the next one only when all shards have passed theirs,
+ * unless a shard is idle or another one has too many pending.
+ * statistics are counted per shard and merged by rxshard_merge().
+ */
+#define RXSHARD_MAX		16
+#define RXSHARD_RINGSIZE	8192	/* sequences in flight to an owner */
+#define RXSHARD_DRAIN		256	/* sequences checked at once by an owner */
+#define RXSHARD_HOLD		(RXSHARD_RINGSIZE / 2)	/* max pending to merge */
+#define RXSHARD_IDLE		64	/* drains a shard may be empty to merge */
+static unsigned int opt_rxthreads = 1;
+
+#ifndef XDP_PROG
+#define XDP_PROG	"af_xdp_kern.o"
+#endif
+static const char *opt_xdp_prog = XDP_PROG;	/* AF_XDP only */
+static int opt_xdp_count = 0;
+#ifdef USE_AF_XDP
+static unsigned int opt_xdp_rx_batch = AX_RX_BATCH;
+#endif
+
+struct rxshard {
+	int ifno;
+	unsigned int id;
+	pthread_t thread;
+#ifdef USE_NETMAP
+	struct nm_desc **nm_desc;	/* RX rings of this thread */
+	unsigned int nnm_desc;
+#elif defined(USE_AF_XDP)
+	struct ax_desc *ax_desc;	/* RX queue <id> */
+	int rxts;			/* XDP program gives RX timestamp */
+	uint64_t rxts_kernel;		/* frames timestamped by the driver */
+#endif
+	struct interface_statistics *stats;	/* &interface[].stats if single */
+	struct interface_statistics shardstats;
+	struct stream_statistics *sstats;	/* per stream. NULL if single */
+	struct sequencechecker *seqchecker_flowtotal;	/* parent of own flows */
+	struct seqring *inq[RXSHARD_MAX];	/* per flow sequences from shard i */
+	struct seqring *ifq[RXSHARD_MAX];	/* interface sequences. shard 0 only */
+	unsigned int ifq_idle[RXSHARD_MAX];	/* drains ifq[i] was empty in a row */
+} rxshard[2][RXSHARD_MAX];
+
+/* per flow work. chunks are never moved nor freed while threads are running */
+#define PERFLOW_SEQUENCE_TX(iface, flowid)	\
+	((iface)->sequence_tx_perflow[(flowid) / PERFLOW_CHUNK][(flowid) % PERFLOW_CHUNK])
+#define PERFLOW_SEQCHECKER(iface, flowid)	\
+	((iface)->seqchecker_perflow[(flowid) / PERFLOW_CHUNK][(flowid) % PERFLOW_CHUNK])
+
+/*
+ * quiescent state of TX and RX threads for flow update.
+ * threads hold no reference to interface[].adrlist and flowtable
+ * at the top of their loops.
+ */
+#define FLOWQS_TX(ifno)		(ifno)
+#define FLOWQS_RX(ifno, shard)	(2 + (ifno) * RXSHARD_MAX + (shard))
+#define FLOWQS_NTHREAD		(2 + 2 * RXSHARD_MAX)
+static struct {
+	volatile int active;
+	volatile unsigned long count;
+} flowqs[FLOWQS_NTHREAD];
+
+static inline void
+flowqs_quiescent(int id)
+{
+	__atomic_store_n(&flowqs[id].count, flowqs[id].count + 1, __ATOMIC_RELEASE);
+}
+
+/* replaced flows waiting for the threads. accessed only by control thread */
+struct flowretire {
+	struct flowretire *next;
+	struct addresslist *adrlist[2];
+	struct flowtable *flowtable[2];
+	struct flowindex *flowindex[2];
+	struct flowdist *flowdist[2];
+	unsigned long qs[FLOWQS_NTHREAD];
+};
+static struct flowretire *flowretire_list;
+
 static char pktbuffer_ipv4[2][2][LIBPKT_PKTBUFSIZE] __attribute__((__aligned__(8)));
 static char pktbuffer_ipv6[2][2][LIBPKT_PKTBUFSIZE] __attribute__((__aligned__(8)));
+static char pktbuffer_template[LIBPKT_PKTBUFSIZE] __attribute__((__aligned__(8)));
+/* [ipv6][proto][ifno]. encapsulation and the above templates */
+static char pktbuffer_encap[2][2][2][LIBPKT_PKTBUFSIZE] __attribute__((__aligned__(8)));
+#define RX_BATCH	32	/* frames classified at once by receive_batch() */
+
 #define PKTBUF_UDP	0
 #define PKTBUF_TCP	1
 
@@ -402,14 +578,13 @@ struct ifflag {
 	{"mce",	LINKSPEED_100GBPS},
 };
 
-struct timespec currenttime_tx;
 struct timespec currenttime_main;
 struct timespec starttime_tx;
 sigset_t used_sigset;
 
 static unsigned int build_template_packet_ipv4(int, char *);
 static unsigned int build_template_packet_ipv6(int, char *);
-static void touchup_tx_packet(char *, int);
+static unsigned int touchup_tx_packet(char *, int, unsigned int, struct stream *);
 static int packet_generator(char *, int);
 #ifdef __linux__
 static int getdrvname(const char *, char *);
@@ -431,8 +606,8 @@ static void ndp_handler(int, char *, int);
 #ifdef SUPPORT_PPPOE
 static int pppoe_handler(int, char *);
 #endif
-static void receive_packet(int, struct timespec *, char *, uint16_t);
-static void interface_receive(int);
+static void receive_packet(struct rxshard *, uint64_t, char *, uint16_t);
+static void interface_receive(struct rxshard *);
 static int interface_transmit(int);
 static void *tx_thread_main(void *);
 static void *rx_thread_main(void *);
@@ -444,7 +619,21 @@ static void rfc2544_test(void);
 static void control_init_items(struct itemlist *);
 static void *control_thread_main(void *);
 static void gentest_main(void);
-static void generate_addrlists(void);
+static int txpath_test_main(void);
+static void build_template_packets(void);
+static void flowlist_compile_main(void);
+static void rss_generate_main(void);
+static int generate_addrlists(struct addresslist *[2]);
+static int interface_alloc_perflow(int, unsigned int);
+static int randfield_setdefault(void);
+static struct addresslist *flow_addresslist_new(void);
+static int flow_addresslist_build(struct addresslist *);
+static int flow_flowtable_new(int, struct addresslist *, struct flowtable **);
+static int flow_flowtable_load(int, const char *, struct flowtable **);
+static int flow_flowindex_new(struct flowtable *, struct flowindex **);
+static int flowcheck_packet(const struct flowindex *, int, const char *, int, uint32_t);
+static void flow_reclaim(void);
+static int flowlist_read(const char *, struct addresslist *[2]);
 
 
 static unsigned int
@@ -487,6 +676,43 @@ build_template_packet_ipv6(int ifno, char *pkt)
 	return interface[ifno].pktsize;
 }
 
+/*
+ * packets of the both directions, to be copied and modified per packet.
+ * encapsulated ones are built from the IPv4 and IPv6 packets.
+ */
+static void
+build_template_packets(void)
+{
+	struct encap *e;
+	int i, j;
+
+	for (i = 0; i < 2; i++) {
+		ip4pkt_udp_template(pktbuffer_ipv4[PKTBUF_UDP][i], 1500 + ETHHDRSIZE);
+		build_template_packet_ipv4(i, pktbuffer_ipv4[PKTBUF_UDP][i]);
+		ip4pkt_tcp_template(pktbuffer_ipv4[PKTBUF_TCP][i], 1500 + ETHHDRSIZE);
+		build_template_packet_ipv4(i, pktbuffer_ipv4[PKTBUF_TCP][i]);
+		ip6pkt_udp_template(pktbuffer_ipv6[PKTBUF_UDP][i], 1500 + ETHHDRSIZE);
+		build_template_packet_ipv6(i, pktbuffer_ipv6[PKTBUF_UDP][i]);
+		ip6pkt_tcp_template(pktbuffer_ipv6[PKTBUF_TCP][i], 1500 + ETHHDRSIZE);
+		build_template_packet_ipv6(i, pktbuffer_ipv6[PKTBUF_TCP][i]);
+	}
+	for (i = 0; i < 2; i++) {
+		if ((e = interface[i].encap) == NULL)
+			continue;
+		if (encap_build(e, (uint8_t *)pktbuffer_ipv4[PKTBUF_UDP][i], interface[i].vlan_id,
+		    interface[i].ipaddr) != 0) {
+			fprintf(stderr, "--encap %s: too long encapsulation\n", e->spec);
+			exit(1);
+		}
+		for (j = 0; j < 2; j++) {
+			memcpy(pktbuffer_encap[0][j][i], e->hdr[0], e->len);
+			memcpy(pktbuffer_encap[0][j][i] + e->len, pktbuffer_ipv4[j][i] + ETHHDRSIZE, 1500);
+			memcpy(pktbuffer_encap[1][j][i], e->hdr[1], e->len);
+			memcpy(pktbuffer_encap[1][j][i] + e->len, pktbuffer_ipv6[j][i] + ETHHDRSIZE, 1500);
+		}
+	}
+}
+
 inline static int
 in_range(int num, int begin, int end)
 {
@@ -497,18 +723,20 @@ in_range(int num, int begin, int end)
 	return 1;
 }
 
-static inline u_int
-get_flowid_max(int ifno)
-{
-	return addresslist_get_tuplenum(interface[ifno].adrlist) - 1;
-}
-
 static inline int
 get_flownum(int ifno)
 {
+	if (interface[ifno].flowtable != NULL)
+		return interface[ifno].flowtable->nflow;
 	return addresslist_get_tuplenum(interface[ifno].adrlist);
 }
 
+static inline u_int
+get_flowid_max(int ifno)
+{
+	return get_flownum(ifno) - 1;
+}
+
 /* dstbuf must be 4 bytes larger than the size of srcbuf  */
 static void
 pktcpy_vlan(char *dstbuf, char *srcbuf, unsigned int pktsize, int vlan)
@@ -525,6 +753,20 @@ pktcpy_vlan(char *dstbuf, char *srcbuf, unsigned int pktsize, int vlan)
 	memcpy(dstbuf + 12 + 4, srcbuf + 12, pktsize - 12);
 }
 
+/* dstbuf must be 4 * ntag bytes larger than the size of srcbuf  */
+static inline void
+pktcpy_l2tag(char *dstbuf, const char *srcbuf, unsigned int pktsize, const uint32_t *tag, unsigned int ntag)
+{
+	/* copy src/dst mac */
+	memcpy(dstbuf, srcbuf, ETHER_ADDR_LEN * 2);
+
+	/* prebuilt tags of the flow */
+	memcpy(dstbuf + ETHER_ADDR_LEN * 2, tag, ntag * 4);
+
+	/* copy original ethertype, and L2 payload */
+	memcpy(dstbuf + ETHER_ADDR_LEN * 2 + ntag * 4, srcbuf + ETHER_ADDR_LEN * 2, pktsize - ETHER_ADDR_LEN * 2);
+}
+
 #ifdef SUPPORT_PPPOE
 /* dstbuf must be 8 bytes larger than the size of srcbuf  */
 static void
@@ -547,20 +789,119 @@ pktcpy_pppoe(char *dstbuf, char *srcbuf, unsigned int pktsize, uint16_t session,
 }
 #endif
 
+/*
+ * choose the next flowid in flowtable by --flowdist.
+ * alias table is built by control thread, and replaced with flows.
+ */
+static inline uint32_t
+interface_next_flowid(struct interface *iface, struct flowtable *ft)
+{
+	struct flowdist *fd;
+	uint32_t flowid, nflow;
+
+	nflow = MIN(opt_nflow, ft->nflow);
+	fd = __atomic_load_n(&iface->flowdist, __ATOMIC_ACQUIRE);
+	if (fd != NULL) {
+		flowid = flowdist_select(fd, prng_next(&iface->prng));
+		/* the table may be for the next flows while being replaced */
+		if (flowid < nflow)
+			return flowid;
+	}
+
+	flowid = iface->flowcur;
+	if (flowid >= nflow)
+		flowid = 0;
+	iface->flowcur = flowid + 1;
+	return flowid;
+}
+
+/*
+ * store sequence number, and remember relational info.
+ * stateid is flowtable_stateid() of the flow, or UINT32_MAX if it has
+ * no per flow sequence.
+ */
+static void
+tx_sequence_prep(int ifno, uint32_t stateid, struct stream *stream, struct seqdata *seqdata)
+{
+	struct interface *iface = &interface[ifno];
+	struct sequence_record *seqrecord;
+
+	seqrecord = seqtable_prep(interface[ifno ^ 1].seqtable);
+	seqdata->magic = seq_magic;
+	seqdata->seq = seqrecord->seq;
+	seqrecord->flowid = stateid;
+	seqrecord->streamid = (stream != NULL) ? stream->id : 0;
+	if (stateid < __atomic_load_n(&iface->nperflow, __ATOMIC_ACQUIRE))
+		seqrecord->flowseq = PERFLOW_SEQUENCE_TX(iface, stateid)++;
+	else
+		seqrecord->flowseq = 0;
+	seqrecord->ts = tsc_read();
+}
+
+/*
+ * --template. header stack of the template is modified by its modifiers,
+ * instead of flow addresses and ports of UDP/TCP packet.
+ */
 static void
-touchup_tx_packet(char *buf, int ifno)
+touchup_template_packet(char *buf, int ifno, unsigned int l3offset, uint32_t stateid,
+    const struct pkttemplate_flow *flow, const struct ether_addr *seaddr, const struct ether_addr *deaddr,
+    const uint32_t *l2tag, unsigned int nl2tag)
+{
+	struct interface *iface = &interface[ifno];
+	struct pkttemplate *tmpl = iface->pkttemplate;
+	struct seqdata seqdata;
+
+	if (iface->encap != NULL) {
+		memcpy(buf, pktbuffer_template, iface->encap->len + tmpl->len);
+	} else if (nl2tag != 0) {
+		pktcpy_l2tag(buf, pktbuffer_template, tmpl->len + ETHHDRSIZE, l2tag, nl2tag);
+	} else if (iface->vlan_id) {
+		pktcpy_vlan(buf, pktbuffer_template, tmpl->len + ETHHDRSIZE, iface->vlan_id);
+#ifdef SUPPORT_PPPOE
+	} else if (iface->pppoe) {
+		pktcpy_pppoe(buf, pktbuffer_template, tmpl->len + ETHHDRSIZE, iface->pppoe_sc.session,
+		    (tmpl->af == AF_INET6) ? PPP_IPV6 : PPP_IP);
+#endif
+	} else {
+		memcpy(buf, pktbuffer_template, tmpl->len + ETHHDRSIZE);
+	}
+
+	if (iface->gw_l2random)
+		ethpkt_dst(buf, (const u_char *)deaddr->octet);
+	if (interface[ifno ^ 1].gw_l2random)
+		ethpkt_src(buf, (const u_char *)seaddr->octet);
+
+	tx_sequence_prep(ifno, stateid, NULL, &seqdata);
+	pkttemplate_apply(tmpl, buf + l3offset, &iface->prng, flow, &seqdata);
+	if (iface->encap != NULL)
+		encap_finish(iface->encap, buf, tmpl->len, tmpl->af == AF_INET6, 0);
+}
+
+/*
+ * build the packet to be transmitted into buf, and return its l3 offset.
+ */
+static unsigned int
+touchup_tx_packet(char *buf, int ifno, unsigned int pktsize, struct stream *stream)
 {
 	struct interface *iface = &interface[ifno];
 	struct interface *iface_other = &interface[ifno ^ 1];
-	static unsigned int id;
 	struct seqdata seqdata;
-	uint32_t flowid;
+	uint32_t flowid, stateid;
 	const struct address_tuple *tuple;
-	int ipv6;
-	unsigned int l3offset, l4payloadsize;
-	struct sequence_record *seqrecord;
-
-	if (iface->vlan_id) {
+	struct addresslist *adrlist;
+	struct flowtable *ft;
+	uint32_t saddr4, daddr4;
+	const struct in6_addr *saddr6, *daddr6;
+	uint16_t sport, dport;
+	const struct ether_addr *seaddr, *deaddr;
+	const uint32_t *l2tag;
+	uint32_t lazytag[2];
+	int ipv6, tcp;
+	unsigned int l3offset, l4payloadsize, nl2tag;
+
+	if (iface->encap != NULL) {
+		l3offset = iface->encap->len;
+	} else if (iface->vlan_id) {
 		l3offset = sizeof(struct ether_vlan_header);
 #ifdef SUPPORT_PPPOE
 	} else if (iface->pppoe) {
@@ -578,113 +919,509 @@ touchup_tx_packet(char *buf, int ifno)
 		ip4pkt_dst(buf, l3offset, x);
 		ip4pkt_srcport(buf, l3offset, x);
 		ip4pkt_dstport(buf, l3offset, x);
-		ip4pkt_length(buf, l3offset, iface->pktsize);
+		ip4pkt_length(buf, l3offset, pktsize);
 
 	} else {
-		flowid = addresslist_get_current_tupleid(iface->adrlist);
-		if (flowid >= opt_nflow) {
-			addresslist_set_current_tupleid(iface->adrlist, 0);
-			flowid = 0;
+		tcp = (stream != NULL) ? (stream->proto == IPPROTO_TCP) : !opt_udp;
+		if ((stream != NULL) && (stream->flowtable != NULL)) {
+			ft = stream->flowtable;
+			flowid = stream->flowcur;
+			if (flowid >= ft->nflow)
+				flowid = 0;
+			stream->flowcur = flowid + 1;
+			/* flows of a stream have no per flow sequence */
+			stateid = UINT32_MAX;
+		} else if ((ft = __atomic_load_n(&iface->flowtable, __ATOMIC_ACQUIRE)) != NULL) {
+			flowid = interface_next_flowid(iface, ft);
+			stateid = flowtable_stateid(ft, flowid);
+		}
+
+		if (ft != NULL) {
+			ipv6 = (flowtable_af(ft, flowid) == AF_INET6);
+			/* the other family is cleared for pkttemplate_flow */
+			if (ipv6) {
+				saddr6 = &ft->saddr6[flowid];
+				daddr6 = &ft->daddr6[flowid];
+				saddr4 = daddr4 = 0;
+			} else {
+				saddr4 = ft->saddr4[flowid];
+				daddr4 = ft->daddr4[flowid];
+				saddr6 = daddr6 = NULL;
+			}
+			sport = ft->sport[flowid];
+			dport = ft->dport[flowid];
+			if (ft->seaddr != NULL) {
+				seaddr = &ft->seaddr[flowid];
+				deaddr = &ft->deaddr[flowid];
+			} else {
+				seaddr = deaddr = NULL;
+			}
+			nl2tag = ft->nl2tag;
+			l2tag = (nl2tag != 0) ? &ft->l2tag[flowid * nl2tag] : NULL;
+		} else {
+			/* lazy addresslist */
+			adrlist = __atomic_load_n(&iface->adrlist, __ATOMIC_ACQUIRE);
+			flowid = addresslist_get_current_tupleid(adrlist);
+			if (flowid >= opt_nflow) {
+				addresslist_set_current_tupleid(adrlist, 0);
+				flowid = 0;
+			}
+			stateid = flowid;
+			tuple = addresslist_get_current_tuple(adrlist);
+			addresslist_get_tuple_next(adrlist);
+
+			ipv6 = (tuple->saddr.af == AF_INET6);
+			saddr4 = tuple->saddr.a.addr4.s_addr;
+			daddr4 = tuple->daddr.a.addr4.s_addr;
+			saddr6 = &tuple->saddr.a.addr6;
+			daddr6 = &tuple->daddr.a.addr6;
+			sport = tuple->sport;
+			dport = tuple->dport;
+			seaddr = &tuple->seaddr;
+			deaddr = &tuple->deaddr;
+
+			nl2tag = 0;
+			if (tuple->svlan != 0)
+				lazytag[nl2tag++] = htonl(((uint32_t)ENCAP_ETHERTYPE_QINQ << 16) | tuple->svlan);
+			if (tuple->cvlan != 0)
+				lazytag[nl2tag++] = htonl(((uint32_t)ETHERTYPE_VLAN << 16) | tuple->cvlan);
+			l2tag = lazytag;
+		}
+		/* per flow VLAN replaces -V */
+		if (nl2tag != 0)
+			l3offset = ETHHDRSIZE + nl2tag * 4;
+
+		if (iface->pkttemplate != NULL) {
+			struct pkttemplate_flow flow = {
+				.af = ipv6 ? AF_INET6 : AF_INET,
+				.saddr4 = saddr4, .daddr4 = daddr4,
+				.saddr6 = saddr6, .daddr6 = daddr6,
+				.sport = sport, .dport = dport,
+			};
+			touchup_template_packet(buf, ifno, l3offset, stateid, &flow, seaddr, deaddr, l2tag, nl2tag);
+			return l3offset;
 		}
-		tuple = addresslist_get_current_tuple(iface->adrlist);
-		addresslist_get_tuple_next(iface->adrlist);
 
-		if (tuple->saddr.af == AF_INET) {
-			int proto = opt_udp ? PKTBUF_UDP : PKTBUF_TCP;
-			if (iface->vlan_id) {
-				pktcpy_vlan(buf, pktbuffer_ipv4[proto][ifno], iface->pktsize + ETHHDRSIZE, iface->vlan_id);
+		if (!ipv6) {
+			int proto = tcp ? PKTBUF_TCP : PKTBUF_UDP;
+			if (iface->encap != NULL) {
+				memcpy(buf, pktbuffer_encap[0][proto][ifno], l3offset + pktsize);
+			} else if (nl2tag != 0) {
+				pktcpy_l2tag(buf, pktbuffer_ipv4[proto][ifno], pktsize + ETHHDRSIZE, l2tag, nl2tag);
+			} else if (iface->vlan_id) {
+				pktcpy_vlan(buf, pktbuffer_ipv4[proto][ifno], pktsize + ETHHDRSIZE, iface->vlan_id);
 #ifdef SUPPORT_PPPOE
 			} else if (iface->pppoe) {
-				pktcpy_pppoe(buf, pktbuffer_ipv4[proto][ifno], iface->pktsize + ETHHDRSIZE, iface->pppoe_sc.session, PPP_IP);
+				pktcpy_pppoe(buf, pktbuffer_ipv4[proto][ifno], pktsize + ETHHDRSIZE, iface->pppoe_sc.session, PPP_IP);
 #endif
 			} else {
-				memcpy(buf, pktbuffer_ipv4[proto][ifno], iface->pktsize + ETHHDRSIZE);
+				memcpy(buf, pktbuffer_ipv4[proto][ifno], pktsize + ETHHDRSIZE);
 			}
 
-			ip4pkt_src(buf, l3offset, tuple->saddr.a.addr4.s_addr);
-			ip4pkt_dst(buf, l3offset, tuple->daddr.a.addr4.s_addr);
-			ip4pkt_srcport(buf, l3offset, tuple->sport);
-			ip4pkt_dstport(buf, l3offset, tuple->dport);
+			ip4pkt_src(buf, l3offset, saddr4);
+			ip4pkt_dst(buf, l3offset, daddr4);
+			ip4pkt_srcport(buf, l3offset, sport);
+			ip4pkt_dstport(buf, l3offset, dport);
 
-			ip4pkt_length(buf, l3offset, iface->pktsize);
-			ip4pkt_id(buf, l3offset, id++);
+			ip4pkt_length(buf, l3offset, pktsize);
+			ip4pkt_id(buf, l3offset, tx_ipid++);
 			if (opt_fragment)
 				ip4pkt_off(buf, l3offset, 1200 | IP_MF);
-
-			ipv6 = 0;
 		} else {
-			int proto = opt_udp ? PKTBUF_UDP : PKTBUF_TCP;
-			if (iface->vlan_id) {
-				pktcpy_vlan(buf, pktbuffer_ipv6[proto][ifno], iface->pktsize + ETHHDRSIZE, iface->vlan_id);
+			int proto = tcp ? PKTBUF_TCP : PKTBUF_UDP;
+			if (iface->encap != NULL) {
+				memcpy(buf, pktbuffer_encap[1][proto][ifno], l3offset + pktsize);
+			} else if (nl2tag != 0) {
+				pktcpy_l2tag(buf, pktbuffer_ipv6[proto][ifno], pktsize + ETHHDRSIZE, l2tag, nl2tag);
+			} else if (iface->vlan_id) {
+				pktcpy_vlan(buf, pktbuffer_ipv6[proto][ifno], pktsize + ETHHDRSIZE, iface->vlan_id);
 #ifdef SUPPORT_PPPOE
 			} else if (iface->pppoe) {
-				pktcpy_pppoe(buf, pktbuffer_ipv6[proto][ifno], iface->pktsize + ETHHDRSIZE, iface->pppoe_sc.session, PPP_IPV6);
+				pktcpy_pppoe(buf, pktbuffer_ipv6[proto][ifno], pktsize + ETHHDRSIZE, iface->pppoe_sc.session, PPP_IPV6);
 #endif
 			} else {
-				memcpy(buf, pktbuffer_ipv6[proto][ifno], iface->pktsize + ETHHDRSIZE);
+				memcpy(buf, pktbuffer_ipv6[proto][ifno], pktsize + ETHHDRSIZE);
 			}
 
-			ip6pkt_src(buf, l3offset, &tuple->saddr.a.addr6);
-			ip6pkt_dst(buf, l3offset, &tuple->daddr.a.addr6);
-			ip6pkt_srcport(buf, l3offset, tuple->sport);
-			ip6pkt_dstport(buf, l3offset, tuple->dport);
+			ip6pkt_src(buf, l3offset, saddr6);
+			ip6pkt_dst(buf, l3offset, daddr6);
+			ip6pkt_srcport(buf, l3offset, sport);
+			ip6pkt_dstport(buf, l3offset, dport);
 
-			ip6pkt_length(buf, l3offset, iface->pktsize);
+			ip6pkt_length(buf, l3offset, pktsize);
+		}
 
-			ipv6 = 1;
+		if ((stream != NULL) && (stream->dscp >= 0)) {
+			if (ipv6)
+				ip6pkt_tclass(buf, l3offset, stream->dscp << 2);
+			else
+				ip4pkt_tos(buf, l3offset, stream->dscp << 2);
 		}
 
+		if (opt_random.enable)
+			randfield_apply(&opt_random, &iface->prng, buf, l3offset, ipv6, ifno == 0);
+
 		if (iface->gw_l2random)
-			ethpkt_dst(buf, (const u_char *)tuple->deaddr.octet);
+			ethpkt_dst(buf, (const u_char *)deaddr->octet);
 		if (iface_other->gw_l2random)
-			ethpkt_src(buf, (const u_char *)tuple->seaddr.octet);
+			ethpkt_src(buf, (const u_char *)seaddr->octet);
 
 		if (ipv6)
-			l4payloadsize = iface->pktsize - sizeof(struct ip6_hdr);
-		else
-			l4payloadsize = iface->pktsize - sizeof(struct ip);
-		if (opt_udp)
-			l4payloadsize -= sizeof(struct udphdr);
+			l4payloadsize = pktsize - sizeof(struct ip6_hdr);
 		else
+			l4payloadsize = pktsize - sizeof(struct ip);
+		if (tcp)
 			l4payloadsize -= sizeof(struct tcphdr);
+		else
+			l4payloadsize -= sizeof(struct udphdr);
 
-		/* store sequence number, and remember relational info */
-		seqrecord = seqtable_prep(iface_other->seqtable);
-		seqdata.magic = seq_magic;
-		seqdata.seq = seqrecord->seq;
-		seqrecord->flowid = flowid;
-		seqrecord->flowseq = iface->sequence_tx_perflow[flowid]++;
-		seqrecord->ts = currenttime_tx;
-
+		tx_sequence_prep(ifno, stateid, stream, &seqdata);
 		if (ipv6)
 			ip6pkt_writedata(buf, l3offset, l4payloadsize - sizeof(seqdata), (char *)&seqdata, sizeof(seqdata));
 		else
 			ip4pkt_writedata(buf, l3offset, l4payloadsize - sizeof(seqdata), (char *)&seqdata, sizeof(seqdata));
+
+		if (iface->encap != NULL)
+			encap_finish(iface->encap, buf, pktsize, ipv6, 1);
+	}
+
+	return l3offset;
+}
+
+/*
+ * specialized TX paths.
+ * touchup_tx_packet() handles every configuration, and branches on it per
+ * packet. txpath_body() is expanded for each combination of address family,
+ * L4 protocol, L2 encapsulation and L2 randomization as constants, so that
+ * the compiler can drop the branches and fold the header offsets. headers
+ * are written directly, and checksums are updated once per packet.
+ * interface_txpath_select() picks one when the flow table is replaced.
+ * streams, lazy flows, mixed address family, --template, --random,
+ * --fragment, -D and -X use touchup_tx_packet().
+ */
+#define TXPATH_L2_ETHER		0
+#define TXPATH_L2_VLAN		1	/* -V */
+#define TXPATH_L2_FLOWVLAN	2	/* per flow VLAN */
+#define TXPATH_L2_FLOWQINQ	3	/* per flow QinQ */
+#define TXPATH_L2_PPPOE		4
+#define TXPATH_L2_ENCAP		5
+#define TXPATH_L2_NUM		6
+
+#define TXPATH_L2RANDOM_DST	1	/* gw_l2random of TX interface */
+#define TXPATH_L2RANDOM_SRC	2	/* gw_l2random of the other interface */
+
+/* one's complement sum to replace old 16bit or 32bit word with new (RFC 1624) */
+static inline uint32_t
+csum_replace16(uint32_t sum, uint16_t old, uint16_t new)
+{
+	return sum + (uint16_t)~old + new;
+}
+
+static inline uint32_t
+csum_replace32(uint32_t sum, uint32_t old, uint32_t new)
+{
+	return sum + (uint16_t)~old + (uint16_t)~(old >> 16) +
+	    (uint16_t)new + (uint16_t)(new >> 16);
+}
+
+static inline uint16_t
+csum_fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+	return sum;
+}
+
+static inline __attribute__((__always_inline__)) int
+txpath_body(char *buf, int ifno, unsigned int pktsize, struct flowtable *ft,
+    const int ipv6, const int tcp, const int l2, const int l2random)
+{
+	struct interface *iface = &interface[ifno];
+	struct seqdata seqdata;
+	uint32_t flowid, sum, dsum;
+	uint16_t *l4sum, *l4port, l4len, oldlen, o, n;
+	unsigned int l3offset, l3hlen, i;
+	char *src, *l3, *datap;
+
+	flowid = interface_next_flowid(iface, ft);
+
+	if (ipv6)
+		src = pktbuffer_ipv6[tcp ? PKTBUF_TCP : PKTBUF_UDP][ifno];
+	else
+		src = pktbuffer_ipv4[tcp ? PKTBUF_TCP : PKTBUF_UDP][ifno];
+	switch (l2) {
+	case TXPATH_L2_VLAN:
+		l3offset = sizeof(struct ether_vlan_header);
+		pktcpy_vlan(buf, src, pktsize + ETHHDRSIZE, iface->vlan_id);
+		break;
+	case TXPATH_L2_FLOWVLAN:
+		l3offset = ETHHDRSIZE + 4;
+		pktcpy_l2tag(buf, src, pktsize + ETHHDRSIZE, &ft->l2tag[flowid], 1);
+		break;
+	case TXPATH_L2_FLOWQINQ:
+		l3offset = ETHHDRSIZE + 8;
+		pktcpy_l2tag(buf, src, pktsize + ETHHDRSIZE, &ft->l2tag[flowid * 2], 2);
+		break;
+#ifdef SUPPORT_PPPOE
+	case TXPATH_L2_PPPOE:
+		l3offset = sizeof(struct pppoe_l2) + 2;
+		pktcpy_pppoe(buf, src, pktsize + ETHHDRSIZE, iface->pppoe_sc.session, ipv6 ? PPP_IPV6 : PPP_IP);
+		break;
+#endif
+	case TXPATH_L2_ENCAP:
+		l3offset = iface->encap->len;
+		memcpy(buf, pktbuffer_encap[ipv6][tcp ? PKTBUF_TCP : PKTBUF_UDP][ifno], l3offset + pktsize);
+		break;
+	default:
+		l3offset = ETHHDRSIZE;
+		memcpy(buf, src, pktsize + ETHHDRSIZE);
+		break;
+	}
+
+	l3 = buf + l3offset;
+	l3hlen = ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct ip);
+	if (tcp) {
+		struct tcphdr *th = (struct tcphdr *)(l3 + l3hlen);
+		l4sum = &th->th_sum;
+		l4port = &th->th_sport;
+	} else {
+		struct udphdr *uh = (struct udphdr *)(l3 + l3hlen);
+		l4sum = &uh->uh_sum;
+		l4port = &uh->uh_sport;
+	}
+	l4len = htons(pktsize - l3hlen);
+
+	/* addresses and length. pseudo header of L4 is updated together */
+	sum = (uint16_t)~*l4sum;
+	if (ipv6) {
+		struct ip6_hdr *ip6 = (struct ip6_hdr *)l3;
+		const uint32_t *s = (const uint32_t *)&ft->saddr6[flowid];
+		const uint32_t *d = (const uint32_t *)&ft->daddr6[flowid];
+		const uint32_t *os = (const uint32_t *)&ip6->ip6_src;
+		const uint32_t *od = (const uint32_t *)&ip6->ip6_dst;
+
+		for (i = 0; i < 4; i++) {
+			sum = csum_replace32(sum, os[i], s[i]);
+			sum = csum_replace32(sum, od[i], d[i]);
+		}
+		ip6->ip6_src = ft->saddr6[flowid];
+		ip6->ip6_dst = ft->daddr6[flowid];
+		oldlen = ip6->ip6_plen;
+		ip6->ip6_plen = l4len;
+	} else {
+		struct ip *ip = (struct ip *)l3;
+		uint32_t ipsum;
+		uint16_t id;
+
+		id = htons(tx_ipid++);
+		ipsum = (uint16_t)~ip->ip_sum;
+		ipsum = csum_replace32(ipsum, ip->ip_src.s_addr, ft->saddr4[flowid]);
+		ipsum = csum_replace32(ipsum, ip->ip_dst.s_addr, ft->daddr4[flowid]);
+		ipsum = csum_replace16(ipsum, ip->ip_len, htons(pktsize));
+		ipsum = csum_replace16(ipsum, ip->ip_id, id);
+		sum = csum_replace32(sum, ip->ip_src.s_addr, ft->saddr4[flowid]);
+		sum = csum_replace32(sum, ip->ip_dst.s_addr, ft->daddr4[flowid]);
+		oldlen = htons(ntohs(ip->ip_len) - sizeof(struct ip));
+
+		ip->ip_src.s_addr = ft->saddr4[flowid];
+		ip->ip_dst.s_addr = ft->daddr4[flowid];
+		ip->ip_len = htons(pktsize);
+		ip->ip_id = id;
+		ip->ip_sum = ~csum_fold(ipsum);
 	}
+	sum = csum_replace16(sum, oldlen, l4len);
+	if (!tcp) {
+		struct udphdr *uh = (struct udphdr *)(l3 + l3hlen);
+		sum = csum_replace16(sum, uh->uh_ulen, l4len);
+		uh->uh_ulen = l4len;
+	}
+
+	/* ports */
+	sum = csum_replace16(sum, l4port[0], htons(ft->sport[flowid]));
+	sum = csum_replace16(sum, l4port[1], htons(ft->dport[flowid]));
+	l4port[0] = htons(ft->sport[flowid]);
+	l4port[1] = htons(ft->dport[flowid]);
+
+	/* sequence at the tail. odd offset from L4 header swaps bytes of the sum */
+	tx_sequence_prep(ifno, flowtable_stateid(ft, flowid), NULL, &seqdata);
+	datap = l3 + pktsize - sizeof(seqdata);
+	dsum = 0;
+	for (i = 0; i < sizeof(seqdata); i += 2) {
+		memcpy(&o, datap + i, sizeof(o));
+		memcpy(&n, (char *)&seqdata + i, sizeof(n));
+		dsum = csum_replace16(dsum, o, n);
+	}
+	memcpy(datap, &seqdata, sizeof(seqdata));
+	if (pktsize & 1) {
+		dsum = csum_fold(dsum);
+		dsum = ((dsum & 0xff) << 8) | (dsum >> 8);
+	}
+	*l4sum = ~csum_fold(sum + dsum);
+	if (!tcp && (*l4sum == 0))
+		*l4sum = 0xffff;
+
+	if (l2random & TXPATH_L2RANDOM_DST)
+		memcpy(buf, &ft->deaddr[flowid], ETHER_ADDR_LEN);
+	if (l2random & TXPATH_L2RANDOM_SRC)
+		memcpy(buf + ETHER_ADDR_LEN, &ft->seaddr[flowid], ETHER_ADDR_LEN);
+
+	if (l2 == TXPATH_L2_ENCAP)
+		encap_finish(iface->encap, buf, pktsize, ipv6, 1);
+
+	return pktsize + l3offset - ETHHDRSIZE;
+}
+
+#define TXPATH_DEFINE(v6, tcp, l2, l2r)						\
+static int									\
+txpath_##v6##tcp##l2##l2r(char *buf, int ifno, unsigned int pktsize,		\
+    struct flowtable *ft)							\
+{										\
+	return txpath_body(buf, ifno, pktsize, ft, v6, tcp, l2, l2r);		\
+}
+#define TXPATH_DEFINE_L2RANDOM(v6, tcp, l2)					\
+	TXPATH_DEFINE(v6, tcp, l2, 0)						\
+	TXPATH_DEFINE(v6, tcp, l2, 1)						\
+	TXPATH_DEFINE(v6, tcp, l2, 2)						\
+	TXPATH_DEFINE(v6, tcp, l2, 3)
+#define TXPATH_DEFINE_L2(v6, tcp)						\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 0)					\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 1)					\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 2)					\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 3)					\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 4)					\
+	TXPATH_DEFINE_L2RANDOM(v6, tcp, 5)
+
+TXPATH_DEFINE_L2(0, 0)
+TXPATH_DEFINE_L2(0, 1)
+TXPATH_DEFINE_L2(1, 0)
+TXPATH_DEFINE_L2(1, 1)
+
+#define TXPATH_ENTRY_L2RANDOM(v6, tcp, l2)					\
+	{ txpath_##v6##tcp##l2##0, txpath_##v6##tcp##l2##1,			\
+	  txpath_##v6##tcp##l2##2, txpath_##v6##tcp##l2##3 }
+#define TXPATH_ENTRY_L2(v6, tcp)						\
+	{ TXPATH_ENTRY_L2RANDOM(v6, tcp, 0), TXPATH_ENTRY_L2RANDOM(v6, tcp, 1),	\
+	  TXPATH_ENTRY_L2RANDOM(v6, tcp, 2), TXPATH_ENTRY_L2RANDOM(v6, tcp, 3),	\
+	  TXPATH_ENTRY_L2RANDOM(v6, tcp, 4), TXPATH_ENTRY_L2RANDOM(v6, tcp, 5) }
+
+/* [ipv6][tcp][TXPATH_L2_*][TXPATH_L2RANDOM_*] */
+static const txpath_t txpath_table[2][2][TXPATH_L2_NUM][4] = {
+	{ TXPATH_ENTRY_L2(0, 0), TXPATH_ENTRY_L2(0, 1) },
+	{ TXPATH_ENTRY_L2(1, 0), TXPATH_ENTRY_L2(1, 1) },
+};
+
+/*
+ * choose specialized TX path for the flow table, or NULL to use
+ * touchup_tx_packet(). called by TX thread.
+ */
+static void
+interface_txpath_select(int ifno, struct flowtable *ft, unsigned int gen)
+{
+	struct interface *iface = &interface[ifno];
+	int l2, l2random;
+
+	iface->txpath = NULL;
+	iface->txpath_ft = ft;
+	iface->txpath_gen = gen;
+
+	/* flows were rebuilt by flow_apply(). start from the first one */
+	if (iface->flowcur_reset_done != __atomic_load_n(&iface->flowcur_reset, __ATOMIC_ACQUIRE)) {
+		iface->flowcur_reset_done = iface->flowcur_reset;
+		iface->flowcur = 0;
+	}
+
+	if ((ft == NULL) || (ft->af == AF_UNSPEC) || opt_gentest || (opt_debug != NULL) ||
+	    opt_fragment || opt_random.enable || (iface->pkttemplate != NULL))
+		return;
+
+	if (iface->encap != NULL)
+		l2 = TXPATH_L2_ENCAP;
+	else if (ft->nl2tag == 2)
+		l2 = TXPATH_L2_FLOWQINQ;
+	else if (ft->nl2tag == 1)
+		l2 = TXPATH_L2_FLOWVLAN;
+	else if (iface->vlan_id)
+		l2 = TXPATH_L2_VLAN;
+#ifdef SUPPORT_PPPOE
+	else if (iface->pppoe)
+		l2 = TXPATH_L2_PPPOE;
+#endif
+	else
+		l2 = TXPATH_L2_ETHER;
+
+	l2random = 0;
+	if (iface->gw_l2random)
+		l2random |= TXPATH_L2RANDOM_DST;
+	if (interface[ifno ^ 1].gw_l2random)
+		l2random |= TXPATH_L2RANDOM_SRC;
+	if ((l2random != 0) && (ft->seaddr == NULL))
+		return;
+
+	iface->txpath = txpath_table[ft->af == AF_INET6][!opt_udp][l2][l2random];
 }
 
 static int
 packet_generator(char *buf, int ifno)
 {
 	struct interface *iface = &interface[ifno];
+	struct stream *stream;
+	struct imix *imix;
+	struct flowtable *ft;
+	unsigned int pktsize, gen;
 	int vlanadj;
 
-	if (iface->vlan_id) {
-		vlanadj = 4;
-#ifdef SUPPORT_PPPOE
-	} else if (iface->pppoe) {
-		vlanadj = 8;
-#endif
+	/* generation first, so that ft is not older than gen */
+	gen = __atomic_load_n(&iface->flowtable_gen, __ATOMIC_ACQUIRE);
+	ft = __atomic_load_n(&iface->flowtable, __ATOMIC_ACQUIRE);
+	if ((ft != iface->txpath_ft) || (gen != iface->txpath_gen))
+		interface_txpath_select(ifno, ft, gen);
+	if ((iface->txpath != NULL) && (iface->streamdue_n == 0)) {
+		if ((imix = iface->imix) != NULL) {
+			pktsize = imix_size(imix, &iface->imixcur);
+			if (pktsize < min_pktsize)
+				pktsize = min_pktsize;
+		} else {
+			pktsize = iface->pktsize;
+		}
+		return iface->txpath(buf, ifno, pktsize, ft);
+	}
+
+	stream = NULL;
+	if (iface->streamdue_n > 0) {
+		stream = iface->streamdue[iface->streamdue_head];
+		iface->streamdue_head = (iface->streamdue_head + 1) % STREAM_DUEMAX;
+		iface->streamdue_n--;
+	}
+
+	if (stream != NULL) {
+		if (stream->imix != NULL)
+			pktsize = imix_size(stream->imix, &stream->imixcur);
+		else
+			pktsize = stream->pktsize;
+		if (pktsize < stream->minsize)
+			pktsize = stream->minsize;
+	} else if ((imix = iface->imix) != NULL) {
+		pktsize = imix_size(imix, &iface->imixcur);
+		if (pktsize < min_pktsize)
+			pktsize = min_pktsize;
 	} else {
-		vlanadj = 0;
+		pktsize = iface->pktsize;
 	}
 
-	touchup_tx_packet(buf, ifno);
+	/* l2 header length may vary by flow */
+	vlanadj = touchup_tx_packet(buf, ifno, pktsize, stream) - ETHHDRSIZE;
+
+	if (stream != NULL) {
+		stream->stats.tx++;
+		stream->stats.tx_byte += pktsize + ETHHDRSIZE + vlanadj + FCS;
+		if (opt_bps_include_preamble)
+			stream->stats.tx_byte += DEFAULT_IFG + DEFAULT_PREAMBLE;
+	}
 
 	if (opt_debug != NULL)
-		tcpdumpfile_output(debug_tcpdump_fd, buf, iface->pktsize + ETHHDRSIZE + vlanadj);
+		tcpdumpfile_output(debug_tcpdump_fd, buf, pktsize + ETHHDRSIZE + vlanadj);
 
-	return iface->pktsize + vlanadj;
+	return pktsize + vlanadj;
 }
 
 int
@@ -1090,17 +1827,53 @@ update_min_pktsize(void)
 	}
 }
 
+/*
+ * sum of the rates of the streams transmitting now. streams are scheduled
+ * relative to the start of transmit, and none of them is running yet
+ * before the tx thread starts the schedule.
+ */
+static double
+stream_active_Mbps(struct interface *iface)
+{
+	uint64_t epoch, elapsed;
+	double mbps;
+	unsigned int i;
+
+	epoch = iface->stream_epoch;
+	elapsed = (epoch == 0) ? 0 : (tsc_read() - epoch) / tsc_hz;
+
+	mbps = 0.0;
+	for (i = 0; i < nstream; i++) {
+		if (elapsed < streams[i].start)
+			continue;
+		if ((streams[i].stop != 0) && (elapsed >= streams[i].stop))
+			continue;
+		mbps += calc_mbps(streams[i].pktsize, streams[i].pps);
+	}
+	return mbps;
+}
+
 static void
 update_transmit_Mbps(int ifno)
 {
 	struct interface *iface = &interface[ifno];
 
-	if (iface->pktsize < min_pktsize)
+	/* rate of mixed sizes is calculated by the average size */
+	if (iface->imix != NULL)
+		iface->pktsize = imix_avgsize(iface->imix, min_pktsize) + 0.5;
+	if (iface->pkttemplate != NULL)
+		iface->pktsize = iface->pkttemplate->len;
+	else if (iface->pktsize < min_pktsize)
 		iface->pktsize = min_pktsize;
 	if (iface->pktsize > 1500)
 		iface->pktsize = 1500;
 
-	if (iface->transmit_enable) {
+	if (iface->transmit_enable && (nstream != 0) && (ifno == 1)) {
+		iface->transmit_Mbps = stream_active_Mbps(iface);
+	} else if (iface->transmit_enable && (opt_train_npkt != 0)) {
+		iface->transmit_Mbps = calc_mbps(iface->pktsize,
+		    MIN(iface->transmit_pps, (uint64_t)opt_train_npkt * 1000000 / opt_train_usec));
+	} else if (iface->transmit_enable) {
 		iface->transmit_Mbps = calc_mbps(iface->pktsize, iface->transmit_pps);
 	} else {
 		iface->transmit_Mbps = 0.0;
@@ -1113,13 +1886,23 @@ setpktsize(int ifno, unsigned int size)
 {
 	if (size < min_pktsize || size > 1500)
 		return -1;
+	if (interface[ifno].pkttemplate != NULL)
+		return -1;
 
+	interface[ifno].imix = NULL;
 	interface[ifno].pktsize = size;
 	update_transmit_Mbps(ifno);
 
 	return 0;
 }
 
+static void
+setimix(int ifno, struct imix *imix)
+{
+	interface[ifno].imix = imix;
+	update_transmit_Mbps(ifno);
+}
+
 unsigned int
 getpktsize(int ifno)
 {
@@ -1298,31 +2081,178 @@ interface_setup(int ifno, const char *ifname)
 	}
 }
 
+#ifdef USE_AF_XDP
+/*
+ * let own XDP program answer ARP, ND and ICMP echo, and pass frames
+ * other than ipgen's to the kernel stack.
+ */
 static void
-interface_open(int ifno)
+interface_xdp_config(int ifno)
 {
 	struct interface *iface = &interface[ifno];
-	struct interface *iface_other = &interface[ifno ^ 1];
-#ifdef USE_NETMAP
-	struct nmreq nmreq;
-	struct netmap_if *nifp;
-	struct netmap_ring *txring, *rxring;
+	struct ax_conf conf;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.flags = AX_CONF_STEER;
+	if (iface->xdpcount != NULL)
+		conf.flags |= AX_CONF_COUNT;
+	conf.seq_magic = seq_magic;
+	memcpy(conf.eaddr, &iface->eaddr, ETHER_ADDR_LEN);
+	conf.ipaddr = iface->ipaddr.s_addr;
+	conf.ipaddr_mask = iface->ipaddr_mask.s_addr;
+	memcpy(conf.ip6addr, &iface->ip6addr, sizeof(conf.ip6addr));
+	memcpy(conf.ip6addr_mask, &iface->ip6addr_mask, sizeof(conf.ip6addr_mask));
+	if (iface->af_gwaddr == AF_INET)
+		conf.gwaddr = iface->gwaddr.s_addr;
+	else if (iface->af_gwaddr == AF_INET6)
+		memcpy(conf.gw6addr, &iface->gw6addr, sizeof(conf.gw6addr));
+
+	if (ax_prog_setconf(iface->ax_prog, &conf) != 0)
+		fprintf(stderr, "%s: all frames are received by ipgen\n", iface->ifname);
+}
 
-	memset(&nmreq, 0, sizeof(nmreq));
-	sprintf(iface->netmapname, "netmap:%s", iface->ifname);
+/* counters of XDP program. called by control thread */
+static void
+interface_xdp_stats(int ifno)
+{
+	struct interface *iface = &interface[ifno];
+	struct interface_statistics *ifstats = &iface->stats;
+	uint64_t cur[AX_STAT_MAX];
+	unsigned int i;
 
-	iface->nm_desc = nm_open(iface->netmapname, &nmreq, 0, NULL);
-	if (iface->nm_desc == NULL) {
-		fprintf(stderr, "cannot open /dev/netmap\n");
-		exit(1);
+	if (iface->ax_prog == NULL)
+		return;
+
+	for (i = 0; i < AX_STAT_MAX; i++)
+		cur[i] = ax_prog_getstat(iface->ax_prog, i);
+	ifstats->rx_xdpreply += cur[AX_STAT_REPLY] - iface->xdpstat_last[AX_STAT_REPLY];
+	ifstats->rx_xdppass += cur[AX_STAT_PASS] - iface->xdpstat_last[AX_STAT_PASS];
+	memcpy(iface->xdpstat_last, cur, sizeof(cur));
+
+	if (iface->xdpcount != NULL) {
+		ifstats->rx_seqdrop += iface->xdp_seqdrop;
+		ifstats->rx_dup += iface->xdp_dup;
+		ifstats->rx_reorder += iface->xdp_reorder;
+		ifstats->rx_outofrange += iface->xdp_outofrange;
 	}
+}
 
+/*
+ * --xdp-count. fold counters of all CPUs, and settle sequences older than
+ * the max by AX_SEQWIN_HOLD: a sequence is received if the bit is set
+ * on any CPU. called by RX thread of shard 0.
+ */
+static void
+interface_xdp_scan(struct rxshard *rs)
+{
+	struct interface *iface = &interface[rs->ifno];
+	struct interface_statistics *ifstats = rs->stats;
+	struct ax_count *c;
+	uint64_t rx, rx_byte, dup, reorder, outofrange, n;
+	uint64_t mask, acc, v;
+	uint32_t lo, hi, tail, limit;
+	unsigned int i, ncpu, w;
+
+	rx = rx_byte = dup = reorder = outofrange = 0;
+	lo = hi = 0;
+	for (ncpu = 0, i = 0; i < iface->xdpcount_ncpu; i++) {
+		c = &iface->xdpcount[i];
+		if (!__atomic_load_n(&c->valid, __ATOMIC_ACQUIRE))
+			continue;
+		rx += c->rx;
+		rx_byte += c->rx_byte;
+		dup += c->dup;
+		reorder += c->reorder;
+		outofrange += c->outofrange;
+		if ((ncpu == 0) || ((int32_t)(c->hi - hi) > 0))
+			hi = c->hi;
+		if ((ncpu == 0) || ((int32_t)(c->lo - lo) < 0))
+			lo = c->lo;
+		iface->xdpcount_cpu[ncpu++] = i;
+	}
+	if (ncpu == 0)
+		return;
 
-	nifp = iface->nm_desc->nifp;
-	txring = NETMAP_TXRING(nifp, 0);
-	rxring = NETMAP_RXRING(nifp, 0);
+	n = rx - iface->xdpcount_last.rx;
+	ifstats->rx += n;
+	if (opt_bps_include_preamble)
+		ifstats->rx_byte += rx_byte - iface->xdpcount_last.rx_byte + n * (DEFAULT_IFG + DEFAULT_PREAMBLE + FCS);
+	else
+		ifstats->rx_byte += rx_byte - iface->xdpcount_last.rx_byte + n * FCS;
+	iface->xdp_dup += dup - iface->xdpcount_last.dup;
+	iface->xdp_reorder += reorder - iface->xdpcount_last.reorder;
+	iface->xdp_outofrange += outofrange - iface->xdpcount_last.outofrange;
+	iface->xdpcount_last.rx = rx;
+	iface->xdpcount_last.rx_byte = rx_byte;
+	iface->xdpcount_last.dup = dup;
+	iface->xdpcount_last.reorder = reorder;
+	iface->xdpcount_last.outofrange = outofrange;
+
+	if (!iface->xdpcount_tailvalid) {
+		iface->xdpcount_tail = lo;
+		iface->xdpcount_tailvalid = 1;
+	}
+	tail = iface->xdpcount_tail;
+	limit = (hi - AX_SEQWIN_HOLD) & ~63U;
+	if ((int32_t)(limit - tail) <= 0)
+		return;
 
-	printf("%s: %d TX rings * %u slots, %d RX rings * %u slots", iface->ifname,
+	/* too late to settle. bits of the window are ambiguous */
+	if (limit - tail > AX_SEQWIN_BITS - AX_SEQWIN_HOLD) {
+		n = limit - tail - (AX_SEQWIN_BITS - AX_SEQWIN_HOLD);
+		iface->xdp_seqdrop += n;
+		tail += n;
+	}
+
+	/* frames before new tail are out of range from now */
+	for (i = 0; i < iface->xdpcount_ncpu; i++) {
+		iface->xdpcount[i].tail = limit;
+		__atomic_store_n(&iface->xdpcount[i].tailvalid, 1, __ATOMIC_RELEASE);
+	}
+
+	for (; tail != limit; tail = (tail | 63) + 1) {
+		w = (tail / 64) & (AX_SEQWIN_WORDS - 1);
+		mask = ~0ULL << (tail & 63);
+		for (acc = 0, i = 0; i < ncpu; i++) {
+			c = &iface->xdpcount[iface->xdpcount_cpu[i]];
+			v = __atomic_exchange_n(&c->bits[w], 0, __ATOMIC_RELAXED) & mask;
+			iface->xdp_dup += __builtin_popcountll(acc & v);
+			acc |= v;
+		}
+		iface->xdp_seqdrop += __builtin_popcountll(~acc & mask);
+	}
+	iface->xdpcount_tail = limit;
+}
+#endif
+
+static void
+interface_open(int ifno)
+{
+	struct interface *iface = &interface[ifno];
+	struct interface *iface_other = &interface[ifno ^ 1];
+#ifdef USE_NETMAP
+	struct nmreq nmreq;
+	struct netmap_if *nifp;
+	struct netmap_ring *txring, *rxring;
+	struct rxshard *rs;
+	char name[128];
+	unsigned int k, j, nring;
+
+	memset(&nmreq, 0, sizeof(nmreq));
+	sprintf(iface->netmapname, "netmap:%s", iface->ifname);
+
+	iface->nm_desc = nm_open(iface->netmapname, &nmreq, 0, NULL);
+	if (iface->nm_desc == NULL) {
+		fprintf(stderr, "cannot open /dev/netmap\n");
+		exit(1);
+	}
+
+
+	nifp = iface->nm_desc->nifp;
+	txring = NETMAP_TXRING(nifp, 0);
+	rxring = NETMAP_RXRING(nifp, 0);
+
+	printf("%s: %d TX rings * %u slots, %d RX rings * %u slots", iface->ifname,
 	    iface->nm_desc->last_tx_ring - iface->nm_desc->first_tx_ring + 1,
 	    txring->num_slots,
 	    iface->nm_desc->last_rx_ring - iface->nm_desc->first_rx_ring + 1,
@@ -1333,12 +2263,87 @@ interface_open(int ifno)
 		printf(", %u MB mapped", iface->nm_desc->memsize / 1024 / 1024);
 	printf("\n");
 
+	/* --rx-threads. RX ring k belongs to RX thread (k % opt_rxthreads) */
+	if (opt_rxthreads == 1) {
+		rxshard[ifno][0].nm_desc = &iface->nm_desc;
+		rxshard[ifno][0].nnm_desc = 1;
+	} else {
+		nring = iface->nm_desc->last_rx_ring - iface->nm_desc->first_rx_ring + 1;
+		if (opt_rxthreads > nring) {
+			fprintf(stderr, "%s: --rx-threads %u exceeds %u RX rings\n",
+			    iface->ifname, opt_rxthreads, nring);
+			exit(1);
+		}
+		for (k = 0; k < opt_rxthreads; k++) {
+			rs = &rxshard[ifno][k];
+			rs->nnm_desc = (nring - k + opt_rxthreads - 1) / opt_rxthreads;
+			rs->nm_desc = calloc(rs->nnm_desc, sizeof(struct nm_desc *));
+			if (rs->nm_desc == NULL) {
+				fprintf(stderr, "cannot allocate memory\n");
+				exit(1);
+			}
+			for (j = 0; j < rs->nnm_desc; j++) {
+				snprintf(name, sizeof(name), "%s-%u",
+				    iface->netmapname, k + j * opt_rxthreads);
+				rs->nm_desc[j] = nm_open(name, NULL,
+				    NM_OPEN_NO_MMAP | NETMAP_NO_TX_POLL, iface->nm_desc);
+				if (rs->nm_desc[j] == NULL) {
+					fprintf(stderr, "cannot open %s\n", name);
+					exit(1);
+				}
+			}
+		}
+	}
+
 #elif defined(USE_AF_XDP)
-	iface->ax_desc = ax_open(iface->ifname);
+	unsigned int k;
+	int rxts;
+
+	/* own XDP program puts RX timestamp if the driver supports */
+	iface->ax_prog = ax_prog_open(iface->ifname, opt_xdp_prog,
+	    opt_xdp_count ? AX_PROG_COUNT : 0);
+	if (iface->ax_prog == NULL) {
+		if (opt_xdp_count) {
+			fprintf(stderr, "%s: --xdp-count needs XDP program %s\n",
+			    iface->ifname, opt_xdp_prog);
+			exit(1);
+		}
+		fprintf(stderr, "%s: using default XDP program\n", iface->ifname);
+	} else {
+		if (opt_xdp_count) {
+			iface->xdpcount = ax_prog_count(iface->ax_prog, &iface->xdpcount_ncpu);
+			if (iface->xdpcount == NULL)
+				exit(1);
+			iface->xdpcount_cpu = calloc(iface->xdpcount_ncpu, sizeof(unsigned int));
+			if (iface->xdpcount_cpu == NULL) {
+				fprintf(stderr, "cannot allocate memory\n");
+				exit(1);
+			}
+		}
+		interface_xdp_config(ifno);
+	}
+	rxts = (iface->ax_prog != NULL) && (ax_prog_flags(iface->ax_prog) & AX_PROG_RXTS);
+	printf_verbose("%s: RX timestamp: %s\n", iface->ifname,
+	    rxts ? "XDP metadata, or TSC if not given" : "TSC");
+
+	iface->ax_desc = ax_open(iface->ifname, 0, iface->ax_prog, opt_xdp_rx_batch);
 	if (iface->ax_desc == NULL) {
 		fprintf(stderr, "failed to initialize AF_XDP\n");
 		exit(1);
 	}
+
+	/* --rx-threads. RX queue k belongs to RX thread k */
+	rxshard[ifno][0].ax_desc = iface->ax_desc;
+	for (k = 1; k < opt_rxthreads; k++) {
+		rxshard[ifno][k].ax_desc = ax_open(iface->ifname, k, iface->ax_prog,
+		    opt_xdp_rx_batch);
+		if (rxshard[ifno][k].ax_desc == NULL) {
+			fprintf(stderr, "failed to initialize AF_XDP on RX queue %u\n", k);
+			exit(1);
+		}
+	}
+	for (k = 0; k < opt_rxthreads; k++)
+		rxshard[ifno][k].rxts = rxts;
 #endif
 
 	/* for IPv6 multicast packet (ndp, etc), or bridge random L2 address mode */
@@ -1356,11 +2361,23 @@ interface_close(int ifno)
 {
 	struct interface *iface = &interface[ifno];
 	struct interface *iface_other = &interface[ifno ^ 1];
+#ifdef USE_NETMAP
+	unsigned int k, j;
+#elif defined(USE_AF_XDP)
+	unsigned int k;
+#endif
 
 	if (use_ipv6 || iface_other->gw_l2random)
 		interface_promisc(iface->ifname, iface->promisc_save, NULL);
 
 #ifdef USE_NETMAP
+	if (opt_rxthreads > 1) {
+		for (k = 0; k < opt_rxthreads; k++) {
+			for (j = 0; j < rxshard[ifno][k].nnm_desc; j++)
+				nm_close(rxshard[ifno][k].nm_desc[j]);
+			free(rxshard[ifno][k].nm_desc);
+		}
+	}
 	nm_close(iface->nm_desc);
 #elif defined(USE_AF_XDP)
 	/*
@@ -1368,7 +2385,16 @@ interface_close(int ifno)
 	 * sleeping 200ms to wait returning from poll().
 	 */
 	usleep(200000);
+	for (k = 1; k < opt_rxthreads; k++)
+		ax_close(rxshard[ifno][k].ax_desc);
 	ax_close(iface->ax_desc);
+	if (iface->ax_prog != NULL) {
+		ax_prog_close(iface->ax_prog);
+		iface->ax_prog = NULL;
+		iface->xdpcount = NULL;
+		free(iface->xdpcount_cpu);
+		iface->xdpcount_cpu = NULL;
+	}
 #endif
 	reset_ipg(ifno);
 
@@ -1603,32 +2629,430 @@ pppoe_handler(int ifno, char *pkt)
 }
 #endif
 
+/*
+ * --flowcheck. the tuple of received packet must be of the flow which
+ * transmitted it, after the translation by DUT. with per flow VLAN,
+ * VLAN tags between ethernet header and L3 are also a part of the flow.
+ */
+static int
+flowcheck_packet(const struct flowindex *fi, int is_ipv6, const char *buf, int l3_offset, uint32_t flowid)
+{
+	const char *l3 = buf + l3_offset;
+	const struct ip *ip;
+	const struct ip6_hdr *ip6;
+	const uint16_t *l4;
+	struct flowkey key;
+	uint32_t id;
+
+	if (is_ipv6) {
+		ip6 = (const struct ip6_hdr *)l3;
+		l4 = (const uint16_t *)(ip6 + 1);	/* XXX: no support extension header */
+		flowkey_init(&key, AF_INET6, ip6->ip6_nxt, &ip6->ip6_src, &ip6->ip6_dst,
+		    ntohs(l4[0]), ntohs(l4[1]));
+	} else {
+		ip = (const struct ip *)l3;
+		l4 = (const uint16_t *)(l3 + ip->ip_hl * 4);
+		flowkey_init(&key, AF_INET, ip->ip_p, &ip->ip_src, &ip->ip_dst,
+		    ntohs(l4[0]), ntohs(l4[1]));
+	}
+	if (fi->vlan && (l3_offset > (int)ETHHDRSIZE))
+		flowkey_vlan(&key, (const uint8_t *)buf + ETHER_ADDR_LEN * 2,
+		    (l3_offset - ETHHDRSIZE) / 4);
+
+	if ((flowindex_lookup(fi, &key, &id) != 0) || (id != flowid))
+		return -1;
+	return 0;
+}
+
+/*
+ * check up to RXSHARD_DRAIN sequences passed from the shards.
+ * see the comment of struct rxshard. return non-zero if any ring may
+ * have more.
+ */
+static int
+rxshard_drain_batch(struct rxshard *rs)
+{
+	struct seqcheck_req out[RXSHARD_DRAIN], *req, *best;
+	unsigned int avail[RXSHARD_MAX], taken[RXSHARD_MAX];
+	unsigned int i, ibest, n, nout, quota;
+	int blocked, full, more;
+
+	/* per flow sequences as they are */
+	quota = RXSHARD_DRAIN / opt_rxthreads / 2;
+	for (more = 0, nout = 0, i = 0; i < opt_rxthreads; i++) {
+		n = seqring_get(rs->inq[i], &out[nout], quota);
+		if (n == quota)
+			more = 1;
+		nout += n;
+	}
+
+	/* interface sequences. merge shards in order */
+	if (rs->id == 0) {
+		blocked = full = 0;
+		for (i = 0; i < opt_rxthreads; i++) {
+			taken[i] = 0;
+			avail[i] = seqring_count(rs->ifq[i]);
+			if (avail[i] != 0)
+				rs->ifq_idle[i] = 0;
+			else if (rs->ifq_idle[i] < RXSHARD_IDLE)
+				rs->ifq_idle[i]++;
+			if (avail[i] >= RXSHARD_HOLD)
+				full = 1;
+		}
+
+		while (nout < RXSHARD_DRAIN) {
+			best = NULL;
+			ibest = 0;
+			for (i = 0; i < opt_rxthreads; i++) {
+				if (taken[i] == avail[i]) {
+					if (rs->ifq_idle[i] < RXSHARD_IDLE)
+						blocked = 1;
+					continue;
+				}
+				req = seqring_peek(rs->ifq[i], taken[i]);
+				if ((best == NULL) || ((int32_t)(req->seq - best->seq) < 0)) {
+					best = req;
+					ibest = i;
+				}
+			}
+			if ((best == NULL) || (blocked && !full))
+				break;
+			out[nout++] = *best;
+			taken[ibest]++;
+		}
+		if (nout == RXSHARD_DRAIN)
+			more = 1;
+
+		for (i = 0; i < opt_rxthreads; i++)
+			seqring_consume(rs->ifq[i], taken[i]);
+	}
+
+	if (nout > 0)
+		seqcheck_receive_n(out, nout);
+	return more;
+}
+
+/*
+ * drain the rings until they are empty, or as many as they can hold at
+ * once, so that the owner keeps up with all of the producers and its own
+ * RX queues are not left behind.
+ */
 static void
-receive_packet(int ifno, struct timespec *curtime, char *buf, uint16_t len)
+rxshard_drain(struct rxshard *rs)
+{
+	unsigned int n;
+
+	for (n = RXSHARD_RINGSIZE * opt_rxthreads * 2 / RXSHARD_DRAIN; n > 0; n--) {
+		if (!rxshard_drain_batch(rs))
+			break;
+	}
+}
+
+static inline void
+rxshard_publish(struct rxshard *rs)
+{
+	unsigned int i;
+
+	for (i = 0; i < opt_rxthreads; i++)
+		seqring_publish(rxshard[rs->ifno][i].inq[rs->id]);
+	seqring_publish(rxshard[rs->ifno][0].ifq[rs->id]);
+}
+
+static inline void
+rxshard_put(struct rxshard *rs, struct seqring *r, struct sequencechecker *sc, uint32_t seq)
+{
+	while (seqring_put(r, sc, seq) != 0) {
+		/* the owner is behind. drain ours meanwhile not to deadlock */
+		seqring_publish(r);
+		rxshard_drain(rs);
+		if (do_quit)
+			return;
+	}
+}
+
+static int
+rxshard_init(int ifno)
 {
 	struct interface *iface = &interface[ifno];
-	struct interface_statistics *ifstats = &iface->stats;
+	struct rxshard *rs;
+	unsigned int k, i;
+
+	for (k = 0; k < opt_rxthreads; k++) {
+		rs = &rxshard[ifno][k];
+		rs->ifno = ifno;
+		rs->id = k;
+		if (opt_rxthreads == 1) {
+			rs->stats = &iface->stats;
+			rs->seqchecker_flowtotal = iface->seqchecker_flowtotal;
+			break;
+		}
+
+		rs->stats = &rs->shardstats;
+		if (k == 0)
+			rs->seqchecker_flowtotal = iface->seqchecker_flowtotal;
+		else
+			rs->seqchecker_flowtotal = seqcheck_new();
+		if (rs->seqchecker_flowtotal == NULL)
+			goto nomem;
+		if (nstream != 0) {
+			rs->sstats = calloc(nstream, sizeof(struct stream_statistics));
+			if (rs->sstats == NULL)
+				goto nomem;
+		}
+		for (i = 0; i < opt_rxthreads; i++) {
+			rs->inq[i] = seqring_new(RXSHARD_RINGSIZE);
+			if (rs->inq[i] == NULL)
+				return -1;
+			if (k == 0) {
+				rs->ifq[i] = seqring_new(RXSHARD_RINGSIZE);
+				if (rs->ifq[i] == NULL)
+					return -1;
+			}
+		}
+	}
+	return 0;
+
+ nomem:
+	fprintf(stderr, "cannot allocate %s RX thread work\n", iface->ifname);
+	return -1;
+}
+
+static void
+rxshard_create(int ifno, pthread_t *thread)
+{
+	struct rxshard *rs;
+	char buf[128];
+	unsigned int k;
+
+	for (k = 0; k < opt_rxthreads; k++) {
+		rs = &rxshard[ifno][k];
+		pthread_create(&rs->thread, NULL, rx_thread_main, rs);
+		if (k == 0)
+			snprintf(buf, sizeof(buf), "%s-rx", interface[ifno].ifname);
+		else
+			snprintf(buf, sizeof(buf), "%s-rx%u", interface[ifno].ifname, k);
+		pthread_setname_np(rs->thread, buf);
+	}
+	*thread = rxshard[ifno][0].thread;
+}
+
+/*
+ * sum up statistics of RX threads. called from control thread.
+ * counters may be updated meanwhile, they are not reset here.
+ */
+static void
+rxshard_merge(int ifno)
+{
+	struct interface_statistics *ifstats = &interface[ifno].stats;
+	struct interface_statistics *shard;
+	struct stream_statistics *sstats, *ss;
+	struct interface_statistics sum;
+	unsigned int k, i;
+
+	if (opt_rxthreads == 1)
+		return;
+
+	memset(&sum, 0, sizeof(sum));
+	for (k = 0; k < opt_rxthreads; k++) {
+		shard = &rxshard[ifno][k].shardstats;
+		sum.rx += shard->rx;
+		sum.rx_byte += shard->rx_byte;
+		sum.rx_flow += shard->rx_flow;
+		sum.rx_arp += shard->rx_arp;
+		sum.rx_icmp += shard->rx_icmp;
+		sum.rx_icmpother += shard->rx_icmpother;
+		sum.rx_icmpecho += shard->rx_icmpecho;
+		sum.rx_icmpunreach += shard->rx_icmpunreach;
+		sum.rx_icmpredirect += shard->rx_icmpredirect;
+		sum.rx_other += shard->rx_other;
+		sum.rx_expire += shard->rx_expire;
+		sum.rx_flowcheck += shard->rx_flowcheck;
+		sum.latency_sum += shard->latency_sum;
+		sum.latency_npkt += shard->latency_npkt;
+		if ((shard->latency_min != 0) &&
+		    ((sum.latency_min == 0) || (sum.latency_min > shard->latency_min)))
+			sum.latency_min = shard->latency_min;
+		if (sum.latency_max < shard->latency_max)
+			sum.latency_max = shard->latency_max;
+	}
+	ifstats->rx = sum.rx;
+	ifstats->rx_byte = sum.rx_byte;
+	ifstats->rx_flow = sum.rx_flow;
+	ifstats->rx_arp = sum.rx_arp;
+	ifstats->rx_icmp = sum.rx_icmp;
+	ifstats->rx_icmpother = sum.rx_icmpother;
+	ifstats->rx_icmpecho = sum.rx_icmpecho;
+	ifstats->rx_icmpunreach = sum.rx_icmpunreach;
+	ifstats->rx_icmpredirect = sum.rx_icmpredirect;
+	ifstats->rx_other = sum.rx_other;
+	ifstats->rx_expire = sum.rx_expire;
+	ifstats->rx_flowcheck = sum.rx_flowcheck;
+	ifstats->latency_sum = sum.latency_sum;
+	ifstats->latency_npkt = sum.latency_npkt;
+	ifstats->latency_min = sum.latency_min;
+	ifstats->latency_max = sum.latency_max;
+	if (sum.latency_npkt != 0)
+		ifstats->latency_avg = sum.latency_sum / sum.latency_npkt;
+
+	/* streams are received on interface[0] */
+	for (i = 0; (ifno == 0) && (i < nstream); i++) {
+		sstats = &streams[i].stats;
+		sstats->rx = sstats->rx_byte = 0;
+		sstats->latency_sum = sstats->latency_max = 0;
+		sstats->latency_npkt = 0;
+		for (k = 0; k < opt_rxthreads; k++) {
+			ss = &rxshard[ifno][k].sstats[i];
+			sstats->rx += ss->rx;
+			sstats->rx_byte += ss->rx_byte;
+			sstats->latency_sum += ss->latency_sum;
+			sstats->latency_npkt += ss->latency_npkt;
+			if (sstats->latency_max < ss->latency_max)
+				sstats->latency_max = ss->latency_max;
+		}
+	}
+}
+
+/* sum of per flow sequence counters over RX threads */
+static uint64_t
+rxshard_flowtotal(int ifno, uint64_t (*count)(struct sequencechecker *))
+{
+	uint64_t sum;
+	unsigned int k;
+
+	for (sum = 0, k = 0; k < opt_rxthreads; k++)
+		sum += count(rxshard[ifno][k].seqchecker_flowtotal);
+	return sum;
+}
+
+/*
+ * account received test packet. seqdata->magic has been checked.
+ * rxts is the RX time of the packet by tsc_read().
+ * if scq is not NULL, sequences are appended to scq[] for
+ * seqcheck_receive_n() instead of being checked here.
+ * with --rx-threads, sequences are passed to the owner shard.
+ */
+static inline void
+receive_sequence(struct rxshard *rs, uint64_t rxts, char *buf, uint16_t len,
+    int l3_offset, int is_ipv6, struct seqcheck_req *scq, unsigned int *nscq)
+{
+	struct interface *iface = &interface[rs->ifno];
+	struct interface_statistics *ifstats = rs->stats;
+	struct seqdata *seqdata;
+	struct sequence_record *seqrecord;
+	struct flowindex *fi;
+	uint64_t seq, seqflow, nskip;
+	uint32_t flowid;
+	double latency;
+
+	seqdata = (struct seqdata *)(buf + len - sizeof(struct seqdata));
+	seq = seqdata->seq;
+	seqrecord = seqtable_get(iface->seqtable, seq);
+
+	if ((seqrecord == NULL) || seqrecord->seq != seq) {
+		ifstats->rx_expire++;
+	} else {
+		/* msec. TX and RX threads may read TSC of different cores */
+		latency = (double)(int64_t)(rxts - seqrecord->ts) * 1000.0 / tsc_hz;
+		if (latency < 0)
+			latency = 0;
+
+		ifstats->latency_sum += latency;
+		ifstats->latency_npkt++;
+		ifstats->latency_avg = ifstats->latency_sum / ifstats->latency_npkt;
+
+		if ((ifstats->latency_min == 0) || (ifstats->latency_min > latency))
+			ifstats->latency_min = latency;
+		if (ifstats->latency_max < latency)
+			ifstats->latency_max = latency;
+
+		if ((seqrecord->streamid != 0) && (seqrecord->streamid <= nstream)) {
+			struct stream_statistics *sstats;
+
+			if (rs->sstats != NULL)
+				sstats = &rs->sstats[seqrecord->streamid - 1];
+			else
+				sstats = &streams[seqrecord->streamid - 1].stats;
+			sstats->rx++;
+			sstats->rx_byte += len + FCS;
+			if (opt_bps_include_preamble)
+				sstats->rx_byte += DEFAULT_IFG + DEFAULT_PREAMBLE;
+			sstats->latency_sum += latency;
+			sstats->latency_npkt++;
+			if (sstats->latency_max < latency)
+				sstats->latency_max = latency;
+		}
+
+		flowid = seqrecord->flowid;
+		seqflow = seqrecord->flowseq;
+		if ((flowid != UINT32_MAX) &&
+		    ((fi = __atomic_load_n(&iface->flowindex, __ATOMIC_ACQUIRE)) != NULL) &&
+		    (flowcheck_packet(fi, is_ipv6, buf, l3_offset, flowid) != 0))
+			ifstats->rx_flowcheck++;
+		if (opt_rxthreads > 1) {
+			if (flowid < __atomic_load_n(&iface->nperflow, __ATOMIC_ACQUIRE))
+				rxshard_put(rs, rxshard[rs->ifno][flowid % opt_rxthreads].inq[rs->id],
+				    PERFLOW_SEQCHECKER(iface, flowid), seqflow);
+			rxshard_put(rs, rxshard[rs->ifno][0].ifq[rs->id], iface->seqchecker, seq);
+			return;
+		}
+		if (scq != NULL) {
+			if (flowid < __atomic_load_n(&iface->nperflow, __ATOMIC_ACQUIRE)) {
+				scq[*nscq].sc = PERFLOW_SEQCHECKER(iface, flowid);
+				scq[(*nscq)++].seq = seqflow;
+			}
+			scq[*nscq].sc = iface->seqchecker;
+			scq[(*nscq)++].seq = seq;
+			return;
+		}
+
+		if (flowid < __atomic_load_n(&iface->nperflow, __ATOMIC_ACQUIRE))
+			nskip = seqcheck_receive(PERFLOW_SEQCHECKER(iface, flowid), seqflow);
+
+		nskip = seqcheck_receive(iface->seqchecker, seq);
+		if (opt_debuglevel > 1) {
+			/* DEBUG */
+			if (nskip > 2) {
+				printf("\r\n\r\n\r\n\r\n\r\n\r\n<seq=%"PRIu64", nskip=%"PRIu64", tx0=%"PRIu64", tx1=%"PRIu64">",
+				    seq, nskip, interface[0].sequence_tx, interface[1].sequence_tx);
+				dumpstr(buf, len, DUMPSTR_FLAGS_CRLF);
+			}
+		}
+	}
+}
+
+static void
+receive_packet(struct rxshard *rs, uint64_t rxts, char *buf, uint16_t len)
+{
+	int ifno = rs->ifno;
+	struct interface *iface = &interface[ifno];
+	struct interface_statistics *ifstats = rs->stats;
 	int is_ipv6 = 0;
 	struct ether_header *eth;
 	struct ip *ip;
 	struct ip6_hdr *ip6;
+	struct seqdata *seqdata;
 	int l3_offset;
 	uint16_t type;
 
-	ifstats->rx++;
-	if (opt_bps_include_preamble)
-		ifstats->rx_byte += len + DEFAULT_IFG + DEFAULT_PREAMBLE + FCS;
-	else
-		ifstats->rx_byte += len + FCS;
-
 	eth = (struct ether_header *)buf;
 	type = ntohs(eth->ether_type);
-	if (type == ETHERTYPE_VLAN) {
-		struct ether_vlan_header *vlan = (struct ether_vlan_header *)buf;
-		type = ntohs(vlan->evl_proto);
-		l3_offset = sizeof(struct ether_vlan_header);
-	} else {
-		l3_offset = sizeof(struct ether_header);
+	l3_offset = sizeof(struct ether_header);
+
+	/* VLAN, QinQ and MPLS label stack */
+	while (((type == ETHERTYPE_VLAN) || (type == ENCAP_ETHERTYPE_QINQ)) &&
+	    (l3_offset + 4 <= len)) {
+		type = ntohs(*(uint16_t *)(buf + l3_offset + 2));
+		l3_offset += 4;
+	}
+	if (type == ENCAP_ETHERTYPE_MPLS) {
+		/* until bottom of stack */
+		while ((l3_offset + 4 < len) && ((buf[l3_offset + 2] & 0x01) == 0))
+			l3_offset += 4;
+		l3_offset += 4;
+		if ((l3_offset < len) && (((uint8_t)buf[l3_offset] >> 4) == 6))
+			type = ETHERTYPE_IPV6;
+		else
+			type = ETHERTYPE_IP;
 	}
 
 	switch (type) {
@@ -1675,6 +3099,10 @@ receive_packet(int ifno, struct timespec *curtime, char *buf, uint16_t len)
 		return;
 	}
 
+	/* tunnel of --encap */
+	if (opt_decap && !is_ipv6)
+		l3_offset = encap_decap(buf, len, l3_offset, &is_ipv6);
+
 	if (is_ipv6) {
 		/* IPv6 packet */
 		ip6 = (struct ip6_hdr *)(buf + l3_offset);
@@ -1738,113 +3166,311 @@ receive_packet(int ifno, struct timespec *curtime, char *buf, uint16_t len)
 	}
 
 	/* check sequence */
-	struct seqdata *seqdata;
-	struct sequence_record *seqrecord;
-	uint64_t seq, seqflow, nskip;
-	uint32_t flowid;
-	struct timespec ts_delta;
-	double latency;
-
 	seqdata = (struct seqdata *)(buf + len - sizeof(struct seqdata));
 	if (seqdata->magic != seq_magic) {
 		/* no ipgen packet? */
 		ifstats->rx_other++;
 		return;
 	}
+	receive_sequence(rs, rxts, buf, len, l3_offset, is_ipv6, NULL, NULL);
+}
 
-	seq = seqdata->seq;
-	seqrecord = seqtable_get(iface->seqtable, seq);
+/*
+ * l3 offset of the test packet for RX fast path, or 0 for receive_packet().
+ * only UDP/TCP over IPv4/IPv6, optionally VLAN/QinQ tagged, is taken.
+ * ICMP errors may quote a test packet as is, and must not be taken.
+ */
+static inline int
+receive_fastpath_l3(const char *buf, uint16_t len, int *is_ipv6)
+{
+	int l3_offset;
+	uint16_t type;
+	uint8_t proto;
 
-	if ((seqrecord == NULL) || seqrecord->seq != seq) {
-		ifstats->rx_expire++;
-	} else {
-		timespecsub(curtime, &seqrecord->ts, &ts_delta);
-		ts_delta.tv_sec &= 0xff;
-		latency = ts_delta.tv_sec / 1000 + ts_delta.tv_nsec / 1000000.0;
+	if (opt_decap)
+		return 0;
 
-		ifstats->latency_sum += latency;
-		ifstats->latency_npkt++;
-		ifstats->latency_avg = ifstats->latency_sum / ifstats->latency_npkt;
+	l3_offset = sizeof(struct ether_header);
+	type = ((const struct ether_header *)buf)->ether_type;
+	while ((type == htons(ETHERTYPE_VLAN)) || (type == htons(ENCAP_ETHERTYPE_QINQ))) {
+		if (l3_offset + 4 > len)
+			return 0;
+		type = *(const uint16_t *)(buf + l3_offset + 2);
+		l3_offset += 4;
+	}
 
-		if ((ifstats->latency_min == 0) || (ifstats->latency_min > latency))
-			ifstats->latency_min = latency;
-		if (ifstats->latency_max < latency)
-			ifstats->latency_max = latency;
+	if (type == htons(ETHERTYPE_IP)) {
+		proto = ((const struct ip *)(buf + l3_offset))->ip_p;
+		*is_ipv6 = 0;
+	} else if (type == htons(ETHERTYPE_IPV6)) {
+		proto = ((const struct ip6_hdr *)(buf + l3_offset))->ip6_nxt;
+		*is_ipv6 = 1;
+	} else {
+		return 0;
+	}
+	if ((proto != IPPROTO_UDP) && (proto != IPPROTO_TCP))
+		return 0;
+	return l3_offset;
+}
 
-		flowid = seqrecord->flowid;
-		seqflow = seqrecord->flowseq;
-		if (get_flowid_max(ifno) >= flowid)
-			nskip = seqcheck_receive(iface->seqchecker_perflow[flowid], seqflow);
+/*
+ * receive a batch of frames. trailers have been prefetched by the caller.
+ * the magic of the whole batch is tested first, and test packets are
+ * accounted in a tight loop. ARP, ND, ICMP and others are deferred to
+ * receive_packet().
+ */
+static void
+receive_batch(struct rxshard *rs, char **buf, uint16_t *len, const uint64_t *rxts, unsigned int n)
+{
+	struct interface *iface = &interface[rs->ifno];
+	struct interface_statistics *ifstats = rs->stats;
+	const struct seqdata *seqdata;
+	unsigned int i, nfast, nslow;
+	unsigned int fast[RX_BATCH], slow[RX_BATCH];
+	int l3_offset[RX_BATCH], is_ipv6[RX_BATCH];
+	struct seqcheck_req scq[RX_BATCH * 2], *scqp;
+	unsigned int nscq;
+	uint64_t bytes;
+
+	bytes = 0;
+	nfast = nslow = 0;
+	for (i = 0; i < n; i++) {
+		bytes += len[i];
+		seqdata = (const struct seqdata *)(buf[i] + len[i] - sizeof(struct seqdata));
+		if ((seqdata->magic == seq_magic) &&
+		    ((l3_offset[i] = receive_fastpath_l3(buf[i], len[i], &is_ipv6[i])) != 0)) {
+			__builtin_prefetch(seqtable_get(iface->seqtable, seqdata->seq));
+			fast[nfast++] = i;
+		} else {
+			slow[nslow++] = i;
+		}
+	}
 
-		nskip = seqcheck_receive(iface->seqchecker, seq);
-		if (opt_debuglevel > 1) {
-			/* DEBUG */
-			if (nskip > 2) {
-				printf("\r\n\r\n\r\n\r\n\r\n\r\n<seq=%"PRIu64", nskip=%"PRIu64", tx0=%"PRIu64", tx1=%"PRIu64">",
-				    seq, nskip, interface[0].sequence_tx, interface[1].sequence_tx);
-				dumpstr(buf, len, DUMPSTR_FLAGS_CRLF);
-			}
+	ifstats->rx += n;
+	if (opt_bps_include_preamble)
+		ifstats->rx_byte += bytes + (uint64_t)n * (DEFAULT_IFG + DEFAULT_PREAMBLE + FCS);
+	else
+		ifstats->rx_byte += bytes + (uint64_t)n * FCS;
+
+	/* per packet seqcheck to show nskip in debug mode */
+	scqp = (opt_debuglevel > 1) ? NULL : scq;
+	nscq = 0;
+	for (i = 0; i < nfast; i++)
+		receive_sequence(rs, rxts[fast[i]], buf[fast[i]], len[fast[i]],
+		    l3_offset[fast[i]], is_ipv6[fast[i]], scqp, &nscq);
+	if (nscq > 0)
+		seqcheck_receive_n(scq, nscq);
+	for (i = 0; i < nslow; i++)
+		receive_packet(rs, rxts[slow[i]], buf[slow[i]], len[slow[i]]);
+
+	if (opt_rxthreads > 1)
+		rxshard_publish(rs);
+}
+
+#ifdef USE_AF_XDP
+/*
+ * RX time of a frame on TSC. the driver timestamp given by the XDP program
+ * is assumed to be CLOCK_REALTIME (PHC synchronized by phc2sys), and is
+ * converted by the clocks read at the beginning of the batch.
+ * TSC at the moment is used if not given, or the clocks are out of sync.
+ */
+static inline uint64_t
+rx_timestamp_xdp(struct rxshard *rs, char *buf, uint64_t tsc0, uint64_t ns0)
+{
+	uint64_t ns;
+
+	if (rs->rxts) {
+		ns = ax_rx_timestamp(buf);
+		if ((ns != 0) && (ns <= ns0) && (ns0 - ns < 1000000000ULL)) {
+			rs->rxts_kernel++;
+			return tsc0 - (ns0 - ns) * tsc_hz / 1000000000ULL;
 		}
 	}
+	return tsc_read();
+}
+#endif
+
+/* "xdp" if the driver timestamps received frames, otherwise "tsc" */
+static const char *
+rx_timestamp_method(int ifno)
+{
+#ifdef USE_AF_XDP
+	unsigned int k;
+
+	for (k = 0; k < opt_rxthreads; k++)
+		if (rxshard[ifno][k].rxts_kernel != 0)
+			return "xdp";
+#else
+	(void)ifno;
+#endif
+	return "tsc";
 }
 
 static void
-interface_receive(int ifno)
+interface_receive(struct rxshard *rs)
 {
-	struct interface *iface = &interface[ifno];
+	char *buf[RX_BATCH];
+	uint16_t len[RX_BATCH];
+	uint64_t rxts[RX_BATCH];
 #ifdef USE_NETMAP
-	char *buf;
-	unsigned int cur, n, i;
-	uint16_t len;
+	unsigned int cur, n, i, d, nbatch;
+	struct nm_desc *nm_desc;
 	struct netmap_if *nifp;
 	struct netmap_ring *rxring;
-	struct timespec curtime;
 
-	clock_gettime(CLOCK_MONOTONIC, &curtime);
+	for (d = 0; d < rs->nnm_desc; d++) {
+		nm_desc = rs->nm_desc[d];
+		nifp = nm_desc->nifp;
+		for (i = nm_desc->first_rx_ring; i <= nm_desc->last_rx_ring; i++) {
 
-	nifp = iface->nm_desc->nifp;
-	for (i = iface->nm_desc->first_rx_ring;
-	    i <= iface->nm_desc->last_rx_ring; i++) {
-
-		rxring = NETMAP_RXRING(nifp, i);
-		if (nm_ring_empty(rxring))
-			continue;
+			rxring = NETMAP_RXRING(nifp, i);
+			if (nm_ring_empty(rxring))
+				continue;
 
-		cur = rxring->cur;
-		for (n = nm_ring_space(rxring); n > 0; n--, cur = nm_ring_next(rxring, cur)) {
-			/* receive packet */
-			buf = NETMAP_BUF(rxring, rxring->slot[cur].buf_idx);
-			len = rxring->slot[cur].len;
+			cur = rxring->cur;
+			for (n = nm_ring_space(rxring); n > 0; ) {
+				for (nbatch = 0; (nbatch < RX_BATCH) && (n > 0); nbatch++, n--) {
+					buf[nbatch] = NETMAP_BUF(rxring, rxring->slot[cur].buf_idx);
+					len[nbatch] = rxring->slot[cur].len;
+					rxts[nbatch] = tsc_read();
+					__builtin_prefetch(buf[nbatch] + len[nbatch] - sizeof(struct seqdata));
+					cur = nm_ring_next(rxring, cur);
+				}
+				receive_batch(rs, buf, len, rxts, nbatch);
+			}
 
-			receive_packet(ifno, &curtime, buf, len);
+			rxring->head = rxring->cur = cur;
 		}
-
-		rxring->head = rxring->cur = cur;
 	}
 #elif defined(USE_AF_XDP)
-	unsigned int i, npkts;
-	struct timespec curtime;
+	unsigned int i, npkts, nbatch;
+	struct timespec rt;
 	struct ax_rx_handle handle;
+	uint64_t tsc0, ns0;
 
-	npkts = ax_wait_for_packets(iface->ax_desc, &handle);
+	npkts = ax_wait_for_packets(rs->ax_desc, &handle);
 	if (npkts == 0)
 		return;
 
-	clock_gettime(CLOCK_MONOTONIC, &curtime);
+	tsc0 = ns0 = 0;
+	if (rs->rxts) {
+		clock_gettime(CLOCK_REALTIME, &rt);
+		tsc0 = tsc_read();
+		ns0 = rt.tv_sec * 1000000000ULL + rt.tv_nsec;
+	}
+
+	for (i = 0; i < npkts; ) {
+		for (nbatch = 0; (nbatch < RX_BATCH) && (i < npkts); nbatch++, i++) {
+			uint32_t framelen;
 
-	for (i = 0; i < npkts; i++) {
-		char *buf;
-		uint32_t len;
+			buf[nbatch] = ax_get_rx_buf(rs->ax_desc, &framelen, &handle);
+			len[nbatch] = framelen;
+			rxts[nbatch] = rx_timestamp_xdp(rs, buf[nbatch], tsc0, ns0);
+			__builtin_prefetch(buf[nbatch] + framelen - sizeof(struct seqdata));
+			ax_rx_handle_advance(&handle);
+		}
+		receive_batch(rs, buf, len, rxts, nbatch);
+	}
+
+	ax_complete_rx(rs->ax_desc, npkts);
+#endif
+}
+
+/*
+ * --burst-train. give credit of a train of back-to-back packets every
+ * interval on TSC, instead of the credit per tick by sighandler_alrm().
+ * transmit_pps caps the average rate by stretching the interval.
+ */
+static void
+interface_train(int ifno)
+{
+	struct interface *iface = &interface[ifno];
+	uint64_t now, interval, cap;
+	uint32_t pps, x;
+
+	now = tsc_read();
+	if (now < iface->train_next)
+		return;
+
+	pps = iface->transmit_pps;
+	if (!iface->transmit_enable || (pps == 0))
+		return;
+
+	interval = (uint64_t)opt_train_usec * tsc_hz / 1000000;
+	cap = (uint64_t)opt_train_npkt * tsc_hz / pps;
+	if (interval < cap)
+		interval = cap;
 
-		buf = ax_get_rx_buf(iface->ax_desc, &len, &handle);
+	if ((x = atomic_swap_32(&iface->transmit_txhz, opt_train_npkt)) != 0)
+		atomic_add_64(&iface->stats.tx_underrun, x);
+
+	/* don't catch up with back-to-back trains if late */
+	iface->train_next += interval;
+	if (iface->train_next < now)
+		iface->train_next = now + interval;
+}
 
-		receive_packet(ifno, &curtime, buf, len);
+/*
+ * --streams. pick due packets of streams in order of departure time,
+ * and give the credit to build them. the stream of each packet is
+ * queued to streamdue[] for packet_generator().
+ */
+static void
+interface_stream_schedule(int ifno)
+{
+	struct interface *iface = &interface[ifno];
+	struct stream *stream;
+	uint64_t now, late;
+	unsigned int i, n, skip;
 
-		ax_rx_handle_advance(&handle);
+	if (!iface->transmit_enable) {
+		iface->stream_epoch = 0;
+		return;
 	}
 
-	ax_complete_rx(iface->ax_desc, npkts);
-#endif
+	now = tsc_read();
+	if (iface->stream_epoch == 0) {
+		/* (re)start. all streams begin from their start time */
+		iface->stream_epoch = now;
+		iface->streamsched.n = 0;
+		iface->streamdue_head = iface->streamdue_n = 0;
+		atomic_swap_32(&iface->transmit_txhz, 0);
+		for (i = 0; i < nstream; i++) {
+			stream = &streams[i];
+			if (stream->pps == 0)
+				continue;
+			stream->gap = MAX(tsc_hz / stream->pps, 1);
+			stream->next = now + stream->start * tsc_hz;
+			streamsched_push(&iface->streamsched, stream);
+		}
+	}
+
+	late = tsc_hz / 1000;
+	for (n = 0; (n < opt_npkt_sync) && (iface->streamdue_n < STREAM_DUEMAX); n++) {
+		if (((stream = streamsched_top(&iface->streamsched)) == NULL) ||
+		    (stream->next > now))
+			break;
+
+		iface->streamdue[(iface->streamdue_head + iface->streamdue_n) % STREAM_DUEMAX] = stream;
+		iface->streamdue_n++;
+
+		stream->next += stream->gap;
+		if (stream->next + late < now) {
+			/* too late to catch up. skip to now */
+			skip = (now - stream->next) / stream->gap;
+			stream->stats.tx_underrun += skip;
+			stream->next += (uint64_t)skip * stream->gap;
+		}
+
+		if ((stream->stop != 0) &&
+		    (stream->next >= iface->stream_epoch + stream->stop * tsc_hz))
+			streamsched_pop(&iface->streamsched);
+		else
+			streamsched_update(&iface->streamsched);
+	}
+
+	if (n > 0)
+		atomic_fetchadd_32(&iface->transmit_txhz, n);
 }
 
 int
@@ -1863,11 +3489,13 @@ interface_transmit(int ifno)
 	int sentpkttype;
 
 	nifp = iface->nm_desc->nifp;
+	if (opt_train_npkt != 0)
+		interface_train(ifno);
+	if ((nstream != 0) && (ifno == 1))
+		interface_stream_schedule(ifno);
 	npkt = interface_need_transmit(ifno);
 	npkt = MIN(npkt, opt_npkt_sync);
 
-	clock_gettime(CLOCK_MONOTONIC, &currenttime_tx);
-
 #ifdef USE_MULTI_TX_QUEUE
 	for (i = iface->nm_desc->first_tx_ring;
 	    i <= iface->nm_desc->last_tx_ring; i++) {
@@ -1904,13 +3532,15 @@ interface_transmit(int ifno)
 	int sentpkttype;
 	uint32_t idx;
 
+	if (opt_train_npkt != 0)
+		interface_train(ifno);
+	if ((nstream != 0) && (ifno == 1))
+		interface_stream_schedule(ifno);
 	npkt = interface_need_transmit(ifno);
 	npkt = MIN(npkt, opt_npkt_sync);
 
 	idx = ax_prepare_tx(iface->ax_desc, &npkt);
 
-	clock_gettime(CLOCK_MONOTONIC, &currenttime_tx);
-
 	for (i = 0; i < npkt; i++) {
 		char *buf;
 		uint32_t *lenp;
@@ -1927,7 +3557,7 @@ interface_transmit(int ifno)
 		ifstats->tx++;
 	}
 
-	ax_complete_tx(iface->ax_desc, npkt);
+	ax_complete_tx(iface->ax_desc, i);
 #endif
 
 	return 0;
@@ -1965,6 +3595,7 @@ interface_statistics_json(int ifno, char *buf, int buflen)
 	    "{"
 	    "\"interface\":\"%s\","
 	    "\"packetsize\":%"PRIu32","
+	    "\"imix\":\"%s\","
 
 	    "\"address\":\"%s\","
 	    "\"macaddr\":\"%s\","
@@ -1984,6 +3615,7 @@ interface_statistics_json(int ifno, char *buf, int buflen)
 	    "\"RXdup\":%"PRIu64","
 	    "\"RXreorder\":%"PRIu64","
 	    "\"RXoutofrange\":%"PRIu64","
+	    "\"RXflowcheck\":%"PRIu64","
 
 	    "\"RXdrop-perflow\":%"PRIu64","
 	    "\"RXdup-perflow\":%"PRIu64","
@@ -1997,14 +3629,18 @@ interface_statistics_json(int ifno, char *buf, int buflen)
 	    "\"RXicmpunreach\":%"PRIu64","
 	    "\"RXicmpredirect\":%"PRIu64","
 	    "\"RXicmpother\":%"PRIu64","
+	    "\"RXxdpreply\":%"PRIu64","
+	    "\"RXxdppass\":%"PRIu64","
 
 	    "\"latency-max\":%.8f,"
 	    "\"latency-min\":%.8f,"
-	    "\"latency-avg\":%.8f"
+	    "\"latency-avg\":%.8f,"
+	    "\"RXtimestamp\":\"%s\""
 	    "}",
 
 	    iface->ifname,
 	    iface->pktsize,
+	    (iface->imix != NULL) ? iface->imix->name : "",
 	    buf_ipaddr,
 	    buf_eaddr,
 	    buf_gwaddr,
@@ -2022,6 +3658,7 @@ interface_statistics_json(int ifno, char *buf, int buflen)
 	    ifstats->rx_dup,
 	    ifstats->rx_reorder,
 	    ifstats->rx_outofrange,
+	    ifstats->rx_flowcheck,
 
 	    ifstats->rx_seqdrop_flow,
 	    ifstats->rx_dup_flow,
@@ -2035,14 +3672,59 @@ interface_statistics_json(int ifno, char *buf, int buflen)
 	    ifstats->rx_icmpunreach,
 	    ifstats->rx_icmpredirect,
 	    ifstats->rx_icmpother,
+	    ifstats->rx_xdpreply,
+	    ifstats->rx_xdppass,
 
 	    ifstats->latency_max,
 	    ifstats->latency_min,
-	    ifstats->latency_avg
+	    ifstats->latency_avg,
+	    rx_timestamp_method(ifno)
+	);
+}
+
+static int
+stream_statistics_json(unsigned int i, char *buf, int buflen)
+{
+	struct stream *stream = &streams[i];
+	struct stream_statistics *sstats = &stream->stats;
+
+	return snprintf(buf, buflen,
+	    "{"
+	    "\"stream\":\"%s\","
+	    "\"packetsize\":%u,"
+	    "\"imix\":\"%s\","
+	    "\"proto\":\"%s\","
+	    "\"dscp\":%d,"
+	    "\"TXppsconfig\":%"PRIu32","
+	    "\"TX\":%"PRIu64","
+	    "\"RX\":%"PRIu64","
+	    "\"TXpps\":%"PRIu64","
+	    "\"RXpps\":%"PRIu64","
+	    "\"TXbyte\":%"PRIu64","
+	    "\"RXbyte\":%"PRIu64","
+	    "\"TXunderrun\":%"PRIu64","
+	    "\"latency-max\":%.8f,"
+	    "\"latency-avg\":%.8f"
+	    "}",
+	    stream->name,
+	    stream->pktsize,
+	    (stream->imix != NULL) ? stream->imix->name : "",
+	    (stream->proto == IPPROTO_TCP) ? "tcp" : "udp",
+	    stream->dscp,
+	    stream->pps,
+	    sstats->tx,
+	    sstats->rx,
+	    sstats->tx_delta,
+	    sstats->rx_delta,
+	    sstats->tx_byte,
+	    sstats->rx_byte,
+	    sstats->tx_underrun,
+	    sstats->latency_max,
+	    (sstats->latency_npkt != 0) ? sstats->latency_sum / sstats->latency_npkt : 0.0
 	);
 }
 
-#define JSON_BUFSIZE	(1024 * 16)
+#define JSON_BUFSIZE	(1024 * 64)
 char jsonbuf_x[4][JSON_BUFSIZE];
 
 static char *
@@ -2066,9 +3748,23 @@ build_json_statistics(unsigned int *lenp)
 		if (len <= JSON_BUFSIZE) {
 			jsonbuf[len++] = ',';
 			len += interface_statistics_json(1, jsonbuf + len, JSON_BUFSIZE - len);
-			len += snprintf(jsonbuf + len, JSON_BUFSIZE - len, "]}\n");
+			len += snprintf(jsonbuf + len, JSON_BUFSIZE - len, "]");
+		}
+	}
+	if ((nstream != 0) && (len <= JSON_BUFSIZE)) {
+		unsigned int i;
+
+		len += snprintf(jsonbuf + len, JSON_BUFSIZE - len, ",\"streams\":[");
+		for (i = 0; (i < nstream) && (len < JSON_BUFSIZE); i++) {
+			if (i != 0)
+				jsonbuf[len++] = ',';
+			len += stream_statistics_json(i, jsonbuf + len, JSON_BUFSIZE - len);
 		}
+		if (len <= JSON_BUFSIZE)
+			len += snprintf(jsonbuf + len, JSON_BUFSIZE - len, "]");
 	}
+	if (len <= JSON_BUFSIZE)
+		len += snprintf(jsonbuf + len, JSON_BUFSIZE - len, "}\n");
 	*lenp = len;
 
 	return jsonbuf;
@@ -2098,6 +3794,11 @@ sighandler_alrm(int signo __unused)
 
 	clock_gettime(CLOCK_MONOTONIC, &currenttime_main);
 
+	for (i = 0; i < 2; i++) {
+		if (interface[i].opened)
+			rxshard_merge(i);
+	}
+
 	if (opt_time) {
 		struct timespec delta;
 		timespecsub(&currenttime_main, &starttime_tx, &delta);
@@ -2130,11 +3831,14 @@ sighandler_alrm(int signo __unused)
 			    seqcheck_outofrangecount(iface->seqchecker);
 
 			ifstats->rx_seqdrop_flow =
-			    seqcheck_dropcount(iface->seqchecker_flowtotal);
+			    rxshard_flowtotal(i, seqcheck_dropcount);
 			ifstats->rx_dup_flow =
-			    seqcheck_dupcount(iface->seqchecker_flowtotal);
+			    rxshard_flowtotal(i, seqcheck_dupcount);
 			ifstats->rx_reorder_flow =
-			    seqcheck_reordercount(iface->seqchecker_flowtotal);
+			    rxshard_flowtotal(i, seqcheck_reordercount);
+#ifdef USE_AF_XDP
+			interface_xdp_stats(i);
+#endif
 
 
 			/* update delta */
@@ -2185,6 +3889,15 @@ sighandler_alrm(int signo __unused)
 			ifstats->rx_reorder_flow_last = ifstats->rx_reorder_flow;
 		}
 
+		for (i = 0; i < (int)nstream; i++) {
+			struct stream_statistics *sstats = &streams[i].stats;
+
+			sstats->tx_delta = sstats->tx - sstats->tx_last;
+			sstats->tx_last = sstats->tx;
+			sstats->rx_delta = sstats->rx - sstats->rx_last;
+			sstats->rx_last = sstats->rx;
+		}
+
 		/* need to update statistics string buffer in json? */
 		if ((logfd >= 0) || (webserv_need_broadcast() != 0)) {
 			char *buf;
@@ -2194,10 +3907,18 @@ sighandler_alrm(int signo __unused)
 		}
 	}
 
+	/* --burst-train is scheduled by TX thread itself */
+	if (opt_train_npkt != 0)
+		return;
+
 	/* check and reset tx pps counter atomically */
 	for (i = 0; i < 2; i++) {
 		struct interface *iface = &interface[i];
 		struct interface_statistics *ifstats = &iface->stats;
+
+		/* --streams are scheduled by TX thread itself */
+		if ((nstream != 0) && (i == 1))
+			continue;
 		x = ((uint64_t)iface->transmit_pps * ((uint64_t)nhz + 1) / pps_hz) -
 		    ((uint64_t)iface->transmit_pps * ((uint64_t)nhz) / pps_hz);
 		if (iface->transmit_enable &&
@@ -2214,6 +3935,7 @@ quit(int fromsig)
 {
 	static int quitting = 0;
 	int status = fromsig ? EXIT_FAILURE : EXIT_SUCCESS;
+	unsigned int i;
 
 	if (quitting) {
 		for (;;)
@@ -2236,16 +3958,19 @@ quit(int fromsig)
 
 	if (!opt_txonly) {
 		pthread_join(txthread0, NULL);
-		pthread_join(rxthread0, NULL);
+		for (i = 0; i < opt_rxthreads; i++)
+			pthread_join(rxshard[0][i].thread, NULL);
 	}
 	if (!opt_rxonly) {
 		pthread_join(txthread1, NULL);
-		pthread_join(rxthread1, NULL);
+		for (i = 0; i < opt_rxthreads; i++)
+			pthread_join(rxshard[1][i].thread, NULL);
 	}
 	interface_close(0);
 	interface_close(1);
 
-	if (opt_rfc2544) {
+	/* results of a run from web are not for this terminal */
+	if (opt_rfc2544 && !rfc2544_web) {
 		rfc2544_showresult();
 		if (opt_rfc2544_output_json != NULL)
 			rfc2544_showresult_json(opt_rfc2544_output_json);
@@ -2295,6 +4020,9 @@ usage(void)
 	       "usage: ipgen [options]\n"
 	       "	[-V <vlanid>]			use VLAN\n"
 	       "	[-P]				use PPPoE\n"
+	       "	[--encap <layer>[/<layer>...]]	prebuilt encapsulation. vlan:<id> (QinQ if stacked),\n"
+	       "					mpls:<label>[.<label>...], vxlan:<vni>,<remote>,\n"
+	       "					gre:<remote>[,<key>] or gtpu:<teid>,<remote>\n"
 	       "	-R <ifname>,<gateway-address>[,<own-address>[/<prefix>]]\n"
 	       "					set RX interface\n"
 	       "\n"
@@ -2305,12 +4033,28 @@ usage(void)
 	       "\n"
 	       "	-H <Hz>				specify control Hz (default: 1000)\n"
 	       "	-n <npkt>			sync transmit per <npkt>\n"
+	       "	--rx-threads <n>		receive by <n> threads sharing RX rings (netmap) or\n"
+	       "					RX queues 0 to <n>-1 (AF_XDP) (default: 1)\n"
+	       "	--xdp-prog <file>		XDP program object for AF_XDP (default: %s)\n"
+	       "	--xdp-count			count and check sequence of test packets in XDP\n"
+	       "					program, without latency and per-flow statistics\n"
+	       "	--xdp-rx-batch <n>		receive up to <n> frames at once on AF_XDP (default: 64)\n"
 	       "\n"	/* size and speed */
 	       "	-s <size>			specify pktsize (IPv4:46-1500, IPv6:tcp:54-1500)\n"
 	       "	-p <pps>			specify pps\n"
+	       "	--imix <mix>			mix packet sizes. simple (7:4:1), tolly, or\n"
+	       "					<size>:<weight>[,<size>:<weight>...] (size as -s)\n"
 	       "\n"	/* L1 or L2 */
 	       "	--ipg				adapt IPG (Inter Packet Gap)\n"
 	       "	--burst				don't set IPG (default)\n"
+	       "	--burst-train <npkt>,<usec>	send <npkt> packets back-to-back every <usec>.\n"
+	       "					-p caps the average pps\n"
+	       "	--streams <file>		transmit streams defined in <file>, one per line:\n"
+	       "					<name> [pps=] [size=|imix=] [proto=udp|tcp] [dscp=]\n"
+	       "					[start=] [stop=] [flow=<src>,<dst>|flowlist=<file>]\n"
+	       "	--template <file>		transmit packets of header stack or raw hex in <file>,\n"
+	       "					with per packet field modifiers (mod <field> inc|dec|\n"
+	       "					random|list|flow). packet size is fixed by <file>\n"
 	       "	--l1-bps			include IFG/PREAMBLE/FCS for bps calculation\n"
 	       "	--l2-bps			don't include IFG/PREAMBLE for bps calculation (default)\n"
 	       "\n"	/* L3 */
@@ -2319,9 +4063,32 @@ usage(void)
 	       "	--daddr <begin>[-<end>]		use destination address range (default: RX interface address)\n"
 	       "	--sport <begin>[-<end>]		use source port range (default: 9)\n"
 	       "	--dport <begin>[-<end>]		use destination port range (default: 9)\n"
-	       "	--flowlist <file>		read flowlist from file\n"
+	       "	--vlan <begin>[-<end>]		use VLAN ID range per flow instead of -V\n"
+	       "	--svlan <begin>[-<end>]		use S-VLAN ID range per flow for QinQ (with --vlan)\n"
+	       "	--flowlist <file>		read flowlist from file (text or compiled)\n"
+	       "	--flowlist-compile <file>	compile --flowlist into binary <file> and exit\n"
+	       "	--rss-generate <file>		write flowlist balanced over RSS queues of DUT and exit.\n"
+	       "					candidates are --saddr/--daddr/--sport/--dport or --flowlist,\n"
+	       "					and -F <nflow> flows are written (default: 64 per queue)\n"
+	       "	--rss-queues <n>		number of RSS queues of DUT (default: 1)\n"
+	       "	--rss-key <hex>			RSS key of DUT (default: Microsoft RSS key)\n"
+	       "	--rss-l3			DUT hashes only addresses (default: addresses and ports)\n"
+	       "	--rss-reta <size>		size of RSS indirection table (default: 128)\n"
+	       "	--rss-weight <w0>,<w1>,...	relative number of flows per queue to skew load\n"
 	       "	--flowsort			sort flow list\n"
 	       "	--flowdump			dump flow list\n"
+	       "	--flowlazy			generate flows on the fly without flow table\n"
+	       "	--flowmac-md5			derive MAC address of flows by MD5 (compatible with older versions)\n"
+	       "	--flowdist <dist>		flow selection. rr (default), uniform, zipf[:<s>] or weight\n"
+	       "	--random <field>[=<begin>-<end>]\n"
+	       "					randomize field per packet. saddr, daddr, sport, dport,\n"
+	       "					flowlabel, dscp or ttl. range of address and port defaults\n"
+	       "					to --saddr, --daddr, --sport and --dport\n"
+	       "	--seed <seed>			seed of random numbers to reproduce packets\n"
+	       "	--flowcheck			check that received packets have the tuple of the flow\n"
+	       "	--xlat-src <prefix>/<len>	source address expected to be translated by DUT\n"
+	       "	--xlat-dst <prefix>/<len>	destination address expected to be translated by DUT.\n"
+	       "					upper <len> bits are replaced with <prefix> (implies --flowcheck)\n"
 	       "	-F <nflow>			limit <nflow>\n"
 	       "\n"	/* L4 */
 	       "	--tcp				generate TCP packet\n"
@@ -2337,6 +4104,7 @@ usage(void)
 	       "	--rfc2544-trial-duration <sec>	rfc2544 trial duration time (default: 60)\n"
 	       "	--rfc2544-pktsize <size>[,<size>...]]\n"
 	       "					test only specified pktsize. (default: 46,110,494,1006,1262,1390,1500)\n"
+	       "					\"imix\" tests --imix. (default with --imix: imix)\n"
 	       "	--rfc2544-output-json <file>	output rfc2544 results as json file format\n"
 	       "	--rfc2544-interval <sec>	interval time between rfc2544 trial (default: 0)\n"
 	       "	--rfc2544-warming-duration <sec>	warming time before rfc2544 trial (1-60, default: 1)\n"
@@ -2353,8 +4121,10 @@ usage(void)
 	       "	-X				packet generation benchmark\n"
 	       "	-XX				packet generation benchmark with memcpy\n"
 	       "	-XXX				packet generation benchmark with memcpy and cksum\n"
+	       "	--txpath-test			compare packets of specialized TX paths with generic one and exit\n"
 	       "	-D <file>			debug. dump all generated packets to <file> as tcpdump file format\n"
-	       "	-d				debug. dump unknown packet\n"
+	       "	-d				debug. dump unknown packet\n",
+	       XDP_PROG
 	);
 
 	exit(1);
@@ -2396,16 +4166,41 @@ tx_thread_main(void *arg)
 
 	(void)pthread_sigmask(SIG_BLOCK, &used_sigset, NULL);
 
+	flowqs[FLOWQS_TX(ifno)].active = 1;
 	clock_gettime(CLOCK_MONOTONIC, &starttime_tx);
 	while (do_quit == 0) {
+		flowqs_quiescent(FLOWQS_TX(ifno));
+		if (iface->need_reset_perflow) {
+			iface->need_reset_perflow = 0;
+			j = iface->nperflow;
+			for (i = 0; i < j; i++) {
+				PERFLOW_SEQUENCE_TX(iface, i) = 0;
+				seqcheck_clear(PERFLOW_SEQCHECKER(iface, i));
+			}
+		}
 		if (iface->need_reset_statistics) {
 			iface->need_reset_statistics = 0;
 			memset(&iface->stats, 0, sizeof(iface->stats));
 			seqcheck_clear(iface->seqchecker);
 			seqcheck_clear(iface->seqchecker_flowtotal);
-			j = get_flownum(ifno);
+			j = iface->nperflow;
 			for (i = 0; i < j; i++) {
-				seqcheck_clear(iface->seqchecker_perflow[i]);
+				seqcheck_clear(PERFLOW_SEQCHECKER(iface, i));
+			}
+			for (i = 1; i < (int)opt_rxthreads; i++)
+				seqcheck_clear(rxshard[ifno][i].seqchecker_flowtotal);
+#ifdef USE_AF_XDP
+			iface->xdp_seqdrop = iface->xdp_dup = 0;
+			iface->xdp_reorder = iface->xdp_outofrange = 0;
+#endif
+			for (i = 0; (opt_rxthreads > 1) && (i < (int)opt_rxthreads); i++) {
+				memset(&rxshard[ifno][i].shardstats, 0, sizeof(rxshard[ifno][i].shardstats));
+				if (rxshard[ifno][i].sstats != NULL)
+					memset(rxshard[ifno][i].sstats, 0, sizeof(struct stream_statistics) * nstream);
+			}
+			if (ifno == 1) {
+				for (i = 0; i < (int)nstream; i++)
+					memset(&streams[i].stats, 0, sizeof(streams[i].stats));
 			}
 		}
 
@@ -2414,6 +4209,7 @@ tx_thread_main(void *arg)
 		ioctl(iface->nm_desc->fd, NIOCTXSYNC, NULL);
 #endif
 	}
+	flowqs[FLOWQS_TX(ifno)].active = 0;
 
 	return NULL;
 }
@@ -2421,26 +4217,47 @@ tx_thread_main(void *arg)
 static void *
 rx_thread_main(void *arg)
 {
-	int ifno = *(int *)arg;
-	struct interface *iface = &interface[ifno];
-	struct pollfd pollfd[1];
-	int rc;
+	struct rxshard *rs = arg;
+	struct pollfd *pollfd;
+	unsigned int i, nfd;
+	int rc, timeout;
 
 	(void)pthread_sigmask(SIG_BLOCK, &used_sigset, NULL);
 
 	/* setup poll */
-	memset(pollfd, 0, sizeof(pollfd));
 #ifdef USE_NETMAP
-	pollfd[0].fd = iface->nm_desc->fd;
+	nfd = rs->nnm_desc;
 #elif defined(USE_AF_XDP)
-	pollfd[0].fd = ax_get_fd(iface->ax_desc);
+	nfd = 1;
 #endif
+	pollfd = calloc(nfd, sizeof(struct pollfd));
+	if (pollfd == NULL) {
+		fprintf(stderr, "cannot allocate memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nfd; i++) {
+#ifdef USE_NETMAP
+		pollfd[i].fd = rs->nm_desc[i]->fd;
+#elif defined(USE_AF_XDP)
+		pollfd[i].fd = ax_get_fd(rs->ax_desc);
+#endif
+	}
+
+	/*
+	 * sequences from the other shards are checked even if no packet arrives.
+	 * with --xdp-count, test frames don't arrive but are to be settled.
+	 */
+	timeout = ((opt_rxthreads > 1) || opt_xdp_count) ? 1 : 100;
 
+	flowqs[FLOWQS_RX(rs->ifno, rs->id)].active = 1;
 	while (do_quit == 0) {
-		pollfd[0].events = POLLIN;
-		pollfd[0].revents = 0;
+		flowqs_quiescent(FLOWQS_RX(rs->ifno, rs->id));
+		for (i = 0; i < nfd; i++) {
+			pollfd[i].events = POLLIN;
+			pollfd[i].revents = 0;
+		}
 
-		rc = poll(pollfd, 1, 100);
+		rc = poll(pollfd, nfd, timeout);
 		if (rc < 0) {
 			if (errno == EINTR)
 				continue;
@@ -2449,9 +4266,17 @@ rx_thread_main(void *arg)
 			continue;
 		}
 
-		if (pollfd[0].revents & POLLIN)
-			interface_receive(ifno);
+		if (rc > 0)
+			interface_receive(rs);
+		if (opt_rxthreads > 1)
+			rxshard_drain(rs);
+#ifdef USE_AF_XDP
+		if ((rs->id == 0) && (interface[rs->ifno].xdpcount != NULL))
+			interface_xdp_scan(rs);
+#endif
 	}
+	flowqs[FLOWQS_RX(rs->ifno, rs->id)].active = 0;
+	free(pollfd);
 
 	return NULL;
 }
@@ -2502,6 +4327,13 @@ genscript_play(void)
 				setpktsize(1, genitem->pktsize);
 				setpps(1, genitem->pps);
 				break;
+			case GENITEM_CMD_FLOWADD:
+			case GENITEM_CMD_FLOWDEL:
+				if (flow_update(genitem->flowstr, genitem->cmd == GENITEM_CMD_FLOWADD) != 0)
+					logging("script: cannot %s flow: %s",
+					    (genitem->cmd == GENITEM_CMD_FLOWADD) ? "add" : "delete",
+					    genitem->flowstr);
+				break;
 			}
 
 		} while (period_left == 0);
@@ -2530,7 +4362,7 @@ control_tty_handler(struct itemlist *itemlist)
 	sigprocmask(SIG_UNBLOCK, &sigalrmset, NULL);
 #endif
 
-	if (opt_rfc2544) {
+	if (rfc2544_running()) {
 		if ((c == 'q') || (c == 'Q'))
 			quit(false);
 
@@ -2578,7 +4410,8 @@ control_tty_handler(struct itemlist *itemlist)
  * RFC2544 test sequence
  */
 struct rfc2544_work {
-	unsigned int pktsize;
+	unsigned int pktsize;		/* average size if imix */
+	struct imix *imix;
 	unsigned int minpps;
 	unsigned int maxpps;
 	unsigned int ppsresolution;
@@ -2609,6 +4442,26 @@ typedef enum {
 	RFC2544_DONE
 } rfc2544_state_t;
 
+static const char *rfc2544_statename[] = {
+	[RFC2544_START]		= "START",
+	[RFC2544_WARMUP0]	= "WARMUP",
+	[RFC2544_WARMUP]	= "WARMUP",
+	[RFC2544_RESETTING0]	= "RESETTING",
+	[RFC2544_RESETTING]	= "RESETTING",
+	[RFC2544_INTERVAL0]	= "INTERVAL",
+	[RFC2544_INTERVAL]	= "INTERVAL",
+	[RFC2544_WARMING0]	= "WARMING",
+	[RFC2544_WARMING]	= "WARMING",
+	[RFC2544_MEASURING0]	= "MEASURING",
+	[RFC2544_MEASURING]	= "MEASURING",
+	[RFC2544_DONE0]		= "DONE",
+	[RFC2544_DONE]		= "DONE"
+};
+
+static rfc2544_state_t rfc2544_state = RFC2544_START;
+static uint64_t rfc2544_maxlinkspeed;
+static int rfc2544_keepalive = 0;	/* don't quit when done. started from web */
+
 static void
 rfc2544_add_test(uint64_t maxlinkspeed, unsigned int pktsize)
 {
@@ -2631,10 +4484,25 @@ rfc2544_add_test(uint64_t maxlinkspeed, unsigned int pktsize)
 	rfc2544_ntest++;
 }
 
+/* --imix as a test. pps is searched as same as a single size */
+static void
+rfc2544_add_imix_test(uint64_t maxlinkspeed, struct imix *imix)
+{
+	u_int ntest = rfc2544_ntest;
+
+	rfc2544_add_test(maxlinkspeed, imix_avgsize(imix, min_pktsize) + 0.5);
+	if (rfc2544_ntest > ntest)
+		rfc2544_work[ntest].imix = imix;
+}
+
 static void
 rfc2544_load_default_test(uint64_t maxlinkspeed)
 {
 	rfc2544_ntest = 0;	/* clear table */
+	if (opt_imix != NULL) {
+		rfc2544_add_imix_test(maxlinkspeed, opt_imix);
+		return;
+	}
 	rfc2544_add_test(maxlinkspeed, 64 - ETHHDRSIZE - FCS);
 	rfc2544_add_test(maxlinkspeed, 128 - ETHHDRSIZE - FCS);
 	rfc2544_add_test(maxlinkspeed, 512 - ETHHDRSIZE - FCS);
@@ -2650,10 +4518,194 @@ rfc2544_calc_param(uint64_t maxlinkspeed)
 	u_int i;
 
 	for (i = 0; i < rfc2544_ntest; i++) {
+		rfc2544_work[i].minpps = 1;
 		rfc2544_work[i].maxpps = maxlinkspeed / 8 / (rfc2544_work[i].pktsize + 18 + DEFAULT_IFG + DEFAULT_PREAMBLE);
 	}
 }
 
+int
+rfc2544_running(void)
+{
+	return opt_rfc2544 && (rfc2544_state != RFC2544_DONE);
+}
+
+const char *
+rfc2544_getstate(void)
+{
+	if (!opt_rfc2544)
+		return "IDLE";
+	return rfc2544_statename[rfc2544_state];
+}
+
+/*
+ * start/stop rfc2544 test from web interface.
+ * the test sequence is driven by control_interval() as same as --rfc2544.
+ */
+int
+rfc2544_start(void)
+{
+	if (rfc2544_running() || (genscript != NULL))
+		return -1;
+	if (rfc2544_ntest == 0)
+		return -1;
+
+	rfc2544_calc_param(rfc2544_maxlinkspeed);
+	rfc2544_nthtest = 0;
+	rfc2544_state = RFC2544_START;
+	rfc2544_keepalive = 1;
+	if (!opt_rfc2544)
+		rfc2544_web = 1;
+	opt_rfc2544 = 1;
+
+	return 0;
+}
+
+int
+rfc2544_stop(void)
+{
+	if (!rfc2544_running())
+		return -1;
+
+	transmit_set(1, 0);
+	logging("rfc2544 test stopped");
+	rfc2544_keepalive = 1;
+	rfc2544_state = RFC2544_DONE;
+
+	return 0;
+}
+
+/*
+ * set rfc2544 parameter. name is same as --rfc2544-<name> option.
+ * boolean option takes "0" or "1".
+ */
+int
+rfc2544_setparam(const char *name, const char *value)
+{
+	char buf[128];
+	char *p, *save, *tofree;
+	double d;
+	long n;
+	int pktsize[RFC2544_MAXTESTNUM];
+	int i, npktsize;
+
+	if (rfc2544_running())
+		return -1;
+
+	d = strtod(value, &p);
+	if ((*value == '\0') || ((*p != '\0') && (strcmp(name, "pktsize") != 0)))
+		return -1;
+	n = (long)d;
+
+	if (strcmp(name, "tolerable-error-rate") == 0) {
+		if ((d > 100.0) || (d < 0.0))
+			return -1;
+		opt_rfc2544_tolerable_error_rate = d;
+	} else if (strcmp(name, "pps-resolution") == 0) {
+		if ((d > 100.0) || (d < 0.0))
+			return -1;
+		opt_rfc2544_ppsresolution = d;
+	} else if (strcmp(name, "trial-duration") == 0) {
+		if (n < 3)
+			return -1;
+		opt_rfc2544_trial_duration = n;
+	} else if (strcmp(name, "interval") == 0) {
+		if ((n < 0) || (n > 60))
+			return -1;
+		opt_rfc2544_interval = n;
+	} else if (strcmp(name, "warming-duration") == 0) {
+		if ((n < 1) || (n > 60))
+			return -1;
+		opt_rfc2544_warming_duration = n;
+	} else if (strcmp(name, "slowstart") == 0) {
+		opt_rfc2544_slowstart = (n != 0);
+	} else if (strcmp(name, "no-early-finish") == 0) {
+		opt_rfc2544_early_finish = (n == 0);
+	} else if (strcmp(name, "pktsize") == 0) {
+		/* check all sizes before replacing the test table */
+		tofree = strdup(value);
+		if (tofree == NULL)
+			return -1;
+		save = NULL;
+		npktsize = 0;
+		while ((p = getword(tofree, ',', &save, buf, sizeof(buf))) != NULL) {
+			if (npktsize >= RFC2544_MAXTESTNUM) {
+				free(tofree);
+				return -1;
+			}
+			if ((strcmp(buf, "imix") == 0) && (opt_imix != NULL))
+				pktsize[npktsize] = 0;
+			else
+				pktsize[npktsize] = atoi(buf);
+			if ((pktsize[npktsize] != 0) &&
+			    ((pktsize[npktsize] < 46) || (pktsize[npktsize] > 1500))) {
+				free(tofree);
+				return -1;
+			}
+			npktsize++;
+		}
+		free(tofree);
+		if (npktsize == 0)
+			return -1;
+
+		rfc2544_ntest = 0;	/* clear table */
+		for (i = 0; i < npktsize; i++) {
+			if (pktsize[i] == 0)
+				rfc2544_add_imix_test(rfc2544_maxlinkspeed, opt_imix);
+			else
+				rfc2544_add_test(rfc2544_maxlinkspeed, pktsize[i]);
+		}
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+rfc2544_param_json(FILE *fp)
+{
+	u_int i;
+
+	fprintf(fp, "{");
+	fprintf(fp, "\"tolerable-error-rate\":%.4f,", opt_rfc2544_tolerable_error_rate);
+	fprintf(fp, "\"trial-duration\":%d,", opt_rfc2544_trial_duration);
+	fprintf(fp, "\"pps-resolution\":%.4f,", opt_rfc2544_ppsresolution);
+	fprintf(fp, "\"interval\":%d,", opt_rfc2544_interval);
+	fprintf(fp, "\"warming-duration\":%d,", opt_rfc2544_warming_duration);
+	fprintf(fp, "\"slowstart\":%d,", opt_rfc2544_slowstart);
+	fprintf(fp, "\"no-early-finish\":%d,", !opt_rfc2544_early_finish);
+	fprintf(fp, "\"pktsize\":\"");
+	for (i = 0; i < rfc2544_ntest; i++) {
+		if (rfc2544_work[i].imix != NULL)
+			fprintf(fp, "%simix", (i == 0) ? "" : ",");
+		else
+			fprintf(fp, "%s%u", (i == 0) ? "" : ",", rfc2544_work[i].pktsize);
+	}
+	fprintf(fp, "\"");
+	fprintf(fp, "}");
+}
+
+void
+rfc2544_status_json(FILE *fp)
+{
+	struct rfc2544_work *work;
+
+	fprintf(fp, "{");
+	fprintf(fp, "\"state\":\"%s\",", rfc2544_getstate());
+	fprintf(fp, "\"running\":%d,", rfc2544_running());
+	fprintf(fp, "\"ntest\":%u,", rfc2544_ntest);
+	fprintf(fp, "\"nthtest\":%u", rfc2544_nthtest);
+	if (rfc2544_running() && (rfc2544_nthtest < rfc2544_ntest)) {
+		work = &rfc2544_work[rfc2544_nthtest];
+		fprintf(fp, ",\"pktsize\":%u", work->pktsize);
+		fprintf(fp, ",\"curpps\":%u", work->curpps);
+		fprintf(fp, ",\"minpps\":%u", work->minpps);
+		fprintf(fp, ",\"maxpps\":%u", work->maxpps);
+		fprintf(fp, ",\"limitpps\":%u", work->limitpps);
+	}
+	fprintf(fp, "}");
+}
+
 void
 rfc2544_showresult(void)
 {
@@ -2750,7 +4802,10 @@ rfc2544_showresult(void)
 
 	for (i = 0; i < rfc2544_ntest; i++) {
 		struct rfc2544_work *work = &rfc2544_work[i];
-		printf("%8u |", work->pktsize + 18);
+		if (work->imix != NULL)
+			printf("%8s |", "imix");
+		else
+			printf("%8u |", work->pktsize + 18);
 
 		mbps = calc_mbps(work->pktsize, work->curpps);
 		for (j = 0; j < mbps / 20 / linkspeed; j++)
@@ -2780,7 +4835,10 @@ rfc2544_showresult(void)
 	for (i = 0; i < rfc2544_ntest; i++) {
 		struct rfc2544_work *work = &rfc2544_work[i];
 
-		printf("%8u |", work->pktsize + 18);
+		if (work->imix != NULL)
+			printf("%8s |", "imix");
+		else
+			printf("%8u |", work->pktsize + 18);
 
 		pps = work->curpps;
 		for (j = 0; j < pps / 20000 / linkspeed; j++)
@@ -2802,11 +4860,10 @@ rfc2544_showresult(void)
 }
 
 void
-rfc2544_showresult_json(char *filename)
+rfc2544_result_json(FILE *fp)
 {
 	double bps;
 	u_int i;
-	FILE *fp;
 
 	/*
 	 * [example]
@@ -2857,14 +4914,16 @@ rfc2544_showresult_json(char *filename)
 	 *
 	 */
 
-	fp = fopen(filename, "w");
 	fprintf(fp, "{");
 	fprintf(fp, "\"framesize\":{");
 	for (i = 0; i < rfc2544_ntest; i++) {
 		struct rfc2544_work *work = &rfc2544_work[i];
 		if (0 < i)
 			fprintf(fp, ",");
-		fprintf(fp, "\"%u\":", work->pktsize + 18);
+		if (work->imix != NULL)
+			fprintf(fp, "\"imix\":");
+		else
+			fprintf(fp, "\"%u\":", work->pktsize + 18);
 		fprintf(fp, "{");
 		bps = calc_bps(work->pktsize, work->curpps);
 		fprintf(fp, "\"bps\":\"%f\",", bps);
@@ -2874,6 +4933,19 @@ rfc2544_showresult_json(char *filename)
 	}
 	fprintf(fp, "}");
 	fprintf(fp, "}");
+}
+
+void
+rfc2544_showresult_json(char *filename)
+{
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		warn("%s", filename);
+		return;
+	}
+	rfc2544_result_json(fp);
 	fclose(fp);
 }
 
@@ -2938,7 +5010,7 @@ static void
 rfc2544_test(void)
 {
 	struct rfc2544_work *work = &rfc2544_work[rfc2544_nthtest];
-	static rfc2544_state_t state = RFC2544_START;
+	rfc2544_state_t state = rfc2544_state;
 	static struct timespec statetime;
 	int measure_done, do_down_pps;
 
@@ -2998,7 +5070,10 @@ rfc2544_test(void)
 
 		/* enable transmit */
 		setpps(1, work->curpps);
-		setpktsize(1, work->pktsize);
+		if (work->imix != NULL)
+			setimix(1, work->imix);
+		else
+			setpktsize(1, work->pktsize);
 		statistics_clear();
 		transmit_set(1, 1);
 
@@ -3171,10 +5246,12 @@ rfc2544_test(void)
 		break;
 
 	case RFC2544_DONE:
-		do_quit = 1;
+		if (!rfc2544_keepalive)
+			do_quit = 1;
 		break;
 	}
 
+	rfc2544_state = state;
 }
 
 static void
@@ -3256,6 +5333,14 @@ control_interval(struct itemlist *itemlist)
 		genscript_play();
 	}
 
+	if (flowretire_list != NULL)
+		flow_reclaim();
+
+	/* follow streams starting and stopping on schedule */
+	if ((nstream != 0) && (ninterval == 0) && interface[1].transmit_enable &&
+	    (stream_active_Mbps(&interface[1]) != interface[1].transmit_Mbps))
+		update_transmit_Mbps(1);
+
 	if (opt_rfc2544) {
 		rfc2544_test();
 	}
@@ -3362,6 +5447,7 @@ itemlist_callback_pktsize(struct itemlist *itemlist __unused, struct item *item,
 		break;
 	}
 
+	interface[ifno].imix = NULL;
 	interface[ifno].pktsize = *pktsize;
 	update_transmit_Mbps(ifno);
 
@@ -3678,7 +5764,7 @@ gentest_main(void)
 				break;
 		}
 
-		touchup_tx_packet(pktbuffer_ipv4[PKTBUF_UDP][0], 0);
+		touchup_tx_packet(pktbuffer_ipv4[PKTBUF_UDP][0], 0, interface[0].pktsize, NULL);
 
 		if (opt_gentest >= 2)
 			memcpy(tmppktbuf, pktbuffer_ipv4[PKTBUF_UDP][0], interface[0].pktsize + ETHHDRSIZE);
@@ -3705,6 +5791,122 @@ gentest_main(void)
 	}
 }
 
+/*
+ * --txpath-test. packets built by each specialized TX path must be
+ * identical to those built by touchup_tx_packet() for the same flows.
+ * TX interface (interface[1]) is configured for each combination of
+ * address family, L4 protocol, L2 encapsulation and L2 randomization,
+ * and no interface is opened. return the number of failures.
+ */
+static int
+txpath_test_main(void)
+{
+	static char pkt[2][LIBPKT_PKTBUFSIZE] __attribute__((__aligned__(8)));
+	static const unsigned int pktsizes[] = { 80, 81, 1001 };
+	struct interface *iface = &interface[1];
+	struct sequence_table *seqtable = interface[0].seqtable;
+	struct addresslist *adrlist;
+	struct flowtable *ft;
+	struct encap *encap;
+	struct in_addr s4[2], d4[2];
+	struct in6_addr s6[2], d6[2];
+	uint32_t nextseq;
+	unsigned int ipid, flowcur, s, n, len, len_generic, ntest, nfail;
+	int ipv6, tcp, l2, l2random, fail;
+
+	inet_pton(AF_INET, "10.0.0.1", &s4[0]);
+	inet_pton(AF_INET, "10.0.0.3", &s4[1]);
+	inet_pton(AF_INET, "10.1.0.1", &d4[0]);
+	inet_pton(AF_INET, "10.1.0.2", &d4[1]);
+	inet_pton(AF_INET6, "fc00::1", &s6[0]);
+	inet_pton(AF_INET6, "fc00::3", &s6[1]);
+	inet_pton(AF_INET6, "fc00:1::1", &d6[0]);
+	inet_pton(AF_INET6, "fc00:1::2", &d6[1]);
+	if ((encap = encap_parse("vlan:100/vxlan:5,192.0.2.1")) == NULL)
+		return 1;
+
+	ntest = nfail = 0;
+	for (ipv6 = 0; ipv6 < 2; ipv6++)
+	for (tcp = 0; tcp < 2; tcp++)
+	for (l2 = 0; l2 < TXPATH_L2_NUM; l2++)
+	for (l2random = 0; l2random < 4; l2random++) {
+#ifndef SUPPORT_PPPOE
+		if (l2 == TXPATH_L2_PPPOE)
+			continue;
+#else
+		iface->pppoe = (l2 == TXPATH_L2_PPPOE);
+		iface->pppoe_sc.session = 0x1234;
+#endif
+		opt_tcp = tcp;
+		opt_udp = !tcp;
+		iface->vlan_id = (l2 == TXPATH_L2_VLAN) ? 10 : 0;
+		iface->encap = (l2 == TXPATH_L2_ENCAP) ? encap : NULL;
+		iface->gw_l2random = (l2random & TXPATH_L2RANDOM_DST) != 0;
+		interface[0].gw_l2random = (l2random & TXPATH_L2RANDOM_SRC) != 0;
+		build_template_packets();
+
+		adrlist = addresslist_new();
+		addresslist_setlimit(adrlist, MAXFLOWNUM);
+		if (l2 == TXPATH_L2_FLOWVLAN)
+			addresslist_setvlan(adrlist, 0, 0, 10, 11);
+		else if (l2 == TXPATH_L2_FLOWQINQ)
+			addresslist_setvlan(adrlist, 20, 21, 10, 11);
+		if (ipv6)
+			addresslist_append6(adrlist, tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &s6[0], &s6[1], &d6[0], &d6[1], 1000, 1001, 2000, 2000);
+		else
+			addresslist_append(adrlist, tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    s4[0], s4[1], d4[0], d4[1], 1000, 1001, 2000, 2000);
+		if ((flow_addresslist_build(adrlist) != 0) ||
+		    ((ft = addresslist_flowtable_new(adrlist, l2random != 0)) == NULL)) {
+			addresslist_delete(adrlist);
+			return 1;
+		}
+		iface->flowtable = ft;
+		iface->flowcur = 0;
+		interface_txpath_select(1, ft, 0);
+
+		ntest++;
+		fail = (iface->txpath != txpath_table[ipv6][tcp][l2][l2random]);
+		if (fail)
+			printf("txpath %d%d%d%d: not selected\n", ipv6, tcp, l2, l2random);
+		for (s = 0; !fail && (s < sizeof(pktsizes) / sizeof(pktsizes[0])); s++) {
+			for (n = 0; !fail && (n < ft->nflow * 2); n++) {
+				memset(pkt, 0, sizeof(pkt));
+				nextseq = seqtable->sq_nextseq;
+				ipid = tx_ipid;
+				flowcur = iface->flowcur;
+				len_generic = touchup_tx_packet(pkt[0], 1, pktsizes[s], NULL) + pktsizes[s];
+
+				/* same sequence, IPv4 ID and flow for the specialized one */
+				seqtable->sq_nextseq = nextseq;
+				tx_ipid = ipid;
+				iface->flowcur = flowcur;
+				len = iface->txpath(pkt[1], 1, pktsizes[s], ft) + ETHHDRSIZE;
+
+				if ((len != len_generic) || (memcmp(pkt[0], pkt[1], len) != 0)) {
+					printf("txpath %d%d%d%d: pktsize %u, flow %u differs\n",
+					    ipv6, tcp, l2, l2random, pktsizes[s], flowcur);
+					dumpstr(pkt[0], len_generic, DUMPSTR_FLAGS_CRLF);
+					dumpstr(pkt[1], len, DUMPSTR_FLAGS_CRLF);
+					fail = 1;
+				}
+			}
+		}
+		if (fail)
+			nfail++;
+
+		iface->flowtable = NULL;
+		addresslist_flowtable_delete(ft);
+		addresslist_delete(adrlist);
+	}
+	iface->encap = NULL;
+	encap_delete(encap);
+
+	printf("txpath test: %u/%u passed\n", ntest - nfail, ntest);
+	return nfail;
+}
+
 static struct option longopts[] = {
 	{	"ipg",				no_argument,		0,	0	},
 	{	"burst",			no_argument,		0,	0	},
@@ -3716,11 +5918,33 @@ static struct option longopts[] = {
 	{	"udp",				no_argument,		0,	0	},
 	{	"sport",			required_argument,	0,	0	},
 	{	"dport",			required_argument,	0,	0	},
+	{	"vlan",				required_argument,	0,	0	},
+	{	"svlan",			required_argument,	0,	0	},
 	{	"saddr",			required_argument,	0,	0	},
 	{	"daddr",			required_argument,	0,	0	},
 	{	"flowlist",			required_argument,	0,	0	},
+	{	"flowlist-compile",		required_argument,	0,	0	},
+	{	"rss-generate",			required_argument,	0,	0	},
+	{	"rss-queues",			required_argument,	0,	0	},
+	{	"rss-key",			required_argument,	0,	0	},
+	{	"rss-l3",			no_argument,		0,	0	},
+	{	"rss-reta",			required_argument,	0,	0	},
+	{	"rss-weight",			required_argument,	0,	0	},
 	{	"flowsort",			no_argument,		0,	0	},
 	{	"flowdump",			no_argument,		0,	0	},
+	{	"flowlazy",			no_argument,		0,	0	},
+	{	"flowmac-md5",			no_argument,		0,	0	},
+	{	"flowcheck",			no_argument,		0,	0	},
+	{	"imix",				required_argument,	0,	0	},
+	{	"burst-train",			required_argument,	0,	0	},
+	{	"streams",			required_argument,	0,	0	},
+	{	"template",			required_argument,	0,	0	},
+	{	"encap",			required_argument,	0,	0	},
+	{	"xlat-src",			required_argument,	0,	0	},
+	{	"xlat-dst",			required_argument,	0,	0	},
+	{	"flowdist",			required_argument,	0,	0	},
+	{	"random",			required_argument,	0,	0	},
+	{	"seed",				required_argument,	0,	0	},
 	{	"rfc2544",			no_argument,		0,	0	},
 	{	"rfc2544-tolerable-error-rate",	required_argument,	0,	0	},
 	{	"rfc2544-slowstart",		no_argument,		0,	0	},
@@ -3731,6 +5955,11 @@ static struct option longopts[] = {
 	{	"rfc2544-warming-duration",		required_argument,	0,	0	},
 	{	"rfc2544-output-json",		required_argument,	0,	0	},
 	{	"rfc2544-no-early-finish",		no_argument,		0,	0	},
+	{	"rx-threads",			required_argument,	0,	0	},
+	{	"xdp-prog",			required_argument,	0,	0	},
+	{	"txpath-test",			no_argument,		0,	0	},
+	{	"xdp-count",			no_argument,		0,	0	},
+	{	"xdp-rx-batch",			required_argument,	0,	0	},
 	{	"nocurses",			no_argument,		0,	0	},
 	{	"fail-if-dropped",		no_argument,		0,	0	},
 	{	NULL,				0,			NULL,	0	}
@@ -3795,215 +6024,1264 @@ parse_address(const int ifno, char *s)
 	}
 }
 
-static void
-generate_addrlists(void)
+/*
+ * address and port of --random without range follow
+ * --saddr, --daddr, --sport and --dport.
+ */
+static int
+randfield_setdefault(void)
 {
+	struct randfield_spec *f;
 	int rc;
+
+	f = &opt_random.field[RANDFIELD_SADDR];
+	if (f->enable && (f->af == 0)) {
+		if (!opt_saddr) {
+			fprintf(stderr, "--random saddr requires range or --saddr\n");
+			return -1;
+		}
+		if (opt_srcaddr_af == AF_INET6)
+			rc = randfield_setrange6(&opt_random, RANDFIELD_SADDR, &opt_srcaddr6_begin, &opt_srcaddr6_end);
+		else
+			rc = randfield_setrange(&opt_random, RANDFIELD_SADDR,
+			    ntohl(opt_srcaddr_begin.s_addr), ntohl(opt_srcaddr_end.s_addr));
+		if (rc != 0) {
+			fprintf(stderr, "--random saddr: illegal range\n");
+			return -1;
+		}
+	}
+
+	f = &opt_random.field[RANDFIELD_DADDR];
+	if (f->enable && (f->af == 0)) {
+		if (!opt_daddr) {
+			fprintf(stderr, "--random daddr requires range or --daddr\n");
+			return -1;
+		}
+		if (opt_dstaddr_af == AF_INET6)
+			rc = randfield_setrange6(&opt_random, RANDFIELD_DADDR, &opt_dstaddr6_begin, &opt_dstaddr6_end);
+		else
+			rc = randfield_setrange(&opt_random, RANDFIELD_DADDR,
+			    ntohl(opt_dstaddr_begin.s_addr), ntohl(opt_dstaddr_end.s_addr));
+		if (rc != 0) {
+			fprintf(stderr, "--random daddr: illegal range\n");
+			return -1;
+		}
+	}
+
+	f = &opt_random.field[RANDFIELD_SPORT];
+	if (f->enable && (f->n == 0))
+		randfield_setrange(&opt_random, RANDFIELD_SPORT, opt_srcport_begin, opt_srcport_end);
+	f = &opt_random.field[RANDFIELD_DPORT];
+	if (f->enable && (f->n == 0))
+		randfield_setrange(&opt_random, RANDFIELD_DPORT, opt_dstport_begin, opt_dstport_end);
+
+	return 0;
+}
+
+static int
+generate_addrlists(struct addresslist *adrlist[2])
+{
+	int i, rc;
 	struct in_addr xaddr;
 	struct in6_addr xaddr6, xaddr6_begin;
 
+	for (i = 0; i < 2; i++) {
+		if (addresslist_setvlan(adrlist[i], opt_svlan_begin, opt_svlan_end,
+		    opt_cvlan_begin, opt_cvlan_end) != 0)
+			return -1;
+	}
+
 	if (opt_addrrange) {
 		if (opt_srcaddr_af == AF_INET) {
 			/* exclude hostzero address and gw address and broadcast address */
 			xaddr.s_addr = interface[1].ipaddr.s_addr | ~interface[1].ipaddr_mask.s_addr;	/* broadcast */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_saddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+			addresslist_exclude_saddr(adrlist[1], xaddr);
 			xaddr.s_addr = interface[1].ipaddr.s_addr & interface[1].ipaddr_mask.s_addr;	/* hostzero */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_saddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+			addresslist_exclude_saddr(adrlist[1], xaddr);
 			xaddr.s_addr = interface[1].gwaddr.s_addr;					/* gw address */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_saddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+			addresslist_exclude_saddr(adrlist[1], xaddr);
 
 			xaddr.s_addr = interface[0].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
-			addresslist_exclude_saddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_saddr(adrlist[0], xaddr);
+			addresslist_exclude_daddr(adrlist[1], xaddr);
 			xaddr.s_addr = interface[0].ipaddr.s_addr & interface[0].ipaddr_mask.s_addr;	/* hostzero */
-			addresslist_exclude_saddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_saddr(adrlist[0], xaddr);
+			addresslist_exclude_daddr(adrlist[1], xaddr);
 			xaddr.s_addr = interface[0].gwaddr.s_addr;					/* gw address */
-			addresslist_exclude_saddr(interface[0].adrlist, xaddr);
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
+			addresslist_exclude_saddr(adrlist[0], xaddr);
+			addresslist_exclude_daddr(adrlist[1], xaddr);
 
 			if (opt_saddr == 0)
 				opt_srcaddr_begin.s_addr = opt_srcaddr_end.s_addr = interface[1].ipaddr.s_addr;
 			if (opt_daddr == 0)
 				opt_dstaddr_begin.s_addr = opt_dstaddr_end.s_addr = interface[0].ipaddr.s_addr;
 
-			rc = addresslist_append(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			rc = addresslist_append(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
 			    opt_srcaddr_begin, opt_srcaddr_end,
 			    opt_dstaddr_begin, opt_dstaddr_end,
 			    opt_srcport_begin, opt_srcport_end,
 			    opt_dstport_begin, opt_dstport_end);
 			if (rc != 0)
-				exit(1);
+				return -1;
 
-			rc = addresslist_append(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			rc = addresslist_append(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
 			    opt_dstaddr_begin, opt_dstaddr_end,
 			    opt_srcaddr_begin, opt_srcaddr_end,
 			    opt_dstport_begin, opt_dstport_end,
 			    opt_srcport_begin, opt_srcport_end);
 			if (rc != 0)
-				exit(1);
+				return -1;
 		} else {
 			/* exclude gw address */
 			xaddr6 = interface[1].gw6addr;						/* gw address */
-			addresslist_exclude_daddr6(interface[0].adrlist, &xaddr6);
-			addresslist_exclude_saddr6(interface[1].adrlist, &xaddr6);
+			addresslist_exclude_daddr6(adrlist[0], &xaddr6);
+			addresslist_exclude_saddr6(adrlist[1], &xaddr6);
+
+			xaddr6 = interface[0].gw6addr;						/* gw address */
+			addresslist_exclude_saddr6(adrlist[0], &xaddr6);
+			addresslist_exclude_daddr6(adrlist[1], &xaddr6);
+
+			if (opt_saddr == 0)
+				opt_srcaddr6_begin = opt_srcaddr6_end = interface[1].ip6addr;
+			if (opt_daddr == 0)
+				opt_dstaddr6_begin = opt_dstaddr6_end = interface[0].ip6addr;
+
+			rc = addresslist_append6(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &opt_srcaddr6_begin, &opt_srcaddr6_end,
+			    &opt_dstaddr6_begin, &opt_dstaddr6_end,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			rc = addresslist_append6(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &opt_dstaddr6_begin, &opt_dstaddr6_end,
+			    &opt_srcaddr6_begin, &opt_srcaddr6_end,
+			    opt_dstport_begin, opt_dstport_end,
+			    opt_srcport_begin, opt_srcport_end);
+			if (rc != 0)
+				return -1;
+		}
+
+	} else if (opt_allnet) {
+
+		if (!ipv4_iszero(&interface[0].ipaddr) && !ipv4_iszero(&interface[1].ipaddr)) {
+			/* exclude hostzero address and gw address and broadcast address */
+			xaddr.s_addr = interface[0].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
+			addresslist_exclude_daddr(adrlist[1], xaddr);
+			xaddr.s_addr = interface[0].ipaddr.s_addr & interface[0].ipaddr_mask.s_addr;	/* hostzero */
+			addresslist_exclude_daddr(adrlist[1], xaddr);
+			xaddr.s_addr = interface[0].gwaddr.s_addr;					/* gw address */
+			addresslist_exclude_daddr(adrlist[1], xaddr);
+
+			xaddr.s_addr = interface[1].ipaddr.s_addr | ~interface[1].ipaddr_mask.s_addr;	/* broadcast */
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+			xaddr.s_addr = interface[1].ipaddr.s_addr & interface[1].ipaddr_mask.s_addr;	/* hostzero */
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+			xaddr.s_addr = interface[1].gwaddr.s_addr;					/* gw address */
+			addresslist_exclude_daddr(adrlist[0], xaddr);
+
+			xaddr.s_addr = interface[0].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
+			rc = addresslist_append(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[1].ipaddr, interface[1].ipaddr,
+			    interface[0].ipaddr, xaddr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			xaddr.s_addr = interface[1].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
+			rc = addresslist_append(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[0].ipaddr, interface[0].ipaddr,
+			    interface[1].ipaddr, xaddr,
+			    opt_dstport_begin, opt_dstport_end,
+			    opt_srcport_begin, opt_srcport_end);
+			if (rc != 0)
+				return -1;
+
+		} else if (!ipv6_iszero(&interface[0].ip6addr) && !ipv6_iszero(&interface[1].ip6addr)) {
+			/* exclude gw address */
+			xaddr6 = interface[0].gw6addr;					/* gw address */
+			addresslist_exclude_daddr6(adrlist[1], &xaddr6);
+			xaddr6 = interface[1].gw6addr;					/* gw address */
+			addresslist_exclude_daddr6(adrlist[0], &xaddr6);
+
+			/* e.g.) fd00::1/112 => from fd00:0 to fd00::ffff */
+			xaddr6_begin = interface[0].ip6addr_mask;
+			ipv6_and(&interface[0].ip6addr, &xaddr6_begin, &xaddr6_begin);	/* beginning of network address */
+			ipv6_not(&interface[0].ip6addr_mask, &xaddr6);
+			ipv6_or(&interface[0].ip6addr, &xaddr6, &xaddr6);	/* end of network address */
+			rc = addresslist_append6(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &interface[1].ip6addr, &interface[1].ip6addr,
+			    &xaddr6_begin, &xaddr6,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			xaddr6_begin = interface[1].ip6addr_mask;
+			ipv6_and(&interface[1].ip6addr, &xaddr6_begin, &xaddr6_begin);	/* beginning of network address */
+			ipv6_not(&interface[1].ip6addr_mask, &xaddr6);
+			ipv6_or(&interface[1].ip6addr, &xaddr6, &xaddr6);	/* last of network address */
+			rc = addresslist_append6(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &interface[0].ip6addr, &interface[0].ip6addr,
+			    &xaddr6_begin, &xaddr6,
+			    opt_dstport_begin, opt_dstport_end,
+			    opt_srcport_begin, opt_srcport_end);
+			if (rc != 0)
+				return -1;
+
+		} else {
+			fprintf(stderr, "no address info on %s and %s\n",
+			    interface[0].ifname, interface[1].ifname);
+			return -1;
+		}
+
+	} else {
+		if (!ipv4_iszero(&interface[0].ipaddr) && !ipv4_iszero(&interface[1].ipaddr)) {
+			rc = addresslist_append(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[1].ipaddr, interface[1].ipaddr,
+			    interface[0].ipaddr, interface[0].ipaddr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			rc = addresslist_append(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[0].ipaddr, interface[0].ipaddr,
+			    interface[1].ipaddr, interface[1].ipaddr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+		} else if (!ipv6_iszero(&interface[0].ip6addr) && !ipv6_iszero(&interface[1].ip6addr)) {
+			rc = addresslist_append6(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &interface[1].ip6addr, &interface[1].ip6addr,
+			    &interface[0].ip6addr, &interface[0].ip6addr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			rc = addresslist_append6(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &interface[0].ip6addr, &interface[0].ip6addr,
+			    &interface[1].ip6addr, &interface[1].ip6addr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+		} else {
+			/* no address information. use 0.0.0.0-0.0.0.0 */
+			rc = addresslist_append(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[1].ipaddr, interface[1].ipaddr,
+			    interface[0].ipaddr, interface[0].ipaddr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+
+			rc = addresslist_append(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    interface[0].ipaddr, interface[0].ipaddr,
+			    interface[1].ipaddr, interface[1].ipaddr,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+			if (rc != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* new addresslist configured by --flowlazy and --flowmac-md5 */
+static struct addresslist *
+flow_addresslist_new(void)
+{
+	struct addresslist *adrlist;
+
+	adrlist = addresslist_new();
+	if (adrlist == NULL) {
+		fprintf(stderr, "cannot allocate addresslist\n");
+		exit(1);
+	}
+
+	if (opt_flowlazy) {
+		addresslist_setlimit(adrlist, UINT_MAX);
+		addresslist_setlazy(adrlist, 1);
+	} else {
+		addresslist_setlimit(adrlist, MAXFLOWNUM);
+	}
+	if (opt_flowmac_md5)
+		addresslist_setmacmode(adrlist, ADDRESSLIST_MAC_MD5);
+
+	return adrlist;
+}
+
+/*
+ * per flow VLAN tags replace -V, but cannot be stacked on other encapsulation.
+ * the flow table is freed on error.
+ */
+static int
+flow_l2tag_check(int ifno, struct flowtable **ftp)
+{
+	if (((*ftp)->nl2tag == 0) || ((interface[ifno].encap == NULL) && !interface[ifno].pppoe))
+		return 0;
+
+	fprintf(stderr, "%s: per flow VLAN cannot be used with --encap or PPPoE (-P)\n",
+	    interface[ifno].ifname);
+	addresslist_flowtable_delete(*ftp);
+	*ftp = NULL;
+	return -1;
+}
+
+/* same as flow_l2tag_check() for lazy addresslist, which has no flowtable */
+static int
+flow_l2tag_check_lazy(int ifno, struct addresslist *adrlist)
+{
+	if (((interface[ifno].encap == NULL) && !interface[ifno].pppoe) ||
+	    !addresslist_include_vlan(adrlist))
+		return 0;
+
+	fprintf(stderr, "%s: per flow VLAN cannot be used with --encap or PPPoE (-P)\n",
+	    interface[ifno].ifname);
+	return -1;
+}
+
+/*
+ * compact flow table for TX. MAC addresses are needed only for
+ * random gateway address (L2 bridge test).
+ * lazy addresslist has no table, and *ftp is set to NULL.
+ */
+static int
+flow_flowtable_new(int ifno, struct addresslist *adrlist, struct flowtable **ftp)
+{
+	*ftp = NULL;
+	if (opt_flowlazy)
+		return flow_l2tag_check_lazy(ifno, adrlist);
+
+	*ftp = addresslist_flowtable_new(adrlist,
+	    interface[ifno].gw_l2random || interface[ifno ^ 1].gw_l2random);
+	if (*ftp == NULL)
+		return -1;
+	return flow_l2tag_check(ifno, ftp);
+}
+
+/*
+ * map compiled flowlist as the flow table.
+ * the file holds TX side (interface[1]) flows, and RX side is reversed.
+ */
+static int
+flow_flowtable_load(int ifno, const char *path, struct flowtable **ftp)
+{
+	*ftp = addresslist_flowtable_load(path, ifno == 0,
+	    interface[ifno].gw_l2random || interface[ifno ^ 1].gw_l2random,
+	    opt_flowmac_md5 ? ADDRESSLIST_MAC_MD5 : ADDRESSLIST_MAC_HASH);
+	if (*ftp == NULL)
+		return -1;
+	return flow_l2tag_check(ifno, ftp);
+}
+
+/*
+ * index of flows to be received for --flowcheck.
+ * ft is the flowtable of the other (transmitting) side.
+ * lazy addresslist has no index, and *fip is set to NULL.
+ */
+static int
+flow_flowindex_new(struct flowtable *ft, struct flowindex **fip)
+{
+	*fip = NULL;
+	if (!opt_flowcheck || (ft == NULL))
+		return 0;
+
+	*fip = flowindex_build(ft, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+	    &opt_xlat_src, &opt_xlat_dst);
+	if (*fip == NULL)
+		return -1;
+	return 0;
+}
+
+/*
+ * per flow state id of the new flowtable ft, to keep the state of the
+ * flows which remain after flow_update(). a flow found in the current
+ * flowtable inherits its id, and a new flow takes the lowest id which
+ * is not used. ft->stateid is left NULL if the ids are same as flowid.
+ * return the number of ids, or -1 on error.
+ */
+static int64_t
+flow_stateid_new(int ifno, struct flowtable *ft)
+{
+	static const struct flowxlat noxlat;
+	struct flowtable *ft_old = interface[ifno].flowtable;
+	struct flowindex *fi;
+	struct flowkey key;
+	uint32_t *stateid, id, next;
+	uint8_t *used;
+	unsigned int flowid, nid;
+	int identity, proto;
+
+	if (ft_old == NULL)
+		return ft->nflow;
+
+	proto = opt_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+	for (nid = ft_old->nflow, flowid = 0; flowid < ft_old->nflow; flowid++)
+		nid = MAX(nid, flowtable_stateid(ft_old, flowid) + 1);
+	nid = MAX(nid, ft->nflow);
+
+	stateid = malloc(sizeof(uint32_t) * ft->nflow);
+	used = calloc(nid, sizeof(uint8_t));
+	if ((stateid == NULL) || (used == NULL) ||
+	    ((fi = flowindex_build(ft_old, proto, &noxlat, &noxlat)) == NULL)) {
+		fprintf(stderr, "cannot allocate flow state id of %u flows\n", ft->nflow);
+		free(stateid);
+		free(used);
+		return -1;
+	}
+
+	for (flowid = 0; flowid < ft->nflow; flowid++) {
+		stateid[flowid] = UINT32_MAX;
+		if ((flowindex_key(ft, flowid, proto, &noxlat, &noxlat, &key) == 0) &&
+		    (flowindex_lookup(fi, &key, &id) == 0) && !used[id]) {
+			stateid[flowid] = id;
+			used[id] = 1;
+		}
+	}
+	flowindex_delete(fi);
+
+	identity = 1;
+	for (next = 0, flowid = 0; flowid < ft->nflow; flowid++) {
+		if (stateid[flowid] == UINT32_MAX) {
+			while (used[next])
+				next++;
+			stateid[flowid] = next;
+			used[next] = 1;
+		}
+		if (stateid[flowid] != flowid)
+			identity = 0;
+	}
+	free(used);
+
+	if (identity)
+		free(stateid);
+	else
+		ft->stateid = stateid;
+	return nid;
+}
+
+/*
+ * alias table of --flowdist for the first nflow flows of ft.
+ * built by control thread, as it takes O(nflow) and may fail.
+ */
+static int
+flow_flowdist_new(struct flowtable *ft, unsigned int nflow, struct flowdist **fdp)
+{
+	*fdp = NULL;
+	if ((opt_flowdist == FLOWDIST_RR) || (ft == NULL))
+		return 0;
+
+	nflow = MIN(nflow, ft->nflow);
+	*fdp = flowdist_new(opt_flowdist, nflow, opt_flowdist_zipf, ft->weight);
+	if (*fdp == NULL) {
+		fprintf(stderr, "cannot build --flowdist table of %u flows\n", nflow);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * read text flowlist. adrlist[1] is for TX, and adrlist[0] is for RX.
+ */
+static int
+flowlist_read(const char *path, struct addresslist *adrlist[2])
+{
+	FILE *fh;
+	char *line;
+	char buf[1024];
+	size_t len, lineno;
+	int anyerror;
+
+	fh = fopen(path, "r");
+	if (fh == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	anyerror = 0;
+	for (lineno = 1; ((line = fgets(buf, sizeof(buf), fh)) != NULL); lineno++) {
+		while ((*line == ' ') || (*line == '\t'))
+			line++;
+		if (line[0] == '#')
+			continue;
+
+		/* chop '\n' */
+		len = strlen(line);
+		if (len > 0)
+			line[len - 1] = '\0';
+
+		if (line[0] == '\0')	/* blank */
+			continue;
+
+		/* for TX */
+		if (parse_flowstr(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP, line, false) != 0) {
+			fprintf(stderr, "%s:%"PRIu64": cannot parse: \"%s\"\n", path, lineno, line);
+			anyerror++;
+		}
+		/* for RX */
+		parse_flowstr(adrlist[0], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP, line, true);
+	}
+	fclose(fh);
+	if (anyerror)
+		return -1;
+	return 0;
+}
+
+/*
+ * --flowlist-compile. convert text flowlist into binary flowlist
+ * which can be mmap'ed by --flowlist without parsing.
+ */
+static void
+flowlist_compile_main(void)
+{
+	struct addresslist *adrlist[2];
+	int i;
+
+	if (opt_flowlist == NULL) {
+		fprintf(stderr, "--flowlist-compile requires --flowlist\n");
+		exit(1);
+	}
+	if (opt_flowlazy) {
+		fprintf(stderr, "--flowlist-compile and --flowlazy cannot be used together\n");
+		exit(1);
+	}
+
+	for (i = 0; i < 2; i++) {
+		adrlist[i] = flow_addresslist_new();
+		addresslist_setlimit(adrlist[i], UINT_MAX);
+	}
+	if (flowlist_read(opt_flowlist, adrlist) != 0)
+		exit(2);
+	if (flow_addresslist_build(adrlist[1]) != 0)
+		exit(1);
+	if (opt_flowsort)
+		addresslist_rebuild(adrlist[1]);
+
+	if (addresslist_flowtable_save(adrlist[1], opt_flowlist_compile) != 0)
+		exit(1);
+	printf("%s: %u flows\n", opt_flowlist_compile, addresslist_get_tuplenum(adrlist[1]));
+
+	addresslist_delete(adrlist[0]);
+	addresslist_delete(adrlist[1]);
+}
+
+/*
+ * --rss-generate. pick flows from candidates so that each RSS queue of
+ * DUT receives the number of flows proportional to --rss-weight.
+ * only TX direction (interface[1] to DUT) is considered.
+ */
+static void
+rss_generate_main(void)
+{
+	struct addresslist *adrlist[2];
+	const struct address_tuple *tuple;
+	unsigned int *quota, *count;
+	unsigned long *weight, wsum;
+	unsigned int i, q, nflow, nleft, ncandidate;
+	char *p, sbuf[INET6_ADDRSTRLEN], dbuf[INET6_ADDRSTRLEN];
+	FILE *fp;
+	int rc;
+
+	quota = calloc(opt_rss.nqueue, sizeof(unsigned int));
+	count = calloc(opt_rss.nqueue, sizeof(unsigned int));
+	weight = calloc(opt_rss.nqueue, sizeof(unsigned long));
+	if ((quota == NULL) || (count == NULL) || (weight == NULL)) {
+		fprintf(stderr, "cannot allocate memory\n");
+		exit(1);
+	}
+
+	/* --rss-weight has a weight for each queue, or none at all */
+	wsum = 0;
+	for (q = 0, p = opt_rss_weight; q < opt_rss.nqueue; q++) {
+		weight[q] = 1;
+		if (opt_rss_weight != NULL) {
+			if ((p == NULL) || !isdigit((unsigned char)*p))
+				break;
+			weight[q] = strtoul(p, &p, 10);
+			if (*p == ',')
+				p++;
+			else if (*p == '\0')
+				p = NULL;
+			else
+				break;
+		}
+		wsum += weight[q];
+	}
+	if ((opt_rss_weight != NULL) && ((q < opt_rss.nqueue) || (p != NULL))) {
+		fprintf(stderr, "illegal --rss-weight: %s (needs a weight for each of %u queues)\n",
+		    opt_rss_weight, opt_rss.nqueue);
+		exit(1);
+	}
+	if (wsum == 0) {
+		fprintf(stderr, "illegal --rss-weight: %s\n", opt_rss_weight);
+		exit(1);
+	}
+
+	nflow = (opt_nflow != 0) ? opt_nflow : 64 * opt_rss.nqueue;
+	nleft = nflow;
+	for (q = 0; q < opt_rss.nqueue; q++) {
+		quota[q] = (uint64_t)nflow * weight[q] / wsum;
+		nleft -= quota[q];
+	}
+	for (q = 0; nleft > 0; q = (q + 1) % opt_rss.nqueue) {
+		if (weight[q] != 0) {
+			quota[q]++;
+			nleft--;
+		}
+	}
+
+	/* candidates are enumerated lazily, to search huge ranges */
+	for (i = 0; i < 2; i++) {
+		adrlist[i] = addresslist_new();
+		addresslist_setlimit(adrlist[i], UINT_MAX);
+		addresslist_setlazy(adrlist[i], 1);
+	}
+	if (opt_flowlist != NULL) {
+		if (flowlist_read(opt_flowlist, adrlist) != 0)
+			exit(2);
+	} else {
+		if (!opt_saddr || !opt_daddr) {
+			fprintf(stderr, "--rss-generate requires --saddr and --daddr, or --flowlist\n");
+			exit(1);
+		}
+		if (opt_srcaddr_af == AF_INET)
+			rc = addresslist_append(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    opt_srcaddr_begin, opt_srcaddr_end,
+			    opt_dstaddr_begin, opt_dstaddr_end,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+		else
+			rc = addresslist_append6(adrlist[1], opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
+			    &opt_srcaddr6_begin, &opt_srcaddr6_end,
+			    &opt_dstaddr6_begin, &opt_dstaddr6_end,
+			    opt_srcport_begin, opt_srcport_end,
+			    opt_dstport_begin, opt_dstport_end);
+		if (rc != 0)
+			exit(1);
+	}
+
+	fp = fopen(opt_rss_generate, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s\n", opt_rss_generate, strerror(errno));
+		exit(1);
+	}
+	fprintf(fp, "# generated by ipgen --rss-generate\n");
+	fprintf(fp, "# queues %u, reta %u, hash %s, key ",
+	    opt_rss.nqueue, opt_rss.retasize, opt_rss.l4 ? "l4" : "l3");
+	for (i = 0; i < opt_rss.keylen; i++)
+		fprintf(fp, "%02x", opt_rss.key[i]);
+	fprintf(fp, "\n");
+
+	nleft = nflow;
+	ncandidate = addresslist_get_tuplenum(adrlist[1]);
+	for (i = 0; (i < ncandidate) && (nleft > 0); i++) {
+		tuple = addresslist_get_tuple_next(adrlist[1]);
+		q = rss_queue(&opt_rss, rss_hash(&opt_rss, tuple));
+		if (count[q] >= quota[q])
+			continue;
+		count[q]++;
+		nleft--;
+
+		inet_ntop(tuple->saddr.af, &tuple->saddr.a, sbuf, sizeof(sbuf));
+		inet_ntop(tuple->daddr.af, &tuple->daddr.a, dbuf, sizeof(dbuf));
+		if (tuple->saddr.af == AF_INET6)
+			fprintf(fp, "[%s]:%u\t[%s]:%u\t", sbuf, tuple->sport, dbuf, tuple->dport);
+		else
+			fprintf(fp, "%s:%u\t%s:%u\t", sbuf, tuple->sport, dbuf, tuple->dport);
+		if (tuple->svlan != 0)
+			fprintf(fp, "svlan=%u ", tuple->svlan);
+		if (tuple->cvlan != 0)
+			fprintf(fp, "vlan=%u ", tuple->cvlan);
+		fprintf(fp, "# queue %u\n", q);
+	}
+	fclose(fp);
+
+	printf("%s: %u flows from %u candidates\n", opt_rss_generate, nflow - nleft, i);
+	for (q = 0; q < opt_rss.nqueue; q++) {
+		printf("  queue %u: %u flows%s\n", q, count[q],
+		    (count[q] < quota[q]) ? " (not enough candidates)" : "");
+	}
+
+	addresslist_delete(adrlist[0]);
+	addresslist_delete(adrlist[1]);
+	free(quota);
+	free(count);
+	free(weight);
+}
+
+/* expand flow ranges into the flow table using all cpus */
+static int
+flow_addresslist_build(struct addresslist *adrlist)
+{
+	long ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+	return addresslist_build(adrlist, ncpu);
+}
+
+/*
+ * grow per flow work. never shrink nor move, because TX/RX threads may
+ * refer to the flowid of the packet in flight.
+ */
+static int
+interface_alloc_perflow(int ifno, unsigned int nflow)
+{
+	struct interface *iface = &interface[ifno];
+	struct sequencechecker *sc;
+	unsigned int chunk, i;
+
+	for (i = iface->nperflow; i < nflow; i++) {
+		chunk = i / PERFLOW_CHUNK;
+		if (iface->sequence_tx_perflow[chunk] == NULL) {
+			iface->sequence_tx_perflow[chunk] = calloc(PERFLOW_CHUNK, sizeof(uint64_t));
+			if (iface->sequence_tx_perflow[chunk] == NULL) {
+				fprintf(stderr, "cannot allocate %s flow sequence work %u\n", iface->ifname, nflow);
+				return -1;
+			}
+		}
+		if (iface->seqchecker_perflow[chunk] == NULL) {
+			iface->seqchecker_perflow[chunk] = calloc(PERFLOW_CHUNK, sizeof(struct sequencechecker *));
+			if (iface->seqchecker_perflow[chunk] == NULL) {
+				fprintf(stderr, "cannot allocate %s flow sequence work %u\n", iface->ifname, nflow);
+				return -1;
+			}
+		}
+
+		sc = seqcheck_new();
+		if (sc == NULL) {
+			fprintf(stderr, "cannot allocate %s flow sequence work %d/%d\n", iface->ifname, i, nflow);
+			return -1;
+		}
+		seqcheck_setparent(sc, rxshard[ifno][i % opt_rxthreads].seqchecker_flowtotal);
+		PERFLOW_SEQUENCE_TX(iface, i) = 0;
+		PERFLOW_SEQCHECKER(iface, i) = sc;
+		__atomic_store_n(&iface->nperflow, i + 1, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/*
+ * change flow ranges from web interface.
+ * name is one of "saddr", "daddr", "sport" and "dport" as same as
+ * --saddr, --daddr, --sport and --dport option. the ranges are not
+ * used until flow_apply() is called.
+ */
+int
+flow_setrange(const char *name, const char *range)
+{
+	char buf[128];
+	uint16_t begin, end;
+
+	if (strlcpy(buf, range, sizeof(buf)) >= sizeof(buf))
+		return -1;
+
+	if (strcmp(name, "sport") == 0) {
+		if (parse_portrange(buf, &begin, &end) != 0)
+			return -1;
+		opt_srcport_begin = begin;
+		opt_srcport_end = end;
+	} else if (strcmp(name, "dport") == 0) {
+		if (parse_portrange(buf, &begin, &end) != 0)
+			return -1;
+		opt_dstport_begin = begin;
+		opt_dstport_end = end;
+	} else if (strcmp(name, "saddr") == 0) {
+		if (parse_addrrange(buf, &opt_srcaddr_begin, &opt_srcaddr_end) == 0)
+			opt_srcaddr_af = AF_INET;
+		else if (parse_addr6range(buf, &opt_srcaddr6_begin, &opt_srcaddr6_end) == 0)
+			opt_srcaddr_af = AF_INET6;
+		else
+			return -1;
+		opt_addrrange = 1;
+		opt_saddr = 1;
+	} else if (strcmp(name, "daddr") == 0) {
+		if (parse_addrrange(buf, &opt_dstaddr_begin, &opt_dstaddr_end) == 0)
+			opt_dstaddr_af = AF_INET;
+		else if (parse_addr6range(buf, &opt_dstaddr6_begin, &opt_dstaddr6_end) == 0)
+			opt_dstaddr_af = AF_INET6;
+		else
+			return -1;
+		opt_addrrange = 1;
+		opt_daddr = 1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * compiled flowlist has no adrlist, and its flow table tells the address family.
+ */
+static int
+flow_include_af(int ifno, int af)
+{
+	struct flowtable *ft = interface[ifno].flowtable;
+
+	if ((ft == NULL) || (ft->map == NULL))
+		return addresslist_include_af(interface[ifno].adrlist, af);
+	if (ft->af == AF_UNSPEC)
+		return 1;
+	return ft->af == af;
+}
+
+/*
+ * --streams. fill defaults, and build the flow table of streams which
+ * have their own flows. others share the flows of TX interface.
+ */
+static int
+stream_setup(void)
+{
+	struct stream *stream;
+	struct addresslist *adrlist[2];
+	unsigned int i, l3size, l4size;
+	int ipv6, error;
+
+	for (i = 0; i < nstream; i++) {
+		stream = &streams[i];
+		if (stream->proto == 0)
+			stream->proto = opt_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+		if (stream->pktsize == 0)
+			stream->pktsize = interface[1].pktsize;
+
+		if ((stream->flowstr != NULL) || (stream->flowlist != NULL)) {
+			adrlist[0] = flow_addresslist_new();
+			adrlist[1] = flow_addresslist_new();
+			addresslist_setlazy(adrlist[1], 0);
+			addresslist_setlimit(adrlist[1], MAXFLOWNUM);
+
+			if (stream->flowlist != NULL)
+				error = flowlist_read(stream->flowlist, adrlist);
+			else
+				error = parse_flowstr(adrlist[1], stream->proto,
+				    stream->flowstr, false);
+			if ((error == 0) &&
+			    ((flow_addresslist_build(adrlist[1]) != 0) ||
+			    (addresslist_get_tuplenum(adrlist[1]) == 0)))
+				error = -1;
+			if (error == 0) {
+				stream->flowtable = addresslist_flowtable_new(adrlist[1],
+				    interface[1].gw_l2random || interface[0].gw_l2random);
+				if ((stream->flowtable == NULL) ||
+				    (flow_l2tag_check(1, &stream->flowtable) != 0))
+					error = -1;
+			}
+			addresslist_delete(adrlist[0]);
+			addresslist_delete(adrlist[1]);
+			if (error != 0) {
+				fprintf(stderr, "stream %s: cannot setup flows\n", stream->name);
+				return -1;
+			}
+			ipv6 = (stream->flowtable->af != AF_INET);
+		} else {
+			ipv6 = use_ipv6;
+		}
+
+		l3size = ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct ip);
+		if (stream->proto == IPPROTO_TCP)
+			l4size = sizeof(struct tcphdr);
+		else
+			l4size = sizeof(struct udphdr);
+		stream->minsize = MAX(min_pktsize, l3size + l4size + sizeof(struct seqdata));
+		if (stream->pktsize < stream->minsize)
+			stream->pktsize = stream->minsize;
+		if (stream->imix != NULL)
+			stream->pktsize = imix_avgsize(stream->imix, stream->minsize) + 0.5;
+	}
+	return 0;
+}
+
+/*
+ * publish new flows to TX/RX threads, RCU-like. the old ones are retired,
+ * and freed by flow_reclaim() after all threads passed quiescent state.
+ * called only from control thread.
+ */
+static void
+flow_retire(struct flowretire *retire)
+{
+	int i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (i = 0; i < FLOWQS_NTHREAD; i++)
+		retire->qs[i] = __atomic_load_n(&flowqs[i].count, __ATOMIC_ACQUIRE);
+	retire->next = flowretire_list;
+	flowretire_list = retire;
+}
+
+static int
+flow_swap(struct addresslist *adrlist[2], struct flowtable *ft[2], struct flowindex *fi[2],
+    struct flowdist *fd[2])
+{
+	struct flowretire *retire;
+	int i;
+
+	retire = calloc(1, sizeof(struct flowretire));
+	if (retire == NULL)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		retire->adrlist[i] = interface[i].adrlist;
+		retire->flowtable[i] = interface[i].flowtable;
+		retire->flowindex[i] = interface[i].flowindex;
+		retire->flowdist[i] = interface[i].flowdist;
+		__atomic_store_n(&interface[i].adrlist, adrlist[i], __ATOMIC_RELEASE);
+		__atomic_store_n(&interface[i].flowtable, ft[i], __ATOMIC_RELEASE);
+		__atomic_store_n(&interface[i].flowindex, fi[i], __ATOMIC_RELEASE);
+		__atomic_store_n(&interface[i].flowdist, fd[i], __ATOMIC_RELEASE);
+		__atomic_add_fetch(&interface[i].flowtable_gen, 1, __ATOMIC_RELEASE);
+	}
+	flow_retire(retire);
+
+	return 0;
+}
+
+/* replace only --flowdist tables, when the number of flows in use is changed */
+static int
+flow_swap_flowdist(struct flowdist *fd[2])
+{
+	struct flowretire *retire;
+	int i;
+
+	retire = calloc(1, sizeof(struct flowretire));
+	if (retire == NULL)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		retire->flowdist[i] = interface[i].flowdist;
+		__atomic_store_n(&interface[i].flowdist, fd[i], __ATOMIC_RELEASE);
+	}
+	flow_retire(retire);
+
+	return 0;
+}
+
+static void
+flow_reclaim(void)
+{
+	struct flowretire *retire, **prev;
+	int i;
+
+	for (prev = &flowretire_list; (retire = *prev) != NULL; ) {
+		for (i = 0; i < FLOWQS_NTHREAD; i++) {
+			if (flowqs[i].active &&
+			    (__atomic_load_n(&flowqs[i].count, __ATOMIC_ACQUIRE) == retire->qs[i]))
+				break;
+		}
+		if (i < FLOWQS_NTHREAD) {
+			/* still may be referred */
+			prev = &retire->next;
+			continue;
+		}
+
+		*prev = retire->next;
+		for (i = 0; i < 2; i++) {
+			if (retire->adrlist[i] != NULL)
+				addresslist_delete(retire->adrlist[i]);
+			if (retire->flowtable[i] != NULL)
+				addresslist_flowtable_delete(retire->flowtable[i]);
+			if (retire->flowindex[i] != NULL)
+				flowindex_delete(retire->flowindex[i]);
+			if (retire->flowdist[i] != NULL)
+				flowdist_delete(retire->flowdist[i]);
+		}
+		free(retire);
+	}
+}
+
+static void
+flow_update_params(void)
+{
+	if (flow_include_af(0, AF_INET6) || flow_include_af(1, AF_INET6))
+		use_ipv6 = 1;
+	else
+		use_ipv6 = 0;
+	update_min_pktsize();
+	update_transmit_Mbps(0);
+	update_transmit_Mbps(1);
+}
+
+/*
+ * add or remove flows while transmitting. flowstr is a line of --flowlist.
+ * new flows are built from a copy of the current ones off the data path,
+ * and swapped by flow_swap(). flowid of the remaining flows may shift,
+ * so that per flow sequence work is looked up by the state id of the
+ * flow, which is inherited from the current flowtable. lazy addresslist
+ * has no flowtable, and per flow work is reset instead.
+ */
+int
+flow_update(const char *flowstr, int add)
+{
+	struct addresslist *adrlist[2] = { NULL, NULL };
+	struct addresslist *pattern[2] = { NULL, NULL };
+	struct flowtable *ft[2] = { NULL, NULL };
+	struct flowindex *fi[2] = { NULL, NULL };
+	struct flowdist *fd[2] = { NULL, NULL };
+	unsigned int nflow, nflow_old, nflow_use;
+	int64_t nid[2] = { 0, 0 };
+	int i, proto, rc;
+
+	if (rfc2544_running())
+		return -1;
+	for (i = 0; i < 2; i++) {
+		/* compiled flowlist cannot be modified */
+		if ((interface[i].flowtable != NULL) && (interface[i].flowtable->map != NULL))
+			return -1;
+	}
+
+	rc = -1;
+	proto = opt_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+	for (i = 0; i < 2; i++) {
+		if ((adrlist[i] = addresslist_dup(interface[i].adrlist)) == NULL)
+			goto done;
+	}
+
+	if (add) {
+		if ((parse_flowstr(adrlist[1], proto, flowstr, false) != 0) ||
+		    (parse_flowstr(adrlist[0], proto, flowstr, true) != 0))
+			goto done;
+	} else {
+		for (i = 0; i < 2; i++) {
+			pattern[i] = flow_addresslist_new();
+			addresslist_setlimit(pattern[i], UINT_MAX);
+			if ((parse_flowstr(pattern[i], proto, flowstr, i == 0) != 0) ||
+			    (addresslist_remove(adrlist[i], pattern[i]) <= 0))
+				goto done;
+		}
+	}
+
+	if ((flow_addresslist_build(adrlist[0]) != 0) ||
+	    (flow_addresslist_build(adrlist[1]) != 0) ||
+	    (addresslist_get_tuplenum(adrlist[0]) == 0) ||
+	    (addresslist_get_tuplenum(adrlist[1]) == 0))
+		goto done;
+
+	for (i = 0; i < 2; i++) {
+		if (opt_flowsort)
+			addresslist_rebuild(adrlist[i]);
+		if ((interface_alloc_perflow(i, MIN(addresslist_get_tuplenum(adrlist[i]), MAXFLOWNUM)) != 0) ||
+		    (flow_flowtable_new(i, adrlist[i], &ft[i]) != 0))
+			goto done;
+		if ((ft[i] != NULL) && ((nid[i] = flow_stateid_new(i, ft[i])) < 0))
+			goto done;
+	}
+	/* state id of TX side indexes per flow work of RX side */
+	for (i = 0; i < 2; i++) {
+		if (interface_alloc_perflow(i, MIN(MAX(nid[0], nid[1]), MAXFLOWNUM)) != 0)
+			goto done;
+	}
+	for (i = 0; i < 2; i++) {
+		if (flow_flowindex_new(ft[i ^ 1], &fi[i]) != 0)
+			goto done;
+	}
+
+	/* keep --nflow limit unless all flows were used */
+	nflow_old = MAX(get_flownum(0), get_flownum(1));
+	for (nflow = 0, i = 0; i < 2; i++) {
+		nflow = MAX(nflow, (ft[i] != NULL) ?
+		    ft[i]->nflow : addresslist_get_tuplenum(adrlist[i]));
+	}
+	nflow_use = ((opt_nflow == nflow_old) || (opt_nflow > nflow)) ? nflow : opt_nflow;
+	for (i = 0; i < 2; i++) {
+		if (flow_flowdist_new(ft[i], nflow_use, &fd[i]) != 0)
+			goto done;
+	}
+
+	if (flow_swap(adrlist, ft, fi, fd) != 0)
+		goto done;
+	for (i = 0; i < 2; i++) {
+		adrlist[i] = NULL;
+		ft[i] = NULL;
+		fi[i] = NULL;
+		fd[i] = NULL;
+	}
+	opt_nflow = nflow_use;
+	for (i = 0; i < 2; i++) {
+		if (interface[i].flowtable == NULL)
+			interface[i].need_reset_perflow = 1;
+	}
 
-			xaddr6 = interface[0].gw6addr;						/* gw address */
-			addresslist_exclude_saddr6(interface[0].adrlist, &xaddr6);
-			addresslist_exclude_daddr6(interface[1].adrlist, &xaddr6);
+	flow_update_params();
+	logging("flow %s: %s, %u flows", add ? "added" : "deleted", flowstr, nflow);
+	rc = 0;
 
-			if (opt_saddr == 0)
-				opt_srcaddr6_begin = opt_srcaddr6_end = interface[1].ip6addr;
-			if (opt_daddr == 0)
-				opt_dstaddr6_begin = opt_dstaddr6_end = interface[0].ip6addr;
+ done:
+	for (i = 0; i < 2; i++) {
+		if (pattern[i] != NULL)
+			addresslist_delete(pattern[i]);
+		if (fd[i] != NULL)
+			flowdist_delete(fd[i]);
+		if (fi[i] != NULL)
+			flowindex_delete(fi[i]);
+		if (ft[i] != NULL)
+			addresslist_flowtable_delete(ft[i]);
+		if (adrlist[i] != NULL)
+			addresslist_delete(adrlist[i]);
+	}
+	return rc;
+}
 
-			rc = addresslist_append6(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &opt_srcaddr6_begin, &opt_srcaddr6_end,
-			    &opt_dstaddr6_begin, &opt_dstaddr6_end,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+/*
+ * rebuild interface[].adrlist from the current flow ranges.
+ * this resets flows and statistics, so that it is allowed only
+ * while both interfaces stop transmitting. TX/RX threads are still
+ * running, so the new flows are published by flow_swap() and per flow
+ * work is only grown by interface_alloc_perflow().
+ */
+int
+flow_apply(void)
+{
+	struct addresslist *adrlist[2];
+	struct flowtable *ft[2] = { NULL, NULL };
+	struct flowindex *fi[2] = { NULL, NULL };
+	struct flowdist *fd[2] = { NULL, NULL };
+	unsigned int nflow;
+	int i;
 
-			rc = addresslist_append6(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &opt_dstaddr6_begin, &opt_dstaddr6_end,
-			    &opt_srcaddr6_begin, &opt_srcaddr6_end,
-			    opt_dstport_begin, opt_dstport_end,
-			    opt_srcport_begin, opt_srcport_end);
-			if (rc != 0)
-				exit(1);
-		}
+	if (interface[0].transmit_enable || interface[1].transmit_enable || rfc2544_running())
+		return -1;
+	if (opt_saddr && opt_daddr && (opt_srcaddr_af != opt_dstaddr_af))
+		return -1;
 
-	} else if (opt_allnet) {
+	for (i = 0; i < 2; i++)
+		adrlist[i] = flow_addresslist_new();
 
-		if (!ipv4_iszero(&interface[0].ipaddr) && !ipv4_iszero(&interface[1].ipaddr)) {
-			/* exclude hostzero address and gw address and broadcast address */
-			xaddr.s_addr = interface[0].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
-			xaddr.s_addr = interface[0].ipaddr.s_addr & interface[0].ipaddr_mask.s_addr;	/* hostzero */
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
-			xaddr.s_addr = interface[0].gwaddr.s_addr;					/* gw address */
-			addresslist_exclude_daddr(interface[1].adrlist, xaddr);
+	if ((generate_addrlists(adrlist) != 0) ||
+	    (flow_addresslist_build(adrlist[0]) != 0) ||
+	    (flow_addresslist_build(adrlist[1]) != 0) ||
+	    (addresslist_get_tuplenum(adrlist[0]) == 0) ||
+	    (addresslist_get_tuplenum(adrlist[1]) == 0)) {
+		addresslist_delete(adrlist[0]);
+		addresslist_delete(adrlist[1]);
+		return -1;
+	}
 
-			xaddr.s_addr = interface[1].ipaddr.s_addr | ~interface[1].ipaddr_mask.s_addr;	/* broadcast */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
-			xaddr.s_addr = interface[1].ipaddr.s_addr & interface[1].ipaddr_mask.s_addr;	/* hostzero */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
-			xaddr.s_addr = interface[1].gwaddr.s_addr;					/* gw address */
-			addresslist_exclude_daddr(interface[0].adrlist, xaddr);
+	for (i = 0; i < 2; i++) {
+		if (opt_flowsort)
+			addresslist_rebuild(adrlist[i]);
+		if ((interface_alloc_perflow(i, MIN(addresslist_get_tuplenum(adrlist[i]), MAXFLOWNUM)) != 0) ||
+		    (flow_flowtable_new(i, adrlist[i], &ft[i]) != 0)) {
+			if (ft[0] != NULL)
+				addresslist_flowtable_delete(ft[0]);
+			addresslist_delete(adrlist[0]);
+			addresslist_delete(adrlist[1]);
+			return -1;
+		}
+	}
 
-			xaddr.s_addr = interface[0].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
-			rc = addresslist_append(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[1].ipaddr, interface[1].ipaddr,
-			    interface[0].ipaddr, xaddr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+	/*
+	 * flowcur belongs to TX thread which may still be in the loop.
+	 * it is rewound by the thread when it sees the new flowtable.
+	 */
+	for (i = 0; i < 2; i++)
+		__atomic_add_fetch(&interface[i].flowcur_reset, 1, __ATOMIC_RELEASE);
+	nflow = MAX((ft[0] != NULL) ? ft[0]->nflow : addresslist_get_tuplenum(adrlist[0]),
+	    (ft[1] != NULL) ? ft[1]->nflow : addresslist_get_tuplenum(adrlist[1]));
+	if ((flow_flowindex_new(ft[1], &fi[0]) != 0) ||
+	    (flow_flowindex_new(ft[0], &fi[1]) != 0) ||
+	    (flow_flowdist_new(ft[0], nflow, &fd[0]) != 0) ||
+	    (flow_flowdist_new(ft[1], nflow, &fd[1]) != 0) ||
+	    (flow_swap(adrlist, ft, fi, fd) != 0)) {
+		for (i = 0; i < 2; i++) {
+			if (fd[i] != NULL)
+				flowdist_delete(fd[i]);
+			if (fi[i] != NULL)
+				flowindex_delete(fi[i]);
+			if (ft[i] != NULL)
+				addresslist_flowtable_delete(ft[i]);
+			addresslist_delete(adrlist[i]);
+		}
+		return -1;
+	}
+	opt_flowlist = NULL;
+	opt_nflow = nflow;
 
-			xaddr.s_addr = interface[1].ipaddr.s_addr | ~interface[0].ipaddr_mask.s_addr;	/* broadcast */
-			rc = addresslist_append(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[0].ipaddr, interface[0].ipaddr,
-			    interface[1].ipaddr, xaddr,
-			    opt_dstport_begin, opt_dstport_end,
-			    opt_srcport_begin, opt_srcport_end);
-			if (rc != 0)
-				exit(1);
+	flow_update_params();
 
-		} else if (!ipv6_iszero(&interface[0].ip6addr) && !ipv6_iszero(&interface[1].ip6addr)) {
-			/* exclude gw address */
-			xaddr6 = interface[0].gw6addr;					/* gw address */
-			addresslist_exclude_daddr6(interface[1].adrlist, &xaddr6);
-			xaddr6 = interface[1].gw6addr;					/* gw address */
-			addresslist_exclude_daddr6(interface[0].adrlist, &xaddr6);
+	statistics_clear();
+	logging("flow changed: %u flows", opt_nflow);
 
-			/* e.g.) fd00::1/112 => from fd00:0 to fd00::ffff */
-			xaddr6_begin = interface[0].ip6addr_mask;
-			ipv6_and(&interface[0].ip6addr, &xaddr6_begin, &xaddr6_begin);	/* beginning of network address */
-			ipv6_not(&interface[0].ip6addr_mask, &xaddr6);
-			ipv6_or(&interface[0].ip6addr, &xaddr6, &xaddr6);	/* end of network address */
-			rc = addresslist_append6(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &interface[1].ip6addr, &interface[1].ip6addr,
-			    &xaddr6_begin, &xaddr6,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+	return 0;
+}
 
-			xaddr6_begin = interface[1].ip6addr_mask;
-			ipv6_and(&interface[1].ip6addr, &xaddr6_begin, &xaddr6_begin);	/* beginning of network address */
-			ipv6_not(&interface[1].ip6addr_mask, &xaddr6);
-			ipv6_or(&interface[1].ip6addr, &xaddr6, &xaddr6);	/* last of network address */
-			rc = addresslist_append6(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &interface[0].ip6addr, &interface[0].ip6addr,
-			    &xaddr6_begin, &xaddr6,
-			    opt_dstport_begin, opt_dstport_end,
-			    opt_srcport_begin, opt_srcport_end);
-			if (rc != 0)
-				exit(1);
+unsigned int
+getnflow(void)
+{
+	return opt_nflow;
+}
 
-		} else {
-			fprintf(stderr, "no address info on %s and %s\n",
-			    interface[0].ifname, interface[1].ifname);
-			exit(1);
-		}
+int
+setnflow(unsigned int nflow)
+{
+	struct flowdist *fd[2];
 
-	} else {
-		if (!ipv4_iszero(&interface[0].ipaddr) && !ipv4_iszero(&interface[1].ipaddr)) {
-			rc = addresslist_append(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[1].ipaddr, interface[1].ipaddr,
-			    interface[0].ipaddr, interface[0].ipaddr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+	if ((nflow < 1) || (nflow > (unsigned int)get_flownum(0)))
+		return -1;
 
-			rc = addresslist_append(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[0].ipaddr, interface[0].ipaddr,
-			    interface[1].ipaddr, interface[1].ipaddr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+	if (opt_flowdist != FLOWDIST_RR) {
+		if (flow_flowdist_new(interface[0].flowtable, nflow, &fd[0]) != 0)
+			return -1;
+		if ((flow_flowdist_new(interface[1].flowtable, nflow, &fd[1]) != 0) ||
+		    (flow_swap_flowdist(fd) != 0)) {
+			if (fd[0] != NULL)
+				flowdist_delete(fd[0]);
+			if (fd[1] != NULL)
+				flowdist_delete(fd[1]);
+			return -1;
+		}
+	}
+	opt_nflow = nflow;
+	return 0;
+}
 
-		} else if (!ipv6_iszero(&interface[0].ip6addr) && !ipv6_iszero(&interface[1].ip6addr)) {
-			rc = addresslist_append6(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &interface[1].ip6addr, &interface[1].ip6addr,
-			    &interface[0].ip6addr, &interface[0].ip6addr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+static void
+flow_range_json(FILE *fp, const char *name, int af,
+    const void *begin, const void *end)
+{
+	char buf1[INET6_ADDRSTRLEN], buf2[INET6_ADDRSTRLEN];
 
-			rc = addresslist_append6(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    &interface[0].ip6addr, &interface[0].ip6addr,
-			    &interface[1].ip6addr, &interface[1].ip6addr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
-		} else {
-			/* no address information. use 0.0.0.0-0.0.0.0 */
-			rc = addresslist_append(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[1].ipaddr, interface[1].ipaddr,
-			    interface[0].ipaddr, interface[0].ipaddr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
+	inet_ntop(af, begin, buf1, sizeof(buf1));
+	inet_ntop(af, end, buf2, sizeof(buf2));
+	fprintf(fp, "\"%s\":\"%s-%s\",", name, buf1, buf2);
+}
 
-			rc = addresslist_append(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP,
-			    interface[0].ipaddr, interface[0].ipaddr,
-			    interface[1].ipaddr, interface[1].ipaddr,
-			    opt_srcport_begin, opt_srcport_end,
-			    opt_dstport_begin, opt_dstport_end);
-			if (rc != 0)
-				exit(1);
-		}
+void
+flow_status_json(FILE *fp)
+{
+	fprintf(fp, "{");
+	if (opt_flowlist != NULL)
+		fprintf(fp, "\"flowlist\":\"%s\",", opt_flowlist);
+	if (opt_saddr) {
+		if (opt_srcaddr_af == AF_INET)
+			flow_range_json(fp, "saddr", AF_INET, &opt_srcaddr_begin, &opt_srcaddr_end);
+		else
+			flow_range_json(fp, "saddr", AF_INET6, &opt_srcaddr6_begin, &opt_srcaddr6_end);
+	}
+	if (opt_daddr) {
+		if (opt_dstaddr_af == AF_INET)
+			flow_range_json(fp, "daddr", AF_INET, &opt_dstaddr_begin, &opt_dstaddr_end);
+		else
+			flow_range_json(fp, "daddr", AF_INET6, &opt_dstaddr6_begin, &opt_dstaddr6_end);
 	}
+	fprintf(fp, "\"sport\":\"%u-%u\",", opt_srcport_begin, opt_srcport_end);
+	fprintf(fp, "\"dport\":\"%u-%u\",", opt_dstport_begin, opt_dstport_end);
+	fprintf(fp, "\"nflow\":%u,", opt_nflow);
+	fprintf(fp, "\"TXflows\":%d,", get_flownum(1));
+	fprintf(fp, "\"RXflows\":%d", get_flownum(0));
+	fprintf(fp, "}");
 }
 
 int
@@ -4015,6 +7293,7 @@ main(int argc, char *argv[])
 	int pps;
 	int pppoe = 0;
 	int vlan = 0;
+	struct encap *encap = NULL;
 	char ifname[2][IFNAMSIZ];
 	char *testscript = NULL;
 	uint64_t maxlinkspeed;
@@ -4033,6 +7312,7 @@ main(int argc, char *argv[])
 		pbufq_init(&interface[i].pbufq);
 		interface[i].pktsize = min_pktsize;
 	}
+	rss_init(&opt_rss);
 
 	while ((ch = getopt_long(argc, argv, "D:dF:fH:L:n:Pp:R:S:s:T:t:vV:X", longopts, &optidx)) != -1) {
 		switch (ch) {
@@ -4066,6 +7346,10 @@ main(int argc, char *argv[])
 				fprintf(stderr, "VLAN (-V) and PPPoE (-P) cannot be specified at the same time\n");
 				usage();
 			}
+			if ((encap != NULL) && pppoe) {
+				fprintf(stderr, "--encap and PPPoE (-P) cannot be specified at the same time\n");
+				usage();
+			}
 #ifndef SUPPORT_PPPOE
 			if (pppoe) {
 				fprintf(stderr, "PPPoE is not supported on this OS\n");
@@ -4074,8 +7358,12 @@ main(int argc, char *argv[])
 #endif
 			iface->vlan_id = vlan;
 			iface->pppoe = pppoe;
+			iface->encap = encap;
+			if ((encap != NULL) && (encap->tunnel != ENCAP_TUNNEL_NONE))
+				opt_decap = 1;
 			vlan = 0;
 			pppoe = 0;
+			encap = NULL;
 
 			/*
 			 * parse
@@ -4213,6 +7501,16 @@ main(int argc, char *argv[])
 				parse_portrange(optarg, &opt_srcport_begin, &opt_srcport_end);
 			} else if (strcmp(longopts[optidx].name, "dport") == 0) {
 				parse_portrange(optarg, &opt_dstport_begin, &opt_dstport_end);
+			} else if (strcmp(longopts[optidx].name, "vlan") == 0) {
+				if (parse_vlanrange(optarg, &opt_cvlan_begin, &opt_cvlan_end) != 0) {
+					fprintf(stderr, "illegal vlan range: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "svlan") == 0) {
+				if (parse_vlanrange(optarg, &opt_svlan_begin, &opt_svlan_end) != 0) {
+					fprintf(stderr, "illegal vlan range: %s\n", optarg);
+					usage();
+				}
 			} else if (strcmp(longopts[optidx].name, "saddr") == 0) {
 				opt_addrrange = 1;
 				opt_saddr = 1;
@@ -4239,8 +7537,91 @@ main(int argc, char *argv[])
 				opt_flowsort = 1;
 			} else if (strcmp(longopts[optidx].name, "flowdump") == 0) {
 				opt_flowdump = 1;
+			} else if (strcmp(longopts[optidx].name, "flowlazy") == 0) {
+				opt_flowlazy = 1;
+			} else if (strcmp(longopts[optidx].name, "flowmac-md5") == 0) {
+				opt_flowmac_md5 = 1;
+			} else if (strcmp(longopts[optidx].name, "burst-train") == 0) {
+				if ((sscanf(optarg, "%u,%u", &opt_train_npkt, &opt_train_usec) != 2) ||
+				    (opt_train_npkt == 0) || (opt_train_usec == 0)) {
+					fprintf(stderr, "illegal --burst-train: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "streams") == 0) {
+				if ((streams = stream_read(optarg, &nstream)) == NULL)
+					usage();
+			} else if (strcmp(longopts[optidx].name, "encap") == 0) {
+				if (encap != NULL)
+					encap_delete(encap);
+				if ((encap = encap_parse(optarg)) == NULL)
+					usage();
+			} else if (strcmp(longopts[optidx].name, "template") == 0) {
+				if (opt_template != NULL)
+					pkttemplate_delete(opt_template);
+				opt_template = pkttemplate_read(optarg, 46, sizeof(struct seqdata));
+				if (opt_template == NULL)
+					usage();
+			} else if (strcmp(longopts[optidx].name, "imix") == 0) {
+				if (opt_imix != NULL)
+					imix_delete(opt_imix);
+				if ((opt_imix = imix_new(optarg)) == NULL) {
+					fprintf(stderr, "illegal --imix: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "flowcheck") == 0) {
+				opt_flowcheck = 1;
+			} else if (strcmp(longopts[optidx].name, "xlat-src") == 0) {
+				if (flowxlat_parse(optarg, &opt_xlat_src) != 0) {
+					fprintf(stderr, "illegal --xlat-src: %s\n", optarg);
+					usage();
+				}
+				opt_flowcheck = 1;
+			} else if (strcmp(longopts[optidx].name, "xlat-dst") == 0) {
+				if (flowxlat_parse(optarg, &opt_xlat_dst) != 0) {
+					fprintf(stderr, "illegal --xlat-dst: %s\n", optarg);
+					usage();
+				}
+				opt_flowcheck = 1;
+			} else if (strcmp(longopts[optidx].name, "random") == 0) {
+				if (randfield_parse(&opt_random, optarg) != 0) {
+					fprintf(stderr, "illegal --random: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "seed") == 0) {
+				opt_seed = strtoull(optarg, NULL, 0);
+				opt_seed_set = 1;
+			} else if (strcmp(longopts[optidx].name, "flowdist") == 0) {
+				if (flowdist_parse(optarg, &opt_flowdist, &opt_flowdist_zipf) != 0) {
+					fprintf(stderr, "illegal --flowdist: %s\n", optarg);
+					usage();
+				}
 			} else if (strcmp(longopts[optidx].name, "flowlist") == 0) {
 				opt_flowlist = optarg;
+			} else if (strcmp(longopts[optidx].name, "flowlist-compile") == 0) {
+				opt_flowlist_compile = optarg;
+			} else if (strcmp(longopts[optidx].name, "rss-generate") == 0) {
+				opt_rss_generate = optarg;
+			} else if (strcmp(longopts[optidx].name, "rss-queues") == 0) {
+				opt_rss.nqueue = strtoul(optarg, NULL, 10);
+				if (opt_rss.nqueue < 1) {
+					fprintf(stderr, "illegal --rss-queues: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "rss-key") == 0) {
+				if (rss_parse_key(&opt_rss, optarg) != 0) {
+					fprintf(stderr, "illegal --rss-key: %s (40-64 bytes in hex)\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "rss-l3") == 0) {
+				opt_rss.l4 = 0;
+			} else if (strcmp(longopts[optidx].name, "rss-reta") == 0) {
+				opt_rss.retasize = strtoul(optarg, NULL, 10);
+				if (opt_rss.retasize < 1) {
+					fprintf(stderr, "illegal --rss-reta: %s\n", optarg);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "rss-weight") == 0) {
+				opt_rss_weight = optarg;
 			} else if (strcmp(longopts[optidx].name, "rfc2544") == 0) {
 				opt_rfc2544 = 1;
 			} else if (strcmp(longopts[optidx].name, "rfc2544-tolerable-error-rate") == 0) {
@@ -4281,6 +7662,34 @@ main(int argc, char *argv[])
 				}
 			} else if (strcmp(longopts[optidx].name, "rfc2544-no-early-finish") == 0) {
 				opt_rfc2544_early_finish = 0;
+			} else if (strcmp(longopts[optidx].name, "rx-threads") == 0) {
+				opt_rxthreads = strtoul(optarg, NULL, 10);
+				if ((opt_rxthreads < 1) || (opt_rxthreads > RXSHARD_MAX)) {
+					fprintf(stderr, "illegal --rx-threads: %s (1-%d)\n", optarg, RXSHARD_MAX);
+					usage();
+				}
+			} else if (strcmp(longopts[optidx].name, "xdp-prog") == 0) {
+				opt_xdp_prog = optarg;
+			} else if (strcmp(longopts[optidx].name, "txpath-test") == 0) {
+				opt_txpath_test = 1;
+			} else if (strcmp(longopts[optidx].name, "xdp-count") == 0) {
+#ifdef USE_AF_XDP
+				opt_xdp_count = 1;
+#else
+				fprintf(stderr, "--xdp-count is supported only on AF_XDP\n");
+				usage();
+#endif
+			} else if (strcmp(longopts[optidx].name, "xdp-rx-batch") == 0) {
+#ifdef USE_AF_XDP
+				opt_xdp_rx_batch = strtoul(optarg, NULL, 10);
+				if ((opt_xdp_rx_batch < 1) || (opt_xdp_rx_batch > AX_RX_BATCH_MAX)) {
+					fprintf(stderr, "illegal --xdp-rx-batch: %s (1-%d)\n", optarg, AX_RX_BATCH_MAX);
+					usage();
+				}
+#else
+				fprintf(stderr, "--xdp-rx-batch is supported only on AF_XDP\n");
+				usage();
+#endif
 			} else if (strcmp(longopts[optidx].name, "nocurses") == 0) {
 				use_curses = false;
 			} else if (strcmp(longopts[optidx].name, "fail-if-dropped") == 0) {
@@ -4302,6 +7711,16 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if ((nstream != 0) && (opt_rfc2544 || (opt_train_npkt != 0))) {
+		fprintf(stderr, "cannot use --streams with --rfc2544 or --burst-train\n");
+		exit(1);
+	}
+	if ((opt_template != NULL) &&
+	    (opt_rfc2544 || (nstream != 0) || (opt_imix != NULL) || opt_flowcheck)) {
+		fprintf(stderr, "cannot use --template with --rfc2544, --streams, --imix or --flowcheck\n");
+		exit(1);
+	}
+
 	if (opt_addrrange && opt_allnet) {
 		fprintf(stderr, "cannot use --allnet and --saddr/--daddr at the same time\n");
 		exit(1);
@@ -4335,6 +7754,20 @@ main(int argc, char *argv[])
 		fprintf(stderr, "illegal port order\n");
 		usage();
 	}
+	if (opt_flowlazy && opt_flowsort) {
+		fprintf(stderr, "--flowlazy and --flowsort cannot be used together\n");
+		usage();
+	}
+	if (opt_flowlazy && (opt_flowdist != FLOWDIST_RR)) {
+		fprintf(stderr, "--flowlazy supports only --flowdist rr\n");
+		usage();
+	}
+	if (opt_random.enable && (randfield_setdefault() != 0))
+		usage();
+	if (!opt_seed_set)
+		getrandom(&opt_seed, sizeof(opt_seed), 0);
+	if (opt_random.enable || (opt_flowdist != FLOWDIST_RR))
+		printf_verbose("random seed: %llu\n", (unsigned long long)opt_seed);
 
 	if (opt_debug != NULL) {
 		debug_tcpdump_fd = tcpdumpfile_open(opt_debug);
@@ -4349,6 +7782,19 @@ main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (opt_txpath_test)
+		exit(txpath_test_main() == 0 ? 0 : 1);
+
+	if (opt_flowlist_compile != NULL) {
+		flowlist_compile_main();
+		exit(0);
+	}
+
+	if (opt_rss_generate != NULL) {
+		rss_generate_main();
+		exit(0);
+	}
+
 	if (ifname[0][0] == '\0')
 		opt_txonly = 1;
 	if (ifname[1][0] == '\0')
@@ -4441,6 +7887,7 @@ main(int argc, char *argv[])
 		if (maxlinkspeed < interface[i].maxlinkspeed)
 			maxlinkspeed = interface[i].maxlinkspeed;
 	}
+	rfc2544_maxlinkspeed = maxlinkspeed;
 
 	if (opt_rfc2544_pktsize != NULL) {
 		char buf[128];
@@ -4448,6 +7895,10 @@ main(int argc, char *argv[])
 		char *p, *save = NULL;
 
 		while ((p = getword(opt_rfc2544_pktsize, ',', &save, buf, sizeof(buf))) != NULL) {
+			if ((strcmp(buf, "imix") == 0) && (opt_imix != NULL)) {
+				rfc2544_add_imix_test(maxlinkspeed, opt_imix);
+				continue;
+			}
 			pktsize = atoi(buf);
 			if ((pktsize < 46) || (pktsize > 1500)) {
 				fprintf(stderr, "illegal packet size in --rfc2544_pktsize: %d\n", pktsize);
@@ -4463,6 +7914,9 @@ main(int argc, char *argv[])
 	if (opt_rfc2544)
 		rfc2544_calc_param(maxlinkspeed);
 
+	for (i = 0; i < 2; i++)
+		interface[i].imix = opt_imix;
+	interface[1].pkttemplate = opt_template;
 
 	if (testscript != NULL) {
 		genscript = genscript_new(testscript);
@@ -4496,6 +7950,18 @@ main(int argc, char *argv[])
 	for (i = 0; i < 2; i++) {
 		interface[i].transmit_txhz = interface[i].transmit_pps / pps_hz;
 	}
+	/* latency is measured on TSC */
+	tsc_init();
+	if (nstream != 0) {
+		printf_verbose("%u streams, tsc %"PRIu64"Hz\n", nstream, tsc_hz);
+		interface[1].transmit_txhz = 0;
+	}
+	if (opt_train_npkt != 0) {
+		printf_verbose("burst train: %u packets every %u usec, tsc %"PRIu64"Hz\n",
+		    opt_train_npkt, opt_train_usec, tsc_hz);
+		for (i = 0; i < 2; i++)
+			interface[i].transmit_txhz = 0;
+	}
 
 	if (!opt_txonly)
 		interface_setup(0, ifname[0]);	/* RX */
@@ -4506,58 +7972,34 @@ main(int argc, char *argv[])
 	/*
 	 * configure adrlist
 	 */
-	for (i = 0; i < 2; i++) {
-		interface[i].adrlist = addresslist_new();
-		addresslist_setlimit(interface[i].adrlist, MAXFLOWNUM);
-	}
+	for (i = 0; i < 2; i++)
+		interface[i].adrlist = flow_addresslist_new();
 
-	if (opt_flowlist != NULL) {
-		FILE *fh;
-		char *line;
-		char buf[1024];
-		size_t len, lineno;
-		int anyerror;
-
-		fh = fopen(opt_flowlist, "r");
-		if (fh == NULL) {
-			fprintf(stderr, "%s: %s\n", opt_flowlist, strerror(errno));
-			exit(2);
+	if ((opt_flowlist != NULL) && addresslist_flowtable_isfile(opt_flowlist)) {
+		/* compiled flowlist. adrlist is left empty */
+		if (opt_flowlazy || opt_flowsort || opt_flowdump) {
+			fprintf(stderr, "%s: compiled flowlist cannot be used with --flowlazy, --flowsort or --flowdump\n", opt_flowlist);
+			exit(1);
 		}
-
-		anyerror = 0;
-		for (lineno = 1; ((line = fgets(buf, sizeof(buf), fh)) != NULL); lineno++) {
-			while ((*line == ' ') || (*line == '\t'))
-				line++;
-			if (line[0] == '#')
-				continue;
-
-			/* chop '\n' */
-			len = strlen(line);
-			if (len > 0)
-				line[len - 1] = '\0';
-
-			if (line[0] == '\0')	/* blank */
-				continue;
-
-			/* for TX */
-			if (parse_flowstr(interface[1].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP, line, false) != 0) {
-				fprintf(stderr, "%s:%"PRIu64": cannot parse: \"%s\"\n", opt_flowlist, lineno, line);
-				anyerror++;
-			}
-			/* for RX */
-			parse_flowstr(interface[0].adrlist, opt_tcp ? IPPROTO_TCP : IPPROTO_UDP, line, true);
+		for (i = 0; i < 2; i++) {
+			if (flow_flowtable_load(i, opt_flowlist, &interface[i].flowtable) != 0)
+				exit(2);
 		}
-		fclose(fh);
-		if (anyerror)
+	} else if (opt_flowlist != NULL) {
+		struct addresslist *adrlist[2] = { interface[0].adrlist, interface[1].adrlist };
+		if (flowlist_read(opt_flowlist, adrlist) != 0)
 			exit(2);
-
 	} else {
 		/* Generate interface[].adrlist based on specified addresses and options */
-		generate_addrlists();
+		struct addresslist *adrlist[2] = { interface[0].adrlist, interface[1].adrlist };
+		if (generate_addrlists(adrlist) != 0)
+			exit(1);
 	}
+	if ((flow_addresslist_build(interface[0].adrlist) != 0) ||
+	    (flow_addresslist_build(interface[1].adrlist) != 0))
+		exit(1);
 
-	if (addresslist_include_af(interface[0].adrlist, AF_INET6) ||
-	    addresslist_include_af(interface[1].adrlist, AF_INET6)) {
+	if (flow_include_af(0, AF_INET6) || flow_include_af(1, AF_INET6)) {
 		use_ipv6 = 1;
 	} else {
 		use_ipv6 = 0;
@@ -4576,11 +8018,24 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
-	if (addresslist_get_tuplenum(interface[1].adrlist) == 0) {
+	for (i = 0; i < 2; i++) {
+		if ((interface[i].flowtable == NULL) &&
+		    (flow_flowtable_new(i, interface[i].adrlist, &interface[i].flowtable) != 0))
+			exit(1);
+	}
+	for (i = 0; i < 2; i++) {
+		if (flow_flowindex_new(interface[i ^ 1].flowtable, &interface[i].flowindex) != 0)
+			exit(1);
+	}
+	if (opt_flowcheck && opt_flowlazy)
+		fprintf(stderr, "--flowcheck is ignored with --flowlazy\n");
+	if ((nstream != 0) && (stream_setup() != 0))
+		exit(1);
+	if (get_flownum(1) == 0) {
 		fprintf(stderr, "--saddr: no valid addresses. (hostzero, gateway or broadcast address were excluded)\n");
 		exit(1);
 	}
-	if (addresslist_get_tuplenum(interface[0].adrlist) == 0) {
+	if (get_flownum(0) == 0) {
 		fprintf(stderr, "--daddr: no valid addresses. (hostzero, gateway or broadcast address were excluded)\n");
 		exit(1);
 	}
@@ -4664,59 +8119,43 @@ main(int argc, char *argv[])
 
 	if (opt_nflow == 0)
 		opt_nflow = MAX(get_flownum(0), get_flownum(1));
+	for (i = 0; i < 2; i++) {
+		if (flow_flowdist_new(interface[i].flowtable, opt_nflow, &interface[i].flowdist) != 0)
+			exit(1);
+	}
 
 	/*
 	 * allocate per frame seqchecker
 	 */
-	j = get_flownum(0);
-	interface[0].sequence_tx_perflow = malloc(sizeof(uint64_t) * j);
-	memset(interface[0].sequence_tx_perflow, 0, sizeof(uint64_t) * j);
-	interface[0].seqchecker_perflow = malloc(sizeof(struct sequencechecker *) * j);
-	interface[0].seqchecker_flowtotal = seqcheck_new();
-	for (i = 0; i < j; i++) {
-		interface[0].seqchecker_perflow[i] = seqcheck_new();
-		if (interface[0].seqchecker_perflow[i] == NULL) {
-			fprintf(stderr, "cannot allocate %s flow sequence work %d/%d\n", interface[0].ifname, i, j);
+	for (i = 0; i < 2; i++) {
+		prng_seed(&interface[i].prng, opt_seed + i);
+		interface[i].seqchecker_flowtotal = seqcheck_new();
+		if (rxshard_init(i) != 0)
 			exit(1);
-		}
-		seqcheck_setparent(interface[0].seqchecker_perflow[i], interface[0].seqchecker_flowtotal);
-	}
-
-	j = get_flownum(1);
-	interface[1].sequence_tx_perflow = malloc(sizeof(uint64_t) * j);
-	memset(interface[1].sequence_tx_perflow, 0, sizeof(uint64_t) * j);
-	interface[1].seqchecker_perflow = malloc(sizeof(struct sequencechecker *) * j);
-	interface[1].seqchecker_flowtotal = seqcheck_new();
-	for (i = 0; i < j; i++) {
-		interface[1].seqchecker_perflow[i] = seqcheck_new();
-		if (interface[1].seqchecker_perflow[i] == NULL) {
-			fprintf(stderr, "cannot allocate %s flow sequence work %d/%d\n", interface[1].ifname, i, j);
+		if (interface_alloc_perflow(i, MIN(get_flownum(i), MAXFLOWNUM)) != 0)
 			exit(1);
-		}
-		seqcheck_setparent(interface[1].seqchecker_perflow[i], interface[1].seqchecker_flowtotal);
 	}
 
 
-	for (i = 0; i < 2; i++) {
-		ip4pkt_udp_template(pktbuffer_ipv4[PKTBUF_UDP][i], 1500 + ETHHDRSIZE);
-		build_template_packet_ipv4(i, pktbuffer_ipv4[PKTBUF_UDP][i]);
-		ip4pkt_tcp_template(pktbuffer_ipv4[PKTBUF_TCP][i], 1500 + ETHHDRSIZE);
-		build_template_packet_ipv4(i, pktbuffer_ipv4[PKTBUF_TCP][i]);
-		ip6pkt_udp_template(pktbuffer_ipv6[PKTBUF_UDP][i], 1500 + ETHHDRSIZE);
-		build_template_packet_ipv6(i, pktbuffer_ipv6[PKTBUF_UDP][i]);
-		ip6pkt_tcp_template(pktbuffer_ipv6[PKTBUF_TCP][i], 1500 + ETHHDRSIZE);
-		build_template_packet_ipv6(i, pktbuffer_ipv6[PKTBUF_TCP][i]);
+	build_template_packets();
+	if ((opt_template != NULL) && (interface[1].encap != NULL)) {
+		memcpy(pktbuffer_template, interface[1].encap->hdr[(opt_template->af == AF_INET6) ? 1 : 0],
+		    interface[1].encap->len);
+		memcpy(pktbuffer_template + interface[1].encap->len, opt_template->frame, opt_template->len);
+	} else if (opt_template != NULL) {
+		/* ether header of the same address family, and the template */
+		memcpy(pktbuffer_template, (opt_template->af == AF_INET6) ?
+		    pktbuffer_ipv6[PKTBUF_UDP][1] : pktbuffer_ipv4[PKTBUF_UDP][1], ETHHDRSIZE);
+		memcpy(pktbuffer_template + ETHHDRSIZE, opt_template->frame, opt_template->len);
 	}
 
 	if (!opt_txonly) {
 		pthread_create(&txthread0, NULL, tx_thread_main, &ifnum[0]);
-		pthread_create(&rxthread0, NULL, rx_thread_main, &ifnum[0]);
+		rxshard_create(0, &rxthread0);
 		{
 			char buf[128];
 			snprintf(buf, sizeof(buf), "%s-tx", interface[0].ifname);
 			pthread_setname_np(txthread0, buf);
-			snprintf(buf, sizeof(buf), "%s-rx", interface[0].ifname);
-			pthread_setname_np(rxthread0, buf);
 		}
 #ifdef __linux__
 		int error, i;
@@ -4727,7 +8166,8 @@ main(int argc, char *argv[])
 		for (i = 0; i < nprocs; i += 2)
 			CPU_SET(i, &cpuset);
 		error = pthread_setaffinity_np(txthread0, sizeof(cpuset), &cpuset);
-		error = pthread_setaffinity_np(rxthread0, sizeof(cpuset), &cpuset);
+		for (i = 0; i < (int)opt_rxthreads; i++)
+			error = pthread_setaffinity_np(rxshard[0][i].thread, sizeof(cpuset), &cpuset);
 #if 0
 		struct sched_param param;
 		param.sched_priority = sched_get_priority_max(SCHED_FIFO);
@@ -4738,13 +8178,11 @@ main(int argc, char *argv[])
 	}
 	if (!opt_rxonly) {
 		pthread_create(&txthread1, NULL, tx_thread_main, &ifnum[1]);
-		pthread_create(&rxthread1, NULL, rx_thread_main, &ifnum[1]);
+		rxshard_create(1, &rxthread1);
 		{
 			char buf[128];
 			snprintf(buf, sizeof(buf), "%s-tx", interface[1].ifname);
 			pthread_setname_np(txthread1, buf);
-			snprintf(buf, sizeof(buf), "%s-rx", interface[1].ifname);
-			pthread_setname_np(rxthread1, buf);
 		}
 #ifdef __linux__
 		int error, i;
@@ -4759,7 +8197,8 @@ main(int argc, char *argv[])
 				CPU_SET(i, &cpuset);
 		}
 		error = pthread_setaffinity_np(txthread1, sizeof(cpuset), &cpuset);
-		error = pthread_setaffinity_np(rxthread1, sizeof(cpuset), &cpuset);
+		for (i = 0; i < (int)opt_rxthreads; i++)
+			error = pthread_setaffinity_np(rxshard[1][i].thread, sizeof(cpuset), &cpuset);
 #if 0
 		struct sched_param param;
 		param.sched_priority = sched_get_priority_max(SCHED_FIFO);
@@ -57,6 +57,7 @@
 #ifndef _GEN_H_
 #define _GEN_H_
 
+#include <stdio.h>
 #include <time.h>
 
 #ifndef timespeccmp
@@ -97,6 +98,22 @@ int setpktsize(int, unsigned int);
 void transmit_set(int, int);
 int statistics_clear(void);
 
+int rfc2544_running(void);
+const char *rfc2544_getstate(void);
+int rfc2544_start(void);
+int rfc2544_stop(void);
+int rfc2544_setparam(const char *, const char *);
+void rfc2544_param_json(FILE *);
+void rfc2544_status_json(FILE *);
+void rfc2544_result_json(FILE *);
+
+int flow_setrange(const char *, const char *);
+int flow_apply(void);
+int flow_update(const char *, int);
+unsigned int getnflow(void);
+int setnflow(unsigned int);
+void flow_status_json(FILE *);
+
 extern struct timespec currenttime;
 
 #ifdef DEBUG
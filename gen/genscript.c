@@ -38,7 +38,7 @@
 #include "genscript.h"
 
 static int
-genscript_add_item(struct genscript *genscript, unsigned int cmd, unsigned int period, unsigned int pktsize, unsigned int pps)
+genscript_add_item(struct genscript *genscript, unsigned int cmd, unsigned int period, unsigned int pktsize, unsigned int pps, const char *flowstr)
 {
 	if (genscript->nalloc <= genscript->nitems) {
 		struct genscript_item *p;
@@ -62,6 +62,12 @@ genscript_add_item(struct genscript *genscript, unsigned int cmd, unsigned int p
 	genscript->items[genscript->nitems].period = period;
 	genscript->items[genscript->nitems].pktsize = pktsize;
 	genscript->items[genscript->nitems].pps = pps;
+	genscript->items[genscript->nitems].flowstr = NULL;
+	if (flowstr != NULL) {
+		genscript->items[genscript->nitems].flowstr = strdup(flowstr);
+		if (genscript->items[genscript->nitems].flowstr == NULL)
+			return -1;
+	}
 	genscript->nitems++;
 
 	return 0;
@@ -116,11 +122,12 @@ static int
 genscript_read(struct genscript *genscript, const char *path)
 {
 	FILE *fp;
-	char buf[1024], wbuf[256], *p, *q;
+	char buf[1024], wbuf[256], flowstr[512], *p, *q;
 	int lineno;
 	int anyerror = 0;
 	unsigned long cmd, period, pktsize, pps;
 	unsigned long long bps;
+	size_t len;
 
 	fp = fopen(path, "r");
 	if (fp == NULL)
@@ -131,6 +138,7 @@ genscript_read(struct genscript *genscript, const char *path)
 	    lineno++) {
 
 		cmd = period = pktsize = pps = 0;
+		flowstr[0] = '\0';
 
 		/* no parameter. empty line */
 		if ((p = getword(p, wbuf, sizeof(wbuf))) == NULL)
@@ -153,6 +161,23 @@ genscript_read(struct genscript *genscript, const char *path)
 			cmd = GENITEM_CMD_TX0SET;
 		} else if (strcmp(wbuf, "tx1") == 0) {
 			cmd = GENITEM_CMD_TX1SET;
+		} else if (strcmp(wbuf, "flowadd") == 0 || strcmp(wbuf, "flowdel") == 0) {
+			cmd = (strcmp(wbuf, "flowadd") == 0) ? GENITEM_CMD_FLOWADD : GENITEM_CMD_FLOWDEL;
+			if ((p = getword(p, flowstr, sizeof(flowstr))) == NULL) {
+				printf("%s:%d: flow parameter is not exists\n", path, lineno);
+				anyerror++;
+				continue;
+			}
+			/* optional "weight=<n>" */
+			q = p;
+			if ((cmd == GENITEM_CMD_FLOWADD) &&
+			    ((q = getword(p, wbuf, sizeof(wbuf))) != NULL) &&
+			    (strncmp(wbuf, "weight=", 7) == 0)) {
+				len = strlen(flowstr);
+				snprintf(flowstr + len, sizeof(flowstr) - len, " %s", wbuf);
+				p = q;
+			}
+			goto end_of_param;
 		} else {
 			printf("%s:%d: unknown command '%s'\n", path, lineno, wbuf);
 			anyerror++;
@@ -194,7 +219,8 @@ genscript_read(struct genscript *genscript, const char *path)
 			printf("%s:%d: unexpected parameter: %s\n", path, lineno, wbuf);
 			anyerror++;
 		}
-		genscript_add_item(genscript, cmd, period, pktsize, pps);
+		genscript_add_item(genscript, cmd, period, pktsize, pps,
+		    (flowstr[0] != '\0') ? flowstr : NULL);
 	}
 
 	fclose(fp);
@@ -208,13 +234,14 @@ genscript_read(struct genscript *genscript, const char *path)
 void
 genscript_dump_item(struct genscript_item *genitem, const char *prefix)
 {
-	printf("%s<item addr=%p cmd=%s period=%u pktsize=%u pps=%u />\n",
+	printf("%s<item addr=%p cmd=%s period=%u pktsize=%u pps=%u flow=\"%s\" />\n",
 	    prefix,
 	    genitem,
 	    genscript_cmdname(genitem->cmd),
 	    genitem->period,
 	    genitem->pktsize,
-	    genitem->pps);
+	    genitem->pps,
+	    (genitem->flowstr != NULL) ? genitem->flowstr : "");
 }
 
 void
@@ -252,7 +279,11 @@ genscript_new(const char *path)
 void
 genscript_delete(struct genscript *genscript)
 {
-	if (genscript->items == NULL)
+	unsigned int i;
+
+	for (i = 0; i < genscript->nitems; i++)
+		free(genscript->items[i].flowstr);
+	if (genscript->items != NULL)
 		free(genscript->items);
 	free(genscript);
 }
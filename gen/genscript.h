@@ -35,10 +35,13 @@ struct genscript {
 #define GENITEM_CMD_NOP		1
 #define GENITEM_CMD_TX0SET	2
 #define GENITEM_CMD_TX1SET	3
-#define GENITEM_CMD_NCMD	4
+#define GENITEM_CMD_FLOWADD	4
+#define GENITEM_CMD_FLOWDEL	5
+#define GENITEM_CMD_NCMD	6
 		unsigned int period;
 		unsigned int pktsize;
 		unsigned int pps;
+		char *flowstr;		/* for FLOWADD and FLOWDEL */
 	} *items;
 };
 
@@ -46,7 +49,7 @@ static inline const char *
 genscript_cmdname(unsigned int cmd)
 {
 	const char *cmd2cmdname[] = {
-		"RESET", "NOP", "TX0", "TX1"
+		"RESET", "NOP", "TX0", "TX1", "FLOWADD", "FLOWDEL"
 	};
 	if (cmd >= GENITEM_CMD_NCMD)
 		return "unknown";
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "imix.h"
+
+/* presets are commonly specified in frame size, including ether-header and FCS */
+static const struct imix_preset {
+	const char *name;
+	const char *spec;
+} imix_presets[] = {
+	/* 64:7, 594:4, 1518:1 */
+	{ "simple",	"46:7,576:4,1500:1" },
+	/* 64:55%, 78:5%, 576:17%, 1518:23% */
+	{ "tolly",	"46:55,60:5,558:17,1500:23" },
+};
+
+static unsigned int
+gcd(unsigned int a, unsigned int b)
+{
+	unsigned int t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * parse "<size>:<weight>[,<size>:<weight>...]"
+ */
+static int
+imix_parse(struct imix *imix, const char *spec)
+{
+	const char *p;
+	char *q;
+	unsigned long size, weight;
+
+	for (p = spec; *p != '\0'; ) {
+		if (imix->nsize >= IMIX_MAXSIZE)
+			return -1;
+		size = strtoul(p, &q, 10);
+		if ((q == p) || (*q != ':'))
+			return -1;
+		p = q + 1;
+		weight = strtoul(p, &q, 10);
+		if ((q == p) || ((*q != ',') && (*q != '\0')) ||
+		    ((*q == ',') && (q[1] == '\0')))
+			return -1;
+		if ((size < 46) || (size > 1500) || (weight == 0) || (weight > IMIX_MAXSCHED))
+			return -1;
+		imix->size[imix->nsize] = size;
+		imix->weight[imix->nsize] = weight;
+		imix->nsize++;
+		p = (*q == ',') ? q + 1 : q;
+	}
+	if (imix->nsize == 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * smooth weighted round-robin. each size is picked evenly spaced in
+ * the schedule, in the reduced ratio of weights.
+ */
+static int
+imix_schedule(struct imix *imix)
+{
+	long current[IMIX_MAXSIZE];
+	unsigned int i, n, g, best, weight[IMIX_MAXSIZE];
+	uint64_t total;
+
+	for (g = 0, i = 0; i < imix->nsize; i++)
+		g = gcd(imix->weight[i], g);
+	for (total = 0, i = 0; i < imix->nsize; i++) {
+		weight[i] = imix->weight[i] / g;
+		total += weight[i];
+		current[i] = 0;
+	}
+	if (total > IMIX_MAXSCHED) {
+		fprintf(stderr, "imix: sum of reduced weights must be <= %d\n", IMIX_MAXSCHED);
+		return -1;
+	}
+
+	imix->nsched = total;
+	imix->sched = malloc(sizeof(uint16_t) * total);
+	if (imix->sched == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return -1;
+	}
+	for (n = 0; n < total; n++) {
+		for (best = 0, i = 0; i < imix->nsize; i++) {
+			current[i] += weight[i];
+			if (current[i] > current[best])
+				best = i;
+		}
+		current[best] -= total;
+		imix->sched[n] = imix->size[best];
+	}
+	return 0;
+}
+
+/*
+ * preset name or "<size>:<weight>[,<size>:<weight>...]"
+ */
+struct imix *
+imix_new(const char *str)
+{
+	struct imix *imix;
+	const char *spec;
+	unsigned int i;
+
+	imix = calloc(1, sizeof(struct imix));
+	if (imix == NULL)
+		return NULL;
+
+	spec = str;
+	for (i = 0; i < sizeof(imix_presets) / sizeof(imix_presets[0]); i++) {
+		if (strcmp(str, imix_presets[i].name) == 0) {
+			spec = imix_presets[i].spec;
+			break;
+		}
+	}
+	snprintf(imix->name, sizeof(imix->name), "%s", str);
+
+	if ((imix_parse(imix, spec) != 0) || (imix_schedule(imix) != 0)) {
+		imix_delete(imix);
+		return NULL;
+	}
+	return imix;
+}
+
+void
+imix_delete(struct imix *imix)
+{
+	free(imix->sched);
+	free(imix);
+}
+
+/*
+ * average packet size. sizes smaller than minsize are sent as minsize.
+ */
+double
+imix_avgsize(const struct imix *imix, unsigned int minsize)
+{
+	uint64_t sum, total;
+	unsigned int i, size;
+
+	for (sum = total = 0, i = 0; i < imix->nsize; i++) {
+		size = (imix->size[i] < minsize) ? minsize : imix->size[i];
+		sum += (uint64_t)size * imix->weight[i];
+		total += imix->weight[i];
+	}
+	return (double)sum / total;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _IMIX_H_
+#define _IMIX_H_
+
+#include <stdint.h>
+
+/*
+ * mix of packet sizes. TX follows the precomputed schedule, which
+ * interleaves sizes by their weight (7:4:1 is not 7 small packets in a row).
+ * packet size does not include ether-header nor FCS, same as -s.
+ */
+#define IMIX_MAXSIZE		64
+#define IMIX_MAXSCHED		65536
+
+struct imix {
+	char name[32];
+	unsigned int nsize;
+	unsigned int size[IMIX_MAXSIZE];
+	unsigned int weight[IMIX_MAXSIZE];
+	unsigned int nsched;
+	uint16_t *sched;
+};
+
+struct imix *imix_new(const char *);
+void imix_delete(struct imix *);
+double imix_avgsize(const struct imix *, unsigned int);
+
+static inline unsigned int
+imix_size(const struct imix *imix, unsigned int *cur)
+{
+	unsigned int i;
+
+	i = *cur;
+	if (i >= imix->nsched)
+		i = 0;
+	*cur = i + 1;
+	return imix->sched[i];
+}
+
+#endif /* _IMIX_H_ */
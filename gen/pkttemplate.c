@@ -0,0 +1,1183 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pkttemplate.h"
+
+#define HDR_IPV4	0
+#define HDR_IPV6	1
+#define HDR_UDP		2
+#define HDR_TCP		3
+#define HDR_GRE		4
+#define HDR_ESP		5
+#define HDR_SCTP	6
+#define HDR_RAW		7
+#define HDR_PAYLOAD	8
+#define HDR_NTYPE	9
+
+#define TEMPLATE_MAXHDR	32
+#define TEMPLATE_MAXLINE	(PKTTEMPLATE_MAXFIELD * 2)
+
+static const struct {
+	const char *name;
+	unsigned int len;
+	int proto;		/* protocol number as the next header of IP */
+} hdrdef[HDR_NTYPE] = {
+	[HDR_IPV4]	= { "ipv4",	20,	IPPROTO_IPIP	},
+	[HDR_IPV6]	= { "ipv6",	40,	IPPROTO_IPV6	},
+	[HDR_UDP]	= { "udp",	8,	IPPROTO_UDP	},
+	[HDR_TCP]	= { "tcp",	20,	IPPROTO_TCP	},
+	[HDR_GRE]	= { "gre",	4,	IPPROTO_GRE	},
+	[HDR_ESP]	= { "esp",	8,	IPPROTO_ESP	},
+	[HDR_SCTP]	= { "sctp",	12,	IPPROTO_SCTP	},
+	[HDR_RAW]	= { "raw",	0,	253		},
+	[HDR_PAYLOAD]	= { "payload",	0,	253		},
+};
+
+/* named fields of headers. "sum" and length fields are filled automatically */
+static const struct {
+	int type;
+	const char *name;
+	unsigned int off, width;
+} hdrfield[] = {
+	{ HDR_IPV4,	"tos",		1,	1	},
+	{ HDR_IPV4,	"len",		2,	2	},
+	{ HDR_IPV4,	"id",		4,	2	},
+	{ HDR_IPV4,	"off",		6,	2	},
+	{ HDR_IPV4,	"ttl",		8,	1	},
+	{ HDR_IPV4,	"proto",	9,	1	},
+	{ HDR_IPV4,	"sum",		10,	2	},
+	{ HDR_IPV4,	"src",		12,	4	},
+	{ HDR_IPV4,	"dst",		16,	4	},
+	{ HDR_IPV6,	"plen",		4,	2	},
+	{ HDR_IPV6,	"nxt",		6,	1	},
+	{ HDR_IPV6,	"hlim",		7,	1	},
+	{ HDR_IPV6,	"src",		8,	16	},
+	{ HDR_IPV6,	"dst",		24,	16	},
+	{ HDR_UDP,	"sport",	0,	2	},
+	{ HDR_UDP,	"dport",	2,	2	},
+	{ HDR_UDP,	"len",		4,	2	},
+	{ HDR_UDP,	"sum",		6,	2	},
+	{ HDR_TCP,	"sport",	0,	2	},
+	{ HDR_TCP,	"dport",	2,	2	},
+	{ HDR_TCP,	"seq",		4,	4	},
+	{ HDR_TCP,	"ack",		8,	4	},
+	{ HDR_TCP,	"flags",	13,	1	},
+	{ HDR_TCP,	"win",		14,	2	},
+	{ HDR_TCP,	"sum",		16,	2	},
+	{ HDR_GRE,	"flags",	0,	2	},
+	{ HDR_GRE,	"proto",	2,	2	},
+	{ HDR_GRE,	"key",		4,	4	},
+	{ HDR_ESP,	"spi",		0,	4	},
+	{ HDR_ESP,	"seq",		4,	4	},
+	{ HDR_SCTP,	"sport",	0,	2	},
+	{ HDR_SCTP,	"dport",	2,	2	},
+	{ HDR_SCTP,	"vtag",		4,	4	},
+	{ HDR_SCTP,	"sum",		8,	4	},
+};
+
+struct tmpl_hdr {
+	int type;
+	char label[32];
+	char *param;
+	unsigned int off, len;
+	uint8_t *raw;
+	int nocsum;		/* udp csum=0 */
+	unsigned int lineno;
+};
+
+struct tmpl_field {
+	char name[48];
+	unsigned int off, width;
+};
+
+struct tmpl_line {
+	char *str;
+	unsigned int lineno;
+};
+
+struct tmpl_parse {
+	const char *path;
+	unsigned int nhdr;
+	struct tmpl_hdr hdr[TEMPLATE_MAXHDR];
+	unsigned int nfield;
+	struct tmpl_field field[TEMPLATE_MAXLINE];
+	unsigned int nmod;
+	struct tmpl_line mod[PKTTEMPLATE_MAXFIELD];
+	unsigned int nchecksum;
+	struct tmpl_line checksum[PKTTEMPLATE_MAXCSUM];
+};
+
+static uint32_t crc32c_table[256];
+
+static void
+crc32c_init(void)
+{
+	uint32_t c;
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? ((c >> 1) ^ 0x82f63b78) : (c >> 1);
+		crc32c_table[i] = c;
+	}
+}
+
+static uint32_t
+crc32c_update(uint32_t crc, const uint8_t *p, unsigned int len)
+{
+	while (len-- > 0)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/* sum of big-endian 16bit words. p must be at even offset of checksum */
+static uint32_t
+sum16(const uint8_t *p, unsigned int len)
+{
+	uint32_t sum = 0;
+
+	for (; len >= 2; p += 2, len -= 2)
+		sum += (p[0] << 8) | p[1];
+	if (len > 0)
+		sum += p[0] << 8;
+	return sum;
+}
+
+static inline uint16_t
+fold16(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+static void
+put_be(uint8_t *p, uint64_t v, unsigned int width)
+{
+	while (width-- > 0) {
+		p[width] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static uint64_t
+get_be(const uint8_t *p, unsigned int width)
+{
+	uint64_t v = 0;
+
+	while (width-- > 0)
+		v = (v << 8) | *p++;
+	return v;
+}
+
+/*
+ * update checksums in mask by delta, which is the sum of ~old + new
+ * of the modified words. a modified checksum field is a modified word
+ * of checksums covering it, too.
+ */
+static void
+csum_update(const struct pkttemplate *t, uint8_t *p, uint32_t mask, uint32_t delta)
+{
+	const struct pkttemplate_csum *c;
+	uint16_t old, new;
+	unsigned int i;
+
+	for (i = 0; mask != 0; i++, mask >>= 1) {
+		if ((mask & 1) == 0)
+			continue;
+		c = &t->csum[i];
+		if (c->type == PKTTEMPLATE_CSUM_CRC32C)
+			continue;
+
+		old = (p[c->off] << 8) | p[c->off + 1];
+		if ((c->type == PKTTEMPLATE_CSUM_UDP) && (old == 0))
+			continue;	/* checksum disabled */
+		new = ~fold16((~old & 0xffff) + fold16(delta));
+		if ((c->type == PKTTEMPLATE_CSUM_UDP) && (new == 0))
+			new = 0xffff;
+		p[c->off] = new >> 8;
+		p[c->off + 1] = new & 0xff;
+
+		if (c->outer != 0)
+			csum_update(t, p, c->outer, (~old & 0xffff) + new);
+	}
+}
+
+static void
+field_write(const struct pkttemplate *t, uint8_t *p, unsigned int off,
+    const void *data, unsigned int width, uint32_t mask)
+{
+	unsigned int i, begin, end;
+	uint32_t delta;
+
+	begin = off & ~1U;
+	end = (off + width + 1) & ~1U;
+
+	delta = 0;
+	for (i = begin; i < end; i += 2)
+		delta += ~((p[i] << 8) | p[i + 1]) & 0xffff;
+	memcpy(p + off, data, width);
+	for (i = begin; i < end; i += 2)
+		delta += (p[i] << 8) | p[i + 1];
+
+	if (mask != 0)
+		csum_update(t, p, mask, delta);
+}
+
+/* length and protocol of pseudo header as 16bit words */
+static inline uint32_t
+pseudo_sum(const struct pkttemplate_csum *c, const uint8_t *p)
+{
+	uint32_t sum;
+
+	sum = (p[c->plenoff] << 8) | p[c->plenoff + 1];
+	if (c->pprotooff != 0)
+		sum += p[c->pprotooff];
+	return sum;
+}
+
+/*
+ * write a field which is length or protocol of IP header (or UDP length),
+ * and update L4 checksums having it in the pseudo header as well.
+ */
+static void
+pseudo_field_write(const struct pkttemplate *t, uint8_t *p,
+    const struct pkttemplate_insn *insn, const void *data)
+{
+	uint32_t old[PKTTEMPLATE_MAXCSUM], mask;
+	unsigned int i;
+
+	for (mask = insn->pcsum, i = 0; mask != 0; i++, mask >>= 1) {
+		if (mask & 1)
+			old[i] = pseudo_sum(&t->csum[i], p);
+	}
+	field_write(t, p, insn->off, data, insn->width, insn->csum);
+	for (mask = insn->pcsum, i = 0; mask != 0; i++, mask >>= 1) {
+		if (mask & 1)
+			csum_update(t, p, 1U << i,
+			    (~fold16(old[i]) & 0xffff) + fold16(pseudo_sum(&t->csum[i], p)));
+	}
+}
+
+static void
+crc32c_write(const struct pkttemplate *t, uint8_t *p, const struct pkttemplate_csum *c)
+{
+	static const uint8_t zero[4];
+	uint8_t v[4];
+	uint32_t crc;
+
+	crc = crc32c_update(0xffffffff, p + c->start, c->off - c->start);
+	crc = crc32c_update(crc, zero, 4);
+	crc = crc32c_update(crc, p + c->off + 4, c->end - c->off - 4);
+	crc = ~crc;
+
+	/* stored in little endian */
+	v[0] = crc & 0xff;
+	v[1] = (crc >> 8) & 0xff;
+	v[2] = (crc >> 16) & 0xff;
+	v[3] = crc >> 24;
+	field_write(t, p, c->off, v, 4, c->outer);
+}
+
+void
+pkttemplate_apply(struct pkttemplate *t, char *l3, struct prng *prng,
+    const struct pkttemplate_flow *flow, const void *trailer)
+{
+	struct pkttemplate_insn *insn;
+	uint8_t *p = (uint8_t *)l3;
+	uint8_t v[16];
+	uint64_t x;
+	unsigned int i;
+
+	for (i = 0; i < t->ninsn; i++) {
+		insn = &t->insn[i];
+		switch (insn->op) {
+		case PKTTEMPLATE_OP_INC:
+			x = insn->min + insn->cur;
+			insn->cur += insn->step;
+			if ((insn->n != 0) && (insn->cur >= insn->n))
+				insn->cur -= insn->n;
+			break;
+		case PKTTEMPLATE_OP_DEC:
+			x = insn->min + (insn->n - 1 - insn->cur);
+			insn->cur += insn->step;
+			if ((insn->n != 0) && (insn->cur >= insn->n))
+				insn->cur -= insn->n;
+			break;
+		case PKTTEMPLATE_OP_RANDOM:
+			if (insn->n == 0)
+				x = prng_next(prng);
+			else
+				x = insn->min + prng_range(prng, insn->n);
+			break;
+		case PKTTEMPLATE_OP_LIST:
+			x = insn->list[insn->cur];
+			if (++insn->cur >= insn->n)
+				insn->cur = 0;
+			break;
+		case PKTTEMPLATE_OP_SADDR:
+		case PKTTEMPLATE_OP_DADDR:
+			if ((flow->af == AF_INET) && (insn->width == 4)) {
+				memcpy(v, (insn->op == PKTTEMPLATE_OP_SADDR) ?
+				    &flow->saddr4 : &flow->daddr4, 4);
+			} else if ((flow->af == AF_INET6) && (insn->width == 16)) {
+				memcpy(v, (insn->op == PKTTEMPLATE_OP_SADDR) ?
+				    flow->saddr6 : flow->daddr6, 16);
+			} else {
+				continue;
+			}
+			field_write(t, p, insn->off, v, insn->width, insn->csum);
+			continue;
+		case PKTTEMPLATE_OP_SPORT:
+			x = flow->sport;
+			break;
+		case PKTTEMPLATE_OP_DPORT:
+			x = flow->dport;
+			break;
+		default:
+			continue;
+		}
+		put_be(v, x, insn->width);
+		if (insn->pcsum != 0)
+			pseudo_field_write(t, p, insn, v);
+		else
+			field_write(t, p, insn->off, v, insn->width, insn->csum);
+	}
+
+	field_write(t, p, t->trailer_off, trailer, t->trailer_len, t->trailer_csum);
+
+	if (t->crc32c != 0) {
+		for (i = 0; i < t->ncsum; i++) {
+			if (t->crc32c & (1U << i))
+				crc32c_write(t, p, &t->csum[i]);
+		}
+	}
+}
+
+/*
+ * parse value of width bytes. IPv4 or IPv6 address is also accepted
+ * for 4 or 16 bytes field.
+ */
+static int
+parse_value(const char *str, unsigned int width, uint8_t *v)
+{
+	unsigned long long x;
+	char *p;
+
+	if ((width == 4) && (strchr(str, '.') != NULL))
+		return (inet_pton(AF_INET, str, v) == 1) ? 0 : -1;
+	if ((width == 16) && (strchr(str, ':') != NULL))
+		return (inet_pton(AF_INET6, str, v) == 1) ? 0 : -1;
+
+	x = strtoull(str, &p, 0);
+	if ((p == str) || (*p != '\0'))
+		return -1;
+	if ((width < 8) && (x >> (width * 8)) != 0)
+		return -1;
+	memset(v, 0, width);
+	put_be(v + ((width > 8) ? width - 8 : 0), x, MIN(width, 8));
+	return 0;
+}
+
+static int
+parse_number(const char *str, unsigned int width, uint64_t *x)
+{
+	uint8_t v[16];
+
+	if (parse_value(str, MIN(width, 8), v) != 0)
+		return -1;
+	*x = get_be(v, MIN(width, 8));
+	return 0;
+}
+
+static struct tmpl_field *
+field_lookup(struct tmpl_parse *tp, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < tp->nfield; i++) {
+		if (strcmp(tp->field[i].name, name) == 0)
+			return &tp->field[i];
+	}
+	return NULL;
+}
+
+static int
+field_add(struct tmpl_parse *tp, const char *label, const char *name, unsigned int off, unsigned int width)
+{
+	struct tmpl_field *f;
+
+	if (tp->nfield >= TEMPLATE_MAXLINE)
+		return -1;
+	f = &tp->field[tp->nfield];
+	if (label != NULL)
+		snprintf(f->name, sizeof(f->name), "%s.%s", label, name);
+	else
+		snprintf(f->name, sizeof(f->name), "%s", name);
+	if (field_lookup(tp, f->name) != NULL)
+		return -1;
+	f->off = off;
+	f->width = width;
+	tp->nfield++;
+	return 0;
+}
+
+static int
+parse_hex(const char *str, uint8_t *buf, unsigned int bufsize, unsigned int *lenp)
+{
+	unsigned int len;
+	int hi;
+
+	for (len = 0, hi = -1; *str != '\0'; str++) {
+		if ((*str == ':') || (*str == '.'))
+			continue;
+		if (!isxdigit((unsigned char)*str))
+			return -1;
+		if (hi < 0) {
+			hi = isdigit((unsigned char)*str) ? *str - '0' : (tolower((unsigned char)*str) - 'a' + 10);
+			continue;
+		}
+		if (len >= bufsize)
+			return -1;
+		buf[len++] = (hi << 4) |
+		    (isdigit((unsigned char)*str) ? *str - '0' : (tolower((unsigned char)*str) - 'a' + 10));
+		hi = -1;
+	}
+	if (hi >= 0)
+		return -1;
+	*lenp = len;
+	return 0;
+}
+
+/* read a header line, "<type> [<field>=<value> ...]", "raw <hex>" or "payload <n>" */
+static int
+parse_hdr(struct tmpl_parse *tp, int type, char *args, unsigned int lineno)
+{
+	struct tmpl_hdr *h;
+	unsigned int i, n;
+	uint8_t buf[PKTTEMPLATE_MAXLEN];
+	char *word, *save, *p;
+
+	if (tp->nhdr >= TEMPLATE_MAXHDR) {
+		fprintf(stderr, "%s:%u: too many headers\n", tp->path, lineno);
+		return -1;
+	}
+	h = &tp->hdr[tp->nhdr];
+	memset(h, 0, sizeof(*h));
+	h->type = type;
+	h->lineno = lineno;
+	h->len = hdrdef[type].len;
+
+	/* default label is the type, and "_<n>" is added to the second one and after */
+	for (n = 1, i = 0; i < tp->nhdr; i++) {
+		if (tp->hdr[i].type == type)
+			n++;
+	}
+	if (n == 1)
+		snprintf(h->label, sizeof(h->label), "%s", hdrdef[type].name);
+	else
+		snprintf(h->label, sizeof(h->label), "%s_%u", hdrdef[type].name, n);
+
+	if (type == HDR_RAW) {
+		word = strtok_r(args, " \t\r\n", &save);
+		if ((word == NULL) || (parse_hex(word, buf, sizeof(buf), &h->len) != 0) ||
+		    (h->len == 0)) {
+			fprintf(stderr, "%s:%u: illegal hex\n", tp->path, lineno);
+			return -1;
+		}
+		h->raw = malloc(h->len);
+		if (h->raw == NULL)
+			return -1;
+		memcpy(h->raw, buf, h->len);
+		args = NULL;
+	} else if (type == HDR_PAYLOAD) {
+		word = strtok_r(args, " \t\r\n", &save);
+		if (word == NULL)
+			goto badlen;
+		h->len = strtoul(word, &p, 0);
+		if ((p == word) || (*p != '\0') || (h->len == 0) || (h->len > PKTTEMPLATE_MAXLEN))
+			goto badlen;
+		args = NULL;
+	}
+
+	/* keep parameters, which are set after the layout */
+	for (word = strtok_r(args, " \t\r\n", &save); word != NULL;
+	    word = strtok_r(NULL, " \t\r\n", &save)) {
+		if (strncmp(word, "name=", 5) == 0) {
+			snprintf(h->label, sizeof(h->label), "%s", word + 5);
+			continue;
+		}
+		if ((type == HDR_GRE) && (strncmp(word, "key=", 4) == 0))
+			h->len = 8;
+		n = (h->param == NULL) ? 0 : strlen(h->param);
+		p = realloc(h->param, n + strlen(word) + 2);
+		if (p == NULL)
+			return -1;
+		h->param = p;
+		snprintf(h->param + n, strlen(word) + 2, "%s%s", (n == 0) ? "" : " ", word);
+	}
+	tp->nhdr++;
+	return 0;
+
+ badlen:
+	fprintf(stderr, "%s:%u: illegal payload length\n", tp->path, lineno);
+	return -1;
+}
+
+static int
+hdr_set_params(struct tmpl_parse *tp, struct tmpl_hdr *h, uint8_t *frame)
+{
+	char *param, *word, *val, *save;
+	unsigned int i;
+	uint8_t v[16];
+	int anyerror = 0;
+
+	if (h->param == NULL)
+		return 0;
+	param = strdup(h->param);
+	if (param == NULL)
+		return -1;
+
+	for (word = strtok_r(param, " ", &save); word != NULL;
+	    word = strtok_r(NULL, " ", &save)) {
+		if ((val = strchr(word, '=')) == NULL)
+			goto illegal;
+		*val++ = '\0';
+		if ((h->type == HDR_UDP) && (strcmp(word, "csum") == 0)) {
+			if (strcmp(val, "0") == 0)
+				h->nocsum = 1;
+			else if (strcmp(val, "1") != 0)
+				goto illegal;
+			continue;
+		}
+		for (i = 0; i < sizeof(hdrfield) / sizeof(hdrfield[0]); i++) {
+			if ((hdrfield[i].type == h->type) &&
+			    (strcmp(hdrfield[i].name, word) == 0))
+				break;
+		}
+		if ((i >= sizeof(hdrfield) / sizeof(hdrfield[0])) ||
+		    (strcmp(word, "sum") == 0) ||
+		    (parse_value(val, hdrfield[i].width, v) != 0))
+			goto illegal;
+		memcpy(frame + h->off + hdrfield[i].off, v, hdrfield[i].width);
+		continue;
+ illegal:
+		fprintf(stderr, "%s:%u: illegal parameter: %s\n", tp->path, h->lineno, word);
+		anyerror++;
+	}
+	free(param);
+	return anyerror ? -1 : 0;
+}
+
+static int
+csum_add(struct pkttemplate *t, int type, unsigned int off, unsigned int start, unsigned int end)
+{
+	struct pkttemplate_csum *c;
+
+	if (t->ncsum >= PKTTEMPLATE_MAXCSUM)
+		return -1;
+	c = &t->csum[t->ncsum++];
+	c->type = type;
+	c->off = off;
+	c->start = start;
+	c->end = end;
+	c->pstart = c->pend = 0;
+	c->plenoff = c->pprotooff = 0;
+	return 0;
+}
+
+static inline int
+overlap(unsigned int a, unsigned int alen, unsigned int b, unsigned int blen)
+{
+	return (a < b + blen) && (b < a + alen);
+}
+
+/* checksums covering [off, off + width) */
+static uint32_t
+csum_covering(const struct pkttemplate *t, unsigned int off, unsigned int width)
+{
+	const struct pkttemplate_csum *c;
+	uint32_t mask;
+	unsigned int i;
+
+	for (mask = 0, i = 0; i < t->ncsum; i++) {
+		c = &t->csum[i];
+		if (overlap(off, width, c->off,
+		    (c->type == PKTTEMPLATE_CSUM_CRC32C) ? 4 : 2))
+			continue;	/* checksum field itself */
+		if (overlap(off, width, c->start, c->end - c->start) ||
+		    ((c->pend != 0) && overlap(off, width, c->pstart, c->pend - c->pstart)))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+/* L4 checksums having [off, off + width) in the pseudo header but addresses */
+static uint32_t
+pseudo_covering(const struct pkttemplate *t, unsigned int off, unsigned int width)
+{
+	const struct pkttemplate_csum *c;
+	uint32_t mask;
+	unsigned int i;
+
+	for (mask = 0, i = 0; i < t->ncsum; i++) {
+		c = &t->csum[i];
+		if (c->pend == 0)
+			continue;
+		if (overlap(off, width, c->plenoff, 2) ||
+		    ((c->pprotooff != 0) && overlap(off, width, c->pprotooff, 1)))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+/*
+ * lay out the header stack, and fill lengths, protocols and checksums.
+ */
+static int
+layout(struct tmpl_parse *tp, struct pkttemplate *t, unsigned int minlen)
+{
+	struct tmpl_hdr *h, *next, *ip;
+	struct pkttemplate_csum *c;
+	uint8_t *f = t->frame;
+	unsigned int i, j, off, protooff;
+	int proto;
+
+	for (off = 0, i = 0; i < tp->nhdr; i++) {
+		tp->hdr[i].off = off;
+		off += tp->hdr[i].len;
+	}
+	/* pad to the minimum length before the trailer */
+	if (off + t->trailer_len < minlen)
+		off = minlen - t->trailer_len;
+	t->trailer_off = off;
+	t->len = off + t->trailer_len;
+	if (t->len > PKTTEMPLATE_MAXLEN) {
+		fprintf(stderr, "%s: too long packet: %u\n", tp->path, t->len);
+		return -1;
+	}
+
+	if (tp->nhdr == 0) {
+		fprintf(stderr, "%s: no header\n", tp->path);
+		return -1;
+	}
+	switch (tp->hdr[0].type) {
+	case HDR_IPV4:
+		t->af = AF_INET;
+		break;
+	case HDR_IPV6:
+		t->af = AF_INET6;
+		break;
+	case HDR_RAW:
+		if ((tp->hdr[0].raw[0] >> 4) == 4) {
+			t->af = AF_INET;
+			break;
+		} else if ((tp->hdr[0].raw[0] >> 4) == 6) {
+			t->af = AF_INET6;
+			break;
+		}
+		/* FALLTHROUGH */
+	default:
+		fprintf(stderr, "%s: packet must begin with IPv4 or IPv6 header\n", tp->path);
+		return -1;
+	}
+
+	/* defaults and automatic fields */
+	for (ip = NULL, i = 0; i < tp->nhdr; i++) {
+		h = &tp->hdr[i];
+		next = (i + 1 < tp->nhdr) ? &tp->hdr[i + 1] : NULL;
+		proto = (next != NULL) ? hdrdef[next->type].proto : IPPROTO_NONE;
+		if ((h->type <= HDR_SCTP) && (h->off & 1)) {
+			fprintf(stderr, "%s:%u: header must be at even offset\n", tp->path, h->lineno);
+			return -1;
+		}
+
+		switch (h->type) {
+		case HDR_IPV4:
+			f[h->off] = 0x45;
+			put_be(f + h->off + 2, t->len - h->off, 2);
+			f[h->off + 8] = 64;
+			f[h->off + 9] = proto;
+			ip = h;
+			break;
+		case HDR_IPV6:
+			f[h->off] = 0x60;
+			put_be(f + h->off + 4, t->len - h->off - 40, 2);
+			f[h->off + 6] = proto;
+			f[h->off + 7] = 64;
+			ip = h;
+			break;
+		case HDR_UDP:
+			put_be(f + h->off, 9, 2);
+			put_be(f + h->off + 2, 9, 2);
+			put_be(f + h->off + 4, t->len - h->off, 2);
+			break;
+		case HDR_TCP:
+			put_be(f + h->off, 9, 2);
+			put_be(f + h->off + 2, 9, 2);
+			f[h->off + 12] = 5 << 4;
+			f[h->off + 13] = 0x10;		/* ACK */
+			put_be(f + h->off + 14, 65535, 2);
+			break;
+		case HDR_GRE:
+			if (h->len == 8)
+				f[h->off] = 0x20;	/* key present */
+			if (next != NULL && next->type == HDR_IPV4)
+				put_be(f + h->off + 2, 0x0800, 2);
+			else if (next != NULL && next->type == HDR_IPV6)
+				put_be(f + h->off + 2, 0x86dd, 2);
+			break;
+		case HDR_ESP:
+			put_be(f + h->off, 1, 4);
+			put_be(f + h->off + 4, 1, 4);
+			break;
+		case HDR_SCTP:
+			put_be(f + h->off, 9, 2);
+			put_be(f + h->off + 2, 9, 2);
+			put_be(f + h->off + 4, 1, 4);
+			break;
+		case HDR_RAW:
+			memcpy(f + h->off, h->raw, h->len);
+			break;
+		}
+		if (hdr_set_params(tp, h, f) != 0)
+			return -1;
+
+		/* named fields */
+		for (j = 0; j < sizeof(hdrfield) / sizeof(hdrfield[0]); j++) {
+			if (hdrfield[j].type != h->type)
+				continue;
+			if ((h->type == HDR_GRE) && (hdrfield[j].off >= h->len))
+				continue;
+			if (field_add(tp, h->label, hdrfield[j].name,
+			    h->off + hdrfield[j].off, hdrfield[j].width) != 0) {
+				fprintf(stderr, "%s:%u: duplicate name: %s\n", tp->path, h->lineno, h->label);
+				return -1;
+			}
+		}
+
+		/* checksums */
+		switch (h->type) {
+		case HDR_IPV4:
+			if (csum_add(t, PKTTEMPLATE_CSUM_INET, h->off + 10, h->off, h->off + 20) != 0)
+				goto toomany;
+			break;
+		case HDR_UDP:
+		case HDR_TCP:
+			if (h->nocsum)
+				break;
+			if (ip == NULL) {
+				fprintf(stderr, "%s:%u: %s must be inside IP\n", tp->path, h->lineno, hdrdef[h->type].name);
+				return -1;
+			}
+			if (csum_add(t, (h->type == HDR_UDP) ? PKTTEMPLATE_CSUM_UDP : PKTTEMPLATE_CSUM_INET,
+			    h->off + ((h->type == HDR_UDP) ? 6 : 16), h->off, t->len) != 0)
+				goto toomany;
+			c = &t->csum[t->ncsum - 1];
+			if (ip->type == HDR_IPV4) {
+				c->pstart = ip->off + 12;
+				c->pend = ip->off + 20;
+				c->plenoff = ip->off + 2;
+				protooff = ip->off + 9;
+			} else {
+				c->pstart = ip->off + 8;
+				c->pend = ip->off + 40;
+				c->plenoff = ip->off + 4;
+				protooff = ip->off + 6;
+			}
+			/*
+			 * UDP length is used as the length of pseudo header.
+			 * the protocol is that of IP header only if no other
+			 * header is between.
+			 */
+			if (h->type == HDR_UDP)
+				c->plenoff = h->off + 4;
+			if (&tp->hdr[i - 1] == ip)
+				c->pprotooff = protooff;
+			break;
+		case HDR_SCTP:
+			if (csum_add(t, PKTTEMPLATE_CSUM_CRC32C, h->off + 8, h->off, t->len) != 0)
+				goto toomany;
+			break;
+		}
+	}
+	return 0;
+
+ toomany:
+	fprintf(stderr, "%s: too many checksums\n", tp->path);
+	return -1;
+}
+
+/*
+ * compute initial checksums from inner (smaller) to outer.
+ * SCTP CRC32c is computed per packet.
+ */
+static void
+csum_init(struct pkttemplate *t)
+{
+	struct pkttemplate_csum *c;
+	uint8_t *f = t->frame;
+	uint32_t done, sum;
+	unsigned int i, n, l4len;
+
+	for (done = 0, n = 0; n < t->ncsum; n++) {
+		for (c = NULL, i = 0; i < t->ncsum; i++) {
+			if (done & (1U << i))
+				continue;
+			if ((c == NULL) ||
+			    (t->csum[i].end - t->csum[i].start < c->end - c->start))
+				c = &t->csum[i];
+		}
+		done |= 1U << (c - t->csum);
+		if (c->type == PKTTEMPLATE_CSUM_CRC32C)
+			continue;
+
+		put_be(f + c->off, 0, 2);
+		sum = sum16(f + c->start, c->end - c->start);
+		if (c->pend != 0) {
+			/* pseudo header */
+			l4len = c->end - c->start;
+			sum += sum16(f + c->pstart, c->pend - c->pstart);
+			sum += (l4len >> 16) + (l4len & 0xffff);
+			sum += (c->type == PKTTEMPLATE_CSUM_UDP) ? IPPROTO_UDP : IPPROTO_TCP;
+		}
+		sum = (uint16_t)~fold16(sum);
+		if ((c->type == PKTTEMPLATE_CSUM_UDP) && (sum == 0))
+			sum = 0xffff;
+		put_be(f + c->off, sum, 2);
+	}
+}
+
+/* "checksum <field> <start>:<length>". length 0 is to the end of packet */
+static int
+parse_checksum(struct tmpl_parse *tp, struct pkttemplate *t, struct tmpl_line *line)
+{
+	struct tmpl_field *f;
+	char *name, *range, *save;
+	unsigned int start, len;
+
+	name = strtok_r(line->str, " \t\r\n", &save);
+	range = strtok_r(NULL, " \t\r\n", &save);
+	if ((name == NULL) || (range == NULL) ||
+	    (sscanf(range, "%u:%u", &start, &len) != 2))
+		goto illegal;
+	if (((f = field_lookup(tp, name)) == NULL) || (f->width != 2) ||
+	    (f->off & 1) || (start & 1))
+		goto illegal;
+	if (len == 0)
+		len = t->len - start;
+	if ((start + len > t->len) || (f->off < start) || (f->off + 2 > start + len))
+		goto illegal;
+	if (csum_add(t, PKTTEMPLATE_CSUM_INET, f->off, start, start + len) != 0)
+		goto illegal;
+	return 0;
+
+ illegal:
+	fprintf(stderr, "%s:%u: illegal checksum\n", tp->path, line->lineno);
+	return -1;
+}
+
+/*
+ * "mod <field> inc|dec [<step>] [<min>-<max>]", "mod <field> random [<min>-<max>]",
+ * "mod <field> list <v>,<v>,..." or "mod <field> flow saddr|daddr|sport|dport"
+ */
+static int
+parse_mod(struct tmpl_parse *tp, struct pkttemplate *t, struct tmpl_line *line)
+{
+	static const char *flowfield[] = { "saddr", "daddr", "sport", "dport" };
+	struct pkttemplate_insn *insn;
+	struct tmpl_field *f;
+	char *name, *op, *arg, *save, *p, *v;
+	uint64_t max;
+	unsigned int i;
+
+	if (t->ninsn >= PKTTEMPLATE_MAXFIELD) {
+		fprintf(stderr, "%s:%u: too many modifiers\n", tp->path, line->lineno);
+		return -1;
+	}
+	insn = &t->insn[t->ninsn];
+
+	name = strtok_r(line->str, " \t\r\n", &save);
+	op = strtok_r(NULL, " \t\r\n", &save);
+	if ((name == NULL) || (op == NULL))
+		goto illegal;
+	if ((f = field_lookup(tp, name)) == NULL) {
+		fprintf(stderr, "%s:%u: unknown field: %s\n", tp->path, line->lineno, name);
+		return -1;
+	}
+
+	insn->off = f->off;
+	insn->width = f->width;
+	if (strcmp(op, "flow") == 0) {
+		arg = strtok_r(NULL, " \t\r\n", &save);
+		for (i = 0; i < 4; i++) {
+			if ((arg != NULL) && (strcmp(arg, flowfield[i]) == 0))
+				break;
+		}
+		if (i >= 4)
+			goto illegal;
+		insn->op = PKTTEMPLATE_OP_SADDR + i;
+		if ((i < 2) && (f->width != 4) && (f->width != 16))
+			goto illegal;
+		if ((i >= 2) && (f->width != 2))
+			goto illegal;
+		goto done;
+	}
+
+	/* numeric modifiers work on lower 8 bytes of wider field */
+	if (f->width > 8) {
+		insn->off = f->off + f->width - 8;
+		insn->width = 8;
+	}
+	max = (insn->width >= 8) ? UINT64_MAX : ((1ULL << (insn->width * 8)) - 1);
+	insn->min = get_be(t->frame + insn->off, insn->width);
+	insn->n = max - insn->min + 1;
+	insn->step = 1;
+
+	if (strcmp(op, "list") == 0) {
+		insn->op = PKTTEMPLATE_OP_LIST;
+		arg = strtok_r(NULL, " \t\r\n", &save);
+		if (arg == NULL)
+			goto illegal;
+		insn->list = malloc(sizeof(uint64_t) * PKTTEMPLATE_MAXLIST);
+		if (insn->list == NULL)
+			return -1;
+		for (insn->n = 0, v = strtok_r(arg, ",", &p); v != NULL; v = strtok_r(NULL, ",", &p)) {
+			if ((insn->n >= PKTTEMPLATE_MAXLIST) ||
+			    (parse_number(v, insn->width, &insn->list[insn->n]) != 0))
+				goto illegal;
+			insn->n++;
+		}
+		goto done;
+	}
+
+	if (strcmp(op, "inc") == 0) {
+		insn->op = PKTTEMPLATE_OP_INC;
+	} else if (strcmp(op, "dec") == 0) {
+		/* count down from the value of template by default */
+		insn->op = PKTTEMPLATE_OP_DEC;
+		insn->n = insn->min + 1;
+		insn->min = 0;
+	} else if (strcmp(op, "random") == 0) {
+		insn->op = PKTTEMPLATE_OP_RANDOM;
+	} else {
+		goto illegal;
+	}
+
+	while ((arg = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		if ((p = strchr(arg, '-')) != NULL) {
+			*p++ = '\0';
+			if ((parse_number(arg, insn->width, &insn->min) != 0) ||
+			    (parse_number(p, insn->width, &max) != 0) || (max < insn->min))
+				goto illegal;
+			insn->n = max - insn->min + 1;	/* 0 is 2^64 */
+		} else if (insn->op != PKTTEMPLATE_OP_RANDOM) {
+			if ((parse_number(arg, 8, &insn->step) != 0) || (insn->step == 0))
+				goto illegal;
+		} else {
+			goto illegal;
+		}
+	}
+	if ((insn->n != 0) && (insn->step >= insn->n))
+		insn->step %= insn->n;
+
+ done:
+	insn->csum = csum_covering(t, insn->off, insn->width);
+	insn->pcsum = pseudo_covering(t, insn->off, insn->width);
+	t->ninsn++;
+	return 0;
+
+ illegal:
+	free(insn->list);
+	insn->list = NULL;
+	fprintf(stderr, "%s:%u: illegal modifier\n", tp->path, line->lineno);
+	return -1;
+}
+
+static void
+parse_free(struct tmpl_parse *tp)
+{
+	unsigned int i;
+
+	for (i = 0; i < tp->nhdr; i++) {
+		free(tp->hdr[i].param);
+		if (tp->hdr[i].type == HDR_RAW)
+			free(tp->hdr[i].raw);
+	}
+	for (i = 0; i < tp->nmod; i++)
+		free(tp->mod[i].str);
+	for (i = 0; i < tp->nchecksum; i++)
+		free(tp->checksum[i].str);
+	free(tp);
+}
+
+/*
+ * read template file. packet is padded up to minlen, and the trailer
+ * of trailerlen bytes is placed at the end.
+ */
+struct pkttemplate *
+pkttemplate_read(const char *path, unsigned int minlen, unsigned int trailerlen)
+{
+	FILE *fp;
+	struct tmpl_parse *tp;
+	struct pkttemplate *t;
+	struct tmpl_line *line;
+	char buf[4096], *p, *word, *save, *name;
+	unsigned int lineno, i, off, width;
+	int type, anyerror = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	tp = calloc(1, sizeof(struct tmpl_parse));
+	t = calloc(1, sizeof(struct pkttemplate));
+	if ((tp == NULL) || (t == NULL)) {
+		fclose(fp);
+		free(tp);
+		free(t);
+		return NULL;
+	}
+	tp->path = path;
+	t->trailer_len = trailerlen;
+
+	for (lineno = 1; fgets(buf, sizeof(buf), fp) != NULL; lineno++) {
+		if ((p = strchr(buf, '#')) != NULL)
+			*p = '\0';
+		if ((word = strtok_r(buf, " \t\r\n", &save)) == NULL)
+			continue;	/* blank */
+
+		for (type = 0; type < HDR_NTYPE; type++) {
+			if (strcmp(word, hdrdef[type].name) == 0)
+				break;
+		}
+		if (type < HDR_NTYPE) {
+			if (parse_hdr(tp, type, save, lineno) != 0)
+				anyerror++;
+			continue;
+		}
+
+		if (strcmp(word, "field") == 0) {
+			/* field <name> <offset>:<width> */
+			name = strtok_r(NULL, " \t\r\n", &save);
+			word = strtok_r(NULL, " \t\r\n", &save);
+			if ((name == NULL) || (word == NULL) ||
+			    (sscanf(word, "%u:%u", &off, &width) != 2) ||
+			    (width == 0) || ((width > 8) && (width != 16)) ||
+			    (off + width > PKTTEMPLATE_MAXLEN) ||
+			    (field_add(tp, NULL, name, off, width) != 0)) {
+				fprintf(stderr, "%s:%u: illegal field\n", path, lineno);
+				anyerror++;
+			}
+			continue;
+		}
+
+		if (strcmp(word, "mod") == 0) {
+			if (tp->nmod >= PKTTEMPLATE_MAXFIELD) {
+				fprintf(stderr, "%s:%u: too many modifiers\n", path, lineno);
+				anyerror++;
+				continue;
+			}
+			line = &tp->mod[tp->nmod++];
+		} else if (strcmp(word, "checksum") == 0) {
+			if (tp->nchecksum >= PKTTEMPLATE_MAXCSUM) {
+				fprintf(stderr, "%s:%u: too many checksums\n", path, lineno);
+				anyerror++;
+				continue;
+			}
+			line = &tp->checksum[tp->nchecksum++];
+		} else {
+			fprintf(stderr, "%s:%u: unknown keyword: %s\n", path, lineno, word);
+			anyerror++;
+			continue;
+		}
+		line->lineno = lineno;
+		if ((line->str = strdup(save)) == NULL)
+			anyerror++;
+	}
+	fclose(fp);
+
+	if (anyerror || (layout(tp, t, minlen) != 0))
+		goto error;
+
+	for (i = 0; i < tp->nfield; i++) {
+		if (tp->field[i].off + tp->field[i].width > t->len) {
+			fprintf(stderr, "%s: field %s is out of packet\n", path, tp->field[i].name);
+			goto error;
+		}
+	}
+	for (i = 0; i < tp->nchecksum; i++) {
+		if (parse_checksum(tp, t, &tp->checksum[i]) != 0)
+			anyerror++;
+	}
+	csum_init(t);
+	for (i = 0; i < t->ncsum; i++) {
+		t->csum[i].outer = csum_covering(t, t->csum[i].off,
+		    (t->csum[i].type == PKTTEMPLATE_CSUM_CRC32C) ? 4 : 2);
+		if (t->csum[i].type == PKTTEMPLATE_CSUM_CRC32C)
+			t->crc32c |= 1U << i;
+	}
+	for (i = 0; i < tp->nmod; i++) {
+		if (parse_mod(tp, t, &tp->mod[i]) != 0)
+			anyerror++;
+	}
+	if (anyerror)
+		goto error;
+	t->trailer_csum = csum_covering(t, t->trailer_off, t->trailer_len);
+
+	if (crc32c_table[1] == 0)
+		crc32c_init();
+
+	parse_free(tp);
+	return t;
+
+ error:
+	parse_free(tp);
+	pkttemplate_delete(t);
+	return NULL;
+}
+
+void
+pkttemplate_delete(struct pkttemplate *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->ninsn; i++)
+		free(t->insn[i].list);
+	free(t);
+}
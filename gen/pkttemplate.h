@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _PKTTEMPLATE_H_
+#define _PKTTEMPLATE_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "prng.h"
+
+/*
+ * user defined packet from L3 header, built from a header stack or raw
+ * hex bytes. fields are rewritten per packet by modifiers, which are
+ * compiled into a flat instruction list, and checksums covering the
+ * fields are updated incrementally (RFC 1624).
+ */
+#define PKTTEMPLATE_MAXLEN	1500
+#define PKTTEMPLATE_MAXFIELD	64
+#define PKTTEMPLATE_MAXCSUM	8
+#define PKTTEMPLATE_MAXLIST	256
+
+#define PKTTEMPLATE_OP_INC	0
+#define PKTTEMPLATE_OP_DEC	1
+#define PKTTEMPLATE_OP_RANDOM	2
+#define PKTTEMPLATE_OP_LIST	3
+#define PKTTEMPLATE_OP_SADDR	4	/* from flow table */
+#define PKTTEMPLATE_OP_DADDR	5
+#define PKTTEMPLATE_OP_SPORT	6
+#define PKTTEMPLATE_OP_DPORT	7
+
+#define PKTTEMPLATE_CSUM_INET	0
+#define PKTTEMPLATE_CSUM_UDP	1	/* 0 is sent as 0xffff */
+#define PKTTEMPLATE_CSUM_CRC32C	2	/* SCTP. recomputed per packet */
+
+struct pkttemplate_csum {
+	int type;
+	unsigned int off;		/* offset of checksum field */
+	unsigned int start, end;	/* covered bytes */
+	unsigned int pstart, pend;	/* addresses in pseudo header, if any */
+	unsigned int plenoff;		/* length field of pseudo header */
+	unsigned int pprotooff;		/* protocol field. 0 if not in the packet */
+	uint32_t outer;			/* checksums covering this checksum field */
+};
+
+struct pkttemplate_insn {
+	int op;
+	unsigned int off;
+	unsigned int width;		/* bytes. up to 8, or 16 for IPv6 address */
+	uint32_t csum;			/* checksums covering the field */
+	uint32_t pcsum;			/* checksums having the field in pseudo header */
+	uint64_t min, n, step;
+	uint64_t cur;
+	uint64_t *list;
+};
+
+/* flow of the packet, for PKTTEMPLATE_OP_{S,D}{ADDR,PORT} */
+struct pkttemplate_flow {
+	int af;
+	uint32_t saddr4, daddr4;	/* network byte order */
+	const struct in6_addr *saddr6, *daddr6;
+	uint16_t sport, dport;
+};
+
+struct pkttemplate {
+	int af;				/* AF_INET or AF_INET6 of the first header */
+	unsigned int len;		/* including trailer */
+	unsigned int trailer_off;	/* sequence data written by caller */
+	unsigned int trailer_len;
+	uint32_t trailer_csum;		/* checksums covering the trailer */
+	uint32_t crc32c;		/* checksums recomputed per packet */
+
+	unsigned int ncsum;
+	struct pkttemplate_csum csum[PKTTEMPLATE_MAXCSUM];
+	unsigned int ninsn;
+	struct pkttemplate_insn insn[PKTTEMPLATE_MAXFIELD];
+
+	uint8_t frame[PKTTEMPLATE_MAXLEN + 1];	/* +1 for word access of odd length */
+};
+
+struct pkttemplate *pkttemplate_read(const char *, unsigned int, unsigned int);
+void pkttemplate_delete(struct pkttemplate *);
+void pkttemplate_apply(struct pkttemplate *, char *, struct prng *,
+    const struct pkttemplate_flow *, const void *);
+
+#endif /* _PKTTEMPLATE_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdint.h>
+
+#include "prng.h"
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t
+splitmix64(uint64_t *state)
+{
+	uint64_t z;
+
+	z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* same seed always generates the same sequence */
+void
+prng_seed(struct prng *prng, uint64_t seed)
+{
+	unsigned int i, lane;
+
+	for (lane = 0; lane < PRNG_LANES; lane++) {
+		for (i = 0; i < 4; i++)
+			prng->s[i][lane] = splitmix64(&seed);
+	}
+	prng->idx = PRNG_BATCH;
+}
+
+void
+prng_refill(struct prng *prng)
+{
+	uint64_t s0, s1, s2, s3, t;
+	unsigned int i, lane;
+
+	for (i = 0; i < PRNG_BATCH; i += PRNG_LANES) {
+		for (lane = 0; lane < PRNG_LANES; lane++) {
+			s0 = prng->s[0][lane];
+			s1 = prng->s[1][lane];
+			s2 = prng->s[2][lane];
+			s3 = prng->s[3][lane];
+
+			prng->buf[i + lane] = rotl(s0 + s3, 23) + s0;
+
+			t = s1 << 17;
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= t;
+			s3 = rotl(s3, 45);
+
+			prng->s[0][lane] = s0;
+			prng->s[1][lane] = s1;
+			prng->s[2][lane] = s2;
+			prng->s[3][lane] = s3;
+		}
+	}
+	prng->idx = 0;
+}
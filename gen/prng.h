@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _PRNG_H_
+#define _PRNG_H_
+
+#include <stdint.h>
+
+/*
+ * xoshiro256++ with PRNG_LANES independent streams.
+ * random numbers are generated PRNG_BATCH at once, and the loop over
+ * lanes has no dependency between lanes so that it can be vectorized.
+ */
+#define PRNG_LANES	4
+#define PRNG_BATCH	64	/* must be multiple of PRNG_LANES */
+
+struct prng {
+	uint64_t s[4][PRNG_LANES];
+	uint64_t buf[PRNG_BATCH];
+	unsigned int idx;
+};
+
+void prng_seed(struct prng *, uint64_t);
+void prng_refill(struct prng *);
+
+static inline uint64_t
+prng_next(struct prng *prng)
+{
+	if (prng->idx >= PRNG_BATCH)
+		prng_refill(prng);
+	return prng->buf[prng->idx++];
+}
+
+/* uniform random number in [0, n) */
+static inline uint64_t
+prng_range(struct prng *prng, uint64_t n)
+{
+	return ((unsigned __int128)prng_next(prng) * n) >> 64;
+}
+
+#endif /* _PRNG_H_ */
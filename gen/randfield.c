@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libpkt/libpkt.h"
+#include "libaddrlist/libaddrlist.h"
+#include "flowparse.h"
+#include "randfield.h"
+
+static const struct {
+	const char *name;
+	uint64_t min, max;	/* allowed range, and default for value fields */
+} randfield_def[RANDFIELD_NFIELD] = {
+	[RANDFIELD_SADDR]	= { "saddr",		0, UINT32_MAX	},
+	[RANDFIELD_DADDR]	= { "daddr",		0, UINT32_MAX	},
+	[RANDFIELD_SPORT]	= { "sport",		0, 65535	},
+	[RANDFIELD_DPORT]	= { "dport",		0, 65535	},
+	[RANDFIELD_FLOWLABEL]	= { "flowlabel",	0, 0xfffff	},
+	[RANDFIELD_DSCP]	= { "dscp",		0, 63		},
+	[RANDFIELD_TTL]		= { "ttl",		1, 255		},
+};
+
+int
+randfield_setrange(struct randfield *rf, int field, uint64_t begin, uint64_t end)
+{
+	struct randfield_spec *f = &rf->field[field];
+
+	if ((begin > end) ||
+	    (begin < randfield_def[field].min) || (end > randfield_def[field].max))
+		return -1;
+
+	if ((field == RANDFIELD_SADDR) || (field == RANDFIELD_DADDR))
+		f->af = AF_INET;
+	f->begin = begin;
+	f->n = end - begin + 1;
+	return 0;
+}
+
+int
+randfield_setrange6(struct randfield *rf, int field, const struct in6_addr *begin, const struct in6_addr *end)
+{
+	struct randfield_spec *f = &rf->field[field];
+	uint64_t diff;
+
+	if ((field != RANDFIELD_SADDR) && (field != RANDFIELD_DADDR))
+		return -1;
+
+	/* end - begin must be less than 2^64 - 1 */
+	if ((ipv6_sub(end, begin, &diff) != 0) || (diff == UINT64_MAX))
+		return -1;
+
+	f->af = AF_INET6;
+	f->begin = 0;
+	f->begin6 = *begin;
+	f->n = diff + 1;
+	return 0;
+}
+
+/*
+ * parse "<field>[=<begin>[-<end>]]"
+ *  e.g.) "saddr=10.0.0.0-10.255.255.255", "sport=1024-65535", "ttl"
+ * address and port without range are filled by caller later.
+ */
+int
+randfield_parse(struct randfield *rf, const char *str)
+{
+	struct in_addr addr_begin, addr_end;
+	struct in6_addr addr6_begin, addr6_end;
+	unsigned long begin, end;
+	char *buf, *range, *p;
+	int field, rc;
+
+	buf = strdup(str);
+	if (buf == NULL)
+		return -1;
+
+	range = index(buf, '=');
+	if (range != NULL)
+		*range++ = '\0';
+
+	for (field = 0; field < RANDFIELD_NFIELD; field++) {
+		if (strcmp(buf, randfield_def[field].name) == 0)
+			break;
+	}
+	if (field >= RANDFIELD_NFIELD) {
+		rc = -1;
+		goto done;
+	}
+
+	if (range == NULL) {
+		rc = 0;
+		switch (field) {
+		case RANDFIELD_FLOWLABEL:
+		case RANDFIELD_DSCP:
+		case RANDFIELD_TTL:
+			rc = randfield_setrange(rf, field,
+			    randfield_def[field].min, randfield_def[field].max);
+			break;
+		}
+	} else if ((field == RANDFIELD_SADDR) || (field == RANDFIELD_DADDR)) {
+		if (index(range, ':') != NULL) {
+			rc = parse_addr6range(range, &addr6_begin, &addr6_end);
+			if (rc == 0)
+				rc = randfield_setrange6(rf, field, &addr6_begin, &addr6_end);
+		} else {
+			rc = parse_addrrange(range, &addr_begin, &addr_end);
+			if (rc == 0)
+				rc = randfield_setrange(rf, field,
+				    ntohl(addr_begin.s_addr), ntohl(addr_end.s_addr));
+		}
+	} else {
+		begin = end = strtoul(range, &p, 0);
+		if (*p == '-')
+			end = strtoul(p + 1, &p, 0);
+		if ((p == range) || (*p != '\0'))
+			rc = -1;
+		else
+			rc = randfield_setrange(rf, field, begin, end);
+	}
+
+	if (rc == 0) {
+		rf->field[field].enable = 1;
+		rf->enable = 1;
+	}
+
+ done:
+	free(buf);
+	return rc;
+}
+
+/*
+ * randomize fields of the packet.
+ * ranges are for forward direction, and source and destination are
+ * swapped for packets of reverse direction.
+ */
+void
+randfield_apply(const struct randfield *rf, struct prng *prng, char *buf, unsigned int l3offset, int ipv6, int reverse)
+{
+	static const int swapped[RANDFIELD_NFIELD] = {
+		[RANDFIELD_SADDR]	= RANDFIELD_DADDR,
+		[RANDFIELD_DADDR]	= RANDFIELD_SADDR,
+		[RANDFIELD_SPORT]	= RANDFIELD_DPORT,
+		[RANDFIELD_DPORT]	= RANDFIELD_SPORT,
+		[RANDFIELD_FLOWLABEL]	= RANDFIELD_FLOWLABEL,
+		[RANDFIELD_DSCP]	= RANDFIELD_DSCP,
+		[RANDFIELD_TTL]		= RANDFIELD_TTL,
+	};
+	const struct randfield_spec *f;
+	struct in6_addr addr6;
+	uint64_t v;
+	int i, field;
+
+	for (i = 0; i < RANDFIELD_NFIELD; i++) {
+		f = &rf->field[i];
+		if (!f->enable || (f->n == 0))
+			continue;
+
+		field = reverse ? swapped[i] : i;
+		v = f->begin + prng_range(prng, f->n);
+		switch (field) {
+		case RANDFIELD_SADDR:
+		case RANDFIELD_DADDR:
+			if (ipv6 && (f->af == AF_INET6)) {
+				addr6 = f->begin6;
+				ipv6_add(&addr6, v);
+				if (field == RANDFIELD_SADDR)
+					ip6pkt_src(buf, l3offset, &addr6);
+				else
+					ip6pkt_dst(buf, l3offset, &addr6);
+			} else if (!ipv6 && (f->af == AF_INET)) {
+				if (field == RANDFIELD_SADDR)
+					ip4pkt_src(buf, l3offset, htonl(v));
+				else
+					ip4pkt_dst(buf, l3offset, htonl(v));
+			}
+			break;
+		case RANDFIELD_SPORT:
+			if (ipv6)
+				ip6pkt_srcport(buf, l3offset, v);
+			else
+				ip4pkt_srcport(buf, l3offset, v);
+			break;
+		case RANDFIELD_DPORT:
+			if (ipv6)
+				ip6pkt_dstport(buf, l3offset, v);
+			else
+				ip4pkt_dstport(buf, l3offset, v);
+			break;
+		case RANDFIELD_FLOWLABEL:
+			if (ipv6)
+				ip6pkt_flowlabel(buf, l3offset, v);
+			break;
+		case RANDFIELD_DSCP:
+			if (ipv6)
+				ip6pkt_tclass(buf, l3offset, v << 2);
+			else
+				ip4pkt_tos(buf, l3offset, v << 2);
+			break;
+		case RANDFIELD_TTL:
+			if (ipv6)
+				ip6pkt_ttl(buf, l3offset, v);
+			else
+				ip4pkt_ttl(buf, l3offset, v);
+			break;
+		}
+	}
+}
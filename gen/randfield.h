@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _RANDFIELD_H_
+#define _RANDFIELD_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "prng.h"
+
+/*
+ * header fields randomized per packet (--random)
+ */
+#define RANDFIELD_SADDR		0
+#define RANDFIELD_DADDR		1
+#define RANDFIELD_SPORT		2
+#define RANDFIELD_DPORT		3
+#define RANDFIELD_FLOWLABEL	4
+#define RANDFIELD_DSCP		5
+#define RANDFIELD_TTL		6
+#define RANDFIELD_NFIELD	7
+
+struct randfield_spec {
+	int enable;
+	int af;			/* AF_INET or AF_INET6 for address. 0 if range is not specified yet */
+	uint64_t begin;		/* host byte order. IPv4 address, port or value */
+	struct in6_addr begin6;
+	uint64_t n;		/* number of values in range */
+};
+
+struct randfield {
+	int enable;
+	struct randfield_spec field[RANDFIELD_NFIELD];
+};
+
+int randfield_parse(struct randfield *, const char *);
+int randfield_setrange(struct randfield *, int, uint64_t, uint64_t);
+int randfield_setrange6(struct randfield *, int, const struct in6_addr *, const struct in6_addr *);
+void randfield_apply(const struct randfield *, struct prng *, char *, unsigned int, int, int);
+
+#endif /* _RANDFIELD_H_ */
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <netinet/in.h>
+
+#include "rss.h"
+
+/* well known default key of Microsoft RSS specification, used by many NICs */
+static const uint8_t rss_default_key[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+void
+rss_init(struct rss *rss)
+{
+	memset(rss, 0, sizeof(*rss));
+	memcpy(rss->key, rss_default_key, sizeof(rss_default_key));
+	rss->keylen = sizeof(rss_default_key);
+	rss->l4 = 1;
+	rss->nqueue = 1;
+	rss->retasize = RSS_RETASIZE_DEFAULT;
+}
+
+static int
+hexdigit(int c)
+{
+	if (isdigit(c))
+		return c - '0';
+	if (isxdigit(c))
+		return tolower(c) - 'a' + 10;
+	return -1;
+}
+
+/*
+ * parse key as hex string. ':' or '-' between bytes are allowed.
+ * e.g.) "6d5a56da...", "6d:5a:56:da:..."
+ */
+int
+rss_parse_key(struct rss *rss, const char *str)
+{
+	uint8_t key[RSS_KEYLEN_MAX];
+	unsigned int len;
+	int hi, lo;
+
+	for (len = 0; *str != '\0'; len++) {
+		if (len >= RSS_KEYLEN_MAX)
+			return -1;
+		if ((hi = hexdigit(str[0])) < 0 || (lo = hexdigit(str[1])) < 0)
+			return -1;
+		key[len] = (hi << 4) | lo;
+		str += 2;
+		if ((*str == ':') || (*str == '-'))
+			str++;
+	}
+	/* IPv6 addresses and ports need 36 + 4 bytes */
+	if (len < 40)
+		return -1;
+
+	memcpy(rss->key, key, len);
+	rss->keylen = len;
+	return 0;
+}
+
+/*
+ * Toeplitz hash. for each bit of data, xor the 32bit window of key
+ * which starts at the bit.
+ */
+uint32_t
+rss_toeplitz(const uint8_t *key, unsigned int keylen, const uint8_t *data, unsigned int len)
+{
+	uint32_t hash, window;
+	unsigned int i, b;
+
+	hash = 0;
+	window = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16) |
+	    ((uint32_t)key[2] << 8) | key[3];
+	for (i = 0; i < len; i++) {
+		for (b = 0; b < 8; b++) {
+			if (data[i] & (0x80 >> b))
+				hash ^= window;
+			window <<= 1;
+			if (((i + 4) < keylen) && (key[i + 4] & (0x80 >> b)))
+				window |= 1;
+		}
+	}
+	return hash;
+}
+
+/*
+ * hash input is source address, destination address, source port
+ * and destination port in network byte order.
+ */
+uint32_t
+rss_hash(const struct rss *rss, const struct address_tuple *tuple)
+{
+	uint8_t data[36];
+	unsigned int len;
+	uint16_t port;
+
+	if (tuple->saddr.af == AF_INET6) {
+		memcpy(&data[0], &tuple->saddr.a.addr6, 16);
+		memcpy(&data[16], &tuple->daddr.a.addr6, 16);
+		len = 32;
+	} else {
+		memcpy(&data[0], &tuple->saddr.a.addr4, 4);
+		memcpy(&data[4], &tuple->daddr.a.addr4, 4);
+		len = 8;
+	}
+	if (rss->l4) {
+		port = htons(tuple->sport);
+		memcpy(&data[len], &port, 2);
+		port = htons(tuple->dport);
+		memcpy(&data[len + 2], &port, 2);
+		len += 4;
+	}
+	return rss_toeplitz(rss->key, rss->keylen, data, len);
+}
+
+#ifdef TEST
+#include "rss_test.c"
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _RSS_H_
+#define _RSS_H_
+
+#include <stdint.h>
+
+#include "libaddrlist/libaddrlist.h"
+
+/*
+ * simulation of receive side scaling of the DUT.
+ * queue of a packet is reta[toeplitz(key, tuple) % retasize], and
+ * reta[i] is (i % nqueue) as the default of most drivers.
+ */
+#define RSS_KEYLEN_MAX		64
+#define RSS_RETASIZE_DEFAULT	128
+
+struct rss {
+	uint8_t key[RSS_KEYLEN_MAX];
+	unsigned int keylen;
+	int l4;				/* hash ports as well as addresses */
+	unsigned int nqueue;
+	unsigned int retasize;
+};
+
+void rss_init(struct rss *);
+int rss_parse_key(struct rss *, const char *);
+uint32_t rss_toeplitz(const uint8_t *, unsigned int, const uint8_t *, unsigned int);
+uint32_t rss_hash(const struct rss *, const struct address_tuple *);
+
+static inline unsigned int
+rss_queue(const struct rss *rss, uint32_t hash)
+{
+	return (hash % rss->retasize) % rss->nqueue;
+}
+
+#endif /* _RSS_H_ */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * known answers of Toeplitz hash with the default key, from the
+ * verification suite of Microsoft RSS specification.
+ */
+#include <arpa/inet.h>
+
+static const struct {
+	const char *src, *dst;
+	uint16_t sport, dport;
+} rss_test_vector[] = {
+	{ "66.9.149.187",	"161.142.100.80",	2794,	1766	},
+	{ "199.92.111.2",	"65.69.140.83",		14230,	4739	},
+	{ "24.19.198.95",	"12.22.207.184",	12898,	38024	},
+	{ "38.27.205.30",	"209.142.163.6",	48228,	2217	},
+	{ "153.39.163.191",	"202.188.127.2",	44251,	1303	},
+	{ "3ffe:2501:200:1fff::7",	"3ffe:2501:200:3::1",	2794,	1766	},
+	{ "3ffe:501:8::260:97ff:fe40:efab",	"ff02::1",	14230,	4739	},
+	{ "3ffe:1900:4545:3:200:f8ff:fe21:67cf",	"fe80::200:f8ff:fe21:67cf",	44251,	38024	},
+};
+
+static int
+rss_test_tuple(struct address_tuple *tuple, const char *src, const char *dst)
+{
+	memset(tuple, 0, sizeof(*tuple));
+	if ((inet_pton(AF_INET, src, &tuple->saddr.a.addr4) == 1) &&
+	    (inet_pton(AF_INET, dst, &tuple->daddr.a.addr4) == 1)) {
+		tuple->saddr.af = tuple->daddr.af = AF_INET;
+		return 0;
+	}
+	if ((inet_pton(AF_INET6, src, &tuple->saddr.a.addr6) == 1) &&
+	    (inet_pton(AF_INET6, dst, &tuple->daddr.a.addr6) == 1)) {
+		tuple->saddr.af = tuple->daddr.af = AF_INET6;
+		return 0;
+	}
+	return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct address_tuple tuple;
+	struct rss rss;
+	uint32_t hash_l3, hash_l4;
+	unsigned int i;
+
+	(void)argc;
+	(void)argv;
+
+	rss_init(&rss);
+	for (i = 0; i < sizeof(rss_test_vector) / sizeof(rss_test_vector[0]); i++) {
+		if (rss_test_tuple(&tuple, rss_test_vector[i].src, rss_test_vector[i].dst) != 0) {
+			printf("illegal address: %s %s\n", rss_test_vector[i].src, rss_test_vector[i].dst);
+			return 1;
+		}
+		tuple.sport = rss_test_vector[i].sport;
+		tuple.dport = rss_test_vector[i].dport;
+
+		rss.l4 = 0;
+		hash_l3 = rss_hash(&rss, &tuple);
+		rss.l4 = 1;
+		hash_l4 = rss_hash(&rss, &tuple);
+		printf("%s %u %s %u: 0x%08x 0x%08x\n",
+		    rss_test_vector[i].src, tuple.sport,
+		    rss_test_vector[i].dst, tuple.dport, hash_l3, hash_l4);
+	}
+	return 0;
+}
@@ -99,6 +99,9 @@ run0 -XX
 testmsg "packet generation benchmark (-XXX)"
 run0 -XXX
 
+testmsg "specialized TX paths against generic one (--txpath-test)"
+run0 --txpath-test
+
 
 testmsg "send/recv test"
 run
@@ -32,6 +32,8 @@ static int test2(void);
 static int test3(void);
 static int test4(void);
 static int test5(void);
+static int test6(void);
+static int test7(void);
 
 /*
  * Print the banner with the function name and initialize seqmap.
@@ -194,6 +196,135 @@ test5(void)
 	return 0;
 }
 
+static int
+seqcheck_equal(struct sequencechecker *a, struct sequencechecker *b)
+{
+	return (a->sc_high == b->sc_high) &&
+	    (a->sc_lastseq == b->sc_lastseq) &&
+	    (a->sc_bitmap_start == b->sc_bitmap_start) &&
+	    (a->sc_bitmap_end == b->sc_bitmap_end) &&
+	    (a->sc_bitmap_baseidx == b->sc_bitmap_baseidx) &&
+	    (a->sc_needinit == b->sc_needinit) &&
+	    (memcmp(a->sc_bitmap, b->sc_bitmap, sizeof(a->sc_bitmap)) == 0) &&
+	    (a->sc_maxseq == b->sc_maxseq) &&
+	    (a->sc_nreceive == b->sc_nreceive) &&
+	    (a->sc_reorder == b->sc_reorder) &&
+	    (a->sc_duplicate == b->sc_duplicate) &&
+	    (a->sc_outofrange == b->sc_outofrange) &&
+	    (a->sc_dropshift == b->sc_dropshift);
+}
+
+/*
+ * seqcheck_receive_n() must give the same result as seqcheck_receive()
+ * for in-order runs, drops, duplicates, reorders, 32bit wraparound and
+ * large jumps, with two checkers under one parent and one without.
+ */
+static int
+test6(void)
+{
+	struct sequencechecker flow[2], total, iface;
+	struct sequencechecker bflow[2], btotal, biface;
+	struct seqcheck_req req[64];
+	uint64_t nskip[64];
+	uint32_t seq, flowseq[2];
+	unsigned int i, n, burst, f, mismatch;
+
+	seqcheck_testinit(__func__, &total);
+	seqcheck_init(&iface);
+	seqcheck_init(&btotal);
+	seqcheck_init(&biface);
+	for (f = 0; f < 2; f++) {
+		seqcheck_init(&flow[f]);
+		seqcheck_init(&bflow[f]);
+		seqcheck_setparent(&flow[f], &total);
+		seqcheck_setparent(&bflow[f], &btotal);
+	}
+
+	/* step forward to near 32bit wraparound */
+	seqcheck_receive(&iface, 0x7fffffff);
+	seqcheck_receive(&biface, 0x7fffffff);
+	seqcheck_receive(&flow[1], 0x7fffffff);
+	seqcheck_receive(&bflow[1], 0x7fffffff);
+
+	mismatch = 0;
+	seq = 0xffff0000;
+	flowseq[0] = 0;
+	flowseq[1] = 0xfffff000;
+	for (burst = 0; burst < 4096; burst++) {
+		/* a burst of packets, interleaving two flows */
+		for (n = 0, i = 0; i < 32; i++) {
+			f = (burst & 1) ? (i & 1) : (i / 16);
+			switch ((burst * 32 + i) % 997) {
+			case 100:	/* drop */
+				seq += 3;
+				flowseq[f] += 3;
+				break;
+			case 200:	/* duplicate */
+				seq--;
+				flowseq[f]--;
+				break;
+			case 300:	/* reorder */
+				seq -= 40;
+				flowseq[f] -= 40;
+				break;
+			case 400:	/* large jump */
+				seq += 100000;
+				flowseq[f] += 100000;
+				break;
+			}
+			req[n].sc = &bflow[f];
+			req[n].seq = flowseq[f];
+			nskip[n++] = seqcheck_receive(&flow[f], flowseq[f]++);
+			req[n].sc = &biface;
+			req[n].seq = seq;
+			nskip[n++] = seqcheck_receive(&iface, seq++);
+		}
+		seqcheck_receive_n(req, n);
+
+		for (i = 0; i < n; i++) {
+			if (req[i].nskip != nskip[i])
+				mismatch++;
+		}
+		if (!seqcheck_equal(&flow[0], &bflow[0]) ||
+		    !seqcheck_equal(&flow[1], &bflow[1]) ||
+		    !seqcheck_equal(&total, &btotal) ||
+		    !seqcheck_equal(&iface, &biface))
+			mismatch++;
+	}
+
+	printf("mismatch   = %u\n", mismatch);
+	seqcheck_dump2(&btotal);
+	seqcheck_dump2(&biface);
+
+	return (mismatch == 0) ? 0 : 1;
+}
+
+static int
+test7(void)
+{
+	struct sequencechecker seqmap;
+	struct seqcheck_req req[200];
+	unsigned int i;
+
+	seqcheck_testinit(__func__, &seqmap);
+
+	seqcheck_receive(&seqmap, 1);
+	seqcheck_receive(&seqmap, 70);
+
+	/*
+	 * Seqno 2-199 are received at once. 70 is a duplicate.
+	 * nreceive = 200, duplicate = 1, maxseq = 199.
+	 */
+	for (i = 0; i < 198; i++) {
+		req[i].sc = &seqmap;
+		req[i].seq = i + 2;
+	}
+	seqcheck_receive_n(req, 198);
+	seqcheck_dump(&seqmap);
+
+	return 0;
+}
+
 struct testtab {
 	int (*func)(void);
 } tests[] = {
@@ -203,6 +334,8 @@ struct testtab {
 	{ test3 },
 	{ test4 },
 	{ test5 },
+	{ test6 },
+	{ test7 },
 };
 
 static int
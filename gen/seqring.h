@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _SEQRING_H_
+#define _SEQRING_H_
+
+#include <stdint.h>
+#include "sequencecheck.h"
+
+/*
+ * lock-free single producer, single consumer ring of sequences.
+ * RX threads pass sequences to the thread owning the checker.
+ * the producer puts sequences and publishes them at once.
+ */
+struct seqring {
+	unsigned int mask;		/* number of slots - 1 */
+
+	/* consumer */
+	uint32_t head __attribute__((__aligned__(64)));
+	uint32_t tail_cache;
+
+	/* producer */
+	uint32_t tail __attribute__((__aligned__(64)));
+	uint32_t ptail;			/* not published yet */
+	uint32_t head_cache;
+
+	struct seqcheck_req ring[] __attribute__((__aligned__(64)));
+};
+
+struct seqring *seqring_new(unsigned int);
+void seqring_delete(struct seqring *);
+
+static inline int
+seqring_put(struct seqring *r, struct sequencechecker *sc, uint32_t seq)
+{
+	struct seqcheck_req *req;
+
+	if (r->ptail - r->head_cache > r->mask) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (r->ptail - r->head_cache > r->mask)
+			return -1;
+	}
+	req = &r->ring[r->ptail & r->mask];
+	req->sc = sc;
+	req->seq = seq;
+	r->ptail++;
+	return 0;
+}
+
+static inline void
+seqring_publish(struct seqring *r)
+{
+	if (r->ptail != r->tail)
+		__atomic_store_n(&r->tail, r->ptail, __ATOMIC_RELEASE);
+}
+
+/* number of sequences ready to get */
+static inline unsigned int
+seqring_count(struct seqring *r)
+{
+	r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	return r->tail_cache - r->head;
+}
+
+/* i-th sequence from the head. i must be less than seqring_count() */
+static inline struct seqcheck_req *
+seqring_peek(struct seqring *r, unsigned int i)
+{
+	return &r->ring[(r->head + i) & r->mask];
+}
+
+static inline void
+seqring_consume(struct seqring *r, unsigned int n)
+{
+	if (n > 0)
+		__atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int
+seqring_get(struct seqring *r, struct seqcheck_req *req, unsigned int n)
+{
+	uint32_t head;
+	unsigned int i;
+
+	head = r->head;
+	if (r->tail_cache - head < n) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->tail_cache - head < n)
+			n = r->tail_cache - head;
+	}
+	for (i = 0; i < n; i++)
+		req[i] = r->ring[(head + i) & r->mask];
+	seqring_consume(r, n);
+	return n;
+}
+
+#endif /* _SEQRING_H_ */
@@ -7,7 +7,8 @@ struct sequence_record {
 	/* filled by caller */
 	uint32_t flowid;
 	uint32_t flowseq;
-	struct timespec ts;
+	uint32_t streamid;	/* 0 if not sent by a stream */
+	uint64_t ts;		/* TX time by tsc_read() */
 };
 
 #define SEQTABLE_NRECORD	(128*1024)	/* must be 2^n */
@@ -69,6 +69,21 @@ struct sequencechecker {
 };
 #define SEQ_NEXT_INDEX(i)	(((i) + 1) & (SEQ_ARRAYSIZE - 1))
 
+/*
+ * counters to be added to the parent.
+ * seqcheck_receive_n() accumulates them over a batch.
+ */
+struct seqcheck_count {
+	uint64_t nreceive;
+	uint64_t reorder;
+	uint64_t duplicate;
+	uint64_t outofrange;
+	uint64_t dropshift;
+};
+
+#define SEQCHECK_NPARENT	4	/* parents accumulated at once */
+#define SEQCHECK_CHUNK		64	/* req[] looked ahead for a run */
+
 
 static inline int
 uint64bitcount(uint64_t x)
@@ -167,7 +182,7 @@ seqcheck_delete(struct sequencechecker *sc)
 }
 
 static inline void
-seqcheck_bit_set(struct sequencechecker *sc, unsigned int n)
+seqcheck_bit_set(struct sequencechecker *sc, unsigned int n, struct seqcheck_count *pc)
 {
 	int idx;
 	uint64_t bit;
@@ -176,13 +191,43 @@ seqcheck_bit_set(struct sequencechecker *sc, unsigned int n)
 	bit = (1ULL << (n & (BIT_PER_DATA - 1)));
 	if (sc->sc_bitmap[idx] & bit) {
 		sc->sc_duplicate++;
-		if (sc->sc_parent)
-			sc->sc_parent->sc_duplicate++;
+		pc->duplicate++;
 	} else {
 		sc->sc_bitmap[idx] |= bit;
 	}
 }
 
+/*
+ * set bits n to n+len-1 a word at a time, and return the number of
+ * bits which were already set. the range must be inside the bitmap.
+ */
+static inline uint64_t
+seqcheck_bit_set_range(struct sequencechecker *sc, unsigned int n, unsigned int len)
+{
+	int idx;
+	unsigned int bit, nbit;
+	uint64_t mask, ndup;
+
+	ndup = 0;
+	while (len > 0) {
+		idx = (sc->sc_bitmap_baseidx + (n / BIT_PER_DATA)) & (SEQ_ARRAYSIZE - 1);
+		bit = n & (BIT_PER_DATA - 1);
+		nbit = BIT_PER_DATA - bit;
+		if (nbit > len)
+			nbit = len;
+		if (nbit == BIT_PER_DATA)
+			mask = ~0ULL;
+		else
+			mask = ((1ULL << nbit) - 1) << bit;
+
+		ndup += uint64bitcount(sc->sc_bitmap[idx] & mask);
+		sc->sc_bitmap[idx] |= mask;
+		n += nbit;
+		len -= nbit;
+	}
+	return ndup;
+}
+
 #if 0
 static inline int
 seqcheck_bit_get(struct sequencechecker *sc, unsigned int n)
@@ -194,8 +239,22 @@ seqcheck_bit_get(struct sequencechecker *sc, unsigned int n)
 }
 #endif
 
-uint64_t
-seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
+static inline void
+seqcheck_count_add(struct sequencechecker *parent, struct seqcheck_count *pc)
+{
+	parent->sc_nreceive += pc->nreceive;
+	parent->sc_reorder += pc->reorder;
+	parent->sc_duplicate += pc->duplicate;
+	parent->sc_outofrange += pc->outofrange;
+	parent->sc_dropshift += pc->dropshift;
+}
+
+/*
+ * receive one sequence. the counters to be added to the parent are
+ * accumulated in *pc instead of the parent itself.
+ */
+static inline uint64_t
+seqcheck_receive1(struct sequencechecker *sc, uint32_t seq, struct seqcheck_count *pc)
 {
 	uint64_t seq64;
 	uint64_t i, n, ndrop;
@@ -216,8 +275,7 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 
 		/* reorder */
 		sc->sc_reorder++;
-		if (sc->sc_parent)
-			sc->sc_parent->sc_reorder++;
+		pc->reorder++;
 	}
 
 	if (sc->sc_needinit) {
@@ -226,8 +284,7 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 	}
 
 	sc->sc_nreceive++;
-	if (sc->sc_parent)
-		sc->sc_parent->sc_nreceive++;
+	pc->nreceive++;
 
 
 	sc->sc_lastseq = seq;
@@ -250,8 +307,7 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 	if (sc->sc_bitmap_start > seq64) {
 		/* (A) Out of range */
 		sc->sc_outofrange++;
-		if (sc->sc_parent)
-			sc->sc_parent->sc_outofrange++;
+		pc->outofrange++;
 		return 0;
 	}
 	if (sc->sc_bitmap_end > seq64) {
@@ -259,7 +315,7 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 		 * (B) Set the bit corresponding to that sequence number.
 		 * The duplicate check is also done in this function.
 		 */
-		seqcheck_bit_set(sc, seq64 - sc->sc_bitmap_start);
+		seqcheck_bit_set(sc, seq64 - sc->sc_bitmap_start, pc);
 		return nskip;
 	}
 
@@ -277,8 +333,7 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 	for (i = 0; i < n; i++) {
 		ndrop = BIT_PER_DATA - uint64bitcount(sc->sc_bitmap[sc->sc_bitmap_baseidx]);
 		sc->sc_dropshift += ndrop;
-		if (sc->sc_parent)
-			sc->sc_parent->sc_dropshift += ndrop;
+		pc->dropshift += ndrop;
 
 		sc->sc_bitmap[sc->sc_bitmap_baseidx] = 0;
 
@@ -294,18 +349,144 @@ seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
 		n = ((seq64 - sc->sc_bitmap_end) + BIT_PER_DATA) / BIT_PER_DATA;
 
 		sc->sc_dropshift += BIT_PER_DATA * n;
-		if (sc->sc_parent)
-			sc->sc_parent->sc_dropshift += BIT_PER_DATA * n;
+		pc->dropshift += BIT_PER_DATA * n;
 
 		sc->sc_bitmap_end =
 		    (seq64 + BIT_PER_DATA) & ~(BIT_PER_DATA - 1);
 		sc->sc_bitmap_start = sc->sc_bitmap_end - SEQ_MAXBIT;
 	}
 
-	seqcheck_bit_set(sc, seq64 - sc->sc_bitmap_start);
+	seqcheck_bit_set(sc, seq64 - sc->sc_bitmap_start, pc);
+	return nskip;
+}
+
+uint64_t
+seqcheck_receive(struct sequencechecker *sc, uint32_t seq)
+{
+	struct seqcheck_count pc;
+	uint64_t nskip;
+
+	memset(&pc, 0, sizeof(pc));
+	nskip = seqcheck_receive1(sc, seq, &pc);
+	if (sc->sc_parent)
+		seqcheck_count_add(sc->sc_parent, &pc);
 	return nskip;
 }
 
+/*
+ * collect the run of req[] of req[i].sc which continues sc_lastseq in
+ * order, without wrapping 32bit sequence and without leaving the bitmap.
+ * req[] of other checkers are skipped. indexes are stored into run[],
+ * and the length is returned.
+ */
+static inline unsigned int
+seqcheck_run(struct seqcheck_req *req, unsigned int i, unsigned int n,
+    uint64_t done, uint8_t *run)
+{
+	struct sequencechecker *sc = req[i].sc;
+	uint64_t seq64, room;
+	uint32_t seq;
+	unsigned int nrun;
+
+	seq = req[i].seq;
+	if (sc->sc_needinit || (seq != sc->sc_lastseq + 1) || (seq == 0))
+		return 0;
+
+	seq64 = ((uint64_t)sc->sc_high << 32) + seq;
+	if ((seq64 < sc->sc_bitmap_start) || (seq64 >= sc->sc_bitmap_end))
+		return 0;
+	room = sc->sc_bitmap_end - seq64;
+
+	run[0] = i;
+	for (nrun = 1, i++; (i < n) && (nrun < room); i++) {
+		if ((req[i].sc != sc) || (done & (1ULL << i)))
+			continue;
+		if ((req[i].seq != seq + 1) || (req[i].seq == 0))
+			break;
+		seq = req[i].seq;
+		run[nrun++] = i;
+	}
+	return nrun;
+}
+
+/*
+ * receive sequences of one RX burst. this is same as calling
+ * seqcheck_receive() for each req[] in order, but an in-order run of
+ * sequences of a checker is set into the bitmap at once, and counters
+ * of the parents are updated once per batch.
+ * nskip of each req[] is set as the return value of seqcheck_receive().
+ */
+void
+seqcheck_receive_n(struct seqcheck_req *req, unsigned int n)
+{
+	struct sequencechecker *sc;
+	struct sequencechecker *parent[SEQCHECK_NPARENT];
+	struct seqcheck_count count[SEQCHECK_NPARENT], scratch, *pc;
+	uint64_t seq64, ndup, done;
+	uint8_t run[SEQCHECK_CHUNK];
+	unsigned int i, j, nchunk, nrun, nparent;
+
+	nparent = 0;
+	for (; n > 0; req += nchunk, n -= nchunk) {
+		nchunk = (n < SEQCHECK_CHUNK) ? n : SEQCHECK_CHUNK;
+
+		for (done = 0, i = 0; i < nchunk; i++) {
+			if (done & (1ULL << i))
+				continue;
+			sc = req[i].sc;
+
+			/* find the parent accumulator */
+			pc = &scratch;
+			if (sc->sc_parent != NULL) {
+				for (j = 0; j < nparent; j++) {
+					if (parent[j] == sc->sc_parent)
+						break;
+				}
+				if (j == SEQCHECK_NPARENT) {
+					/* full. flush all */
+					for (j = 0; j < nparent; j++)
+						seqcheck_count_add(parent[j], &count[j]);
+					nparent = j = 0;
+				}
+				if (j == nparent) {
+					parent[j] = sc->sc_parent;
+					memset(&count[j], 0, sizeof(count[j]));
+					nparent++;
+				}
+				pc = &count[j];
+			}
+
+			nrun = seqcheck_run(req, i, nchunk, done, run);
+			if (nrun < 2) {
+				req[i].nskip = seqcheck_receive1(sc, req[i].seq, pc);
+				continue;
+			}
+
+			/* fast path. in-order sequences without gap */
+			seq64 = ((uint64_t)sc->sc_high << 32) + req[i].seq;
+			ndup = seqcheck_bit_set_range(sc,
+			    seq64 - sc->sc_bitmap_start, nrun);
+			sc->sc_duplicate += ndup;
+			pc->duplicate += ndup;
+			for (j = 0; j < nrun; j++, seq64++) {
+				if (sc->sc_maxseq < seq64) {
+					req[run[j]].nskip = seq64 - sc->sc_maxseq;
+					sc->sc_maxseq = seq64;
+				} else {
+					req[run[j]].nskip = 0;
+				}
+				done |= 1ULL << run[j];
+			}
+			sc->sc_lastseq = req[run[nrun - 1]].seq;
+			sc->sc_nreceive += nrun;
+			pc->nreceive += nrun;
+		}
+	}
+
+	for (j = 0; j < nparent; j++)
+		seqcheck_count_add(parent[j], &count[j]);
+}
+
 uint64_t
 seqcheck_dupcount(struct sequencechecker *sc)
 {
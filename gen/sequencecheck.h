@@ -28,6 +28,13 @@
 
 struct sequencechecker;
 
+/* a sequence for seqcheck_receive_n() */
+struct seqcheck_req {
+	struct sequencechecker *sc;
+	uint32_t seq;
+	uint64_t nskip;		/* out: return value of seqcheck_receive() */
+};
+
 struct sequencechecker *seqcheck_new(void);
 void seqcheck_setparent(struct sequencechecker *, struct sequencechecker *);
 void seqcheck_clear(struct sequencechecker *);
@@ -35,6 +42,7 @@ void seqcheck_delete(struct sequencechecker *);
 void seqcheck_dump(struct sequencechecker *);
 void seqcheck_dump2(struct sequencechecker *);
 uint64_t seqcheck_receive(struct sequencechecker *, uint32_t);
+void seqcheck_receive_n(struct seqcheck_req *, unsigned int);
 
 uint64_t seqcheck_dropcount(struct sequencechecker *);
 uint64_t seqcheck_dupcount(struct sequencechecker *);
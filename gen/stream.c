@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "stream.h"
+
+static int
+stream_parse_param(struct stream *stream, const char *key, const char *val)
+{
+	unsigned long n;
+	char *p;
+
+	if (strcmp(key, "flow") == 0) {
+		free(stream->flowstr);
+		stream->flowstr = strdup(val);
+		return (stream->flowstr == NULL) ? -1 : 0;
+	} else if (strcmp(key, "flowlist") == 0) {
+		free(stream->flowlist);
+		stream->flowlist = strdup(val);
+		return (stream->flowlist == NULL) ? -1 : 0;
+	} else if (strcmp(key, "imix") == 0) {
+		if (stream->imix != NULL)
+			imix_delete(stream->imix);
+		stream->imix = imix_new(val);
+		return (stream->imix == NULL) ? -1 : 0;
+	} else if (strcmp(key, "proto") == 0) {
+		if (strcmp(val, "udp") == 0)
+			stream->proto = IPPROTO_UDP;
+		else if (strcmp(val, "tcp") == 0)
+			stream->proto = IPPROTO_TCP;
+		else
+			return -1;
+		return 0;
+	}
+
+	n = strtoul(val, &p, 10);
+	if ((*p != '\0') || (p == val))
+		return -1;
+
+	if (strcmp(key, "pps") == 0) {
+		if (n > UINT32_MAX)
+			return -1;
+		stream->pps = n;
+	} else if (strcmp(key, "size") == 0) {
+		if ((n < 46) || (n > 1500))
+			return -1;
+		stream->pktsize = n;
+	} else if (strcmp(key, "dscp") == 0) {
+		if (n > 63)
+			return -1;
+		stream->dscp = n;
+	} else if (strcmp(key, "start") == 0) {
+		stream->start = n;
+	} else if (strcmp(key, "stop") == 0) {
+		stream->stop = n;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * read stream definitions. one stream per line.
+ *
+ *   <name> pps=<pps> [size=<size>|imix=<mix>] [proto=udp|tcp] [dscp=<dscp>]
+ *          [start=<sec>] [stop=<sec>] [flow=<src>,<dst>|flowlist=<file>]
+ *
+ * size 0 and proto 0 are left to the caller to be the defaults.
+ */
+struct stream *
+stream_read(const char *path, unsigned int *nstreamp)
+{
+	FILE *fp;
+	struct stream *streams, *stream;
+	char buf[1024], *p, *word, *val, *save;
+	unsigned int nstream, lineno;
+	int anyerror = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	streams = calloc(STREAM_MAX, sizeof(struct stream));
+	if (streams == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+
+	for (nstream = 0, lineno = 1; fgets(buf, sizeof(buf), fp) != NULL; lineno++) {
+		if ((p = strchr(buf, '#')) != NULL)
+			*p = '\0';
+		if ((word = strtok_r(buf, " \t\r\n", &save)) == NULL)
+			continue;	/* blank */
+
+		if (nstream >= STREAM_MAX) {
+			fprintf(stderr, "%s:%u: too many streams (max %d)\n", path, lineno, STREAM_MAX);
+			anyerror++;
+			break;
+		}
+		stream = &streams[nstream];
+		snprintf(stream->name, sizeof(stream->name), "%s", word);
+		stream->id = nstream + 1;
+		stream->dscp = -1;
+
+		while ((word = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if ((val = strchr(word, '=')) == NULL) {
+				fprintf(stderr, "%s:%u: illegal parameter: %s\n", path, lineno, word);
+				anyerror++;
+				continue;
+			}
+			*val++ = '\0';
+			if (stream_parse_param(stream, word, val) != 0) {
+				fprintf(stderr, "%s:%u: illegal %s: %s\n", path, lineno, word, val);
+				anyerror++;
+			}
+		}
+		if ((stream->flowstr != NULL) && (stream->flowlist != NULL)) {
+			fprintf(stderr, "%s:%u: flow and flowlist cannot be used together\n", path, lineno);
+			anyerror++;
+		}
+		if ((stream->stop != 0) && (stream->stop <= stream->start)) {
+			fprintf(stderr, "%s:%u: stop must be after start\n", path, lineno);
+			anyerror++;
+		}
+		nstream++;
+	}
+	fclose(fp);
+
+	if (anyerror || (nstream == 0)) {
+		if (nstream == 0)
+			fprintf(stderr, "%s: no stream\n", path);
+		for (stream = streams; stream < streams + STREAM_MAX; stream++) {
+			free(stream->flowstr);
+			free(stream->flowlist);
+			if (stream->imix != NULL)
+				imix_delete(stream->imix);
+		}
+		free(streams);
+		return NULL;
+	}
+
+	*nstreamp = nstream;
+	return streams;
+}
+
+static void
+streamsched_swap(struct streamsched *sched, unsigned int a, unsigned int b)
+{
+	struct stream *tmp;
+
+	tmp = sched->heap[a];
+	sched->heap[a] = sched->heap[b];
+	sched->heap[b] = tmp;
+}
+
+static void
+streamsched_down(struct streamsched *sched, unsigned int i)
+{
+	unsigned int l, r, min;
+
+	for (;;) {
+		l = i * 2 + 1;
+		r = l + 1;
+		min = i;
+		if ((l < sched->n) && (sched->heap[l]->next < sched->heap[min]->next))
+			min = l;
+		if ((r < sched->n) && (sched->heap[r]->next < sched->heap[min]->next))
+			min = r;
+		if (min == i)
+			break;
+		streamsched_swap(sched, i, min);
+		i = min;
+	}
+}
+
+void
+streamsched_push(struct streamsched *sched, struct stream *stream)
+{
+	unsigned int i, parent;
+
+	if (sched->n >= STREAM_MAX)
+		return;
+
+	i = sched->n++;
+	sched->heap[i] = stream;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (sched->heap[parent]->next <= sched->heap[i]->next)
+			break;
+		streamsched_swap(sched, i, parent);
+		i = parent;
+	}
+}
+
+/* remove the top */
+void
+streamsched_pop(struct streamsched *sched)
+{
+	if (sched->n == 0)
+		return;
+	sched->heap[0] = sched->heap[--sched->n];
+	streamsched_down(sched, 0);
+}
+
+/* next of the top was increased */
+void
+streamsched_update(struct streamsched *sched)
+{
+	streamsched_down(sched, 0);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026 Internet Initiative Japan, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "libaddrlist/libaddrlist.h"
+#include "imix.h"
+
+/*
+ * traffic stream. each stream has its own rate, size, protocol and flows,
+ * and streams are multiplexed on the TX interface by the scheduler,
+ * which picks the stream of the earliest departure time.
+ */
+#define STREAM_MAX		32
+#define STREAM_DUEMAX		1024	/* packets scheduled but not built yet */
+
+struct stream {
+	char name[32];
+	unsigned int id;		/* 1 origin. 0 is the traffic without stream */
+	uint32_t pps;
+	unsigned int pktsize;		/* average size if imix */
+	struct imix *imix;
+	int proto;			/* IPPROTO_UDP or IPPROTO_TCP */
+	int dscp;			/* -1 if not changed */
+	unsigned int start;		/* seconds from start of transmit */
+	unsigned int stop;		/* 0 is forever */
+	char *flowstr;			/* flow=<src>,<dst> */
+	char *flowlist;			/* flowlist=<file> */
+
+	struct flowtable *flowtable;	/* NULL if flows of interface are used */
+	unsigned int minsize;		/* smallest packet size of the stream */
+
+	/* owned by TX thread */
+	unsigned int flowcur;
+	unsigned int imixcur;
+	uint64_t next;			/* tsc of next packet */
+	uint64_t gap;			/* tsc between packets */
+
+	struct stream_statistics {
+		uint64_t tx;
+		uint64_t tx_byte;
+		uint64_t tx_underrun;
+		uint64_t rx;		/* updated by RX thread */
+		uint64_t rx_byte;
+		uint64_t tx_last, rx_last;
+		uint64_t tx_delta, rx_delta;
+		double latency_sum;
+		uint64_t latency_npkt;
+		double latency_max;
+	} stats;
+};
+
+/* binary heap of streams ordered by next */
+struct streamsched {
+	unsigned int n;
+	struct stream *heap[STREAM_MAX];
+};
+
+struct stream *stream_read(const char *, unsigned int *);
+void streamsched_push(struct streamsched *, struct stream *);
+void streamsched_pop(struct streamsched *);
+void streamsched_update(struct streamsched *);
+
+static inline struct stream *
+streamsched_top(const struct streamsched *sched)
+{
+	return (sched->n == 0) ? NULL : sched->heap[0];
+}
+
+#endif /* _STREAM_H_ */
@@ -47,6 +47,8 @@ static int handler_index(struct webserv *, const char *path, int argc, char *arg
 static int handler_stat(struct webserv *, const char *path, int argc, char *argv[]);
 static int handler_clear(struct webserv *, const char *path, int argc, char *argv[]);
 static int handler_interface(struct webserv *, const char *path, int argc, char *argv[]);
+static int handler_rfc2544(struct webserv *, const char *path, int argc, char *argv[]);
+static int handler_flow(struct webserv *, const char *path, int argc, char *argv[]);
 static int pathhandler(struct webserv *, char *);
 
 
@@ -76,8 +78,10 @@ struct urlhandler {
 } urlhandler[] = {
 	/* XXX: must be sorted by strlen! */
 	{	"/interface/",			handler_interface		},
+	{	"/rfc2544/",			handler_rfc2544			},
 	{	"/clear/",			handler_clear			},
 	{	"/stat/",			handler_stat			},
+	{	"/flow/",			handler_flow			},
 	{	"/",				handler_index			},
 };
 
@@ -193,6 +197,14 @@ handler_interface(struct webserv *web, const char *path __unused, int argc, char
 			    "}\n",
 			    getifname(ifno), n);
 		}
+	} else if ((argc == 2) && (strcmp(argv[1], "start") == 0)) {
+		transmit_set(ifno, 1);
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if ((argc == 2) && (strcmp(argv[1], "stop") == 0)) {
+		transmit_set(ifno, 0);
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
 	} else if (strcmp(argv[1], "pps") == 0) {
 		if (argc == 3) {
 			nl = strtol(argv[2], NULL, 10);
@@ -214,6 +226,107 @@ handler_interface(struct webserv *web, const char *path __unused, int argc, char
 	return 0;
 }
 
+/*
+ * GET /rfc2544/status			state of the test sequence
+ * GET /rfc2544/start			start test with current parameters
+ * GET /rfc2544/stop			abort test
+ * GET /rfc2544/result			result as --rfc2544-output-json
+ * GET /rfc2544/param			current parameters
+ * GET /rfc2544/param/<name>/<value>	same as --rfc2544-<name> <value>
+ */
+static int
+handler_rfc2544(struct webserv *web, const char *path __unused, int argc, char *argv[])
+{
+	if ((argc == 0) || ((argc == 1) && (strcmp(argv[0], "status") == 0))) {
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON);
+		rfc2544_status_json(web->fh);
+		fprintf(web->fh, "\n");
+	} else if ((argc == 1) && (strcmp(argv[0], "start") == 0)) {
+		if (rfc2544_start() != 0)
+			return webserv_reply_errcode(web, 409, "Conflict");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if ((argc == 1) && (strcmp(argv[0], "stop") == 0)) {
+		if (rfc2544_stop() != 0)
+			return webserv_reply_errcode(web, 409, "Conflict");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if ((argc == 1) && (strcmp(argv[0], "result") == 0)) {
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON);
+		rfc2544_result_json(web->fh);
+		fprintf(web->fh, "\n");
+	} else if ((argc == 1) && (strcmp(argv[0], "param") == 0)) {
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON);
+		rfc2544_param_json(web->fh);
+		fprintf(web->fh, "\n");
+	} else if ((argc == 3) && (strcmp(argv[0], "param") == 0)) {
+		if (rfc2544_running())
+			return webserv_reply_errcode(web, 409, "Conflict");
+		if (rfc2544_setparam(argv[1], argv[2]) != 0)
+			return webserv_reply_errcode(web, 400, "Bad Request");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else {
+		return webserv_reply_errcode(web, 404, "Not found");
+	}
+	return 0;
+}
+
+/*
+ * GET /flow				current flow ranges and number of flows
+ * GET /flow/nflow/<n>			use only first <n> flows
+ * GET /flow/saddr/<begin>[-<end>]	same as --saddr
+ * GET /flow/daddr/<begin>[-<end>]	same as --daddr
+ * GET /flow/sport/<begin>[-<end>]	same as --sport
+ * GET /flow/dport/<begin>[-<end>]	same as --dport
+ * GET /flow/apply			rebuild flows. transmit must be stopped
+ * GET /flow/add/<flow>[/<weight>]	add flow of --flowlist format while transmitting
+ * GET /flow/delete/<flow>		delete flow of --flowlist format while transmitting
+ */
+static int
+handler_flow(struct webserv *web, const char *path __unused, int argc, char *argv[])
+{
+	if (argc == 0) {
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON);
+		flow_status_json(web->fh);
+		fprintf(web->fh, "\n");
+	} else if ((argc == 1) && (strcmp(argv[0], "apply") == 0)) {
+		if (flow_apply() != 0)
+			return webserv_reply_errcode(web, 409, "Conflict");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if (((argc == 2) || (argc == 3)) && (strcmp(argv[0], "add") == 0)) {
+		char flowstr[256];
+
+		if (argc == 3)
+			snprintf(flowstr, sizeof(flowstr), "%s weight=%s", argv[1], argv[2]);
+		else
+			snprintf(flowstr, sizeof(flowstr), "%s", argv[1]);
+		if (flow_update(flowstr, 1) != 0)
+			return webserv_reply_errcode(web, 400, "Bad Request");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if ((argc == 2) && (strcmp(argv[0], "delete") == 0)) {
+		if (flow_update(argv[1], 0) != 0)
+			return webserv_reply_errcode(web, 400, "Bad Request");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if ((argc == 2) && (strcmp(argv[0], "nflow") == 0)) {
+		if (setnflow(strtoul(argv[1], NULL, 10)) != 0)
+			return webserv_reply_errcode(web, 400, "Bad Request");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else if (argc == 2) {
+		if (flow_setrange(argv[0], argv[1]) != 0)
+			return webserv_reply_errcode(web, 400, "Bad Request");
+		fprintf(web->fh, HTTP_FOUND_APPLICATION_JSON
+		    "{\"status\":0}\n");
+	} else {
+		return webserv_reply_errcode(web, 404, "Not found");
+	}
+	return 0;
+}
+
 static int
 pathhandler(struct webserv *web, char *path)
 {
@@ -25,11 +25,17 @@
  */
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -58,10 +64,19 @@ gcd(uint64_t a, uint64_t b)
 	return b;
 }
 
-static unsigned int
+/* return 0 if overflow */
+static uint64_t
 lcm(uint64_t a, uint64_t b)
 {
-	return a * b / gcd(a, b);
+	uint64_t x;
+
+	if ((a == 0) || (b == 0))
+		return 0;
+
+	x = a / gcd(a, b);
+	if (x > UINT64_MAX / b)
+		return 0;
+	return x * b;
 }
 
 struct addresslist *
@@ -70,42 +85,34 @@ addresslist_new(void)
 	struct addresslist *adrlist;
 
 	adrlist = malloc(sizeof(struct addresslist));
-	if (adrlist != NULL)
+	if (adrlist != NULL) {
 		memset(adrlist, 0, sizeof(*adrlist));
+		adrlist->weight = 1;
+		adrlist->svlan_num = 1;
+		adrlist->cvlan_num = 1;
+	}
 
 	return adrlist;
 }
 
+static void range_free(struct address_range *);
+
 void
 addresslist_delete(struct addresslist *adrlist)
 {
+	unsigned int i;
+
 	if (adrlist->tuple != NULL)
 		free(adrlist->tuple);
+	for (i = 0; i < adrlist->nrange; i++)
+		range_free(&adrlist->range[i]);
+	if (adrlist->range != NULL)
+		free(adrlist->range);
+	free(adrlist->exclude_saddr);
+	free(adrlist->exclude_daddr);
 	free(adrlist);
 }
 
-static int
-exists_in_addresses(int af, void *addr, struct address *addrlist, unsigned int addrlistnum)
-{
-	unsigned int i;
-
-	for (i = 0; i < addrlistnum; i++) {
-		if (addrlist[i].af == af) {
-			switch (af) {
-			case AF_INET:
-				if (((struct in_addr *)addr)->s_addr == addrlist[i].a.addr4.s_addr)
-					return 1;
-				break;
-			case AF_INET6:
-				if (memcmp(addr, &addrlist[i].a, sizeof(struct in6_addr)) == 0)
-					return 1;
-				break;
-			}
-		}
-	}
-	return 0;
-}
-
 int
 addresslist_exclude_saddr(struct addresslist *adrlist, struct in_addr addr)
 {
@@ -125,6 +132,7 @@ addresslist_exclude_saddr(struct addresslist *adrlist, struct in_addr addr)
 	adrlist->exclude_saddr[adrlist->exclude_saddr_num].a.addr4.s_addr = addr.s_addr;
 
 	adrlist->exclude_saddr_num++;
+	adrlist->exclude_sorted = 0;
 
 	return 0;
 }
@@ -147,6 +155,8 @@ addresslist_exclude_daddr(struct addresslist *adrlist, struct in_addr addr)
 	adrlist->exclude_daddr[adrlist->exclude_daddr_num].af = AF_INET;
 	adrlist->exclude_daddr[adrlist->exclude_daddr_num].a.addr4.s_addr = addr.s_addr;
 	adrlist->exclude_daddr_num++;
+	adrlist->exclude_sorted = 0;
+
 	return 0;
 }
 
@@ -169,6 +179,7 @@ addresslist_exclude_saddr6(struct addresslist *adrlist, struct in6_addr *addr6)
 	adrlist->exclude_saddr[adrlist->exclude_saddr_num].a.addr6 = *addr6;
 
 	adrlist->exclude_saddr_num++;
+	adrlist->exclude_sorted = 0;
 
 	return 0;
 }
@@ -191,6 +202,8 @@ addresslist_exclude_daddr6(struct addresslist *adrlist, struct in6_addr *addr6)
 	adrlist->exclude_daddr[adrlist->exclude_daddr_num].af = AF_INET6;
 	adrlist->exclude_daddr[adrlist->exclude_daddr_num].a.addr6 = *addr6;
 	adrlist->exclude_daddr_num++;
+	adrlist->exclude_sorted = 0;
+
 	return 0;
 }
 
@@ -218,7 +231,7 @@ ip4_sprintf(struct in_addr *addr)
 }
 
 static void
-l2random(const void *data, unsigned int len, struct ether_addr *eaddr)
+l2random_md5(const void *data, unsigned int len, struct ether_addr *eaddr)
 {
 	MD5_CTX ctx;
 	unsigned char digest[MD5_DIGEST_LENGTH];
@@ -231,193 +244,739 @@ l2random(const void *data, unsigned int len, struct ether_addr *eaddr)
 	eaddr->octet[0] &= 0xfc;
 }
 
-int
-addresslist_append(struct addresslist *adrlist, uint8_t proto,
-    struct in_addr saddr_begin, struct in_addr saddr_end,
-    struct in_addr daddr_begin, struct in_addr daddr_end,
-    uint16_t sport_begin, uint16_t sport_end,
-    uint16_t dport_begin, uint16_t dport_end)
+static inline uint64_t
+mix64(uint64_t x)
 {
-	struct address_tuple *newtuple;
-	struct in_addr saddr, daddr;
-	uint16_t sport, dport;
-	uint64_t saddr_num, daddr_num, sport_num, dport_num;
-	uint64_t addr_num, port_num;
-	uint64_t tuple_num, n;
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
 
-	saddr_num = ntohl(saddr_end.s_addr) - ntohl(saddr_begin.s_addr) + 1;
-	daddr_num = ntohl(daddr_end.s_addr) - ntohl(daddr_begin.s_addr) + 1;
-	sport_num = sport_end - sport_begin+ 1;
-	dport_num = dport_end - dport_begin+ 1;
+static void
+l2random_hash(const void *data, unsigned int len, struct ether_addr *eaddr)
+{
+	const uint8_t *p = data;
+	uint64_t h, v;
+	unsigned int i, j;
+
+	h = len;
+	for (i = 0; i < len; ) {
+		for (v = 0, j = 0; (i < len) && (j < 8); i++, j++)
+			v = (v << 8) | p[i];
+		h = mix64(h ^ v);
+	}
+	h = mix64(h);
 
-	addr_num = lcm(saddr_num, daddr_num);
-	port_num = lcm(sport_num, dport_num);
-	tuple_num = lcm(addr_num, port_num);
+	for (i = 0; i < sizeof(eaddr->octet); i++)
+		eaddr->octet[i] = h >> (56 - i * 8);
+	eaddr->octet[0] &= 0xfc;
+}
 
-	if (adrlist->tuple_limit < (adrlist->ntuple + tuple_num)) {
-		fprintf(stderr, "too large flowlist: %lu: %s-%s:%d-%d - %s-%s:%d-%d\n",
-		    adrlist->ntuple + tuple_num,
-		    ip4_sprintf(&saddr_begin), ip4_sprintf(&saddr_end),
-		    sport_begin, sport_end,
-		    ip4_sprintf(&daddr_begin), ip4_sprintf(&daddr_end),
-		    dport_begin, dport_end);
+static inline void
+l2random(int macmode, const void *data, unsigned int len, struct ether_addr *eaddr)
+{
+	if (macmode == ADDRESSLIST_MAC_MD5)
+		l2random_md5(data, len, eaddr);
+	else
+		l2random_hash(data, len, eaddr);
+}
+
+/* a += n as 128bit */
+void
+ipv6_add(struct in6_addr *a, uint64_t n)
+{
+	unsigned int i, x, carry;
+
+	carry = 0;
+	for (i = 16; i-- > 0; ) {
+		x = a->s6_addr[i] + (unsigned int)(n & 0xff) + carry;
+		a->s6_addr[i] = x & 0xff;
+		carry = x >> 8;
+		n >>= 8;
+	}
+}
+
+/*
+ * *diff = a - b as 128bit.
+ * return -1 if a < b, or the difference doesn't fit in 64bit.
+ */
+int
+ipv6_sub(const struct in6_addr *a, const struct in6_addr *b, uint64_t *diff)
+{
+	uint8_t d[16];
+	unsigned int i;
+	int x, borrow;
+
+	borrow = 0;
+	for (i = 16; i-- > 0; ) {
+		x = a->s6_addr[i] - b->s6_addr[i] - borrow;
+		borrow = (x < 0);
+		d[i] = x & 0xff;
+	}
+	if (borrow)
 		return -1;
+
+	for (i = 0; i < 8; i++) {
+		if (d[i] != 0)
+			return -1;
+	}
+
+	*diff = 0;
+	for (i = 8; i < 16; i++)
+		*diff = (*diff << 8) + d[i];
+	return 0;
+}
+
+
+/*
+ * lazy addresslist.
+ * tuples are not materialized, but calculated from address_range.
+ */
+static uint64_t
+mulmod(uint64_t a, uint64_t b, uint64_t m)
+{
+	uint64_t r;
+
+	r = 0;
+	a %= m;
+	while (b != 0) {
+		if (b & 1)
+			r = (r >= m - a) ? r - (m - a) : r + a;
+		a = (a >= m - a) ? a - (m - a) : a + a;
+		b >>= 1;
+	}
+	return r;
+}
+
+/* inverse of a modulo m. a and m must be coprime */
+static uint64_t
+invmod(uint64_t a, uint64_t m)
+{
+	uint64_t r0, r1, t0, t1, q, x, tmp;
+
+	if (m == 1)
+		return 0;
+
+	r0 = m;
+	r1 = a % m;
+	t0 = 0;
+	t1 = 1;
+	while (r1 != 0) {
+		q = r0 / r1;
+		tmp = r0 - q * r1;
+		r0 = r1;
+		r1 = tmp;
+
+		x = mulmod(q, t1, m);
+		tmp = (t0 >= x) ? t0 - x : m - (x - t0);
+		t0 = t1;
+		t1 = tmp;
 	}
+	return t0;
+}
+
+/* number of n (0 <= n < k) that n % m == r */
+static inline uint64_t
+count_mod(uint64_t k, uint64_t m, uint64_t r)
+{
+	if (k <= r)
+		return 0;
+	return (k - r - 1) / m + 1;
+}
+
+/* number of tuples not excluded in candidates [0, k) */
+static uint64_t
+range_count(const struct address_range *range, uint64_t k)
+{
+	uint64_t n;
+	unsigned int i;
+
+	n = k;
+	for (i = 0; i < range->exclude_saddr_num; i++)
+		n -= count_mod(k, range->saddr_num, range->exclude_saddr[i]);
+	for (i = 0; i < range->exclude_daddr_num; i++)
+		n -= count_mod(k, range->daddr_num, range->exclude_daddr[i]);
+	for (i = 0; i < range->exclude_both_num; i++)
+		n += count_mod(k, range->exclude_lcm, range->exclude_both[i]);
+	return n;
+}
 
+static void
+range_free(struct address_range *range)
+{
+	free(range->exclude_saddr);
+	free(range->exclude_daddr);
+	free(range->exclude_both);
+	range->exclude_saddr = NULL;
+	range->exclude_daddr = NULL;
+	range->exclude_both = NULL;
+}
+
+static int
+address_cmp(const void *a, const void *b)
+{
+	const struct address *x = a, *y = b;
+
+	if (x->af != y->af)
+		return (x->af < y->af) ? -1 : 1;
+	if (x->af == AF_INET)
+		return memcmp(&x->a.addr4, &y->a.addr4, sizeof(x->a.addr4));
+	return memcmp(&x->a.addr6, &y->a.addr6, sizeof(x->a.addr6));
+}
 
-	if (adrlist->tuple == NULL) {
-		newtuple = malloc(sizeof(struct address_tuple) * tuple_num);
-		memset(newtuple, 0, sizeof(struct address_tuple) * tuple_num);
+/* sort exclude lists to look them up by binary search */
+static void
+addresslist_sort_exclude(struct addresslist *adrlist)
+{
+	if (adrlist->exclude_sorted)
+		return;
+
+	if (adrlist->exclude_saddr_num > 1)
+		qsort(adrlist->exclude_saddr, adrlist->exclude_saddr_num, sizeof(struct address), address_cmp);
+	if (adrlist->exclude_daddr_num > 1)
+		qsort(adrlist->exclude_daddr, adrlist->exclude_daddr_num, sizeof(struct address), address_cmp);
+	adrlist->exclude_sorted = 1;
+}
+
+/* index of excluded address in the range. return -1 if out of range */
+static int
+range_exclude_offset(const struct address *begin, uint64_t num,
+    const struct address *exclude, uint64_t *idx)
+{
+	if (begin->af == AF_INET) {
+		if (ntohl(exclude->a.addr4.s_addr) < ntohl(begin->a.addr4.s_addr))
+			return -1;
+		*idx = ntohl(exclude->a.addr4.s_addr) - ntohl(begin->a.addr4.s_addr);
 	} else {
-		newtuple = realloc(adrlist->tuple, sizeof(struct address_tuple) * (adrlist->ntuple + tuple_num));
-		memset(newtuple + adrlist->ntuple, 0, sizeof(struct address_tuple) * tuple_num);
+		if (ipv6_sub(&exclude->a.addr6, &begin->a.addr6, idx) != 0)
+			return -1;
 	}
+	if (*idx >= num)
+		return -1;
+	return 0;
+}
 
-	if (newtuple == NULL) {
-		fprintf(stderr, "Cannot allocate memory. number of session is %lu\n", adrlist->ntuple + tuple_num);
+/*
+ * convert excluded addresses into indexes in the range.
+ * exclude[] must be sorted, and the result is sorted and unique.
+ */
+static int
+range_exclude_index(const struct address *begin, uint64_t num,
+    const struct address *exclude, unsigned int exclude_num,
+    uint64_t **indexp, unsigned int *nindexp)
+{
+	uint64_t *index, idx;
+	unsigned int lo, hi, mid, i, n;
+
+	*indexp = NULL;
+	*nindexp = 0;
+
+	/* lower bound of begin */
+	lo = 0;
+	hi = exclude_num;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (address_cmp(&exclude[mid], begin) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = lo; i < exclude_num; i++) {
+		if ((exclude[i].af != begin->af) ||
+		    (range_exclude_offset(begin, num, &exclude[i], &idx) != 0))
+			break;
+	}
+	if (i == lo)
+		return 0;
+
+	index = malloc(sizeof(uint64_t) * (i - lo));
+	if (index == NULL) {
+		fprintf(stderr, "Cannot allocate memory. number of exclude address is %u\n", i - lo);
 		return -1;
 	}
 
-	adrlist->tuple = newtuple;
+	for (n = 0; lo < i; lo++) {
+		range_exclude_offset(begin, num, &exclude[lo], &idx);
+		if ((n == 0) || (index[n - 1] != idx))
+			index[n++] = idx;
+	}
 
-	saddr.s_addr = saddr_begin.s_addr;
-	daddr.s_addr = daddr_begin.s_addr;
-	sport = sport_begin;
-	dport = dport_begin;
+	*indexp = index;
+	*nindexp = n;
+	return 0;
+}
 
-	for (n = 0; n < tuple_num; ) {
-		if (exists_in_addresses(AF_INET, &saddr, adrlist->exclude_saddr, adrlist->exclude_saddr_num) ||
-		    exists_in_addresses(AF_INET, &daddr, adrlist->exclude_daddr, adrlist->exclude_daddr_num)) {
-			tuple_num--;
-		} else {
-			newtuple[adrlist->ntuple + n].saddr.af = AF_INET;
-			newtuple[adrlist->ntuple + n].saddr.a.addr4.s_addr = saddr.s_addr;
-			newtuple[adrlist->ntuple + n].daddr.af = AF_INET;
-			newtuple[adrlist->ntuple + n].daddr.a.addr4.s_addr = daddr.s_addr;
-			newtuple[adrlist->ntuple + n].sport = sport;
-			newtuple[adrlist->ntuple + n].dport = dport;
-			newtuple[adrlist->ntuple + n].proto = proto;
-
-			l2random(&newtuple[adrlist->ntuple + n].saddr.a.addr4,
-			    sizeof(newtuple[adrlist->ntuple + n].saddr.a.addr4),
-			    &newtuple[adrlist->ntuple + n].seaddr);
-			l2random(&newtuple[adrlist->ntuple + n].daddr.a.addr4,
-			    sizeof(newtuple[adrlist->ntuple + n].daddr.a.addr4),
-			    &newtuple[adrlist->ntuple + n].deaddr);
-
-			n++;
+/*
+ * candidates excluded by both saddr and daddr are counted twice
+ * in range_count(). solve n = x (mod saddr_num), n = y (mod daddr_num)
+ * for each pair, to compensate them.
+ */
+static int
+range_exclude_both(struct address_range *range)
+{
+	uint64_t g, m, x, y, d, t;
+	unsigned int i, j;
+
+	if ((range->exclude_saddr_num == 0) || (range->exclude_daddr_num == 0))
+		return 0;
+
+	range->exclude_both = malloc(sizeof(uint64_t) *
+	    range->exclude_saddr_num * range->exclude_daddr_num);
+	if (range->exclude_both == NULL) {
+		fprintf(stderr, "Cannot allocate memory. number of exclude address is %u\n",
+		    range->exclude_saddr_num * range->exclude_daddr_num);
+		return -1;
+	}
+
+	g = gcd(range->saddr_num, range->daddr_num);
+	m = range->daddr_num / g;
+	range->exclude_lcm = range->saddr_num * m;
+
+	for (i = 0; i < range->exclude_saddr_num; i++) {
+		for (j = 0; j < range->exclude_daddr_num; j++) {
+			x = range->exclude_saddr[i];
+			y = range->exclude_daddr[j];
+			if ((x % g) != (y % g))
+				continue;	/* no solution */
+
+			if (y >= x)
+				d = ((y - x) / g) % m;
+			else
+				d = (m - ((x - y) / g) % m) % m;
+			t = mulmod(d, invmod((range->saddr_num / g) % m, m), m);
+			range->exclude_both[range->exclude_both_num++] = x + range->saddr_num * t;
 		}
+	}
+	return 0;
+}
 
-		/* increment addresses and ports */
-		if (saddr.s_addr == saddr_end.s_addr)
-			saddr.s_addr = saddr_begin.s_addr;
+static inline int
+index_exists(const uint64_t *index, unsigned int n, uint64_t idx)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (index[mid] == idx)
+			return 1;
+		if (index[mid] < idx)
+			lo = mid + 1;
 		else
-			saddr.s_addr = htonl(ntohl(saddr.s_addr) + 1);
+			hi = mid;
+	}
+	return 0;
+}
 
-		if (daddr.s_addr == daddr_end.s_addr)
-			daddr.s_addr = daddr_begin.s_addr;
-		else
-			daddr.s_addr = htonl(ntohl(daddr.s_addr) + 1);
+static inline int
+range_excluded(const struct address_range *range, const struct address_range_iter *iter)
+{
+	return index_exists(range->exclude_saddr, range->exclude_saddr_num, iter->saddr) ||
+	    index_exists(range->exclude_daddr, range->exclude_daddr_num, iter->daddr);
+}
 
-		if (sport == sport_end)
-			sport = sport_begin;
-		else
-			sport++;
+static void
+range_tuple(const struct addresslist *adrlist, const struct address_range_iter *iter,
+    struct address_tuple *tuple)
+{
+	const struct address_range *range = &adrlist->range[iter->range];
+
+	tuple->saddr = range->saddr;
+	tuple->daddr = range->daddr;
+	if (range->saddr.af == AF_INET) {
+		tuple->saddr.a.addr4.s_addr = htonl(ntohl(range->saddr.a.addr4.s_addr) + (uint32_t)iter->saddr);
+		tuple->daddr.a.addr4.s_addr = htonl(ntohl(range->daddr.a.addr4.s_addr) + (uint32_t)iter->daddr);
+		l2random(adrlist->macmode, &tuple->saddr.a.addr4, sizeof(tuple->saddr.a.addr4), &tuple->seaddr);
+		l2random(adrlist->macmode, &tuple->daddr.a.addr4, sizeof(tuple->daddr.a.addr4), &tuple->deaddr);
+	} else {
+		ipv6_add(&tuple->saddr.a.addr6, iter->saddr);
+		ipv6_add(&tuple->daddr.a.addr6, iter->daddr);
+		l2random(adrlist->macmode, &tuple->saddr.a.addr6, sizeof(tuple->saddr.a.addr6), &tuple->seaddr);
+		l2random(adrlist->macmode, &tuple->daddr.a.addr6, sizeof(tuple->daddr.a.addr6), &tuple->deaddr);
+	}
+	tuple->sport = range->sport + iter->sport;
+	tuple->dport = range->dport + iter->dport;
+	tuple->svlan = range->svlan + iter->svlan;
+	tuple->cvlan = range->cvlan + iter->cvlan;
+	tuple->proto = range->proto;
+	tuple->weight = range->weight;
+	tuple->udata = NULL;
+}
+
+/* advance iterator to the next tuple not excluded */
+static void
+range_iter_next(struct addresslist *adrlist, struct address_range_iter *iter)
+{
+	const struct address_range *range = &adrlist->range[iter->range];
+
+	do {
+		if (++iter->n >= range->ncandidate) {
+			if (++iter->range >= adrlist->nrange)
+				iter->range = 0;
+			range = &adrlist->range[iter->range];
+			iter->n = iter->saddr = iter->daddr = iter->sport = iter->dport = 0;
+			iter->svlan = iter->cvlan = 0;
+			continue;
+		}
+		if (++iter->saddr >= range->saddr_num)
+			iter->saddr = 0;
+		if (++iter->daddr >= range->daddr_num)
+			iter->daddr = 0;
+		if (++iter->sport >= range->sport_num)
+			iter->sport = 0;
+		if (++iter->dport >= range->dport_num)
+			iter->dport = 0;
+		if (++iter->svlan >= range->svlan_num)
+			iter->svlan = 0;
+		if (++iter->cvlan >= range->cvlan_num)
+			iter->cvlan = 0;
+	} while (range_excluded(range, iter));
+}
 
-		if (dport == dport_end)
-			dport = dport_begin;
+static void
+range_iter_seek(struct addresslist *adrlist, struct address_range_iter *iter, unsigned int tupleid)
+{
+	const struct address_range *range;
+	unsigned int lo, hi, mid;
+	uint64_t n_lo, n_hi, n_mid, target;
+
+	/* find the range which has tupleid */
+	lo = 0;
+	hi = adrlist->nrange - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (adrlist->range[mid].tupleid <= tupleid)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	range = &adrlist->range[lo];
+
+	/* smallest candidate index n that range_count(n + 1) reaches target */
+	target = tupleid - range->tupleid + 1;
+	n_lo = 0;
+	n_hi = range->ncandidate - 1;
+	while (n_lo < n_hi) {
+		n_mid = n_lo + (n_hi - n_lo) / 2;
+		if (range_count(range, n_mid + 1) >= target)
+			n_hi = n_mid;
 		else
-			dport++;
+			n_lo = n_mid + 1;
 	}
 
-	adrlist->ntuple += tuple_num;
+	iter->range = lo;
+	iter->n = n_lo;
+	iter->saddr = n_lo % range->saddr_num;
+	iter->daddr = n_lo % range->daddr_num;
+	iter->sport = n_lo % range->sport_num;
+	iter->dport = n_lo % range->dport_num;
+	iter->svlan = n_lo % range->svlan_num;
+	iter->cvlan = n_lo % range->cvlan_num;
+}
+
+static void
+addresslist_lazy_seek(struct addresslist *adrlist, unsigned int tupleid)
+{
+	range_iter_seek(adrlist, &adrlist->iter, tupleid);
+	range_tuple(adrlist, &adrlist->iter, &adrlist->lazytuple[adrlist->lazycur]);
+	adrlist->curtuple = tupleid;
+}
+
+static int
+addresslist_append_range(struct addresslist *adrlist, uint16_t proto,
+    const struct address *saddr, uint64_t saddr_num,
+    const struct address *daddr, uint64_t daddr_num,
+    uint16_t sport, uint32_t sport_num,
+    uint16_t dport, uint32_t dport_num,
+    uint64_t tuple_num)
+{
+	struct address_range *range;
+
+	range = realloc(adrlist->range, sizeof(struct address_range) * (adrlist->nrange + 1));
+	if (range == NULL) {
+		fprintf(stderr, "Cannot allocate memory. number of range is %u\n", adrlist->nrange + 1);
+		return -1;
+	}
+	adrlist->range = range;
+
+	range = &adrlist->range[adrlist->nrange];
+	memset(range, 0, sizeof(*range));
+	range->saddr = *saddr;
+	range->daddr = *daddr;
+	range->saddr_num = saddr_num;
+	range->daddr_num = daddr_num;
+	range->sport = sport;
+	range->dport = dport;
+	range->sport_num = sport_num;
+	range->dport_num = dport_num;
+	range->svlan = adrlist->svlan;
+	range->cvlan = adrlist->cvlan;
+	range->svlan_num = adrlist->svlan_num;
+	range->cvlan_num = adrlist->cvlan_num;
+	range->proto = proto;
+	range->weight = adrlist->weight;
+	range->ncandidate = tuple_num;
+
+	addresslist_sort_exclude(adrlist);
+	if ((range_exclude_index(saddr, saddr_num, adrlist->exclude_saddr, adrlist->exclude_saddr_num,
+	    &range->exclude_saddr, &range->exclude_saddr_num) != 0) ||
+	    (range_exclude_index(daddr, daddr_num, adrlist->exclude_daddr, adrlist->exclude_daddr_num,
+	    &range->exclude_daddr, &range->exclude_daddr_num) != 0) ||
+	    (range_exclude_both(range) != 0)) {
+		range_free(range);
+		return -1;
+	}
+
+	range->ntuple = range_count(range, range->ncandidate);
+	if (range->ntuple == 0) {
+		/* all excluded */
+		range_free(range);
+		return 0;
+	}
+	range->tupleid = adrlist->ntuple;
+
+	adrlist->nrange++;
+	adrlist->ntuple += range->ntuple;
 	adrlist->sorted = 0;
+	if (adrlist->lazy && (adrlist->nrange == 1))
+		addresslist_lazy_seek(adrlist, 0);
+
 	return 0;
 }
 
-static int
-ipv6_equal(struct in6_addr *a, struct in6_addr *b)
+int
+addresslist_setlazy(struct addresslist *adrlist, int lazy)
 {
-	if (memcmp(a, b, sizeof(struct in6_addr)) == 0)
-		return 1;
+	if (adrlist->ntuple != 0) {
+		fprintf(stderr, "cannot change lazy mode of non-empty addresslist\n");
+		return -1;
+	}
+	adrlist->lazy = lazy;
 	return 0;
 }
 
-static void
-ipv6_increment(struct in6_addr *a)
+int
+addresslist_setmacmode(struct addresslist *adrlist, int macmode)
 {
-	if (++a->s6_addr[15] == 0)
-		if (++a->s6_addr[14] == 0)
-			if (++a->s6_addr[13] == 0)
-				if (++a->s6_addr[12] == 0)
-					if (++a->s6_addr[11] == 0)
-						if (++a->s6_addr[10] == 0)
-							if (++a->s6_addr[9] == 0)
-								++a->s6_addr[8];
+	if (adrlist->ntuple != 0) {
+		fprintf(stderr, "cannot change MAC mode of non-empty addresslist\n");
+		return -1;
+	}
+	adrlist->macmode = macmode;
+	return 0;
 }
 
-static uint64_t
-ipv6_sub(struct in6_addr *a, struct in6_addr *b)
+int
+addresslist_setweight(struct addresslist *adrlist, unsigned int weight)
 {
-	uint64_t ax, bx;
+	if (weight == 0) {
+		fprintf(stderr, "weight must be greater than 0\n");
+		return -1;
+	}
+	adrlist->weight = weight;
+	return 0;
+}
 
-	if (memcmp(&a->s6_addr[0], &b->s6_addr[0], 8) != 0)
-		return UINT64_MAX;
+/*
+ * VLAN ID range of tuples appended from now on. 0-0 is untagged.
+ * S-VLAN makes QinQ, and cannot be used without (C-)VLAN.
+ */
+int
+addresslist_setvlan(struct addresslist *adrlist, uint16_t svlan_begin, uint16_t svlan_end,
+    uint16_t cvlan_begin, uint16_t cvlan_end)
+{
+	if ((svlan_begin > svlan_end) || (cvlan_begin > cvlan_end) ||
+	    (svlan_end > 4095) || (cvlan_end > 4095) ||
+	    ((svlan_begin == 0) && (svlan_end != 0)) ||
+	    ((cvlan_begin == 0) && (cvlan_end != 0)) ||
+	    ((svlan_begin != 0) && (cvlan_begin == 0))) {
+		fprintf(stderr, "illegal vlan range: %u-%u/%u-%u\n",
+		    svlan_begin, svlan_end, cvlan_begin, cvlan_end);
+		return -1;
+	}
+	adrlist->svlan = svlan_begin;
+	adrlist->cvlan = cvlan_begin;
+	adrlist->svlan_num = svlan_end - svlan_begin + 1;
+	adrlist->cvlan_num = cvlan_end - cvlan_begin + 1;
+	return 0;
+}
+
+/*
+ * expand pending ranges into tuple[].
+ * large list is divided by tupleid, and built by multiple threads.
+ */
+#define ADDRESSLIST_BUILD_MIN_PER_THREAD	(64 * 1024)
 
-	ax = a->s6_addr[8];
-	ax = (ax << 8) + a->s6_addr[9];
-	ax = (ax << 8) + a->s6_addr[10];
-	ax = (ax << 8) + a->s6_addr[11];
-	ax = (ax << 8) + a->s6_addr[12];
-	ax = (ax << 8) + a->s6_addr[13];
-	ax = (ax << 8) + a->s6_addr[14];
-	ax = (ax << 8) + a->s6_addr[15];
+struct addresslist_build_arg {
+	struct addresslist *adrlist;
+	unsigned int begin, end;	/* tupleid */
+	pthread_t thread;
+	int started;
+};
+
+static void *
+addresslist_build_thread(void *arg)
+{
+	struct addresslist_build_arg *barg = arg;
+	struct addresslist *adrlist = barg->adrlist;
+	struct address_range_iter iter;
+	struct address_tuple *tuple;
+	unsigned int n;
 
-	bx = b->s6_addr[8];
-	bx = (bx << 8) + b->s6_addr[9];
-	bx = (bx << 8) + b->s6_addr[10];
-	bx = (bx << 8) + b->s6_addr[11];
-	bx = (bx << 8) + b->s6_addr[12];
-	bx = (bx << 8) + b->s6_addr[13];
-	bx = (bx << 8) + b->s6_addr[14];
-	bx = (bx << 8) + b->s6_addr[15];
+	tuple = &adrlist->tuple[barg->begin];
+	/* clear padding, for memcmp() in addresslist_rebuild() */
+	memset(tuple, 0, sizeof(struct address_tuple) * (barg->end - barg->begin));
 
-	return ax - bx;
+	range_iter_seek(adrlist, &iter, barg->begin);
+	for (n = barg->begin; n < barg->end; n++, tuple++) {
+		range_tuple(adrlist, &iter, tuple);
+		range_iter_next(adrlist, &iter);
+	}
+	return NULL;
 }
 
 int
-addresslist_append6(struct addresslist *adrlist, uint8_t proto,
-    struct in6_addr *saddr_begin, struct in6_addr *saddr_end,
-    struct in6_addr *daddr_begin, struct in6_addr *daddr_end,
+addresslist_build(struct addresslist *adrlist, int nthreads)
+{
+	struct addresslist_build_arg *barg;
+	struct address_tuple *newtuple;
+	unsigned int i, nbuild;
+
+	if (adrlist->lazy || (adrlist->nbuilt == adrlist->ntuple))
+		return 0;
+
+	/* allocate exactly once for all pending ranges */
+	newtuple = realloc(adrlist->tuple, sizeof(struct address_tuple) * adrlist->ntuple);
+	if (newtuple == NULL) {
+		fprintf(stderr, "Cannot allocate memory. number of session is %u\n", adrlist->ntuple);
+		return -1;
+	}
+	adrlist->tuple = newtuple;
+
+	nbuild = adrlist->ntuple - adrlist->nbuilt;
+	if (nthreads > (int)(nbuild / ADDRESSLIST_BUILD_MIN_PER_THREAD))
+		nthreads = nbuild / ADDRESSLIST_BUILD_MIN_PER_THREAD;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	barg = calloc(nthreads, sizeof(struct addresslist_build_arg));
+	if (barg == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < (unsigned int)nthreads; i++) {
+		barg[i].adrlist = adrlist;
+		barg[i].begin = adrlist->nbuilt + (uint64_t)nbuild * i / nthreads;
+		barg[i].end = adrlist->nbuilt + (uint64_t)nbuild * (i + 1) / nthreads;
+	}
+
+	/* the first part is built by this thread */
+	for (i = 1; i < (unsigned int)nthreads; i++) {
+		if (pthread_create(&barg[i].thread, NULL, addresslist_build_thread, &barg[i]) == 0)
+			barg[i].started = 1;
+	}
+	addresslist_build_thread(&barg[0]);
+	for (i = 1; i < (unsigned int)nthreads; i++) {
+		if (barg[i].started)
+			pthread_join(barg[i].thread, NULL);
+		else
+			addresslist_build_thread(&barg[i]);
+	}
+	free(barg);
+
+	for (i = 0; i < adrlist->nrange; i++)
+		range_free(&adrlist->range[i]);
+	free(adrlist->range);
+	adrlist->range = NULL;
+	adrlist->nrange = 0;
+	adrlist->nbuilt = adrlist->ntuple;
+
+	return 0;
+}
+
+static inline void
+addresslist_build_pending(struct addresslist *adrlist)
+{
+	if (!adrlist->lazy && (adrlist->nbuilt != adrlist->ntuple))
+		addresslist_build(adrlist, 1);
+}
+
+int
+addresslist_append(struct addresslist *adrlist, uint8_t proto,
+    struct in_addr saddr_begin, struct in_addr saddr_end,
+    struct in_addr daddr_begin, struct in_addr daddr_end,
     uint16_t sport_begin, uint16_t sport_end,
     uint16_t dport_begin, uint16_t dport_end)
 {
-	struct address_tuple *newtuple;
-	struct in6_addr saddr, daddr;
-	uint16_t sport, dport;
+	struct address s, d;
 	uint64_t saddr_num, daddr_num, sport_num, dport_num;
 	uint64_t addr_num, port_num;
-	uint64_t tuple_num, n;
+	uint64_t tuple_num;
 
-	saddr_num = ipv6_sub(saddr_end, saddr_begin) + 1;
-	daddr_num = ipv6_sub(daddr_end, daddr_begin) + 1;
+	saddr_num = (uint64_t)ntohl(saddr_end.s_addr) - ntohl(saddr_begin.s_addr) + 1;
+	daddr_num = (uint64_t)ntohl(daddr_end.s_addr) - ntohl(daddr_begin.s_addr) + 1;
 	sport_num = sport_end - sport_begin+ 1;
 	dport_num = dport_end - dport_begin+ 1;
 
-	if (saddr_num == 0) {
+	addr_num = lcm(saddr_num, daddr_num);
+	port_num = lcm(sport_num, dport_num);
+	tuple_num = lcm(addr_num, port_num);
+	tuple_num = lcm(tuple_num, lcm(adrlist->svlan_num, adrlist->cvlan_num));
+
+	if ((tuple_num == 0) || (adrlist->tuple_limit < (adrlist->ntuple + tuple_num))) {
+		fprintf(stderr, "too large flowlist: %lu: %s-%s:%d-%d - %s-%s:%d-%d\n",
+		    adrlist->ntuple + tuple_num,
+		    ip4_sprintf(&saddr_begin), ip4_sprintf(&saddr_end),
+		    sport_begin, sport_end,
+		    ip4_sprintf(&daddr_begin), ip4_sprintf(&daddr_end),
+		    dport_begin, dport_end);
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(s));
+	memset(&d, 0, sizeof(d));
+	s.af = d.af = AF_INET;
+	s.a.addr4 = saddr_begin;
+	d.a.addr4 = daddr_begin;
+	return addresslist_append_range(adrlist, proto,
+	    &s, saddr_num, &d, daddr_num,
+	    sport_begin, sport_num, dport_begin, dport_num, tuple_num);
+}
+
+int
+addresslist_append6(struct addresslist *adrlist, uint8_t proto,
+    struct in6_addr *saddr_begin, struct in6_addr *saddr_end,
+    struct in6_addr *daddr_begin, struct in6_addr *daddr_end,
+    uint16_t sport_begin, uint16_t sport_end,
+    uint16_t dport_begin, uint16_t dport_end)
+{
+	struct address s, d;
+	uint64_t saddr_num, daddr_num, sport_num, dport_num;
+	uint64_t addr_num, port_num;
+	uint64_t tuple_num;
+
+	if ((ipv6_sub(saddr_end, saddr_begin, &saddr_num) != 0) || (++saddr_num == 0)) {
 		 fprintf(stderr, "address range too large: %s - %s\n", ip6_sprintf(saddr_begin), ip6_sprintf(saddr_end));
 		 return -1;
 	}
-	if (daddr_num == 0) {
+	if ((ipv6_sub(daddr_end, daddr_begin, &daddr_num) != 0) || (++daddr_num == 0)) {
 		 fprintf(stderr, "address range too large: %s - %s\n", ip6_sprintf(daddr_begin), ip6_sprintf(daddr_end));
 		 return -1;
 	}
+	sport_num = sport_end - sport_begin+ 1;
+	dport_num = dport_end - dport_begin+ 1;
 
 	addr_num = lcm(saddr_num, daddr_num);
 	port_num = lcm(sport_num, dport_num);
 	tuple_num = lcm(addr_num, port_num);
+	tuple_num = lcm(tuple_num, lcm(adrlist->svlan_num, adrlist->cvlan_num));
 
-	if (adrlist->tuple_limit < (adrlist->ntuple + tuple_num)) {
+	if ((tuple_num == 0) || (adrlist->tuple_limit < (adrlist->ntuple + tuple_num))) {
 		fprintf(stderr, "too large flowlist: %lu: [%s-%s]:%d-%d - [%s-%s]:%d-%d\n",
 		    adrlist->ntuple + tuple_num,
 		    ip6_sprintf(saddr_begin), ip6_sprintf(saddr_end),
@@ -427,88 +986,53 @@ addresslist_append6(struct addresslist *adrlist, uint8_t proto,
 		return -1;
 	}
 
-	if (adrlist->tuple == NULL) {
-		newtuple = malloc(sizeof(struct address_tuple) * tuple_num);
-		memset(newtuple, 0, sizeof(struct address_tuple) * tuple_num);
-	} else {
-		newtuple = realloc(adrlist->tuple, sizeof(struct address_tuple) * (adrlist->ntuple + tuple_num));
-		memset(newtuple + adrlist->ntuple, 0, sizeof(struct address_tuple) * tuple_num);
-	}
-
-	if (newtuple == NULL) {
-		fprintf(stderr, "Cannot allocate memory. number of session is %lu\n", adrlist->ntuple + tuple_num);
-		return -1;
-	}
-
-	adrlist->tuple = newtuple;
-
-	saddr = *saddr_begin;
-	daddr = *daddr_begin;
-	sport = sport_begin;
-	dport = dport_begin;
-
-	for (n = 0; n < tuple_num; ) {
-		if (exists_in_addresses(AF_INET, &saddr, adrlist->exclude_saddr, adrlist->exclude_saddr_num) ||
-		    exists_in_addresses(AF_INET, &daddr, adrlist->exclude_daddr, adrlist->exclude_daddr_num)) {
-			tuple_num--;
-		} else {
-			newtuple[adrlist->ntuple + n].saddr.af = AF_INET6;
-			newtuple[adrlist->ntuple + n].saddr.a.addr6 = saddr;
-			newtuple[adrlist->ntuple + n].daddr.af = AF_INET6;
-			newtuple[adrlist->ntuple + n].daddr.a.addr6 = daddr;
-			newtuple[adrlist->ntuple + n].sport = sport;
-			newtuple[adrlist->ntuple + n].dport = dport;
-			newtuple[adrlist->ntuple + n].proto = proto;
-
-			l2random(&newtuple[adrlist->ntuple + n].saddr.a.addr6,
-			    sizeof(newtuple[adrlist->ntuple + n].saddr.a.addr6),
-			    &newtuple[adrlist->ntuple + n].seaddr);
-			l2random(&newtuple[adrlist->ntuple + n].daddr.a.addr6,
-			    sizeof(newtuple[adrlist->ntuple + n].daddr.a.addr6),
-			    &newtuple[adrlist->ntuple + n].deaddr);
-
-			n++;
-		}
-
-		/* increment addresses and ports */
-		if (ipv6_equal(&saddr, saddr_end))
-			saddr = *saddr_begin;
-		else
-			ipv6_increment(&saddr);
-
-		if (ipv6_equal(&daddr, daddr_end))
-			daddr = *daddr_begin;
-		else
-			ipv6_increment(&daddr);
-
-		if (sport == sport_end)
-			sport = sport_begin;
-		else
-			sport++;
-
-		if (dport == dport_end)
-			dport = dport_begin;
-		else
-			dport++;
-	}
-
-	adrlist->ntuple += tuple_num;
-	adrlist->sorted = 0;
-	return 0;
+	memset(&s, 0, sizeof(s));
+	memset(&d, 0, sizeof(d));
+	s.af = d.af = AF_INET6;
+	s.a.addr6 = *saddr_begin;
+	d.a.addr6 = *daddr_begin;
+	return addresslist_append_range(adrlist, proto,
+	    &s, saddr_num, &d, daddr_num,
+	    sport_begin, sport_num, dport_begin, dport_num, tuple_num);
 }
 
 
+/* compare flow of tuples, ignoring MAC address and weight */
 static int
-address_tuple_cmp(const void *a, const void *b)
+address_tuple_flowcmp(const void *a, const void *b)
 {
-	return memcmp(a, b, sizeof(struct address_tuple));
+	const struct address_tuple *x = a, *y = b;
+	int rc;
+
+	if ((rc = address_cmp(&x->saddr, &y->saddr)) != 0)
+		return rc;
+	if ((rc = address_cmp(&x->daddr, &y->daddr)) != 0)
+		return rc;
+	if (x->sport != y->sport)
+		return (x->sport < y->sport) ? -1 : 1;
+	if (x->dport != y->dport)
+		return (x->dport < y->dport) ? -1 : 1;
+	if (x->proto != y->proto)
+		return (x->proto < y->proto) ? -1 : 1;
+	if (x->svlan != y->svlan)
+		return (x->svlan < y->svlan) ? -1 : 1;
+	if (x->cvlan != y->cvlan)
+		return (x->cvlan < y->cvlan) ? -1 : 1;
+	return 0;
 }
 
 int
 addresslist_rebuild(struct addresslist *adrlist)
 {
+	if (adrlist->lazy) {
+		fprintf(stderr, "lazy addresslist cannot be sorted\n");
+		return -1;
+	}
+	if (addresslist_build(adrlist, 1) != 0)
+		return -1;
+
 	qsort(adrlist->tuple, adrlist->ntuple, sizeof(struct address_tuple),
-	    address_tuple_cmp);
+	    address_tuple_flowcmp);
 	adrlist->sorted = 1;
 	return 0;
 }
@@ -523,8 +1047,8 @@ addresslist_tuple2id(struct addresslist *adrlist, struct address_tuple *tuple)
 		return -1;
 	}
 
-	found = bsearch(&tuple, adrlist->tuple, adrlist->ntuple, sizeof(struct address_tuple),
-	    address_tuple_cmp);
+	found = bsearch(tuple, adrlist->tuple, adrlist->ntuple, sizeof(struct address_tuple),
+	    address_tuple_flowcmp);
 
 	if (found != NULL)
 		return (found - adrlist->tuple);
@@ -532,6 +1056,177 @@ addresslist_tuple2id(struct addresslist *adrlist, struct address_tuple *tuple)
 	return -1;
 }
 
+/*
+ * copy addresslist for modification off the data path.
+ * settings, exclude lists and flows are copied, but not the current position.
+ */
+struct addresslist *
+addresslist_dup(struct addresslist *src)
+{
+	struct addresslist *dst;
+	struct address_range *range;
+	unsigned int i;
+
+	addresslist_build_pending(src);
+
+	dst = addresslist_new();
+	if (dst == NULL)
+		goto nomem;
+	dst->tuple_limit = src->tuple_limit;
+	dst->macmode = src->macmode;
+	dst->weight = src->weight;
+	dst->svlan = src->svlan;
+	dst->cvlan = src->cvlan;
+	dst->svlan_num = src->svlan_num;
+	dst->cvlan_num = src->cvlan_num;
+	dst->lazy = src->lazy;
+	dst->sorted = src->sorted;
+
+	if (src->exclude_saddr_num != 0) {
+		dst->exclude_saddr = malloc(sizeof(struct address) * src->exclude_saddr_num);
+		if (dst->exclude_saddr == NULL)
+			goto nomem;
+		memcpy(dst->exclude_saddr, src->exclude_saddr, sizeof(struct address) * src->exclude_saddr_num);
+		dst->exclude_saddr_num = src->exclude_saddr_num;
+	}
+	if (src->exclude_daddr_num != 0) {
+		dst->exclude_daddr = malloc(sizeof(struct address) * src->exclude_daddr_num);
+		if (dst->exclude_daddr == NULL)
+			goto nomem;
+		memcpy(dst->exclude_daddr, src->exclude_daddr, sizeof(struct address) * src->exclude_daddr_num);
+		dst->exclude_daddr_num = src->exclude_daddr_num;
+	}
+	dst->exclude_sorted = src->exclude_sorted;
+
+	if (src->ntuple != 0 && !src->lazy) {
+		dst->tuple = malloc(sizeof(struct address_tuple) * src->ntuple);
+		if (dst->tuple == NULL)
+			goto nomem;
+		memcpy(dst->tuple, src->tuple, sizeof(struct address_tuple) * src->ntuple);
+		dst->nbuilt = src->ntuple;
+	}
+
+	if (src->nrange != 0) {
+		dst->range = calloc(src->nrange, sizeof(struct address_range));
+		if (dst->range == NULL)
+			goto nomem;
+		for (i = 0; i < src->nrange; i++) {
+			range = &dst->range[i];
+			*range = src->range[i];
+			range->exclude_saddr = NULL;
+			range->exclude_daddr = NULL;
+			range->exclude_both = NULL;
+			dst->nrange = i + 1;
+			if (((range->exclude_saddr = malloc(sizeof(uint64_t) * (range->exclude_saddr_num + 1))) == NULL) ||
+			    ((range->exclude_daddr = malloc(sizeof(uint64_t) * (range->exclude_daddr_num + 1))) == NULL) ||
+			    ((range->exclude_both = malloc(sizeof(uint64_t) * (range->exclude_both_num + 1))) == NULL))
+				goto nomem;
+			memcpy(range->exclude_saddr, src->range[i].exclude_saddr, sizeof(uint64_t) * range->exclude_saddr_num);
+			memcpy(range->exclude_daddr, src->range[i].exclude_daddr, sizeof(uint64_t) * range->exclude_daddr_num);
+			memcpy(range->exclude_both, src->range[i].exclude_both, sizeof(uint64_t) * range->exclude_both_num);
+		}
+	}
+	dst->ntuple = src->ntuple;
+	if (dst->lazy && (dst->nrange != 0))
+		addresslist_lazy_seek(dst, 0);
+
+	return dst;
+
+ nomem:
+	fprintf(stderr, "Cannot allocate memory. number of session is %u\n", src->ntuple);
+	if (dst != NULL)
+		addresslist_delete(dst);
+	return NULL;
+}
+
+static int
+range_equal(const struct address_range *x, const struct address_range *y)
+{
+	return (address_cmp(&x->saddr, &y->saddr) == 0) &&
+	    (address_cmp(&x->daddr, &y->daddr) == 0) &&
+	    (x->saddr_num == y->saddr_num) && (x->daddr_num == y->daddr_num) &&
+	    (x->sport == y->sport) && (x->sport_num == y->sport_num) &&
+	    (x->dport == y->dport) && (x->dport_num == y->dport_num) &&
+	    (x->svlan == y->svlan) && (x->svlan_num == y->svlan_num) &&
+	    (x->cvlan == y->cvlan) && (x->cvlan_num == y->cvlan_num) &&
+	    (x->proto == y->proto);
+}
+
+/*
+ * remove flows which are in pattern from adrlist.
+ * lazy addresslist removes only ranges which are appended as same as pattern.
+ * return number of removed flows.
+ */
+int
+addresslist_remove(struct addresslist *adrlist, struct addresslist *pattern)
+{
+	struct address_tuple *key;
+	unsigned int i, j, k, n, nremove;
+
+	if (adrlist->lazy != pattern->lazy) {
+		fprintf(stderr, "cannot remove flows between lazy and non-lazy addresslist\n");
+		return -1;
+	}
+
+	if (adrlist->lazy) {
+		nremove = 0;
+		for (i = j = 0; i < adrlist->nrange; i++) {
+			for (k = 0; k < pattern->nrange; k++) {
+				if (range_equal(&adrlist->range[i], &pattern->range[k]))
+					break;
+			}
+			if (k < pattern->nrange) {
+				nremove += adrlist->range[i].ntuple;
+				range_free(&adrlist->range[i]);
+				continue;
+			}
+			adrlist->range[j++] = adrlist->range[i];
+		}
+		adrlist->nrange = j;
+		adrlist->ntuple = 0;
+		for (i = 0; i < adrlist->nrange; i++) {
+			adrlist->range[i].tupleid = adrlist->ntuple;
+			adrlist->ntuple += adrlist->range[i].ntuple;
+		}
+		if (adrlist->nrange != 0)
+			addresslist_lazy_seek(adrlist, 0);
+		else
+			adrlist->curtuple = 0;
+		return nremove;
+	}
+
+	if ((addresslist_build(adrlist, 1) != 0) ||
+	    (addresslist_build(pattern, 1) != 0))
+		return -1;
+	if (pattern->ntuple == 0)
+		return 0;
+
+	n = pattern->ntuple;
+	key = malloc(sizeof(struct address_tuple) * n);
+	if (key == NULL) {
+		fprintf(stderr, "Cannot allocate memory. number of session is %u\n", n);
+		return -1;
+	}
+	memcpy(key, pattern->tuple, sizeof(struct address_tuple) * n);
+	qsort(key, n, sizeof(struct address_tuple), address_tuple_flowcmp);
+
+	for (i = j = 0; i < adrlist->ntuple; i++) {
+		if (bsearch(&adrlist->tuple[i], key, n, sizeof(struct address_tuple),
+		    address_tuple_flowcmp) != NULL)
+			continue;
+		if (i != j)
+			adrlist->tuple[j] = adrlist->tuple[i];
+		j++;
+	}
+	free(key);
+
+	nremove = adrlist->ntuple - j;
+	adrlist->ntuple = adrlist->nbuilt = j;
+	if (adrlist->curtuple >= adrlist->ntuple)
+		adrlist->curtuple = 0;
+	return nremove;
+}
+
 void
 addresslist_setlimit(struct addresslist *adrlist, unsigned int limit)
 {
@@ -556,12 +1251,23 @@ addresslist_set_current_tupleid(struct addresslist *adrlist, unsigned int tuplei
 	if (tupleid >= adrlist->ntuple)
 		tupleid = adrlist->ntuple - 1;
 
+	if (adrlist->lazy) {
+		if (adrlist->ntuple != 0)
+			addresslist_lazy_seek(adrlist, tupleid);
+		return;
+	}
+
+	addresslist_build_pending(adrlist);
 	adrlist->curtuple = tupleid;
 }
 
 const struct address_tuple *
 addresslist_get_current_tuple(struct addresslist *adrlist)
 {
+	if (adrlist->lazy)
+		return &adrlist->lazytuple[adrlist->lazycur];
+
+	addresslist_build_pending(adrlist);
 	return &adrlist->tuple[adrlist->curtuple];
 }
 
@@ -570,6 +1276,19 @@ addresslist_get_tuple_next(struct addresslist *adrlist)
 {
 	const struct address_tuple *tuple;
 
+	if (adrlist->lazy) {
+		/* keep returned tuple valid until the next call */
+		tuple = &adrlist->lazytuple[adrlist->lazycur];
+		adrlist->lazycur ^= 1;
+		range_iter_next(adrlist, &adrlist->iter);
+		range_tuple(adrlist, &adrlist->iter, &adrlist->lazytuple[adrlist->lazycur]);
+
+		if (++adrlist->curtuple >= adrlist->ntuple)
+			adrlist->curtuple = 0;
+		return tuple;
+	}
+
+	addresslist_build_pending(adrlist);
 	tuple = &adrlist->tuple[adrlist->curtuple];
 
 	if (++adrlist->curtuple >= adrlist->ntuple)
@@ -584,6 +1303,11 @@ addresslist_include_af(struct addresslist *adrlist, int af)
 	struct address_tuple *tuple;
 	unsigned int n;
 
+	for (n = 0; n < adrlist->nrange; n++) {
+		if (adrlist->range[n].saddr.af == af)
+			return 1;
+	}
+
 	tuple = adrlist->tuple;
 	if (tuple != NULL) {
 		for (n = 0; n < adrlist->ntuple; n++) {
@@ -594,62 +1318,124 @@ addresslist_include_af(struct addresslist *adrlist, int af)
 	return 0;
 }
 
-void
-addresslist_dump(struct addresslist *adrlist)
+/* check if any flow has per flow VLAN */
+int
+addresslist_include_vlan(struct addresslist *adrlist)
 {
 	struct address_tuple *tuple;
 	unsigned int n;
-	char buf1[128], buf2[128];
-	char ebuf1[sizeof("00:00:00:00:00:00")], ebuf2[sizeof("00:00:00:00:00:00")];
-	const char *bracket_l, *bracket_r;
 
-	printf("<addresslist p=%p sorted=%d ntuple=%u curtuple=%u>\n",
-	    adrlist, adrlist->sorted,
-	    adrlist->ntuple, adrlist->curtuple);
+	for (n = 0; n < adrlist->nrange; n++) {
+		if ((adrlist->range[n].svlan != 0) || (adrlist->range[n].cvlan != 0))
+			return 1;
+	}
 
 	tuple = adrlist->tuple;
 	if (tuple != NULL) {
-		printf("  <tuple>\n");
 		for (n = 0; n < adrlist->ntuple; n++) {
-			switch (tuple[n].saddr.af) {
-			case AF_INET:
-				inet_ntop(AF_INET, &tuple[n].saddr.a.addr4, buf1, sizeof(buf1));
-				break;
-			case AF_INET6:
-				inet_ntop(AF_INET6, &tuple[n].saddr.a.addr6, buf1, sizeof(buf1));
-				break;
-			default:
-				sprintf(buf1, "??? (family=%d)", tuple[n].saddr.af);
-				break;
-			}
+			if ((tuple[n].svlan != 0) || (tuple[n].cvlan != 0))
+				return 1;
+		}
+	}
+	return 0;
+}
 
-			switch (tuple[n].daddr.af) {
-			case AF_INET:
-				inet_ntop(AF_INET, &tuple[n].daddr.a.addr4, buf2, sizeof(buf2));
-				bracket_l = bracket_r = "";
-				break;
-			case AF_INET6:
-				inet_ntop(AF_INET6, &tuple[n].daddr.a.addr6, buf2, sizeof(buf2));
-				bracket_l = "[";
-				bracket_r = "]";
-				break;
-			default:
-				sprintf(buf1, "??? (family=%d)", tuple[n].daddr.af);
-				break;
-			}
+static void
+addresslist_dump_tuple(unsigned int n, const struct address_tuple *tuple)
+{
+	char buf1[128], buf2[128];
+	char ebuf1[sizeof("00:00:00:00:00:00")], ebuf2[sizeof("00:00:00:00:00:00")];
+	const char *bracket_l, *bracket_r;
+
+	switch (tuple->saddr.af) {
+	case AF_INET:
+		inet_ntop(AF_INET, &tuple->saddr.a.addr4, buf1, sizeof(buf1));
+		break;
+	case AF_INET6:
+		inet_ntop(AF_INET6, &tuple->saddr.a.addr6, buf1, sizeof(buf1));
+		break;
+	default:
+		sprintf(buf1, "??? (family=%d)", tuple->saddr.af);
+		break;
+	}
+
+	bracket_l = bracket_r = "";
+	switch (tuple->daddr.af) {
+	case AF_INET:
+		inet_ntop(AF_INET, &tuple->daddr.a.addr4, buf2, sizeof(buf2));
+		break;
+	case AF_INET6:
+		inet_ntop(AF_INET6, &tuple->daddr.a.addr6, buf2, sizeof(buf2));
+		bracket_l = "[";
+		bracket_r = "]";
+		break;
+	default:
+		sprintf(buf2, "??? (family=%d)", tuple->daddr.af);
+		break;
+	}
+
+	ether_ntoa_r(&tuple->seaddr, ebuf1);
+	ether_ntoa_r(&tuple->deaddr, ebuf2);
+
+	printf("    %d: %d %s%s%s:%d - %s%s%s:%d    (%s - %s)",
+	    n, tuple->proto,
+	    bracket_l, buf1, bracket_r,
+	    tuple->sport,
+	    bracket_l, buf2, bracket_r,
+	    tuple->dport,
+	    ebuf1, ebuf2);
+	if (tuple->weight != 1)
+		printf(" weight=%u", tuple->weight);
+	if (tuple->svlan != 0)
+		printf(" svlan=%u", tuple->svlan);
+	if (tuple->cvlan != 0)
+		printf(" vlan=%u", tuple->cvlan);
+}
+
+void
+addresslist_dump(struct addresslist *adrlist)
+{
+	struct address_tuple *tuple, lazytuple;
+	struct address_range *range;
+	struct address_range_iter iter;
+	unsigned int n;
 
-			ether_ntoa_r(&tuple[n].seaddr, ebuf1);
-			ether_ntoa_r(&tuple[n].deaddr, ebuf2);
+	addresslist_build_pending(adrlist);
 
+	printf("<addresslist p=%p sorted=%d lazy=%d ntuple=%u curtuple=%u>\n",
+	    adrlist, adrlist->sorted, adrlist->lazy,
+	    adrlist->ntuple, adrlist->curtuple);
+
+	if (adrlist->nrange != 0) {
+		printf("  <range>\n");
+		for (n = 0; n < adrlist->nrange; n++) {
+			range = &adrlist->range[n];
+			printf("    %d: tupleid=%u ntuple=%u candidate=%lu saddr_num=%lu daddr_num=%lu sport_num=%u dport_num=%u vlan_num=%u/%u exclude=%u/%u/%u\n",
+			    n, range->tupleid, range->ntuple, range->ncandidate,
+			    range->saddr_num, range->daddr_num,
+			    range->sport_num, range->dport_num,
+			    range->svlan_num, range->cvlan_num,
+			    range->exclude_saddr_num, range->exclude_daddr_num,
+			    range->exclude_both_num);
+		}
+		printf("  </range>\n");
 
-			printf("    %d: %d %s%s%s:%d - %s%s%s:%d    (%s - %s)",
-			    n, tuple[n].proto,
-			    bracket_l, buf1, bracket_r,
-			    tuple[n].sport,
-			    bracket_l, buf2, bracket_r,
-			    tuple[n].dport,
-			    ebuf1, ebuf2);
+		printf("  <tuple>\n");
+		range_iter_seek(adrlist, &iter, 0);
+		for (n = 0; n < adrlist->ntuple; n++) {
+			range_tuple(adrlist, &iter, &lazytuple);
+			addresslist_dump_tuple(n, &lazytuple);
+			printf("\n");
+			range_iter_next(adrlist, &iter);
+		}
+		printf("  </tuple>\n");
+	}
 
+	tuple = adrlist->tuple;
+	if (tuple != NULL) {
+		printf("  <tuple>\n");
+		for (n = 0; n < adrlist->ntuple; n++) {
+			addresslist_dump_tuple(n, &tuple[n]);
 			if (adrlist->sorted) {
 				printf("   => id=%d",
 				    addresslist_tuple2id(adrlist, &tuple[n]));
@@ -661,3 +1447,519 @@ addresslist_dump(struct addresslist *adrlist)
 
 	printf("</addresslist>\n");
 }
+
+void
+addresslist_flowtable_delete(struct flowtable *ft)
+{
+	free(ft->family);
+	free(ft->stateid);
+	if (ft->map != NULL) {
+		/* other arrays point into the mapped file */
+		munmap(ft->map, ft->maplen);
+		free(ft);
+		return;
+	}
+	free(ft->saddr4);
+	free(ft->daddr4);
+	free(ft->saddr6);
+	free(ft->daddr6);
+	free(ft->sport);
+	free(ft->dport);
+	free(ft->seaddr);
+	free(ft->deaddr);
+	free(ft->weight);
+	free(ft->l2tag);
+	free(ft);
+}
+
+static inline unsigned int
+tuple_nl2tag(const struct address_tuple *tuple)
+{
+	return (tuple->svlan != 0) + (tuple->cvlan != 0);
+}
+
+/* 802.1Q tag, or 802.1ad and 802.1Q tags as on the wire */
+static void
+tuple_l2tag(const struct address_tuple *tuple, uint32_t *tag)
+{
+	if (tuple->svlan != 0)
+		*tag++ = htonl(((uint32_t)0x88a8 << 16) | tuple->svlan);
+	if (tuple->cvlan != 0)
+		*tag = htonl(((uint32_t)ETHERTYPE_VLAN << 16) | tuple->cvlan);
+}
+
+/*
+ * build compact flow table from the addresslist.
+ * lazy addresslist has no table, and returns NULL.
+ */
+struct flowtable *
+addresslist_flowtable_new(struct addresslist *adrlist, int withmac)
+{
+	struct flowtable *ft;
+	const struct address_tuple *tuple;
+	unsigned int i, n, nl2tag;
+	int has4, has6, weighted;
+
+	if (adrlist->lazy)
+		return NULL;
+	if (addresslist_build(adrlist, 1) != 0)
+		return NULL;
+
+	n = adrlist->ntuple;
+	has4 = has6 = weighted = 0;
+	nl2tag = (n != 0) ? tuple_nl2tag(&adrlist->tuple[0]) : 0;
+	for (i = 0; i < n; i++) {
+		if (adrlist->tuple[i].saddr.af == AF_INET)
+			has4 = 1;
+		else
+			has6 = 1;
+		if (adrlist->tuple[i].weight != 1)
+			weighted = 1;
+		if (tuple_nl2tag(&adrlist->tuple[i]) != nl2tag) {
+			/* l3 offset must not vary by flow */
+			fprintf(stderr, "untagged, VLAN and QinQ flows cannot be mixed\n");
+			return NULL;
+		}
+	}
+
+	ft = calloc(1, sizeof(struct flowtable));
+	if (ft == NULL)
+		goto nomem;
+	ft->nflow = n;
+	ft->af = (has4 && has6) ? AF_UNSPEC : (has6 ? AF_INET6 : AF_INET);
+
+	if ((ft->sport = malloc(sizeof(uint16_t) * n)) == NULL ||
+	    (ft->dport = malloc(sizeof(uint16_t) * n)) == NULL)
+		goto nomem;
+	if (ft->af == AF_UNSPEC) {
+		if ((ft->family = malloc(sizeof(uint8_t) * n)) == NULL)
+			goto nomem;
+	}
+	if (has4) {
+		if ((ft->saddr4 = malloc(sizeof(uint32_t) * n)) == NULL ||
+		    (ft->daddr4 = malloc(sizeof(uint32_t) * n)) == NULL)
+			goto nomem;
+	}
+	if (has6) {
+		if ((ft->saddr6 = malloc(sizeof(struct in6_addr) * n)) == NULL ||
+		    (ft->daddr6 = malloc(sizeof(struct in6_addr) * n)) == NULL)
+			goto nomem;
+	}
+	if (withmac) {
+		if ((ft->seaddr = malloc(sizeof(struct ether_addr) * n)) == NULL ||
+		    (ft->deaddr = malloc(sizeof(struct ether_addr) * n)) == NULL)
+			goto nomem;
+	}
+	if (weighted) {
+		if ((ft->weight = malloc(sizeof(uint32_t) * n)) == NULL)
+			goto nomem;
+	}
+	if (nl2tag != 0) {
+		if ((ft->l2tag = malloc(sizeof(uint32_t) * nl2tag * n)) == NULL)
+			goto nomem;
+		ft->nl2tag = nl2tag;
+	}
+
+	for (i = 0; i < n; i++) {
+		tuple = &adrlist->tuple[i];
+		if (ft->family != NULL)
+			ft->family[i] = tuple->saddr.af;
+		if (tuple->saddr.af == AF_INET) {
+			ft->saddr4[i] = tuple->saddr.a.addr4.s_addr;
+			ft->daddr4[i] = tuple->daddr.a.addr4.s_addr;
+		} else {
+			ft->saddr6[i] = tuple->saddr.a.addr6;
+			ft->daddr6[i] = tuple->daddr.a.addr6;
+		}
+		ft->sport[i] = tuple->sport;
+		ft->dport[i] = tuple->dport;
+		if (withmac) {
+			ft->seaddr[i] = tuple->seaddr;
+			ft->deaddr[i] = tuple->deaddr;
+		}
+		if (weighted)
+			ft->weight[i] = tuple->weight;
+		if (nl2tag != 0)
+			tuple_l2tag(tuple, &ft->l2tag[i * nl2tag]);
+	}
+
+	return ft;
+
+ nomem:
+	fprintf(stderr, "Cannot allocate memory. number of flow is %u\n", n);
+	if (ft != NULL)
+		addresslist_flowtable_delete(ft);
+	return NULL;
+}
+
+/*
+ * binary flowlist file.
+ *
+ * the file holds struct flowtable of TX side as is, so that it can be
+ * mmap'ed and used without parsing. each array starts at 64 byte
+ * boundary. numbers are in host byte order of the writer, and the file
+ * cannot be used on a host of other byte order.
+ * address family is stored as 4 or 6 since AF_INET6 differs between OSes.
+ */
+#define FLOWFILE_MAGIC		"IPGFLOW"
+#define FLOWFILE_VERSION	2
+#define FLOWFILE_BYTEORDER	0x01020304
+#define FLOWFILE_ALIGN		64
+
+#define FLOWFILE_FAMILY		0
+#define FLOWFILE_SADDR4		1
+#define FLOWFILE_DADDR4		2
+#define FLOWFILE_SADDR6		3
+#define FLOWFILE_DADDR6		4
+#define FLOWFILE_SPORT		5
+#define FLOWFILE_DPORT		6
+#define FLOWFILE_SEADDR		7
+#define FLOWFILE_DEADDR		8
+#define FLOWFILE_WEIGHT		9
+#define FLOWFILE_L2TAG		10
+#define FLOWFILE_NSECTION	11
+
+struct flowfile_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t nflow;
+	uint32_t af;			/* 4, 6, or 0 if mixed */
+	uint32_t macmode;		/* ADDRESSLIST_MAC_* of seaddr/deaddr */
+	uint32_t nl2tag;		/* number of VLAN tags per flow */
+	uint64_t filesize;
+	uint64_t offset[FLOWFILE_NSECTION];	/* 0 if not present */
+	uint64_t size[FLOWFILE_NSECTION];
+};
+
+static int
+af2flowfile(int af)
+{
+	switch (af) {
+	case AF_INET:
+		return 4;
+	case AF_INET6:
+		return 6;
+	}
+	return 0;
+}
+
+static int
+flowfile2af(int v)
+{
+	switch (v) {
+	case 4:
+		return AF_INET;
+	case 6:
+		return AF_INET6;
+	}
+	return AF_UNSPEC;
+}
+
+/*
+ * compile the addresslist into a binary flowlist file.
+ * MAC addresses are always included.
+ */
+int
+addresslist_flowtable_save(struct addresslist *adrlist, const char *path)
+{
+	static const char zero[FLOWFILE_ALIGN];
+	struct flowfile_header hdr;
+	struct flowtable *ft;
+	const void *data[FLOWFILE_NSECTION];
+	uint8_t *family;
+	uint64_t off;
+	unsigned int i;
+	FILE *fp;
+	int rc;
+
+	ft = addresslist_flowtable_new(adrlist, 1);
+	if (ft == NULL)
+		return -1;
+
+	family = NULL;
+	if (ft->family != NULL) {
+		family = malloc(ft->nflow);
+		if (family == NULL) {
+			fprintf(stderr, "Cannot allocate memory. number of flow is %u\n", ft->nflow);
+			addresslist_flowtable_delete(ft);
+			return -1;
+		}
+		for (i = 0; i < ft->nflow; i++)
+			family[i] = af2flowfile(ft->family[i]);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FLOWFILE_MAGIC, sizeof(FLOWFILE_MAGIC));
+	hdr.version = FLOWFILE_VERSION;
+	hdr.byteorder = FLOWFILE_BYTEORDER;
+	hdr.nflow = ft->nflow;
+	hdr.af = af2flowfile(ft->af);
+	hdr.macmode = adrlist->macmode;
+	hdr.nl2tag = ft->nl2tag;
+
+	data[FLOWFILE_FAMILY] = family;
+	data[FLOWFILE_SADDR4] = ft->saddr4;
+	data[FLOWFILE_DADDR4] = ft->daddr4;
+	data[FLOWFILE_SADDR6] = ft->saddr6;
+	data[FLOWFILE_DADDR6] = ft->daddr6;
+	data[FLOWFILE_SPORT] = ft->sport;
+	data[FLOWFILE_DPORT] = ft->dport;
+	data[FLOWFILE_SEADDR] = ft->seaddr;
+	data[FLOWFILE_DEADDR] = ft->deaddr;
+	data[FLOWFILE_WEIGHT] = ft->weight;
+	data[FLOWFILE_L2TAG] = ft->l2tag;
+	hdr.size[FLOWFILE_FAMILY] = sizeof(uint8_t);
+	hdr.size[FLOWFILE_SADDR4] = sizeof(uint32_t);
+	hdr.size[FLOWFILE_DADDR4] = sizeof(uint32_t);
+	hdr.size[FLOWFILE_SADDR6] = sizeof(struct in6_addr);
+	hdr.size[FLOWFILE_DADDR6] = sizeof(struct in6_addr);
+	hdr.size[FLOWFILE_SPORT] = sizeof(uint16_t);
+	hdr.size[FLOWFILE_DPORT] = sizeof(uint16_t);
+	hdr.size[FLOWFILE_SEADDR] = sizeof(struct ether_addr);
+	hdr.size[FLOWFILE_DEADDR] = sizeof(struct ether_addr);
+	hdr.size[FLOWFILE_WEIGHT] = sizeof(uint32_t);
+	hdr.size[FLOWFILE_L2TAG] = sizeof(uint32_t) * ft->nl2tag;
+
+	off = roundup(sizeof(hdr), FLOWFILE_ALIGN);
+	for (i = 0; i < FLOWFILE_NSECTION; i++) {
+		if (data[i] == NULL) {
+			hdr.size[i] = 0;
+			continue;
+		}
+		hdr.size[i] *= ft->nflow;
+		hdr.offset[i] = off;
+		off = roundup(off + hdr.size[i], FLOWFILE_ALIGN);
+	}
+	hdr.filesize = off;
+
+	rc = -1;
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto done;
+	}
+	off = 0;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto write_error;
+	off += sizeof(hdr);
+	for (i = 0; i < FLOWFILE_NSECTION; i++) {
+		if (data[i] == NULL)
+			continue;
+		if (((hdr.offset[i] > off) && (fwrite(zero, hdr.offset[i] - off, 1, fp) != 1)) ||
+		    ((hdr.size[i] != 0) && (fwrite(data[i], hdr.size[i], 1, fp) != 1)))
+			goto write_error;
+		off = hdr.offset[i] + hdr.size[i];
+	}
+	if ((hdr.filesize > off) && (fwrite(zero, hdr.filesize - off, 1, fp) != 1))
+		goto write_error;
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		goto write_error;
+	}
+	rc = 0;
+	goto done;
+
+ write_error:
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	if (fp != NULL)
+		fclose(fp);
+ done:
+	free(family);
+	addresslist_flowtable_delete(ft);
+	return rc;
+}
+
+/*
+ * check if the file is a binary flowlist
+ */
+int
+addresslist_flowtable_isfile(const char *path)
+{
+	char magic[8];
+	FILE *fp;
+	int rc;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	rc = (fread(magic, sizeof(magic), 1, fp) == 1) &&
+	    (memcmp(magic, FLOWFILE_MAGIC, sizeof(FLOWFILE_MAGIC)) == 0);
+	fclose(fp);
+	return rc;
+}
+
+/*
+ * mmap binary flowlist as a flow table.
+ * the file is mapped shared and read-only, so that pages are shared
+ * among processes using the same file.
+ * if reverse is set, source and destination are swapped for RX side.
+ * MAC addresses are provided only if withmac is set, and must have
+ * been derived with macmode.
+ */
+struct flowtable *
+addresslist_flowtable_load(const char *path, int reverse, int withmac, int macmode)
+{
+	const struct flowfile_header *hdr;
+	struct flowtable *ft;
+	struct stat st;
+	void *map, *p[FLOWFILE_NSECTION];
+	uint64_t elemsize[FLOWFILE_NSECTION];
+	const uint8_t *family;
+	unsigned int i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a binary flowlist\n", path);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	hdr = map;
+	if (memcmp(hdr->magic, FLOWFILE_MAGIC, sizeof(FLOWFILE_MAGIC)) != 0) {
+		fprintf(stderr, "%s: not a binary flowlist\n", path);
+		goto error;
+	}
+	if (hdr->byteorder != FLOWFILE_BYTEORDER) {
+		fprintf(stderr, "%s: byte order mismatch\n", path);
+		goto error;
+	}
+	if (hdr->version != FLOWFILE_VERSION) {
+		fprintf(stderr, "%s: unsupported version %u\n", path, hdr->version);
+		goto error;
+	}
+	if (hdr->filesize != (uint64_t)st.st_size) {
+		fprintf(stderr, "%s: truncated\n", path);
+		goto error;
+	}
+	if (hdr->af != 0 && hdr->af != 4 && hdr->af != 6) {
+		fprintf(stderr, "%s: illegal address family %u\n", path, hdr->af);
+		goto error;
+	}
+	if (hdr->nl2tag > 2) {
+		fprintf(stderr, "%s: illegal number of VLAN tags %u\n", path, hdr->nl2tag);
+		goto error;
+	}
+	elemsize[FLOWFILE_FAMILY] = sizeof(uint8_t);
+	elemsize[FLOWFILE_SADDR4] = sizeof(uint32_t);
+	elemsize[FLOWFILE_DADDR4] = sizeof(uint32_t);
+	elemsize[FLOWFILE_SADDR6] = sizeof(struct in6_addr);
+	elemsize[FLOWFILE_DADDR6] = sizeof(struct in6_addr);
+	elemsize[FLOWFILE_SPORT] = sizeof(uint16_t);
+	elemsize[FLOWFILE_DPORT] = sizeof(uint16_t);
+	elemsize[FLOWFILE_SEADDR] = sizeof(struct ether_addr);
+	elemsize[FLOWFILE_DEADDR] = sizeof(struct ether_addr);
+	elemsize[FLOWFILE_WEIGHT] = sizeof(uint32_t);
+	elemsize[FLOWFILE_L2TAG] = sizeof(uint32_t) * hdr->nl2tag;
+	for (i = 0; i < FLOWFILE_NSECTION; i++) {
+		p[i] = NULL;
+		if (hdr->offset[i] == 0)
+			continue;
+		/* every array must hold exactly nflow elements within the file */
+		if ((hdr->offset[i] % FLOWFILE_ALIGN) != 0 ||
+		    hdr->offset[i] < sizeof(*hdr) ||
+		    hdr->size[i] != elemsize[i] * hdr->nflow ||
+		    hdr->offset[i] > (uint64_t)st.st_size ||
+		    hdr->size[i] > (uint64_t)st.st_size - hdr->offset[i]) {
+			fprintf(stderr, "%s: broken section %u\n", path, i);
+			goto error;
+		}
+		p[i] = (char *)map + hdr->offset[i];
+	}
+	if (p[FLOWFILE_SPORT] == NULL || p[FLOWFILE_DPORT] == NULL ||
+	    (hdr->af != 6 && (p[FLOWFILE_SADDR4] == NULL || p[FLOWFILE_DADDR4] == NULL)) ||
+	    (hdr->af != 4 && (p[FLOWFILE_SADDR6] == NULL || p[FLOWFILE_DADDR6] == NULL)) ||
+	    (hdr->af == 0 && p[FLOWFILE_FAMILY] == NULL) ||
+	    (hdr->nl2tag != 0 && p[FLOWFILE_L2TAG] == NULL)) {
+		fprintf(stderr, "%s: missing section\n", path);
+		goto error;
+	}
+	if (withmac) {
+		if (p[FLOWFILE_SEADDR] == NULL || p[FLOWFILE_DEADDR] == NULL) {
+			fprintf(stderr, "%s: no MAC address\n", path);
+			goto error;
+		}
+		if ((int)hdr->macmode != macmode) {
+			fprintf(stderr, "%s: MAC addresses were derived with other method\n", path);
+			goto error;
+		}
+	}
+
+	ft = calloc(1, sizeof(struct flowtable));
+	if (ft == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		goto error;
+	}
+	ft->map = map;
+	ft->maplen = st.st_size;
+	ft->nflow = hdr->nflow;
+	ft->af = flowfile2af(hdr->af);
+	if (ft->af == AF_UNSPEC) {
+		ft->family = malloc(ft->nflow);
+		if (ft->family == NULL) {
+			fprintf(stderr, "Cannot allocate memory. number of flow is %u\n", ft->nflow);
+			free(ft);
+			goto error;
+		}
+		family = p[FLOWFILE_FAMILY];
+		for (i = 0; i < ft->nflow; i++) {
+			ft->family[i] = flowfile2af(family[i]);
+			if (ft->family[i] == AF_UNSPEC) {
+				fprintf(stderr, "%s: illegal address family of flow %u\n", path, i);
+				free(ft->family);
+				free(ft);
+				goto error;
+			}
+		}
+	}
+	ft->weight = p[FLOWFILE_WEIGHT];
+	if (hdr->nl2tag != 0) {
+		ft->l2tag = p[FLOWFILE_L2TAG];
+		ft->nl2tag = hdr->nl2tag;
+	}
+	if (reverse) {
+		ft->saddr4 = p[FLOWFILE_DADDR4];
+		ft->daddr4 = p[FLOWFILE_SADDR4];
+		ft->saddr6 = p[FLOWFILE_DADDR6];
+		ft->daddr6 = p[FLOWFILE_SADDR6];
+		ft->sport = p[FLOWFILE_DPORT];
+		ft->dport = p[FLOWFILE_SPORT];
+		if (withmac) {
+			ft->seaddr = p[FLOWFILE_DEADDR];
+			ft->deaddr = p[FLOWFILE_SEADDR];
+		}
+	} else {
+		ft->saddr4 = p[FLOWFILE_SADDR4];
+		ft->daddr4 = p[FLOWFILE_DADDR4];
+		ft->saddr6 = p[FLOWFILE_SADDR6];
+		ft->daddr6 = p[FLOWFILE_DADDR6];
+		ft->sport = p[FLOWFILE_SPORT];
+		ft->dport = p[FLOWFILE_DPORT];
+		if (withmac) {
+			ft->seaddr = p[FLOWFILE_SEADDR];
+			ft->deaddr = p[FLOWFILE_DEADDR];
+		}
+	}
+
+	return ft;
+
+ error:
+	munmap(map, st.st_size);
+	return NULL;
+}
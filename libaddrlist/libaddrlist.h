@@ -36,6 +36,54 @@ struct address {
 	} a;
 };
 
+struct address_tuple {
+	struct ether_addr seaddr, deaddr;
+	struct address saddr, daddr;
+	uint16_t sport, dport;
+	uint16_t proto;
+	uint32_t weight;		/* relative frequency of flow */
+	uint16_t svlan, cvlan;		/* 802.1ad S-VLAN and 802.1Q VLAN ID. 0 if none */
+	void *udata;
+};
+
+/*
+ * implicit tuple range. lazy addresslist computes tuples from these on
+ * demand, otherwise they are expanded into tuple[] by addresslist_build().
+ * n-th candidate is (saddr + n % saddr_num, daddr + n % daddr_num,
+ * sport + n % sport_num, dport + n % dport_num, svlan + n % svlan_num,
+ * cvlan + n % cvlan_num), and candidates
+ * which have an excluded address are skipped.
+ */
+struct address_range {
+	struct address saddr, daddr;	/* beginning of range */
+	uint64_t saddr_num, daddr_num;
+	uint16_t sport, dport;
+	uint32_t sport_num, dport_num;
+	uint16_t svlan, cvlan;
+	uint32_t svlan_num, cvlan_num;
+	uint16_t proto;
+	uint32_t weight;
+	uint64_t ncandidate;		/* lcm of all *_num */
+	unsigned int ntuple;		/* number of candidates not excluded */
+	unsigned int tupleid;		/* tuple id of the first tuple */
+
+	/* excluded index in saddr/daddr range */
+	unsigned int exclude_saddr_num;
+	unsigned int exclude_daddr_num;
+	uint64_t *exclude_saddr;
+	uint64_t *exclude_daddr;
+	/* candidate index excluded by both saddr and daddr (mod exclude_lcm) */
+	uint64_t exclude_lcm;
+	unsigned int exclude_both_num;
+	uint64_t *exclude_both;
+};
+
+struct address_range_iter {
+	unsigned int range;
+	uint64_t n;			/* index of candidate */
+	uint64_t saddr, daddr, sport, dport, svlan, cvlan;
+};
+
 struct addresslist {
 	unsigned int ntuple;
 	unsigned int curtuple;
@@ -47,17 +95,67 @@ struct addresslist {
 	struct address *exclude_saddr;
 	struct address *exclude_daddr;
 
+	int exclude_sorted;
+
 	struct address_tuple *tuple;
+	unsigned int nbuilt;		/* number of tuples expanded in tuple[] */
+	int macmode;
+	uint32_t weight;		/* weight of tuples appended from now on */
+	uint16_t svlan, cvlan;		/* VLAN range of tuples appended from now on */
+	uint32_t svlan_num, cvlan_num;
+
+	/* lazy mode. tuples are computed from ranges on demand */
+	int lazy;
+	unsigned int nrange;
+	struct address_range *range;
+	struct address_range_iter iter;
+	struct address_tuple lazytuple[2];
+	int lazycur;
 };
 
-struct address_tuple {
-	struct ether_addr seaddr, deaddr;
-	struct address saddr, daddr;
-	uint16_t sport, dport;
-	uint16_t proto;
-	void *udata;
+/*
+ * compact structure-of-arrays flow table for TX loop.
+ * IPv4 flow takes 12 bytes (saddr4, daddr4, sport, dport).
+ * MAC addresses are held only when requested.
+ * VLAN tags are prebuilt as they are on the wire, nl2tag words per flow.
+ */
+struct flowtable {
+	unsigned int nflow;
+	int af;				/* AF_INET, AF_INET6, or AF_UNSPEC if mixed */
+	uint8_t *family;		/* af per flow. only if mixed */
+	uint32_t *saddr4, *daddr4;	/* network byte order */
+	struct in6_addr *saddr6, *daddr6;
+	uint16_t *sport, *dport;
+	struct ether_addr *seaddr, *deaddr;
+	uint32_t *weight;		/* NULL if all flows have weight 1 */
+	uint32_t *l2tag;		/* TPID and TCI in network byte order */
+	unsigned int nl2tag;		/* 0, 1 (VLAN) or 2 (QinQ). same for all flows */
+	uint32_t *stateid;		/* per flow state of the user. NULL if same as flowid */
+
+	void *map;			/* mmap'ed binary flowlist. NULL if allocated */
+	size_t maplen;
 };
 
+static inline int
+flowtable_af(const struct flowtable *ft, unsigned int flowid)
+{
+	if (ft->family != NULL)
+		return ft->family[flowid];
+	return ft->af;
+}
+
+static inline uint32_t
+flowtable_stateid(const struct flowtable *ft, unsigned int flowid)
+{
+	if (ft->stateid != NULL)
+		return ft->stateid[flowid];
+	return flowid;
+}
+
+/* how to derive MAC addresses of tuple from IP addresses */
+#define ADDRESSLIST_MAC_HASH	0	/* fast non-cryptographic hash (default) */
+#define ADDRESSLIST_MAC_MD5	1	/* MD5. compatible with older versions */
+
 struct addresslist *addresslist_new(void);
 void addresslist_delete(struct addresslist *);
 
@@ -71,15 +169,32 @@ int addresslist_append6(struct addresslist *, uint8_t, struct in6_addr *, struct
 
 int addresslist_rebuild(struct addresslist *);
 void addresslist_setlimit(struct addresslist *, unsigned int);
+int addresslist_setlazy(struct addresslist *, int);
+int addresslist_setmacmode(struct addresslist *, int);
+int addresslist_setweight(struct addresslist *, unsigned int);
+int addresslist_setvlan(struct addresslist *, uint16_t, uint16_t, uint16_t, uint16_t);
+int addresslist_build(struct addresslist *, int);
 unsigned int addresslist_get_tuplenum(struct addresslist *);
 void addresslist_set_current_tupleid(struct addresslist *, unsigned int);
 unsigned int addresslist_get_current_tupleid(struct addresslist *);
 const struct address_tuple *addresslist_get_current_tuple(struct addresslist *);
 const struct address_tuple *addresslist_get_tuple_next(struct addresslist *);
 int addresslist_tuple2id(struct addresslist *, struct address_tuple *);
+struct addresslist *addresslist_dup(struct addresslist *);
+int addresslist_remove(struct addresslist *, struct addresslist *);
 
 int addresslist_include_af(struct addresslist *, int);
+int addresslist_include_vlan(struct addresslist *);
 
 void addresslist_dump(struct addresslist *);
 
+struct flowtable *addresslist_flowtable_new(struct addresslist *, int);
+void addresslist_flowtable_delete(struct flowtable *);
+int addresslist_flowtable_save(struct addresslist *, const char *);
+int addresslist_flowtable_isfile(const char *);
+struct flowtable *addresslist_flowtable_load(const char *, int, int, int);
+
+void ipv6_add(struct in6_addr *, uint64_t);
+int ipv6_sub(const struct in6_addr *, const struct in6_addr *, uint64_t *);
+
 #endif /* _LIBADDR_H_ */
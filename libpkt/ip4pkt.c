@@ -429,6 +429,30 @@ ip4pkt_ttl(char *buf, unsigned int l3offset, unsigned int ttl)
 	return 0;
 }
 
+int
+ip4pkt_tos(char *buf, unsigned int l3offset, uint8_t tos)
+{
+	struct ip *ip;
+	uint32_t sum;
+
+	ip = (struct ip *)(buf + l3offset);
+	if (ip->ip_v != IPVERSION)
+		return -1;
+
+	sum = ~ip->ip_sum & 0xffff;
+#if _BYTE_ORDER == _LITTLE_ENDIAN
+	sum -= (ip->ip_tos << 8);
+	sum += tos << 8;
+#else
+	sum -= (ip->ip_tos);
+	sum += tos;
+#endif
+	ip->ip_sum = ~reduce1(sum);
+	ip->ip_tos = tos;
+
+	return 0;
+}
+
 static int
 ip4pkt_srcdst(int srcdst, char *buf, unsigned int l3offset, in_addr_t addr)
 {
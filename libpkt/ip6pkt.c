@@ -443,11 +443,41 @@ ip6pkt_flowinfo(char *buf, unsigned int l3offset, uint32_t flow)
 	if ((ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION)
 		return -1;
 
-	ip6->ip6_flow &= IPV6_FLOWINFO_MASK;
+	ip6->ip6_flow &= ~IPV6_FLOWINFO_MASK;
 	ip6->ip6_flow |= (flow & IPV6_FLOWINFO_MASK);
 	return 0;
 }
 
+int
+ip6pkt_tclass(char *buf, unsigned int l3offset, uint8_t tclass)
+{
+	struct ip6_hdr *ip6;
+
+	ip6 = (struct ip6_hdr *)(buf + l3offset);
+
+	if ((ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION)
+		return -1;
+
+	ip6->ip6_flow &= ~htonl(0x0ff00000);
+	ip6->ip6_flow |= htonl((uint32_t)tclass << 20);
+	return 0;
+}
+
+int
+ip6pkt_flowlabel(char *buf, unsigned int l3offset, uint32_t label)
+{
+	struct ip6_hdr *ip6;
+
+	ip6 = (struct ip6_hdr *)(buf + l3offset);
+
+	if ((ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION)
+		return -1;
+
+	ip6->ip6_flow &= ~htonl(0x000fffff);
+	ip6->ip6_flow |= htonl(label & 0x000fffff);
+	return 0;
+}
+
 int
 ip6pkt_ttl(char *buf, unsigned int l3offset, int ttl)
 {
@@ -246,6 +246,7 @@ int ip4pkt_length(char *, unsigned int, unsigned int);
 int ip4pkt_off(char *, unsigned int, uint16_t);
 int ip4pkt_id(char *, unsigned int, uint16_t);
 int ip4pkt_ttl(char *, unsigned int, unsigned int);
+int ip4pkt_tos(char *, unsigned int, uint8_t);
 int ip4pkt_src(char *, unsigned int, in_addr_t);
 int ip4pkt_dst(char *, unsigned int, in_addr_t);
 int ip4pkt_srcport(char *, unsigned int, uint16_t);
@@ -281,6 +282,8 @@ int ip6pkt_tcp_template(char *, unsigned int);
 int ip6pkt_length(char *, unsigned int, unsigned int);
 int ip6pkt_off(char *, unsigned int, uint16_t);
 int ip6pkt_flowinfo(char *, unsigned int, uint32_t);
+int ip6pkt_tclass(char *, unsigned int, uint8_t);
+int ip6pkt_flowlabel(char *, unsigned int, uint32_t);
 int ip6pkt_ttl(char *, unsigned int, int);
 int ip6pkt_src(char *, unsigned int, const struct in6_addr *);
 int ip6pkt_dst(char *, unsigned int, const struct in6_addr *);